@@ -5,6 +5,7 @@
 #include "memory.h"
 
 #define STACK_SIZE (8 * PGSIZE)
+#define DEFAULT_ENTRY ((void *)0x8048000)
 
 typedef union {
   uint8_t stack[STACK_SIZE] PG_ALIGN;
@@ -12,8 +13,13 @@ typedef union {
     _RegSet *tf;
     _Protect as;
     uintptr_t cur_brk;
-    // we do not free memory, so use `max_brk' to determine when to call _map()
+    // we do not free memory, so `max_brk' is the end of the heap
     uintptr_t max_brk;
+    // the program file, whose pages are read in on the first access
+    int fd;
+    uintptr_t file_end;
+    // the x87 and SSE state saved by fxsave while the process is switched out
+    uint8_t fpu[512] __attribute__((aligned(16)));
   };
 } PCB;
 
@@ -7,7 +7,14 @@ static const char *keyname[256]
 
 extern void game_change();
 size_t events_read(void *buf, size_t len) {
+  static uint32_t last_ut = 0;
   int key = _read_key();
+  if (key == _KEY_NONE && _uptime() == last_ut) {
+    // polled again within a millisecond, the process is waiting for
+    // something to happen: sleep until the next interrupt
+    _idle();
+    key = _read_key();
+  }
   bool is_down = false;
   if (key & 0x8000) {
     key ^= 0x8000;
@@ -15,6 +22,7 @@ size_t events_read(void *buf, size_t len) {
   }
   if (key == _KEY_NONE) {
     uint32_t ut = _uptime();
+    last_ut = ut;
     sprintf(buf, "t %d\n", ut);
   } else {
     sprintf(buf, "%s %s\n", is_down ? "kd" : "ku", keyname[key]);
@@ -0,0 +1,83 @@
+#include "common.h"
+
+#ifdef HAS_DISK
+
+/* The files are on the disk of the machine instead of in the kernel.
+ * This provides the interface of ramdisk.c on top of the AM disk.
+ * Whole blocks going to or from kernel memory, which is identity
+ * mapped, are moved by DMA directly. The rest, such as the buffers of
+ * user processes and the partial blocks at both ends, goes through
+ * `bounce'.
+ */
+
+#define BLK_SIZE 512
+#define BOUNCE_BLKS 8
+
+static uint8_t bounce[BOUNCE_BLKS * BLK_SIZE];
+
+static bool is_kernel(const void *buf, size_t len) {
+  return (uintptr_t)buf + len <= (uintptr_t)_heap.end;
+}
+
+/* read `len' bytes starting from `offset' of the disk into `buf' */
+void ramdisk_read(void *buf, off_t offset, size_t len) {
+  assert(offset + len <= (size_t)_disk.nr_blk * BLK_SIZE);
+  while (len > 0) {
+    uint32_t blk = offset / BLK_SIZE, skip = offset % BLK_SIZE;
+    size_t n;
+    if (skip == 0 && len >= BLK_SIZE && is_kernel(buf, len)) {
+      n = len / BLK_SIZE * BLK_SIZE;
+      assert(_disk_read(buf, blk, n / BLK_SIZE) == 0);
+    }
+    else {
+      uint32_t nr_blk = (skip + len + BLK_SIZE - 1) / BLK_SIZE;
+      if (nr_blk > BOUNCE_BLKS) nr_blk = BOUNCE_BLKS;
+      assert(_disk_read(bounce, blk, nr_blk) == 0);
+      n = nr_blk * BLK_SIZE - skip;
+      if (n > len) n = len;
+      memcpy(buf, bounce + skip, n);
+    }
+    buf += n;
+    offset += n;
+    len -= n;
+  }
+}
+
+/* write `len' bytes starting from `buf' into the `offset' of the disk */
+void ramdisk_write(const void *buf, off_t offset, size_t len) {
+  assert(offset + len <= (size_t)_disk.nr_blk * BLK_SIZE);
+  while (len > 0) {
+    uint32_t blk = offset / BLK_SIZE, skip = offset % BLK_SIZE;
+    size_t n;
+    if (skip == 0 && len >= BLK_SIZE && is_kernel(buf, len)) {
+      n = len / BLK_SIZE * BLK_SIZE;
+      assert(_disk_write(buf, blk, n / BLK_SIZE) == 0);
+    }
+    else {
+      uint32_t nr_blk = (skip + len + BLK_SIZE - 1) / BLK_SIZE;
+      if (nr_blk > BOUNCE_BLKS) nr_blk = BOUNCE_BLKS;
+      n = nr_blk * BLK_SIZE - skip;
+      if (n > len) n = len;
+      // keep the rest of the partial blocks
+      if (skip != 0 || n % BLK_SIZE != 0) {
+        assert(_disk_read(bounce, blk, nr_blk) == 0);
+      }
+      memcpy(bounce + skip, buf, n);
+      assert(_disk_write(bounce, blk, nr_blk) == 0);
+    }
+    buf += n;
+    offset += n;
+    len -= n;
+  }
+}
+
+void init_ramdisk() {
+  assert(_disk.nr_blk > 0);
+  Log("disk info: %d blocks of %d bytes", _disk.nr_blk, _disk.blksz);
+}
+
+size_t get_ramdisk_size() {
+  return _disk.nr_blk * BLK_SIZE;
+}
+
+#endif
@@ -87,9 +87,7 @@ ssize_t fs_write(int fd, const void *buf, size_t len) {
 	switch(fd) {
 		case FD_STDOUT:
 		case FD_STDERR:
-			for(int i = 0; i < len; i++) {
-				_putc(((char*)buf)[i]);
-			}
+			_putstr(buf, len);
 			break;
 		case FD_FB:
 			// Ļ
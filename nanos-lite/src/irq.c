@@ -2,6 +2,7 @@
 
 extern _RegSet *do_syscall(_RegSet *r);
 extern _RegSet *schedule(_RegSet *prev);
+extern void mm_page_fault(uintptr_t va);
 
 static _RegSet *do_event(_Event e, _RegSet *r) {
   switch (e.event) {
@@ -10,9 +11,15 @@ static _RegSet *do_event(_Event e, _RegSet *r) {
   case _EVENT_TRAP:
     printf("trap hit\n");
     return schedule(r);
+  case _EVENT_PAGE_FAULT:
+    mm_page_fault(e.cause);
+    return r;
   case _EVENT_IRQ_TIME:
     Log("timer hit");
     return schedule(r);
+  case _EVENT_IRQ_IODEV:
+    // disk requests are complete when _disk_read() returns
+    return r;
   default:
     panic("Unhandled event ID = %d", e.event);
   }
@@ -1,30 +1,15 @@
-#include "common.h"
-
-#define DEFAULT_ENTRY ((void *)0x8048000)
-extern size_t get_ramdisk_size();
-extern void ramdisk_read(void *, off_t, size_t);
-extern void* new_page(void);
+#include "proc.h"
 
 int fs_open(const char* path, int flags, int mode);
 size_t fs_filesz(int fd);
-ssize_t fs_read(int fd, void* buf, size_t len);
-int fs_close(int fd);
 
-// ļ->ڴ->رļ
-uintptr_t loader(_Protect *as, const char *filename) {
-  int fd=fs_open(filename,0,0);
-  Log("filename=%s,fd=%d",filename,fd);
-  int f_size = fs_filesz(fd);
-  fs_close(fd);
-  void* pa = DEFAULT_ENTRY;
-  void* va = DEFAULT_ENTRY;
-  while(f_size > 0){  // ϵҳӳ䣬ҳ
-    pa = new_page();
-    _map(as, va, pa);
-    fs_read(fd, pa, PGSIZE);
-    va += PGSIZE;
-    f_size -= PGSIZE;
-  }
-  fs_close(fd);
+/* Nothing is copied at load time: the pages of the program are read
+ * from the ramdisk when the process first touches them, see
+ * mm_page_fault().
+ */
+uintptr_t loader(PCB *p, const char *filename) {
+  p->fd = fs_open(filename, 0, 0);
+  p->file_end = (uintptr_t)DEFAULT_ENTRY + fs_filesz(p->fd);
+  Log("filename=%s,fd=%d,size=%d", filename, p->fd, (int)fs_filesz(p->fd));
   return (uintptr_t)DEFAULT_ENTRY;
 }
@@ -9,7 +9,6 @@ void init_ramdisk(void);
 void init_device(void);
 void init_irq(void);
 void init_fs(void);
-uint32_t loader(_Protect *, const char *);
 
 extern void load_prog(const char *filename);
 
@@ -21,10 +20,11 @@ int main() {
   Log("'Hello World!' from Nanos-lite");
   Log("Build time: %s, %s", __TIME__, __DATE__);
 
-  init_ramdisk();
-
   init_device();
 
+  // the disk is found by _ioe_init()
+  init_ramdisk();
+
 #ifdef HAS_ASYE
   Log("Initializing interrupt/exception handler...");
   init_irq();
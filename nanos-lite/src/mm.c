@@ -1,40 +1,87 @@
 #include "proc.h"
 #include "memory.h"
+#include "fs.h"
 
 static void *pf = NULL;
+// large pages are taken from the top of the free memory, growing down
+static void *pf_large = NULL;
 
 void* new_page(void) {
-  assert(pf < (void *)_heap.end);
+  assert(pf < pf_large);
   void *p = pf;
   pf += PGSIZE;
   return p;
 }
 
+static void* new_large_page(void) {
+  if (pf_large - PGSIZE_LARGE < pf) return NULL;
+  pf_large -= PGSIZE_LARGE;
+  return pf_large;
+}
+
 void free_page(void *p) {
   panic("not implement yet");
 }
 
-/* The brk() system call handler. */
+/* The brk() system call handler. The heap pages are mapped when they
+ * are first touched.
+ */
 int mm_brk(uint32_t new_brk) {
-  if(current->cur_brk==0){
-    current->cur_brk=current->max_brk=new_brk;
-  }
-  else{
-    if(new_brk > current->max_brk){
-			uintptr_t va = (((uint32_t)(current->max_brk)+0xfff) & ~0xfff); // 4k
-	    while(va < new_brk) {
-	      _map(&current->as, (void *)va, (void *)new_page());  // ӳ
-			  va += PGSIZE;
-	    }
-      current->max_brk=new_brk;
-    }
-    current->cur_brk=new_brk;
+  if(new_brk > current->max_brk){
+    current->max_brk=new_brk;
   }
+  current->cur_brk=new_brk;
   return 0;
 }
 
+int fs_lseek(int fd, off_t offset, int whence);
+ssize_t fs_read(int fd, void *buf, size_t len);
+
+/* Map a large page for the heap if the one holding `va' lies in the
+ * heap as a whole and none of its pages has been mapped yet.
+ */
+static bool map_large_heap(uintptr_t va) {
+  uintptr_t page = va & ~(PGSIZE_LARGE - 1);
+  if (page < PGROUNDUP(current->file_end) || page + PGSIZE_LARGE > current->max_brk) {
+    return false;
+  }
+
+  void *pa = new_large_page();
+  if (pa == NULL) return false;
+  if (!_map_large(&current->as, (void *)page, pa)) {
+    pf_large += PGSIZE_LARGE;
+    return false;
+  }
+  memset(pa, 0, PGSIZE_LARGE);
+  return true;
+}
+
+/* Map a page at `va' in the current process: the pages of the program
+ * are read from its file, and those of the heap are zero-filled.
+ */
+void mm_page_fault(uintptr_t va) {
+  uintptr_t start = (uintptr_t)DEFAULT_ENTRY;
+  uintptr_t end = (current->max_brk > current->file_end ? current->max_brk : current->file_end);
+  if (va < start || va >= end) {
+    panic("page fault at 0x%x out of the program", va);
+  }
+
+  if (map_large_heap(va)) return;
+
+  uintptr_t page = PGROUNDDOWN(va);
+  void *pa = new_page();
+  memset(pa, 0, PGSIZE);
+  if (page < current->file_end) {
+    // DEFAULT_ENTRY is page aligned; the page holding the end of the file is partly read
+    fs_lseek(current->fd, page - start, SEEK_SET);
+    fs_read(current->fd, pa, PGSIZE);
+  }
+  _map(&current->as, (void *)page, pa);
+}
+
 void init_mm() {
   pf = (void *)PGROUNDUP((uintptr_t)_heap.start);
+  pf_large = (void *)((uintptr_t)_heap.end & ~(PGSIZE_LARGE - 1));
   Log("free physical pages starting from %p", pf);
 
   _pte_init(new_page, free_page);
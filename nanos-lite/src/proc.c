@@ -6,13 +6,13 @@ static PCB pcb[MAX_NR_PROC];
 static int nr_proc = 0;
 PCB *current = NULL;
 
-uintptr_t loader(_Protect *as, const char *filename);
+uintptr_t loader(PCB *p, const char *filename);
 
 void load_prog(const char *filename) {
   int i = nr_proc++;
   _protect(&pcb[i].as);
 
-  uintptr_t entry = loader(&pcb[i].as, filename);
+  uintptr_t entry = loader(&pcb[i], filename);
 
   // TODO: remove the following three lines after you have implemented _umake()
   // _switch(&pcb[i].as);
@@ -24,6 +24,23 @@ void load_prog(const char *filename) {
   stack.end = stack.start + sizeof(pcb[i].stack);
 
   pcb[i].tf = _umake(&pcb[i].as, stack, stack, (void *)entry, NULL, NULL);
+
+  // start from the state after fninit, with the default MXCSR
+  static const uint32_t mxcsr = 0x1f80;
+  asm volatile ("fninit; ldmxcsr %1; fxsave %0" : "=m"(pcb[i].fpu) : "m"(mxcsr));
+}
+
+/* The x87 and SSE registers are not in the trap frame, so they are
+ * switched here together with the address space.
+ */
+static void switch_fpu(PCB *prev, PCB *next) {
+  if (prev == next) {
+    return;
+  }
+  if (prev != NULL) {
+    asm volatile ("fxsave %0" : "=m"(prev->fpu));
+  }
+  asm volatile ("fxrstor %0" : : "m"(next->fpu));
 }
 
 int count = 0;
@@ -32,6 +49,7 @@ int current_game = 0;
 void game_change() { current_game = 2 - current_game; }
 
 _RegSet *schedule(_RegSet *prev) {
+  PCB *prev_pcb = current;
   count++;
   current->tf = prev;
   current = &pcb[current_game];
@@ -41,5 +59,6 @@ _RegSet *schedule(_RegSet *prev) {
     count = 0;
   }
   _switch(&current->as);
+  switch_fpu(prev_pcb, current);
   return current->tf;
 }
@@ -1,5 +1,7 @@
 #include "common.h"
 
+#ifndef HAS_DISK
+
 extern uint8_t ramdisk_start;
 extern uint8_t ramdisk_end;
 #define RAMDISK_SIZE ((&ramdisk_end) - (&ramdisk_start))
@@ -29,3 +31,4 @@ void init_ramdisk() {
 size_t get_ramdisk_size() {
   return RAMDISK_SIZE;
 }
+#endif
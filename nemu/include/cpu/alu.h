@@ -0,0 +1,144 @@
+#ifndef __ALU_H__
+#define __ALU_H__
+
+#include "cpu/exec.h"
+
+/* The semantics of the most frequent instructions with the operand
+ * width as a parameter. The EHelpers pass the decoded width, while the
+ * handlers in specialized.c and the code translated ahead of time pass
+ * a constant, so that the compiler folds the switches on the width away.
+ */
+
+static inline void do_mov(int width) {
+  operand_write_w(id_dest, &id_src->val, width);
+}
+
+static inline void do_lea(int width) {
+  rtl_li(&t2, id_src->addr);
+  operand_write_w(id_dest, &t2, width);
+}
+
+/* 0x66 push and pop move ESP by 2, also push imm8 */
+static inline void do_push(int width) {
+  if (decoding.is_operand_size_16) {
+    rtl_push_w(&id_dest->val, 2);
+  }
+  else {
+    rtl_push(&id_dest->val);
+  }
+}
+
+static inline void do_pop(int width) {
+  if (decoding.is_operand_size_16) {
+    rtl_pop_w(&t0, 2);
+  }
+  else {
+    rtl_pop(&t0);
+  }
+  operand_write_w(id_dest, &t0, width);
+}
+
+static inline void do_add(int width) {
+  rtl_add(&t2, &id_dest->val, &id_src->val);
+  rtl_zext(&t2, &t2, width);
+  operand_write_w(id_dest, &t2, width);
+  rtl_update_ZFSF(&t2, width);
+
+  rtl_sltu(&t0, &t2, &id_dest->val);
+  rtl_set_CF(&t0);
+
+  rtl_xor(&t0, &id_src->val, &t2);
+  rtl_xor(&t1, &id_dest->val, &t2);
+  rtl_and(&t0, &t0, &t1);
+  rtl_msb(&t0, &t0, width);
+  rtl_set_OF(&t0);
+}
+
+static inline void do_sub(int width) {
+  rtl_sub(&t2, &id_dest->val, &id_src->val);
+  rtl_sltu(&t3, &id_dest->val, &t2);
+  operand_write_w(id_dest, &t2, width);
+  rtl_update_ZFSF(&t2, width);
+
+  rtl_sltu(&t0, &id_dest->val, &t2);
+  rtl_or(&t0, &t3, &t0);
+  rtl_set_CF(&t0);
+
+  rtl_xor(&t0, &id_dest->val, &id_src->val);
+  rtl_xor(&t1, &id_dest->val, &t2);
+  rtl_and(&t0, &t0, &t1);
+  rtl_msb(&t0, &t0, width);
+  rtl_set_OF(&t0);
+}
+
+static inline void do_cmp(int width) {
+  rtl_sub(&t2, &id_dest->val, &id_src->val);
+  rtl_sltu(&t3, &id_dest->val, &t2);
+  rtl_update_ZFSF(&t2, width);
+
+  rtl_set_CF(&t3);
+
+  rtl_xor(&t0, &id_dest->val, &id_src->val);
+  rtl_xor(&t1, &id_dest->val, &t2);
+  rtl_and(&t0, &t0, &t1);
+  rtl_msb(&t0, &t0, width);
+  rtl_set_OF(&t0);
+}
+
+static inline void do_inc(int width) {
+  rtl_addi(&t1, &id_dest->val, 1);
+  operand_write_w(id_dest, &t1, width);
+
+  rtl_update_ZFSF(&t1, width);
+  rtl_zext(&t0, &t1, width);
+  rtl_eqi(&t0, &t0, 1u << (width * 8 - 1));
+  rtl_set_OF(&t0);
+}
+
+static inline void do_dec(int width) {
+  rtl_subi(&t1, &id_dest->val, 1);
+  operand_write_w(id_dest, &t1, width);
+
+  rtl_update_ZFSF(&t1, width);
+  rtl_zext(&t0, &t1, width);
+  rtl_eqi(&t0, &t0, (1u << (width * 8 - 1)) - 1);
+  rtl_set_OF(&t0);
+}
+
+static inline void do_test(int width) {
+  rtl_and(&t0, &id_dest->val, &id_src->val);
+  t1 = 0;
+  rtl_set_CF(&t1);
+  rtl_set_OF(&t1);
+  rtl_update_ZFSF(&t0, width);
+}
+
+static inline void do_and(int width) {
+  rtl_and(&t0, &id_dest->val, &id_src->val);
+  operand_write_w(id_dest, &t0, width);
+  t1 = 0;
+  rtl_set_CF(&t1);
+  rtl_set_OF(&t1);
+  rtl_update_ZFSF(&t0, width);
+}
+
+static inline void do_xor(int width) {
+  rtl_xor(&t0, &id_dest->val, &id_src->val);
+  operand_write_w(id_dest, &t0, width);
+  rtl_update_ZFSF(&t0, width);
+
+  t1 = 0;
+  rtl_set_CF(&t1);
+  rtl_set_OF(&t1);
+}
+
+static inline void do_or(int width) {
+  rtl_or(&t0, &id_dest->val, &id_src->val);
+  operand_write_w(id_dest, &t0, width);
+  t1 = 0;
+  rtl_set_CF(&t1);
+  rtl_set_OF(&t1);
+  rtl_update_ZFSF(&t0, width);
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __CPU_AOT_H__
+#define __CPU_AOT_H__
+
+#include "cpu/exec.h"
+#include "cpu/alu.h"
+
+/* Ahead-of-time translation, see src/cpu/aot/. The C code generated for
+ * an image includes this header, and is compiled into a shared object
+ * which NEMU loads with `-a'.
+ */
+
+typedef void (*AOTHelper) (void);
+
+typedef struct {
+  vaddr_t eip;
+  AOTHelper run;
+  int nr_instr;
+} AOTBlock;
+
+/* The generated code sets up the operands the same way as the decode
+ * helpers, and then calls the semantics in alu.h or the EHelpers. A
+ * block ends by setting `decoding.seq_eip' to the next instruction.
+ */
+#define aot_width(w) \
+  (decoding.src.width = decoding.dest.width = decoding.src2.width = (w))
+#define aot_reg(op, r, w) \
+  ((op)->type = OP_TYPE_REG, (op)->reg = (r), rtl_lr(&(op)->val, (r), (w)))
+#define aot_reg_noload(op, r) \
+  ((op)->type = OP_TYPE_REG, (op)->reg = (r))
+#define aot_mem(op, a, w) \
+  ((op)->type = OP_TYPE_MEM, (op)->addr = (a), rtl_lm(&(op)->val, &(op)->addr, (w)))
+#define aot_mem_noload(op, a) \
+  ((op)->type = OP_TYPE_MEM, (op)->addr = (a))
+#define aot_imm(op, v) \
+  ((op)->type = OP_TYPE_IMM, (op)->imm = (v), (op)->val = (v))
+
+void init_aot(vaddr_t, uint32_t);
+void init_aot_record(vaddr_t, uint32_t);
+uint32_t aot_hash(vaddr_t, uint32_t);
+void aot_record(vaddr_t, vaddr_t);
+bool aot_is_recording(void);
+void aot_set_enabled(bool);
+const AOTBlock *aot_lookup(vaddr_t);
+
+/* a block only runs if it has at most this many instructions */
+extern __thread uint64_t aot_max_instr;
+
+#endif
@@ -19,14 +19,19 @@ typedef struct {
     int32_t simm;
   };
   rtlreg_t val;
+#ifdef DEBUG
   char str[OP_STR_SIZE];
+#endif
 } Operand;
 
 typedef struct {
   uint32_t opcode;
   vaddr_t seq_eip;  // sequential eip
   bool is_operand_size_16;
+  uint8_t rep;  // 0, or the REP/REPE (0xf3) or REPNE (0xf2) prefix
   uint8_t ext_opcode;
+  bool lock;         // LOCK prefix
+  bool lock_failed;  // the locked memory write lost a race
   bool is_jmp;
   vaddr_t jmp_eip;
   Operand src, dest, src2;
@@ -59,18 +64,46 @@ typedef union {
   uint8_t val;
 } SIB;
 
+/* a memory operand: disp + base + (index << scale), -1 for no register */
+typedef struct {
+  int base_reg, index_reg, scale;
+  int32_t disp;
+  int disp_size;
+} AddrForm;
+
+void decode_addr(vaddr_t *, ModR_M *, AddrForm *);
 void load_addr(vaddr_t *, ModR_M *, Operand *);
 void read_ModR_M(vaddr_t *, Operand *, bool, Operand *, bool);
 
 void operand_write(Operand *, rtlreg_t *);
 
 /* shared by all helper functions */
-extern DecodeInfo decoding;
+extern __thread DecodeInfo decoding;
 
 #define id_src (&decoding.src)
 #define id_src2 (&decoding.src2)
 #define id_dest (&decoding.dest)
 
+/* operand_write() with a width known at the call site */
+static inline void operand_write_w(Operand *op, rtlreg_t *src, int width) {
+  if (op->type == OP_TYPE_REG) {
+    rtl_sr(op->reg, width, src);
+  } else if (op->type == OP_TYPE_MEM) {
+    if (decoding.lock) {
+      /* The memory must still hold the value loaded by the decoder,
+       * otherwise another CPU has written it in between. */
+      if (!vaddr_cmpxchg(op->addr, width, op->val, *src)) {
+        decoding.lock_failed = true;
+      }
+    }
+    else {
+      rtl_sm(&op->addr, width, src);
+    }
+  } else {
+    assert(0);
+  }
+}
+
 #define make_DHelper(name) void concat(decode_, name) (vaddr_t *eip)
 typedef void (*DHelper) (vaddr_t *);
 
@@ -93,12 +126,16 @@ make_DHelper(E2G);
 make_DHelper(mov_I2r);
 make_DHelper(mov_I2E);
 make_DHelper(mov_G2E);
+make_DHelper(bt_G2E);
 make_DHelper(mov_E2G);
 make_DHelper(lea_M2G);
 
 make_DHelper(gp2_1_E);
 make_DHelper(gp2_cl2E);
 make_DHelper(gp2_Ib2E);
+make_DHelper(Ib_G2E);
+make_DHelper(cl_G2E);
+make_DHelper(a2r);
 
 make_DHelper(O2a);
 make_DHelper(a2O);
@@ -115,4 +152,15 @@ make_DHelper(out_a2dx);
 make_DHelper(mov_store_cr);
 make_DHelper(mov_load_cr);
 
+make_DHelper(fpu);
+
+make_DHelper(xmm_E2G);
+make_DHelper(xmm_G2E);
+make_DHelper(xmm_Ib_E2G);
+make_DHelper(xmm_Ib_E);
+make_DHelper(E2xmm);
+make_DHelper(Ib_E2xmm);
+make_DHelper(xmm2r);
+make_DHelper(Ib_xmm2r);
+
 #endif
@@ -9,7 +9,7 @@ typedef void (*EHelper) (vaddr_t *);
 #include "cpu/decode.h"
 
 static inline uint32_t instr_fetch(vaddr_t *eip, int len) {
-  uint32_t instr = vaddr_read(*eip, len);
+  uint32_t instr = vaddr_ifetch(*eip, len);
 #ifdef DEBUG
   uint8_t *p_instr = (void *)&instr;
   int i;
@@ -21,6 +21,45 @@ static inline uint32_t instr_fetch(vaddr_t *eip, int len) {
   return instr;
 }
 
+/* read_ModR_M() with the widths of the operands as parameters, which
+ * are constants for the specialized handlers
+ */
+static inline void read_ModR_M_w(vaddr_t *eip, Operand *rm, bool load_rm_val,
+    Operand *reg, bool load_reg_val, int rm_width, int reg_width) {
+  ModR_M m;
+  m.val = instr_fetch(eip, 1);
+  decoding.ext_opcode = m.opcode;
+  if (reg != NULL) {
+    reg->type = OP_TYPE_REG;
+    reg->reg = m.reg;
+    if (load_reg_val) {
+      rtl_lr(&reg->val, reg->reg, reg_width);
+    }
+
+#ifdef DEBUG
+    snprintf(reg->str, OP_STR_SIZE, "%%%s", reg_name(reg->reg, reg_width));
+#endif
+  }
+
+  if (m.mod == 3) {
+    rm->type = OP_TYPE_REG;
+    rm->reg = m.R_M;
+    if (load_rm_val) {
+      rtl_lr(&rm->val, m.R_M, rm_width);
+    }
+
+#ifdef DEBUG
+    sprintf(rm->str, "%%%s", reg_name(m.R_M, rm_width));
+#endif
+  }
+  else {
+    load_addr(eip, &m, rm);
+    if (load_rm_val) {
+      rtl_lm(&rm->val, &rm->addr, rm_width);
+    }
+  }
+}
+
 void rtl_setcc(rtlreg_t*, uint8_t);
 
 static inline const char* get_cc_name(int subcode) {
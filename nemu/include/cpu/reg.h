@@ -36,12 +36,13 @@ typedef struct {
     struct{
       uint32_t CF : 1;  // /λ1
       uint32_t    : 1;
-      uint32_t    : 4;
+      uint32_t PF : 1;  // 8λ1ĸΪż1
+      uint32_t    : 3;
       uint32_t ZF : 1;  // Ϊ01
       uint32_t SF : 1;  // Ϊ1
       uint32_t    : 1;
       uint32_t IF : 1;  // 1ʱӦж
-      uint32_t    : 1;
+      uint32_t DF : 1;  // 1ʱַݼ
       uint32_t OF : 1;  // 1
       uint32_t    : 20;
     };
@@ -53,14 +54,59 @@ typedef struct {
   }idtr;
   uint32_t cs;
   uint32_t CR0;
+  uint32_t CR2;
   uint32_t CR3;
-  bool INTR;
+  uint32_t CR4;
+
+  /* SYSENTER_CS, SYSENTER_ESP and SYSENTER_EIP model-specific registers */
+  struct {
+    uint32_t cs, esp, eip;
+  } sysenter;
+
+  /* x87 FPU. The data registers hold host long double values, which on
+   * an x86 host have the same 80-bit format. st(i) is
+   * st[(top + i) & 7]; TOP is kept in `top' instead of in `sw'.
+   */
+  struct {
+    long double st[8];
+    uint16_t cw, sw;
+    uint8_t top;
+    uint8_t valid;  // bit i is set if st[i] is not empty
+  } fpu;
+
+  /* SSE registers */
+  union {
+    uint8_t _8[16];
+    uint16_t _16[8];
+    uint32_t _32[4];
+    uint64_t _64[2];
+  } xmm[8];
+  uint32_t mxcsr;
+
+  uint32_t INTR;  // pending external interrupts, bit i is IRQ i
+  bool halted;    // by hlt, until an interrupt is taken
+  bool intr_shadow;  // no interrupt before the instruction after sti
+  int id;         // index in cpus[]
 } CPU_state;
 
-extern CPU_state cpu;
+#define MAX_CPU 8
+
+/* Every CPU is run by its own host thread, so `cpu' is the state of
+ * the CPU running on the calling thread. Devices reach the others
+ * through cpus[].
+ */
+extern __thread CPU_state cpu;
+extern CPU_state *cpus[MAX_CPU];
+extern int nr_cpu;
+
+/* instructions executed by the calling CPU, where a fused pair counts
+ * as two and a block translated ahead of time as its length */
+extern __thread uint64_t cpu_steps;
 
 static inline int check_reg_index(int index) {
+#ifdef DEBUG
   assert(index >= 0 && index < 8);
+#endif
   return index;
 }
 
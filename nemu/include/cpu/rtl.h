@@ -3,7 +3,7 @@
 
 #include "nemu.h"
 
-extern rtlreg_t t0, t1, t2, t3;
+extern __thread rtlreg_t t0, t1, t2, t3;
 extern const rtlreg_t tzero;
 
 /* RTL basic instructions */
@@ -123,6 +123,8 @@ make_rtl_setget_eflags(CF)
 make_rtl_setget_eflags(OF)
 make_rtl_setget_eflags(ZF)
 make_rtl_setget_eflags(SF)
+make_rtl_setget_eflags(DF)
+make_rtl_setget_eflags(PF)
 
 static inline void rtl_mv(rtlreg_t* dest, const rtlreg_t *src1) {
   // dest <- src1
@@ -140,6 +142,11 @@ static inline void rtl_sext(rtlreg_t* dest, const rtlreg_t* src1, int width) {
   rtl_sari(dest, dest, (4 - width) * 8);  // 
 }
 
+static inline void rtl_zext(rtlreg_t* dest, const rtlreg_t* src1, int width) {
+  // dest <- zeroext(src1[(width * 8 - 1) .. 0])
+  *dest = *src1 & (~0u >> ((4 - width) << 3));
+}
+
 static inline void rtl_push(const rtlreg_t* src1) {
   // esp <- esp - 4
   cpu.esp-=4;
@@ -155,6 +162,17 @@ static inline void rtl_pop(rtlreg_t* dest) {
 
 }
 
+/* the same, moving ESP by the operand size */
+static inline void rtl_push_w(const rtlreg_t* src1, int width) {
+  cpu.esp-=width;
+  rtl_sm(&cpu.esp,width,src1);
+}
+
+static inline void rtl_pop_w(rtlreg_t* dest, int width) {
+  rtl_lm(dest,&cpu.esp,width);
+  cpu.esp+=width;
+}
+
 static inline void rtl_eq0(rtlreg_t* dest, const rtlreg_t* src1) {
   // dest <- (src1 == 0 ? 1 : 0)
   *dest=*src1==0?1:0;
@@ -197,16 +215,24 @@ static inline void rtl_update_SF(const rtlreg_t* result, int width) {
   cpu.eflags.SF=((*result)>>(width*8-1))&0x1;
 }
 
+static inline void rtl_update_PF(const rtlreg_t* result) {
+  // eflags.PF <- has_even_parity(result[7 .. 0])
+  cpu.eflags.PF=!__builtin_parity(*result&0xff);
+}
+
 static inline void rtl_update_ZFSF(const rtlreg_t* result, int width) {
   rtl_update_ZF(result, width);
   rtl_update_SF(result, width);
+  rtl_update_PF(result);
 }
 
 // ȡĴ
 static inline void rtl_load_cr(rtlreg_t* dest,int r){
   switch (r){
     case 0:*dest=cpu.CR0;break;
+    case 2:*dest=cpu.CR2;break;
     case 3:*dest=cpu.CR3;break;
+    case 4:*dest=cpu.CR4;break;
     default:assert(0);
   }
 }
@@ -215,7 +241,9 @@ static inline void rtl_load_cr(rtlreg_t* dest,int r){
 static inline void rtl_store_cr(int r,const rtlreg_t* src){
   switch (r){
     case 0:cpu.CR0=*src;break;
+    case 2:cpu.CR2=*src;break;
     case 3:cpu.CR3=*src;break;
+    case 4:cpu.CR4=*src;break;
     default:assert(0);
   }
 }
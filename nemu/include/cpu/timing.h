@@ -0,0 +1,42 @@
+#ifndef __CPU_TIMING_H__
+#define __CPU_TIMING_H__
+
+#include "common.h"
+
+/* The timing model, see src/cpu/timing/. The control transfer helpers
+ * report each branch to the branch predictors, and the cycles are
+ * estimated for an in-order pipeline from the mispredictions and the
+ * misses of the cache models.
+ */
+
+enum { BR_COND, BR_JMP, BR_JMP_IND, BR_CALL, BR_CALL_IND, BR_RET, NR_BR_TYPE };
+
+enum { BPRED_BIMODAL, BPRED_GSHARE, BPRED_STATIC };
+
+/* predictor sizes, all powers of 2 */
+#define BPRED_TABLE_SIZE 4096
+#define BPRED_HISTORY_BITS 12
+#define BTB_SIZE 1024
+#define RAS_SIZE 16
+
+/* pipeline penalties in cycles */
+#define MISPREDICT_PENALTY 10  // resolved at the execute stage
+#define MISFETCH_PENALTY 2     // direct target missing in the BTB, resolved at decode
+#define CACHE_MISS_PENALTY 20
+
+typedef struct {
+  uint64_t instr;
+  uint64_t branch[NR_BR_TYPE], mispredict[NR_BR_TYPE];
+  uint64_t misfetch;
+} TimingStat;
+
+extern bool timing_enabled;
+extern TimingStat timing_stat;
+
+void timing_set_predictor(const char *);
+void init_timing(void);
+void timing_reset_stat(void);
+uint64_t timing_cycles(const TimingStat *, const uint64_t *);
+void bpred_branch(int, vaddr_t, vaddr_t, vaddr_t, bool);
+
+#endif
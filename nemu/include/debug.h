@@ -17,8 +17,18 @@ extern FILE* log_fp;
 #	define Log_write(format, ...)
 #endif
 
+/* Set by the serial port, so that the output of the guest held back
+ * comes before a message. */
+extern void (*log_flush)(void);
+
+/* Functions to run when NEMU aborts, which skips the atexit() ones,
+ * see src/monitor/monitor.c. */
+void at_abort(void (*)(void));
+void run_abort_hooks(void);
+
 #define Log(format, ...) \
   do { \
+    if (log_flush != NULL) log_flush(); \
     fprintf(stdout, "\33[1;34m[%s,%d,%s] " format "\33[0m\n", \
         __FILE__, __LINE__, __func__, ## __VA_ARGS__); \
     fflush(stdout); \
@@ -29,6 +39,7 @@ extern FILE* log_fp;
 #define Assert(cond, ...) \
   do { \
     if (!(cond)) { \
+      run_abort_hooks(); \
       fflush(stdout); \
       fprintf(stderr, "\33[1;31m"); \
       fprintf(stderr, __VA_ARGS__); \
@@ -0,0 +1,16 @@
+#ifndef __DISPLAY_H__
+#define __DISPLAY_H__
+
+#include "common.h"
+
+/* Where the frames of the VGA go (-D), see src/device/display.c. */
+
+enum { DISPLAY_SDL, DISPLAY_NONE, DISPLAY_Y4M, DISPLAY_PNG };
+extern int display_mode;
+extern bool display_is_set;
+
+void display_set(const char *);
+void init_display(void);
+void display_frame(const uint32_t *, bool);
+
+#endif
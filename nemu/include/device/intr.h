@@ -0,0 +1,13 @@
+#ifndef __INTR_H__
+#define __INTR_H__
+
+#include "common.h"
+
+/* external interrupt lines, IRQ i is delivered through vector 32 + i */
+enum { IRQ_TIMER = 0, IRQ_IPI = 2, IRQ_VBLANK = 3, IRQ_DISK = 14 };
+
+#define TIMER_HZ 100
+
+void dev_raise_intr(int cpu_no, int irq);
+
+#endif
@@ -10,4 +10,7 @@ void* add_pio_map(ioaddr_t, int, pio_callback_t);
 uint32_t pio_read(ioaddr_t, int);
 void pio_write(ioaddr_t, int, uint32_t);
 
+void pio_save(FILE *);
+bool pio_load(FILE *);
+
 #endif
@@ -0,0 +1,19 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include "common.h"
+
+/* Record and replay of the device inputs (-r and -p), see
+ * src/device/replay.c. */
+
+enum { REPLAY_NONE, REPLAY_RECORD, REPLAY_PLAY };
+extern int replay_mode;
+
+void replay_set(int, const char *);
+void init_replay(void);
+void replay_host_tick(void);
+void replay_update(void);
+uint32_t replay_rtc(uint32_t);
+void replay_key(uint8_t, bool);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef __SPIN_H__
+#define __SPIN_H__
+
+#include "common.h"
+
+/* Fast-forward of polling loops (-W), see src/device/spin.c. */
+
+extern bool spin_enabled;
+
+void spin_set(void);
+void spin_io(void);
+void spin_poll(void);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef __VGA_H__
+#define __VGA_H__
+
+#include "common.h"
+
+#define VMEM 0x40000
+
+#define SCREEN_H 300
+#define SCREEN_W 400
+
+#define VGA_HZ 50   // vblanks per second of virtual time
+
+extern uint32_t (*vmem) [SCREEN_W];
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "common.h"
+
+/* A model of the L1 caches, see src/memory/cache.c. It only counts hits
+ * and misses; the data always comes from pmem.
+ */
+
+enum { CACHE_I, CACHE_D, NR_CACHE };
+
+#define CACHE_SIZE (32 * 1024)
+#define CACHE_WAYS 8
+#define CACHE_LINE 64
+
+extern bool cache_enabled;
+
+void init_cache(void);
+void cache_access(int, paddr_t, int);
+void cache_reset_stat(void);
+void cache_get_stat(int, uint64_t *, uint64_t *);
+
+#endif
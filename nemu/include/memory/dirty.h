@@ -0,0 +1,34 @@
+#ifndef __DIRTY_H__
+#define __DIRTY_H__
+
+#include "common.h"
+#include "memory/memory.h"
+#include "memory/mmu.h"
+
+/* The pages of physical memory written since some point, for any number
+ * of clients, see src/memory/dirty.c. A write only sets the byte of its
+ * page in `dirty_map'.
+ */
+
+#define NR_DIRTY_PAGE (PMEM_SIZE / PAGE_SIZE)
+
+typedef struct {
+  uint32_t gen;  // the generation at the last dirty_reset()
+} DirtyClient;
+
+extern uint8_t dirty_map[NR_DIRTY_PAGE];
+
+/* call after the write, see dirty_sync() */
+static inline void dirty_mark(paddr_t addr) {
+  dirty_map[(addr / PAGE_SIZE) & (NR_DIRTY_PAGE - 1)] = 1;
+}
+
+void dirty_mark_range(paddr_t, uint32_t);
+void dirty_sync(void);
+void dirty_reset(DirtyClient *);
+bool dirty_test(DirtyClient *, uint32_t);
+bool dirty_written(DirtyClient *, uint32_t);
+int dirty_next(DirtyClient *, uint32_t, uint32_t);
+int dirty_count(DirtyClient *);
+
+#endif
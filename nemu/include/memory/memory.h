@@ -3,6 +3,8 @@
 
 #include "common.h"
 
+#define PMEM_SIZE (128 * 1024 * 1024)
+
 extern uint8_t pmem[];
 
 /* convert the guest physical address in the guest program to host virtual address in NEMU */
@@ -11,8 +13,12 @@ extern uint8_t pmem[];
 #define host_to_guest(p) ((paddr_t)((void *)p - (void *)pmem))
 
 uint32_t vaddr_read(vaddr_t, int);
+uint32_t vaddr_ifetch(vaddr_t, int);
 uint32_t paddr_read(paddr_t, int);
 void vaddr_write(vaddr_t, int, uint32_t);
 void paddr_write(paddr_t, int, uint32_t);
+paddr_t page_translate(vaddr_t, bool);
+bool vaddr_probe(vaddr_t, paddr_t *);
+bool vaddr_cmpxchg(vaddr_t, int, uint32_t, uint32_t);
 
 #endif
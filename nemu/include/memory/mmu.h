@@ -9,6 +9,7 @@
 #define NR_PTE						1024
 #define PAGE_MASK					(4096 - 1)
 #define PT_SIZE						((NR_PTE) * (PAGE_SIZE))
+#define LARGE_PAGE_MASK				(PT_SIZE - 1)
 
 /* the Control Register 0 */
 typedef union CR0 {
@@ -32,6 +33,16 @@ typedef union CR3 {
   uint32_t val;
 } CR3;
 
+/* the Control Register 4 */
+typedef union CR4 {
+  struct {
+    uint32_t pad0                : 4;
+    uint32_t page_size_extension : 1;
+    uint32_t pad1                : 27;
+  };
+  uint32_t val;
+} CR4;
+
 
 /* the 32bit Page Directory(first level page table) data structure */
 typedef union PageDirectoryEntry {
@@ -42,7 +53,10 @@ typedef union PageDirectoryEntry {
     uint32_t page_write_through  : 1;
     uint32_t page_cache_disable  : 1;
     uint32_t accessed            : 1;
-    uint32_t pad0                : 6;
+    uint32_t dirty               : 1;
+    uint32_t page_size           : 1;
+    uint32_t global              : 1;
+    uint32_t pad0                : 3;
     uint32_t page_frame          : 20;
   };
   uint32_t val;
@@ -0,0 +1,90 @@
+#ifndef __FUZZ_H__
+#define __FUZZ_H__
+
+#include "nemu.h"
+#include "memory/mmu.h"
+#include <setjmp.h>
+
+/* The differential instruction fuzzer, see src/monitor/fuzz/. `-F n'
+ * runs n random instruction sequences both in NEMU and natively on the
+ * host CPU in 32-bit compatibility mode, and compares the states after
+ * each instruction. Each distinct mismatch is minimized and written as
+ * a cputest-style program.
+ *
+ * The sequences run in a window of memory at the same address in the
+ * guest and in the host: the code at the first page, then the data and
+ * the stack. Anything outside the window is not mapped in either.
+ */
+
+#define FUZZ_BASE 0x01000000
+#define FUZZ_PAGES 16
+#define FUZZ_SIZE (FUZZ_PAGES * PAGE_SIZE)
+#define FUZZ_DATA (FUZZ_BASE + PAGE_SIZE)
+#define FUZZ_DATA_SIZE (FUZZ_SIZE - PAGE_SIZE)
+#define FUZZ_PDIR 0x00800000  // the page tables of the guest
+
+#define FUZZ_MAX_INSTR 4
+#define FUZZ_MAX_LEN 15
+
+typedef struct {
+  uint32_t gpr[8], eip, eflags;
+  struct {
+    long double st[8];  // physical registers, st(i) is st[(top + i) & 7]
+    uint16_t cw, sw;    // TOP is kept in `top'
+    uint8_t top, valid;
+  } fpu;
+  uint32_t xmm[8][4];
+  uint32_t mxcsr;
+} FuzzState;
+
+typedef struct {
+  uint8_t bytes[FUZZ_MAX_LEN];
+  int len;
+  uint32_t opcode;  // 0x100 | byte for the two-byte opcodes
+  uint8_t rep;      // 0, 0xf2 or 0xf3
+  bool op16, lock, modrm;
+  int mod, reg, rm;
+  bool last;        // a control transfer, or pushf, popf or lahf, which end the sequence
+} FuzzInstr;
+
+#define FUZZ_NO_FAULT (-1)
+#define FUZZ_BAD_LENGTH (-2)  // the host decoded another length, a bug of the generator
+#define FUZZ_CODE_CHANGED (-3)
+
+typedef struct {
+  FuzzState init;
+  uint32_t stack0;  // the dword at the initial ESP
+  FuzzInstr instr[FUZZ_MAX_INSTR];
+  int nr_instr;
+
+  /* the results of the host: the state after each instruction, and the
+   * exception raised by the last one, if any */
+  FuzzState host[FUZZ_MAX_INSTR];
+  int nr_done;
+  int fault, fault_page;
+} FuzzCase;
+
+/* the memory of the window in the host */
+#define fuzz_host_mem ((uint8_t *)(uintptr_t)FUZZ_BASE)
+
+/* gen.c */
+void fuzz_gen_init(uint32_t);
+uint32_t fuzz_rand(void);
+void fuzz_gen_state(FuzzCase *);
+bool fuzz_gen_instr(FuzzCase *, const FuzzState *, vaddr_t);
+void fuzz_gen_skip(const FuzzInstr *);
+int fuzz_nr_skipped(void);
+uint32_t fuzz_undefined_flags(const FuzzInstr *, const FuzzState *);
+int fuzz_instr_key(const FuzzInstr *);
+void fuzz_instr_str(char *, const FuzzInstr *);
+bool fuzz_is_sse(const FuzzInstr *);
+bool fuzz_is_x87(const FuzzInstr *);
+bool fuzz_is_rep_string(const FuzzInstr *);
+
+/* host.c */
+extern sigjmp_buf fuzz_nemu_env;
+extern volatile bool fuzz_in_nemu;
+void fuzz_host_init(void);
+void fuzz_host_run(FuzzCase *, bool);
+
+#endif
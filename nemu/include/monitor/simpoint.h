@@ -0,0 +1,50 @@
+#ifndef __SIMPOINT_H__
+#define __SIMPOINT_H__
+
+#include "nemu.h"
+
+/* SimPoint-style sampling, see src/monitor/simpoint/. A run is done in
+ * three passes over the same image:
+ *   -S dir  profile the basic blocks of each interval and pick the
+ *           representative intervals (simulation points)
+ *   -C dir  take a checkpoint before each simulation point
+ *   -R dir  simulate the simulation points in detail from their
+ *           checkpoints in parallel, and combine the weighted results
+ */
+
+enum { SIMPOINT_NONE, SIMPOINT_PROFILE, SIMPOINT_CHECKPOINT, SIMPOINT_DETAIL };
+
+#define DEFAULT_INTERVAL 10000000
+
+typedef struct {
+  uint32_t index;  // the interval starts after index * interval instructions
+  double weight;
+} SimPoint;
+
+typedef struct {
+  char magic[8];
+  uint32_t index;
+  uint64_t interval;
+  uint64_t warmup;  // the number of instructions before the interval
+} CheckpointHeader;
+
+extern int simpoint_mode;
+extern const char *simpoint_dir;
+extern uint64_t simpoint_interval;
+extern uint64_t simpoint_icount;
+
+void simpoint_step(void);
+int simpoint_read(SimPoint **);
+void simpoint_write(SimPoint *, int);
+void simpoint_path(char *, int, const char *, uint32_t);
+
+void init_bbv(void);
+void bbv_step(void);
+
+void init_checkpoint(void);
+void checkpoint_step(void);
+bool checkpoint_load(const char *, CheckpointHeader *);
+
+void simpoint_detail(void);
+
+#endif
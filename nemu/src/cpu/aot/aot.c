@@ -0,0 +1,85 @@
+#include "cpu/aot.h"
+#include "memory/mmu.h"
+#include <dlfcn.h>
+#include <stdlib.h>
+
+/* The blocks translated ahead of time by translate.c are loaded from the
+ * shared object given by `-a', which must be translated from the same
+ * image. exec_once() runs a block instead of a single instruction when
+ * the EIP is the start of one, and counts each of its instructions as
+ * a step. The blocks assume that the code is not
+ * modified and that the addresses are physical, so they are only used
+ * while paging is off. Elsewhere, the interpreter runs as usual.
+ */
+
+static const char *aot_file = NULL;
+bool aot_enabled = false;
+static const AOTBlock **aot_map = NULL;
+static vaddr_t aot_base;
+static uint32_t aot_size;
+__thread uint64_t aot_max_instr = UINT64_MAX;
+
+uint32_t aot_hash(vaddr_t base, uint32_t size) {
+  // FNV-1a
+  uint8_t *p = guest_to_host(base);
+  uint32_t h = 0x811c9dc5;
+  uint32_t i;
+  for (i = 0; i < size; i ++) {
+    h = (h ^ p[i]) * 0x01000193;
+  }
+  return h;
+}
+
+void aot_set_file(const char *file) {
+  aot_file = file;
+}
+
+static void aot_load(vaddr_t base, uint32_t size) {
+  char path[256];
+  // dlopen() only searches the library path for a name without `/'
+  snprintf(path, sizeof(path), (strchr(aot_file, '/') ? "%s" : "./%s"), aot_file);
+  void *handle = dlopen(path, RTLD_NOW);
+  Assert(handle, "Can not load '%s': %s", aot_file, dlerror());
+
+  const AOTBlock *blocks = dlsym(handle, "aot_blocks");
+  const int *nr_blocks = dlsym(handle, "aot_nr_blocks");
+  const uint32_t *img_size = dlsym(handle, "aot_img_size");
+  const uint32_t *img_hash = dlsym(handle, "aot_img_hash");
+  Assert(blocks && nr_blocks && img_size && img_hash, "'%s' is not translated by NEMU", aot_file);
+  if (*img_size != size || *img_hash != aot_hash(base, size)) {
+    Log("'%s' is translated from another image, ignored", aot_file);
+    dlclose(handle);
+    return;
+  }
+
+  aot_map = calloc(size, sizeof(aot_map[0]));
+  assert(aot_map != NULL);
+  aot_base = base;
+  aot_size = size;
+  int i;
+  for (i = 0; i < *nr_blocks; i ++) {
+    if (blocks[i].eip - base < size) {
+      aot_map[blocks[i].eip - base] = &blocks[i];
+    }
+  }
+  Log("%d blocks translated ahead of time are loaded from %s", *nr_blocks, aot_file);
+}
+
+/* Called after the image of `size' bytes is loaded at `base'. */
+void init_aot(vaddr_t base, uint32_t size) {
+  init_aot_record(base, size);
+  if (aot_file != NULL) {
+    aot_load(base, size);
+  }
+}
+
+void aot_set_enabled(bool enable) {
+  aot_enabled = enable && aot_map != NULL;
+}
+
+const AOTBlock *aot_lookup(vaddr_t eip) {
+  if (eip - aot_base >= aot_size || ((CR0)cpu.CR0).paging) {
+    return NULL;
+  }
+  return aot_map[eip - aot_base];
+}
@@ -0,0 +1,454 @@
+#include "cpu/aot.h"
+#include "memory/mmu.h"
+#include <stdlib.h>
+
+/* The translator of `-t'. NEMU runs the image in the interpreter, and
+ * records the length of each instruction executed and where the blocks
+ * start, that is the first instruction after a jump, a call, a return,
+ * an interrupt or an instruction which can not be translated. At exit,
+ * the blocks are decoded with the decoder of NEMU and written out as C
+ * functions, which set up the operands and call the semantics the same
+ * way as the interpreter. A block ends at a control transfer, and the
+ * targets of the direct ones are translated as well.
+ *
+ * Then compile the C file into a shared object, e.g. with `make aot',
+ * and run the image with it by `-a'.
+ */
+
+#define MAX_BLOCK_INSTR 64
+#define MAX_INSTR_CODE 512
+
+enum { AOT_NEXT, AOT_END, AOT_FAIL };
+
+enum { LEADER_NONE, LEADER_PENDING, LEADER_DONE, LEADER_EMPTY };
+
+bool aot_recording = false;
+static const char *aot_output = NULL;
+static vaddr_t img_base;
+static uint32_t img_size, img_hash;
+static uint8_t *instr_len;  // 0 if the instruction is not executed
+static uint8_t *leader;
+static uint8_t *block_len;  // the number of instructions of a block
+static __thread vaddr_t last_seq_eip = 0;
+
+static inline bool in_img(vaddr_t eip) {
+  return eip - img_base < img_size;
+}
+
+static inline void add_leader(vaddr_t eip) {
+  if (in_img(eip) && leader[eip - img_base] == LEADER_NONE) {
+    leader[eip - img_base] = LEADER_PENDING;
+  }
+}
+
+/* Called after an instruction at `eip' is executed. The counters are
+ * not locked, since other CPUs only write the same values.
+ */
+void aot_record(vaddr_t eip, vaddr_t seq_eip) {
+  if (in_img(eip)) {
+    if (eip != last_seq_eip) {
+      leader[eip - img_base] = LEADER_PENDING;
+    }
+    instr_len[eip - img_base] = seq_eip - eip;
+  }
+  last_seq_eip = seq_eip;
+}
+
+bool aot_is_recording() {
+  return aot_recording;
+}
+
+/* operands, like the ones in DecodeInfo but known at translation time */
+typedef struct {
+  uint32_t type;
+  int reg;
+  AddrForm addr;
+  uint32_t imm;
+} AOTOperand;
+
+/* The ways of setting up the operands, named after the decode helpers
+ * in decode.c, which they must agree with.
+ */
+enum { F_none, F_G2E, F_mov_G2E, F_E2G, F_mov_E2G, F_lea_M2G, F_I2a, F_r,
+  F_mov_I2r, F_I2E, F_mov_I2E, F_SI2E, F_E, F_test_I, F_gp2_1_E, F_gp2_cl2E,
+  F_gp2_Ib2E, F_I, F_push_SI };
+
+static const int alu_form[] = { F_G2E, F_E2G, F_I2a };
+
+/* The semantics is a function in alu.h, or an EHelper which does not
+ * use `eip'. These EHelpers are declared in the generated code.
+ */
+static const char *alu_sem[] = { "do_add", "do_or", "exec_adc", "exec_sbb",
+  "do_and", "do_sub", "do_xor", "do_cmp" };
+static const char *gp2_sem[] = { "exec_rol", "exec_ror", "exec_rcl", "exec_rcr",
+  "exec_shl", "exec_shr", "exec_shl", "exec_sar" };
+static const char *gp3_sem[] = { "do_test", NULL, "exec_not", "exec_neg",
+  "exec_mul", "exec_imul1", NULL, NULL };
+static const char *ehelpers[] = { "adc", "sbb", "rol", "ror", "rcl", "rcr",
+  "shl", "shr", "sar", "not", "neg", "mul", "imul1", "imul2", "cwtl", "cltd",
+  "leave", "movzx", "movsx", "cmovcc", "setcc" };
+
+static char *emit_op(char *p, const char *name, AOTOperand *op, int width, bool load) {
+  switch (op->type) {
+    case OP_TYPE_REG:
+      if (load) {
+        return p + sprintf(p, "  aot_reg(%s, %d, %d);\n", name, op->reg, width);
+      }
+      return p + sprintf(p, "  aot_reg_noload(%s, %d);\n", name, op->reg);
+    case OP_TYPE_MEM: {
+      char addr[64], *q = addr;
+      AddrForm *f = &op->addr;
+      q += sprintf(q, "(vaddr_t)0x%x", f->disp);
+      if (f->base_reg != -1) {
+        q += sprintf(q, " + reg_l(%d)", f->base_reg);
+      }
+      if (f->index_reg != -1) {
+        q += sprintf(q, " + (reg_l(%d) << %d)", f->index_reg, f->scale);
+      }
+      if (load) {
+        return p + sprintf(p, "  aot_mem(%s, %s, %d);\n", name, addr, width);
+      }
+      return p + sprintf(p, "  aot_mem_noload(%s, %s);\n", name, addr);
+    }
+    default:
+      return p + sprintf(p, "  aot_imm(%s, 0x%x);\n", name, op->imm);
+  }
+}
+
+/* read the ModR/M byte, return the reg/opcode field */
+static int decode_rm(vaddr_t *pc, AOTOperand *rm, AOTOperand *reg) {
+  ModR_M m;
+  m.val = instr_fetch(pc, 1);
+  reg->type = OP_TYPE_REG;
+  reg->reg = m.reg;
+  if (m.mod == 3) {
+    rm->type = OP_TYPE_REG;
+    rm->reg = m.R_M;
+  }
+  else {
+    rm->type = OP_TYPE_MEM;
+    decode_addr(pc, &m, &rm->addr);
+  }
+  return m.opcode;
+}
+
+static void decode_imm(vaddr_t *pc, AOTOperand *op, int width, bool is_signed) {
+  op->type = OP_TYPE_IMM;
+  op->imm = instr_fetch(pc, width);
+  if (is_signed && width == 1) {
+    op->imm = (int8_t)op->imm;
+  }
+}
+
+/* Translate the instruction at `pc' into `p'. For a control transfer,
+ * the code sets the next EIP, and the direct targets are added as the
+ * leaders of blocks.
+ */
+static int translate_instr(vaddr_t *pc, char *p) {
+  AOTOperand rm, reg, imm;
+  uint32_t opcode = instr_fetch(pc, 1);
+  if (opcode == 0x0f) {
+    opcode = 0x100 | instr_fetch(pc, 1);
+  }
+
+  int form = F_none, width = 4, ext = 0;
+  const char *sem = NULL;
+  bool set_opcode = false;
+  vaddr_t target;
+  switch (opcode) {
+    case 0x00 ... 0x3f:
+      if ((opcode & 0x7) >= 6) return AOT_FAIL;
+      form = alu_form[(opcode & 0x7) >> 1];
+      width = (opcode & 0x1 ? 4 : 1);
+      sem = alu_sem[opcode >> 3];
+      break;
+    // 0x4c and 0x4d are not in opcode_table
+    case 0x40 ... 0x47: form = F_r; sem = "do_inc"; break;
+    case 0x48 ... 0x4b: case 0x4e: case 0x4f: form = F_r; sem = "do_dec"; break;
+    case 0x50 ... 0x57: form = F_r; sem = "do_push"; break;
+    case 0x58 ... 0x5f: form = F_r; sem = "do_pop"; break;
+    case 0x68: form = F_I; sem = "do_push"; break;
+    case 0x6a: form = F_push_SI; width = 1; sem = "do_push"; break;
+    case 0x80: case 0x81: form = F_I2E; width = (opcode == 0x80 ? 1 : 4); break;
+    case 0x83: form = F_SI2E; break;
+    case 0x84: case 0x85: form = F_G2E; width = (opcode & 0x1 ? 4 : 1); sem = "do_test"; break;
+    case 0x88: case 0x89: form = F_mov_G2E; width = (opcode & 0x1 ? 4 : 1); sem = "do_mov"; break;
+    case 0x8a: case 0x8b: form = F_mov_E2G; width = (opcode & 0x1 ? 4 : 1); sem = "do_mov"; break;
+    case 0x8d: form = F_lea_M2G; sem = "do_lea"; break;
+    case 0x90: break;
+    case 0x98: sem = "exec_cwtl"; break;
+    case 0x99: sem = "exec_cltd"; break;
+    case 0xa8: form = F_I2a; width = 1; sem = "do_test"; break;
+    case 0xb0 ... 0xb7: form = F_mov_I2r; width = 1; sem = "do_mov"; break;
+    case 0xb8 ... 0xbf: form = F_mov_I2r; sem = "do_mov"; break;
+    case 0xc0: case 0xc1: form = F_gp2_Ib2E; width = (opcode & 0x1 ? 4 : 1); break;
+    case 0xd0: case 0xd1: form = F_gp2_1_E; width = (opcode & 0x1 ? 4 : 1); break;
+    case 0xd2: case 0xd3: form = F_gp2_cl2E; width = (opcode & 0x1 ? 4 : 1); break;
+    case 0xc6: case 0xc7: form = F_mov_I2E; width = (opcode & 0x1 ? 4 : 1); sem = "do_mov"; break;
+    case 0xc9: sem = "exec_leave"; break;
+    case 0xf6: case 0xf7: form = F_E; width = (opcode & 0x1 ? 4 : 1); break;
+    case 0x140 ... 0x14f: form = F_E2G; sem = "exec_cmovcc"; set_opcode = true; break;
+    case 0x190 ... 0x19f: form = F_E; width = 1; sem = "exec_setcc"; set_opcode = true; break;
+    case 0x1af: form = F_E2G; sem = "exec_imul2"; break;
+    case 0x1b6: case 0x1b7: form = F_E2G; width = (opcode & 0x1 ? 2 : 1); sem = "exec_movzx"; break;
+    case 0x1be: case 0x1bf: form = F_E2G; width = (opcode & 0x1 ? 2 : 1); sem = "exec_movsx"; break;
+
+    /* control transfers */
+    case 0x70 ... 0x7f: case 0x180 ... 0x18f:
+      target = (int32_t)(opcode < 0x100 ? (int8_t)instr_fetch(pc, 1) : instr_fetch(pc, 4));
+      target += *pc;
+      // rtl_setcc() uses t0, see exec_jcc()
+      sprintf(p, "  rtl_setcc(&t2, %d);\n  decoding.seq_eip = (t2 ? 0x%x : 0x%x);\n",
+          opcode & 0xf, target, *pc);
+      add_leader(target);
+      add_leader(*pc);
+      return AOT_END;
+    case 0xe8: case 0xe9: case 0xeb:
+      target = (opcode == 0xeb ? (int8_t)instr_fetch(pc, 1) : instr_fetch(pc, 4));
+      target += *pc;
+      if (opcode == 0xe8) {
+        // the return address
+        p += sprintf(p, "  t0 = 0x%x;\n  rtl_push(&t0);\n", *pc);
+        add_leader(*pc);
+      }
+      sprintf(p, "  decoding.seq_eip = 0x%x;\n", target);
+      add_leader(target);
+      return AOT_END;
+    case 0xc3:
+      sprintf(p, "  rtl_pop(&decoding.seq_eip);\n");
+      return AOT_END;
+    default: return AOT_FAIL;
+  }
+
+  /* decode the operands */
+  switch (form) {
+    case F_G2E: case F_mov_G2E: case F_E2G: case F_mov_E2G: case F_lea_M2G:
+      ext = decode_rm(pc, &rm, &reg);
+      if (form == F_lea_M2G && rm.type != OP_TYPE_MEM) return AOT_FAIL;
+      break;
+    case F_I2E: case F_mov_I2E: case F_gp2_Ib2E:
+      ext = decode_rm(pc, &rm, &reg);
+      decode_imm(pc, &imm, (form == F_gp2_Ib2E ? 1 : width), false);
+      break;
+    case F_SI2E:
+      ext = decode_rm(pc, &rm, &reg);
+      decode_imm(pc, &imm, 1, true);
+      break;
+    case F_E: case F_gp2_1_E: case F_gp2_cl2E:
+      ext = decode_rm(pc, &rm, &reg);
+      break;
+    case F_I2a: case F_I: case F_mov_I2r:
+      decode_imm(pc, &imm, width, false);
+      break;
+    case F_push_SI:
+      decode_imm(pc, &imm, 1, true);
+      break;
+  }
+
+  /* the groups */
+  switch (opcode) {
+    case 0x80: case 0x81: case 0x83: sem = alu_sem[ext]; break;
+    case 0xc0: case 0xc1: case 0xd0: case 0xd1: case 0xd2: case 0xd3: sem = gp2_sem[ext]; break;
+    case 0xf6: case 0xf7:
+      sem = gp3_sem[ext];
+      // div and idiv may raise #DE
+      if (sem == NULL) return AOT_FAIL;
+      if (ext == 0) {
+        form = F_test_I;
+        decode_imm(pc, &imm, width, false);
+      }
+      break;
+    case 0xc6: case 0xc7:
+      // only mov in group 11
+      if (ext != 0) return AOT_FAIL;
+      break;
+  }
+
+  if (sem != NULL && strncmp(sem, "exec_", 5) == 0) {
+    p += sprintf(p, "  aot_width(%d);\n", width);
+  }
+  if (set_opcode) {
+    p += sprintf(p, "  decoding.opcode = 0x%x;\n", opcode);
+  }
+
+  switch (form) {
+    case F_G2E:
+      p = emit_op(p, "id_dest", &rm, width, true);
+      p = emit_op(p, "id_src", &reg, width, true);
+      break;
+    case F_mov_G2E:
+      p = emit_op(p, "id_dest", &rm, width, false);
+      p = emit_op(p, "id_src", &reg, width, true);
+      break;
+    case F_E2G:
+      p = emit_op(p, "id_src", &rm, width, true);
+      p = emit_op(p, "id_dest", &reg, width, true);
+      break;
+    case F_mov_E2G:
+      p = emit_op(p, "id_src", &rm, width, true);
+      p = emit_op(p, "id_dest", &reg, width, false);
+      break;
+    case F_lea_M2G:
+      p = emit_op(p, "id_src", &rm, width, false);
+      p = emit_op(p, "id_dest", &reg, width, false);
+      break;
+    case F_I2a:
+      reg.type = OP_TYPE_REG;
+      reg.reg = R_EAX;
+      p = emit_op(p, "id_dest", &reg, width, true);
+      p = emit_op(p, "id_src", &imm, width, true);
+      break;
+    case F_r: case F_mov_I2r:
+      reg.type = OP_TYPE_REG;
+      reg.reg = opcode & 0x7;
+      p = emit_op(p, "id_dest", &reg, width, form == F_r);
+      if (form == F_mov_I2r) {
+        p = emit_op(p, "id_src", &imm, width, true);
+      }
+      break;
+    case F_I2E: case F_mov_I2E: case F_test_I:
+      p = emit_op(p, "id_dest", &rm, width, form != F_mov_I2E);
+      p = emit_op(p, "id_src", &imm, width, true);
+      break;
+    case F_SI2E: case F_gp2_Ib2E:
+      p = emit_op(p, "id_dest", &rm, width, true);
+      p += sprintf(p, "  id_src->width = 1;\n");
+      p = emit_op(p, "id_src", &imm, 1, true);
+      break;
+    case F_E:
+      p = emit_op(p, "id_dest", &rm, width, true);
+      break;
+    case F_gp2_1_E:
+      p = emit_op(p, "id_dest", &rm, width, true);
+      imm.type = OP_TYPE_IMM;
+      imm.imm = 1;
+      p = emit_op(p, "id_src", &imm, 1, true);
+      break;
+    case F_gp2_cl2E:
+      p = emit_op(p, "id_dest", &rm, width, true);
+      reg.type = OP_TYPE_REG;
+      reg.reg = R_CL;
+      p = emit_op(p, "id_src", &reg, 1, true);
+      break;
+    case F_I: case F_push_SI:
+      p = emit_op(p, "id_dest", &imm, width, true);
+      break;
+  }
+
+  if (sem == NULL) {
+    // nop
+  }
+  else if (strncmp(sem, "exec_", 5) == 0) {
+    p += sprintf(p, "  %s(&decoding.seq_eip);\n", sem);
+  }
+  else {
+    p += sprintf(p, "  %s(%d);\n", sem, width);
+  }
+  return AOT_NEXT;
+}
+
+/* Write the block starting at `eip' as a function. Return the number
+ * of its instructions.
+ */
+static int translate_block(FILE *fp, vaddr_t eip) {
+  static char code[MAX_BLOCK_INSTR * MAX_INSTR_CODE];
+  char *p = code;
+  vaddr_t pc = eip;
+  int nr_instr = 0, ret = AOT_NEXT;
+
+  while (ret == AOT_NEXT && nr_instr < MAX_BLOCK_INSTR && in_img(pc)) {
+#ifdef DEBUG
+    decoding.p = decoding.asm_buf;
+#endif
+    vaddr_t next = pc;
+    char *q = p + sprintf(p, "  // %x\n", pc);
+    ret = translate_instr(&next, q);
+    if (ret == AOT_FAIL) {
+      // the interpreter executes it, and the next block starts after it
+      if (instr_len[pc - img_base] != 0) {
+        add_leader(pc + instr_len[pc - img_base]);
+      }
+      *p = '\0';
+      break;
+    }
+    p = q + strlen(q);
+    pc = next;
+    nr_instr ++;
+  }
+
+  if (nr_instr == 0) {
+    return 0;
+  }
+  fprintf(fp, "static void b_%x(void) {\n%s", eip, code);
+  if (ret != AOT_END) {
+    fprintf(fp, "  decoding.seq_eip = 0x%x;\n", pc);
+  }
+  fprintf(fp, "}\n\n");
+  return nr_instr;
+}
+
+static void aot_translate() {
+  FILE *fp = fopen(aot_output, "w");
+  Assert(fp, "Can not open '%s'", aot_output);
+
+  /* the image is translated as it runs, without paging */
+  uint32_t CR0 = cpu.CR0;
+  cpu.CR0 &= ~0x80000000u;
+
+  fprintf(fp, "/* Translated by NEMU ahead of time, do not edit. */\n\n");
+  fprintf(fp, "#include \"cpu/aot.h\"\n\n");
+  int i;
+  for (i = 0; i < sizeof(ehelpers) / sizeof(ehelpers[0]); i ++) {
+    fprintf(fp, "make_EHelper(%s);\n", ehelpers[i]);
+  }
+  fprintf(fp, "\n");
+
+  /* the direct targets of a block may be before it */
+  uint32_t off;
+  bool pending = true;
+  while (pending) {
+    pending = false;
+    for (off = 0; off < img_size; off ++) {
+      if (leader[off] != LEADER_PENDING) continue;
+      block_len[off] = translate_block(fp, img_base + off);
+      leader[off] = (block_len[off] != 0 ? LEADER_DONE : LEADER_EMPTY);
+      pending = true;
+    }
+  }
+
+  int nr_block = 0;
+  fprintf(fp, "const AOTBlock aot_blocks[] = {\n");
+  for (off = 0; off < img_size; off ++) {
+    if (leader[off] == LEADER_DONE) {
+      fprintf(fp, "  { 0x%x, b_%x, %d },\n", img_base + off, img_base + off, block_len[off]);
+      nr_block ++;
+    }
+  }
+  fprintf(fp, "};\n\n");
+  fprintf(fp, "const int aot_nr_blocks = %d;\n", nr_block);
+  fprintf(fp, "const uint32_t aot_img_size = 0x%x;\n", img_size);
+  fprintf(fp, "const uint32_t aot_img_hash = 0x%x;\n", img_hash);
+  fclose(fp);
+
+  cpu.CR0 = CR0;
+  Log("%d blocks are translated into %s", nr_block, aot_output);
+}
+
+void aot_set_output(const char *file) {
+  aot_output = file;
+}
+
+void init_aot_record(vaddr_t base, uint32_t size) {
+  if (aot_output == NULL) return;
+
+  img_base = base;
+  img_size = size;
+  img_hash = aot_hash(base, size);
+  instr_len = calloc(size, 1);
+  leader = calloc(size, 1);
+  block_len = calloc(size, 1);
+  assert(instr_len != NULL && leader != NULL && block_len != NULL);
+  add_leader(base);
+  aot_recording = true;
+  atexit(aot_translate);
+}
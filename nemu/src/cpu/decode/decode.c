@@ -2,8 +2,8 @@
 #include "cpu/rtl.h"
 
 /* shared by all helper functions */
-DecodeInfo decoding;
-rtlreg_t t0, t1, t2, t3;
+__thread DecodeInfo decoding;
+__thread rtlreg_t t0, t1, t2, t3;
 const rtlreg_t tzero = 0;
 
 #define make_DopHelper(name)                                                   \
@@ -117,6 +117,16 @@ make_DHelper(G2E) { decode_op_rm(eip, id_dest, true, id_src, true); }
 
 make_DHelper(mov_G2E) { decode_op_rm(eip, id_dest, false, id_src, true); }
 
+/* The bit offset in Gv also selects the word of a memory operand, so
+ * bt* load it themselves.
+ */
+make_DHelper(bt_G2E) {
+  decode_op_rm(eip, id_dest, false, id_src, true);
+  if (id_dest->type == OP_TYPE_REG) {
+    rtl_lr(&id_dest->val, id_dest->reg, id_dest->width);
+  }
+}
+
 /* Gb <- Eb
  * Gv <- Ev
  */
@@ -234,6 +244,25 @@ make_DHelper(Ib_G2E) {
   decode_op_I(eip, id_src, true);
 }
 
+/* Ev <- GvCL
+ * use for shld/shrd */
+make_DHelper(cl_G2E) {
+  decode_op_rm(eip, id_dest, true, id_src2, true);
+  id_src->type = OP_TYPE_REG;
+  id_src->reg = R_CL;
+  rtl_lr_b(&id_src->val, R_CL);
+#ifdef DEBUG
+  sprintf(id_src->str, "%%cl");
+#endif
+}
+
+/* eXX <-> eAX
+ * use for xchg */
+make_DHelper(a2r) {
+  decode_op_r(eip, id_dest, true);
+  decode_op_a(eip, id_src, true);
+}
+
 make_DHelper(O2a) {
   decode_op_O(eip, id_src, true);
   decode_op_a(eip, id_dest, false);
@@ -293,12 +322,96 @@ make_DHelper(mov_load_cr) {
 
 make_DHelper(mov_store_cr) { decode_op_rm(eip, id_src, true, id_dest, false); }
 
-void operand_write(Operand *op, rtlreg_t *src) {
+/* x87 escape: the memory operand or st(i) is in dest, the reg field is
+ * in decoding.ext_opcode. Nothing is loaded since the operand size
+ * depends on the instruction.
+ */
+make_DHelper(fpu) {
+  decode_op_rm(eip, id_dest, false, NULL, false);
+#ifdef DEBUG
+  if (id_dest->type == OP_TYPE_REG) {
+    sprintf(id_dest->str, "%%st(%d)", id_dest->reg);
+  }
+#endif
+}
+
+/* SSE operands: an XMM register number is in `reg'. The values are not
+ * loaded since they do not fit in rtlreg_t.
+ */
+static inline void xmm_str(Operand *op) {
+#ifdef DEBUG
   if (op->type == OP_TYPE_REG) {
-    rtl_sr(op->reg, op->width, src);
-  } else if (op->type == OP_TYPE_MEM) {
-    rtl_sm(&op->addr, op->width, src);
-  } else {
-    assert(0);
+    sprintf(op->str, "%%xmm%d", op->reg);
   }
+#endif
+}
+
+/* xmm <- xmm/m128 */
+make_DHelper(xmm_E2G) {
+  decode_op_rm(eip, id_src, false, id_dest, false);
+  xmm_str(id_src);
+  xmm_str(id_dest);
+}
+
+/* xmm/m128 <- xmm */
+make_DHelper(xmm_G2E) {
+  decode_op_rm(eip, id_dest, false, id_src, false);
+  xmm_str(id_src);
+  xmm_str(id_dest);
+}
+
+/* xmm <- xmm/m128, imm8 */
+make_DHelper(xmm_Ib_E2G) {
+  decode_xmm_E2G(eip);
+  id_src2->width = 1;
+  decode_op_I(eip, id_src2, true);
+}
+
+/* xmm <- imm8, used by the shift groups */
+make_DHelper(xmm_Ib_E) {
+  decode_op_rm(eip, id_dest, false, NULL, false);
+  xmm_str(id_dest);
+  id_src->width = 1;
+  decode_op_I(eip, id_src, true);
+}
+
+/* xmm <- r/m32, or r/m16 with imm8 for pinsrw. A memory operand is
+ * loaded by the EHelper once the prefix is known to be valid, see
+ * sse.c.
+ */
+static inline void decode_r_E2xmm(vaddr_t *eip) {
+  decode_op_rm(eip, id_src, false, id_dest, false);
+  if (id_src->type == OP_TYPE_REG) {
+    rtl_lr(&id_src->val, id_src->reg, id_src->width);
+  }
+  xmm_str(id_dest);
+}
+
+make_DHelper(E2xmm) {
+  id_src->width = 4;
+  decode_r_E2xmm(eip);
+}
+
+make_DHelper(Ib_E2xmm) {
+  id_src->width = 2;
+  decode_r_E2xmm(eip);
+  id_src2->width = 1;
+  decode_op_I(eip, id_src2, true);
+}
+
+/* r32 <- xmm, with imm8 for pextrw */
+make_DHelper(xmm2r) {
+  id_dest->width = 4;
+  decode_op_rm(eip, id_src, false, id_dest, false);
+  xmm_str(id_src);
+}
+
+make_DHelper(Ib_xmm2r) {
+  decode_xmm2r(eip);
+  id_src2->width = 1;
+  decode_op_I(eip, id_src2, true);
+}
+
+void operand_write(Operand *op, rtlreg_t *src) {
+  operand_write_w(op, src, op->width);
 }
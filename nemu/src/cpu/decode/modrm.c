@@ -1,13 +1,13 @@
 #include "cpu/exec.h"
 #include "cpu/rtl.h"
 
-void load_addr(vaddr_t *eip, ModR_M *m, Operand *rm) {
+/* Fetch the SIB byte and the displacement of a memory operand. */
+void decode_addr(vaddr_t *eip, ModR_M *m, AddrForm *f) {
   assert(m->mod != 3);
 
   int32_t disp = 0;
   int disp_size = 4;
   int base_reg = -1, index_reg = -1, scale = 0;
-  rtl_li(&rm->addr, 0);
 
   if (m->R_M == R_ESP) {
     SIB s;
@@ -32,25 +32,38 @@ void load_addr(vaddr_t *eip, ModR_M *m, Operand *rm) {
     /* has disp */
     disp = instr_fetch(eip, disp_size);
     if (disp_size == 1) { disp = (int8_t)disp; }
-
-    rtl_addi(&rm->addr, &rm->addr, disp);
   }
 
-  if (base_reg != -1) {
-    rtl_add(&rm->addr, &rm->addr, &reg_l(base_reg));
+  f->base_reg = base_reg;
+  f->index_reg = index_reg;
+  f->scale = scale;
+  f->disp = disp;
+  f->disp_size = disp_size;
+}
+
+void load_addr(vaddr_t *eip, ModR_M *m, Operand *rm) {
+  AddrForm f;
+  decode_addr(eip, m, &f);
+
+  rtl_li(&rm->addr, f.disp);
+
+  if (f.base_reg != -1) {
+    rtl_add(&rm->addr, &rm->addr, &reg_l(f.base_reg));
   }
 
-  if (index_reg != -1) {
-    rtl_shli(&t0, &reg_l(index_reg), scale);
+  if (f.index_reg != -1) {
+    rtl_shli(&t0, &reg_l(f.index_reg), f.scale);
     rtl_add(&rm->addr, &rm->addr, &t0);
   }
 
 #ifdef DEBUG
+  int32_t disp = f.disp;
+  int base_reg = f.base_reg, index_reg = f.index_reg, scale = f.scale;
   char disp_buf[16];
   char base_buf[8];
   char index_buf[8];
 
-  if (disp_size != 0) {
+  if (f.disp_size != 0) {
     /* has disp */
     sprintf(disp_buf, "%s%#x", (disp < 0 ? "-" : ""), (disp < 0 ? -disp : disp));
   }
@@ -78,36 +91,5 @@ void load_addr(vaddr_t *eip, ModR_M *m, Operand *rm) {
 }
 
 void read_ModR_M(vaddr_t *eip, Operand *rm, bool load_rm_val, Operand *reg, bool load_reg_val) {
-  ModR_M m;
-  m.val = instr_fetch(eip, 1);
-  decoding.ext_opcode = m.opcode;
-  if (reg != NULL) {
-    reg->type = OP_TYPE_REG;
-    reg->reg = m.reg;
-    if (load_reg_val) {
-      rtl_lr(&reg->val, reg->reg, reg->width);
-    }
-
-#ifdef DEBUG
-    snprintf(reg->str, OP_STR_SIZE, "%%%s", reg_name(reg->reg, reg->width));
-#endif
-  }
-
-  if (m.mod == 3) {
-    rm->type = OP_TYPE_REG;
-    rm->reg = m.R_M;
-    if (load_rm_val) {
-      rtl_lr(&rm->val, m.R_M, rm->width);
-    }
-
-#ifdef DEBUG
-    sprintf(rm->str, "%%%s", reg_name(m.R_M, rm->width));
-#endif
-  }
-  else {
-    load_addr(eip, &m, rm);
-    if (load_rm_val) {
-      rtl_lm(&rm->val, &rm->addr, rm->width);
-    }
-  }
+  read_ModR_M_w(eip, rm, load_rm_val, reg, load_reg_val, rm->width, (reg ? reg->width : 0));
 }
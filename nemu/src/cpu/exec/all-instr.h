@@ -3,6 +3,9 @@
 make_EHelper(mov);
 
 make_EHelper(operand_size);
+make_EHelper(rep);
+make_EHelper(repnz);
+make_EHelper(lock);
 
 make_EHelper(inv);
 make_EHelper(nemu_trap);
@@ -14,6 +17,9 @@ make_EHelper(leave);
 make_EHelper(cltd);
 make_EHelper(movsx);
 make_EHelper(movzx);
+make_EHelper(cmovcc);
+make_EHelper(xchg);
+make_EHelper(bswap);
 
 make_EHelper(add);
 make_EHelper(inc);
@@ -29,6 +35,8 @@ make_EHelper(imul2);
 make_EHelper(imul3);
 make_EHelper(div);
 make_EHelper(idiv);
+make_EHelper(xadd);
+make_EHelper(cmpxchg);
 
 make_EHelper(not);
 make_EHelper(and);
@@ -39,13 +47,35 @@ make_EHelper(shr);
 make_EHelper(sar);
 make_EHelper(setcc);
 make_EHelper(test);
+make_EHelper(rol);
+make_EHelper(ror);
+make_EHelper(rcl);
+make_EHelper(rcr);
+make_EHelper(shld);
+make_EHelper(shrd);
+make_EHelper(bsf);
+make_EHelper(bsr);
+make_EHelper(bt);
+make_EHelper(bts);
+make_EHelper(btr);
+make_EHelper(btc);
+make_EHelper(clc);
+make_EHelper(stc);
+make_EHelper(cmc);
+make_EHelper(sahf);
+make_EHelper(lahf);
 
 make_EHelper(jmp);
 make_EHelper(jcc);
 make_EHelper(call);
 make_EHelper(ret);
+make_EHelper(ret_imm);
 make_EHelper(jmp_rm);
 make_EHelper(call_rm);
+make_EHelper(loop);
+make_EHelper(loope);
+make_EHelper(loopne);
+make_EHelper(jecxz);
 
 make_EHelper(lea);
 make_EHelper(nop);
@@ -58,6 +88,125 @@ make_EHelper(int);
 make_EHelper(pusha);
 make_EHelper(popa);
 make_EHelper(iret);
+make_EHelper(pushf);
+make_EHelper(popf);
+make_EHelper(cli);
+make_EHelper(sti);
+make_EHelper(hlt);
+make_EHelper(cpuid);
+make_EHelper(rdmsr);
+make_EHelper(wrmsr);
+make_EHelper(sysenter);
+make_EHelper(sysexit);
 make_EHelper(cwtl);
 
 make_EHelper(mov_store_cr);
+
+make_EHelper(movs);
+make_EHelper(stos);
+make_EHelper(lods);
+make_EHelper(cmps);
+make_EHelper(scas);
+make_EHelper(cld);
+make_EHelper(std);
+
+make_EHelper(fpu_d8);
+make_EHelper(fpu_d9);
+make_EHelper(fpu_da);
+make_EHelper(fpu_db);
+make_EHelper(fpu_dc);
+make_EHelper(fpu_dd);
+make_EHelper(fpu_de);
+make_EHelper(fpu_df);
+make_EHelper(fwait);
+
+make_EHelper(paddb);
+make_EHelper(paddw);
+make_EHelper(paddd);
+make_EHelper(paddq);
+make_EHelper(paddusb);
+make_EHelper(paddusw);
+make_EHelper(paddsb);
+make_EHelper(paddsw);
+make_EHelper(psubb);
+make_EHelper(psubw);
+make_EHelper(psubd);
+make_EHelper(psubq);
+make_EHelper(psubusb);
+make_EHelper(psubusw);
+make_EHelper(psubsb);
+make_EHelper(psubsw);
+make_EHelper(pmullw);
+make_EHelper(pmulhw);
+make_EHelper(pmulhuw);
+make_EHelper(pmuludq);
+make_EHelper(pmaddwd);
+make_EHelper(psadbw);
+make_EHelper(pavgb);
+make_EHelper(pavgw);
+make_EHelper(pmaxub);
+make_EHelper(pminub);
+make_EHelper(pmaxsw);
+make_EHelper(pminsw);
+make_EHelper(pand);
+make_EHelper(pandn);
+make_EHelper(por);
+make_EHelper(pxor);
+make_EHelper(pcmpeqb);
+make_EHelper(pcmpeqw);
+make_EHelper(pcmpeqd);
+make_EHelper(pcmpgtb);
+make_EHelper(pcmpgtw);
+make_EHelper(pcmpgtd);
+make_EHelper(punpcklbw);
+make_EHelper(punpcklwd);
+make_EHelper(punpckldq);
+make_EHelper(punpcklqdq);
+make_EHelper(punpckhbw);
+make_EHelper(punpckhwd);
+make_EHelper(punpckhdq);
+make_EHelper(punpckhqdq);
+make_EHelper(packsswb);
+make_EHelper(packssdw);
+make_EHelper(packuswb);
+make_EHelper(psrlw);
+make_EHelper(psrld);
+make_EHelper(psrlq);
+make_EHelper(psraw);
+make_EHelper(psrad);
+make_EHelper(psllw);
+make_EHelper(pslld);
+make_EHelper(psllq);
+make_EHelper(andps);
+make_EHelper(andnps);
+make_EHelper(orps);
+make_EHelper(xorps);
+make_EHelper(unpcklps);
+make_EHelper(unpckhps);
+make_EHelper(sse_shift_imm);
+make_EHelper(pshufd);
+make_EHelper(shufps);
+make_EHelper(movdq);
+make_EHelper(movups);
+make_EHelper(movlps);
+make_EHelper(movd_E2xmm);
+make_EHelper(movd_xmm2E);
+make_EHelper(movq_G2E);
+make_EHelper(pmovmskb);
+make_EHelper(pextrw);
+make_EHelper(pinsrw);
+make_EHelper(addps);
+make_EHelper(subps);
+make_EHelper(mulps);
+make_EHelper(divps);
+make_EHelper(minps);
+make_EHelper(maxps);
+make_EHelper(sqrtps);
+make_EHelper(cmpps);
+make_EHelper(comiss);
+make_EHelper(movmskps);
+make_EHelper(cvtsi2ss);
+make_EHelper(cvtss2si);
+make_EHelper(cvtps2pd);
+make_EHelper(cvtdq2ps);
+make_EHelper(sse_ctl);
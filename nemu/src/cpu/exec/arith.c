@@ -1,76 +1,28 @@
 #include "cpu/exec.h"
+#include "cpu/alu.h"
 
 make_EHelper(add) {
-  rtl_add(&t2, &id_dest->val, &id_src->val);
-  operand_write(id_dest, &t2);
-  rtl_update_ZFSF(&t2, id_dest->width);
-
-  rtl_sltu(&t0, &t2, &id_dest->val);
-  rtl_set_CF(&t0);
-
-  rtl_xor(&t0, &id_src->val, &t2);
-  rtl_xor(&t1, &id_dest->val, &t2);
-  rtl_and(&t0, &t0, &t1);
-  rtl_msb(&t0, &t0, id_dest->width);
-  rtl_set_OF(&t0);
-
+  do_add(id_dest->width);
   print_asm_template2(add);
 }
 
 make_EHelper(sub) {
-  rtl_sub(&t2, &id_dest->val, &id_src->val);
-  rtl_sltu(&t3, &id_dest->val, &t2);
-  operand_write(id_dest, &t2);
-  rtl_update_ZFSF(&t2, id_dest->width);
-
-  rtl_sltu(&t0, &id_dest->val, &t2);
-  rtl_or(&t0, &t3, &t0);
-  rtl_set_CF(&t0);
-
-  rtl_xor(&t0, &id_dest->val, &id_src->val);
-  rtl_xor(&t1, &id_dest->val, &t2);
-  rtl_and(&t0, &t0, &t1);
-  rtl_msb(&t0, &t0, id_dest->width);
-  rtl_set_OF(&t0);
-
+  do_sub(id_dest->width);
   print_asm_template2(sub);
 }
 
 make_EHelper(cmp) {
-  rtl_sub(&t2, &id_dest->val, &id_src->val);
-  rtl_sltu(&t3, &id_dest->val, &t2);
-  rtl_update_ZFSF(&t2, id_dest->width);
-
-  rtl_set_CF(&t3);
-
-  rtl_xor(&t0, &id_dest->val, &id_src->val);
-  rtl_xor(&t1, &id_dest->val, &t2);
-  rtl_and(&t0, &t0, &t1);
-  rtl_msb(&t0, &t0, id_dest->width);
-  rtl_set_OF(&t0);
-
+  do_cmp(id_dest->width);
   print_asm_template2(cmp);
 }
 
 make_EHelper(inc) {
-  rtl_addi(&t1, &id_dest->val, 1);
-  operand_write(id_dest, &t1);
-
-  rtl_update_ZFSF(&t1, id_dest->width);
-  rtl_eqi(&t0, &t1, 0x80000000);
-  rtl_set_OF(&t0);
-
+  do_inc(id_dest->width);
   print_asm_template1(inc);
 }
 
 make_EHelper(dec) {
-  rtl_subi(&t1, &id_dest->val, 1);
-  operand_write(id_dest, &t1);
-
-  rtl_update_ZFSF(&t1, id_dest->width);
-  rtl_eqi(&t0, &t1, 0x7fffffff);
-  rtl_set_OF(&t0);
-
+  do_dec(id_dest->width);
   print_asm_template1(dec);
 }
 
@@ -85,26 +37,27 @@ make_EHelper(neg) {
   t0 = -1 * t0;
   operand_write(id_dest, &t0);
   rtl_update_ZFSF(&t0, id_dest->width);
-  rtl_xor(&t0, &id_dest->val, &id_src->val);
-  rtl_xor(&t1, &id_dest->val, &t2);
-  rtl_and(&t0, &t0, &t1);
-  rtl_msb(&t0, &t0, id_dest->width);
+  // only the most negative number overflows
+  rtl_eqi(&t0, &id_dest->val, 1u << (id_dest->width * 8 - 1));
   rtl_set_OF(&t0);
 
   print_asm_template1(neg);
 }
 
+/* With the carry in, the result equal to dest also means a carry (or
+ * borrow) out: src + CF wraps around.
+ */
 make_EHelper(adc) {
-  rtl_add(&t2, &id_dest->val, &id_src->val);
-  rtl_sltu(&t3, &t2, &id_dest->val);
   rtl_get_CF(&t1);
+  rtl_add(&t2, &id_dest->val, &id_src->val);
   rtl_add(&t2, &t2, &t1);
+  rtl_zext(&t2, &t2, id_dest->width);
   operand_write(id_dest, &t2);
 
   rtl_update_ZFSF(&t2, id_dest->width);
 
-  rtl_sltu(&t0, &t2, &id_dest->val);
-  rtl_or(&t0, &t3, &t0);
+  rtl_zext(&t3, &id_dest->val, id_dest->width);
+  t0 = (t2 < t3) || (t1 && t2 == t3);
   rtl_set_CF(&t0);
 
   rtl_xor(&t0, &id_dest->val, &id_src->val);
@@ -118,16 +71,16 @@ make_EHelper(adc) {
 }
 
 make_EHelper(sbb) {
-  rtl_sub(&t2, &id_dest->val, &id_src->val);
-  rtl_sltu(&t3, &id_dest->val, &t2);
   rtl_get_CF(&t1);
+  rtl_sub(&t2, &id_dest->val, &id_src->val);
   rtl_sub(&t2, &t2, &t1);
+  rtl_zext(&t2, &t2, id_dest->width);
   operand_write(id_dest, &t2);
 
   rtl_update_ZFSF(&t2, id_dest->width);
 
-  rtl_sltu(&t0, &id_dest->val, &t2);
-  rtl_or(&t0, &t3, &t0);
+  rtl_zext(&t3, &id_dest->val, id_dest->width);
+  t0 = (t2 > t3) || (t1 && t2 == t3);
   rtl_set_CF(&t0);
 
   rtl_xor(&t0, &id_dest->val, &id_src->val);
@@ -139,9 +92,27 @@ make_EHelper(sbb) {
   print_asm_template2(sbb);
 }
 
+/* CF and OF of mul: set if the upper half of the product is not zero. */
+static inline void mul_set_flags(rtlreg_t hi, rtlreg_t lo, int width) {
+  uint64_t p = ((uint64_t)hi << 32) | lo;
+  t3 = (p >> (width * 8)) != 0;
+  rtl_set_CF(&t3);
+  rtl_set_OF(&t3);
+}
+
+/* CF and OF of imul: set if the signed product does not fit in `width'. */
+static inline void imul_set_flags(rtlreg_t hi, rtlreg_t lo, int width) {
+  int64_t p = (int64_t)(((uint64_t)hi << 32) | lo);
+  rtl_sext(&t3, &lo, width);
+  t3 = (p != (int32_t)t3);
+  rtl_set_CF(&t3);
+  rtl_set_OF(&t3);
+}
+
 make_EHelper(mul) {
   rtl_lr(&t0, R_EAX, id_dest->width);
   rtl_mul(&t0, &t1, &id_dest->val, &t0);
+  mul_set_flags(t0, t1, id_dest->width);
 
   switch (id_dest->width) {
   case 1:
@@ -166,7 +137,10 @@ make_EHelper(mul) {
 // imul with one operand
 make_EHelper(imul1) {
   rtl_lr(&t0, R_EAX, id_dest->width);
+  rtl_sext(&t0, &t0, id_dest->width);
+  rtl_sext(&id_dest->val, &id_dest->val, id_dest->width);
   rtl_imul(&t0, &t1, &id_dest->val, &t0);
+  imul_set_flags(t0, t1, id_dest->width);
 
   switch (id_dest->width) {
   case 1:
@@ -194,6 +168,7 @@ make_EHelper(imul2) {
   rtl_sext(&id_dest->val, &id_dest->val, id_dest->width);
 
   rtl_imul(&t0, &t1, &id_dest->val, &id_src->val);
+  imul_set_flags(t0, t1, id_dest->width);
   operand_write(id_dest, &t1);
 
   print_asm_template2(imul);
@@ -202,10 +177,11 @@ make_EHelper(imul2) {
 // imul with three operands
 make_EHelper(imul3) {
   rtl_sext(&id_src->val, &id_src->val, id_src->width);
-  rtl_sext(&id_src2->val, &id_src2->val, id_src->width);
+  rtl_sext(&id_src2->val, &id_src2->val, id_src2->width);
   rtl_sext(&id_dest->val, &id_dest->val, id_dest->width);
 
   rtl_imul(&t0, &t1, &id_src2->val, &id_src->val);
+  imul_set_flags(t0, t1, id_dest->width);
   operand_write(id_dest, &t1);
 
   print_asm_template3(imul);
@@ -281,3 +257,47 @@ make_EHelper(idiv) {
 
   print_asm_template1(idiv);
 }
+
+make_EHelper(xadd) {
+  rtl_add(&t2, &id_dest->val, &id_src->val);
+  rtl_zext(&t2, &t2, id_dest->width);
+  operand_write(id_src, &id_dest->val);
+  operand_write(id_dest, &t2);
+  rtl_update_ZFSF(&t2, id_dest->width);
+
+  rtl_sltu(&t0, &t2, &id_dest->val);
+  rtl_set_CF(&t0);
+
+  rtl_xor(&t0, &id_src->val, &t2);
+  rtl_xor(&t1, &id_dest->val, &t2);
+  rtl_and(&t0, &t0, &t1);
+  rtl_msb(&t0, &t0, id_dest->width);
+  rtl_set_OF(&t0);
+
+  print_asm_template2(xadd);
+}
+
+make_EHelper(cmpxchg) {
+  // compare the accumulator with the destination as `cmp' does
+  rtl_lr(&id_src2->val, R_EAX, id_dest->width);
+  rtl_sub(&t2, &id_src2->val, &id_dest->val);
+  rtl_sltu(&t3, &id_src2->val, &t2);
+  rtl_update_ZFSF(&t2, id_dest->width);
+
+  rtl_set_CF(&t3);
+
+  rtl_xor(&t0, &id_src2->val, &id_dest->val);
+  rtl_xor(&t1, &id_src2->val, &t2);
+  rtl_and(&t0, &t0, &t1);
+  rtl_msb(&t0, &t0, id_dest->width);
+  rtl_set_OF(&t0);
+
+  if (cpu.eflags.ZF) {
+    operand_write(id_dest, &id_src->val);
+  }
+  else {
+    rtl_sr(R_EAX, id_dest->width, &id_dest->val);
+  }
+
+  print_asm_template2(cmpxchg);
+}
@@ -55,10 +55,11 @@ void rtl_setcc(rtlreg_t *dest, uint8_t subcode) {
     rtl_get_ZF(&t0);
     rtl_or(dest, dest, &t0);
     break;
+  case CC_P:
+    rtl_get_PF(dest);
+    break;
   default:
     panic("should not reach here");
-  case CC_P:
-    panic("n86 does not have PF");
   }
 
   if (invert) {
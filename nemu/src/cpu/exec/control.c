@@ -1,8 +1,17 @@
 #include "cpu/exec.h"
+#include "cpu/timing.h"
+
+/* Report a branch to the timing model. */
+static inline void branch(int type, bool taken) {
+  if (timing_enabled) {
+    bpred_branch(type, cpu.eip, decoding.seq_eip, decoding.jmp_eip, taken);
+  }
+}
 
 make_EHelper(jmp) {
   // the target address is calculated at the decode stage
   decoding.is_jmp = 1;
+  branch(BR_JMP, true);
 
   print_asm("jmp %x", decoding.jmp_eip);
 }
@@ -12,6 +21,7 @@ make_EHelper(jcc) {
   uint8_t subcode = decoding.opcode & 0xf;
   rtl_setcc(&t2, subcode);
   decoding.is_jmp = t2;
+  branch(BR_COND, t2);
 
   print_asm("j%s %x", get_cc_name(subcode), decoding.jmp_eip);
 }
@@ -19,6 +29,7 @@ make_EHelper(jcc) {
 make_EHelper(jmp_rm) {
   decoding.jmp_eip = id_dest->val;
   decoding.is_jmp = 1;
+  branch(BR_JMP_IND, true);
 
   print_asm("jmp *%s", id_dest->str);
 }
@@ -27,6 +38,7 @@ make_EHelper(call) {
   // the target address is calculated at the decode stage
   decoding.is_jmp = 1;
   rtl_push(&decoding.seq_eip);
+  branch(BR_CALL, true);
   // cpu.eip=decoding.jmp_eip;
 
   print_asm("call %x", decoding.jmp_eip);
@@ -36,14 +48,58 @@ make_EHelper(ret) {
   rtl_pop(&t1);
   decoding.jmp_eip = t1;
   decoding.is_jmp = 1;
+  branch(BR_RET, true);
 
   print_asm("ret");
 }
 
+/* ret imm16: also release imm16 bytes of arguments */
+make_EHelper(ret_imm) {
+  rtl_pop(&t1);
+  rtl_add(&cpu.esp, &cpu.esp, &id_dest->val);
+  decoding.jmp_eip = t1;
+  decoding.is_jmp = 1;
+  branch(BR_RET, true);
+
+  print_asm("ret %s", id_dest->str);
+}
+
 make_EHelper(call_rm) {
   decoding.is_jmp = 1;
   decoding.jmp_eip = id_dest->val;
   rtl_push(&decoding.seq_eip);
+  branch(BR_CALL_IND, true);
 
   print_asm("call *%s", id_dest->str);
 }
+
+make_EHelper(loop) {
+  rtl_subi(&cpu.ecx, &cpu.ecx, 1);
+  decoding.is_jmp = (cpu.ecx != 0);
+  branch(BR_COND, decoding.is_jmp);
+
+  print_asm("loop %x", decoding.jmp_eip);
+}
+
+make_EHelper(loope) {
+  rtl_subi(&cpu.ecx, &cpu.ecx, 1);
+  decoding.is_jmp = (cpu.ecx != 0 && cpu.eflags.ZF);
+  branch(BR_COND, decoding.is_jmp);
+
+  print_asm("loope %x", decoding.jmp_eip);
+}
+
+make_EHelper(loopne) {
+  rtl_subi(&cpu.ecx, &cpu.ecx, 1);
+  decoding.is_jmp = (cpu.ecx != 0 && !cpu.eflags.ZF);
+  branch(BR_COND, decoding.is_jmp);
+
+  print_asm("loopne %x", decoding.jmp_eip);
+}
+
+make_EHelper(jecxz) {
+  decoding.is_jmp = (cpu.ecx == 0);
+  branch(BR_COND, decoding.is_jmp);
+
+  print_asm("jecxz %x", decoding.jmp_eip);
+}
@@ -1,46 +1,43 @@
 #include "cpu/exec.h"
+#include "cpu/alu.h"
 
 make_EHelper(mov) {
-  operand_write(id_dest, &id_src->val);
+  do_mov(id_dest->width);
   print_asm_template2(mov);
 }
 
 make_EHelper(push) {
-  rtl_push(&id_dest->val);
+  do_push(id_dest->width);
 
   print_asm_template1(push);
 }
 
 make_EHelper(pop) {
-  rtl_pop(&t0);
-  operand_write(id_dest, &t0);
+  do_pop(id_dest->width);
 
   print_asm_template1(pop);
 }
 
+/* with 0x66, pushaw and popaw on the 16-bit registers */
 make_EHelper(pusha) {
+  int width = decoding.is_operand_size_16 ? 2 : 4;
+  int i;
   t1 = cpu.esp;
-  rtl_push(&cpu.eax);
-  rtl_push(&cpu.ecx);
-  rtl_push(&cpu.edx);
-  rtl_push(&cpu.ebx);
-  rtl_push(&t1);
-  rtl_push(&cpu.ebp);
-  rtl_push(&cpu.esi);
-  rtl_push(&cpu.edi);
+  for (i = R_EAX; i <= R_EDI; i ++) {
+    rtl_push_w((i == R_ESP ? &t1 : &reg_l(i)), width);
+  }
 
   print_asm("pusha");
 }
 
 make_EHelper(popa) {
-  rtl_pop(&cpu.edi);
-  rtl_pop(&cpu.esi);
-  rtl_pop(&cpu.ebp);
-  rtl_pop(&t1);
-  rtl_pop(&cpu.ebx);
-  rtl_pop(&cpu.edx);
-  rtl_pop(&cpu.ecx);
-  rtl_pop(&cpu.eax);
+  int width = decoding.is_operand_size_16 ? 2 : 4;
+  int i;
+  for (i = R_EDI; i >= R_EAX; i --) {
+    rtl_pop_w(&t0, width);
+    // the saved ESP is skipped
+    if (i != R_ESP) rtl_sr(i, width, &t0);
+  }
 
   print_asm("popa");
 }
@@ -58,7 +55,7 @@ make_EHelper(cltd) {
     if (t0 == 1)
       cpu.edx = cpu.edx | 0xffff;
     else
-      cpu.edx = 0;
+      cpu.edx = cpu.edx & 0xffff0000;
   } else {
     rtl_msb(&t0, &cpu.eax, 4);
     if (t0 == 1)
@@ -94,8 +91,7 @@ make_EHelper(movzx) {
 }
 
 make_EHelper(lea) {
-  rtl_li(&t2, id_src->addr);
-  operand_write(id_dest, &t2);
+  do_lea(id_dest->width);
   print_asm_template2(lea);
 }
 
@@ -103,3 +99,37 @@ make_EHelper(mov_store_cr) {
   rtl_store_cr(id_dest->reg, &id_src->val);
   print_asm_template2(mov_store_cr);
 }
+
+make_EHelper(cmovcc) {
+  uint8_t subcode = decoding.opcode & 0xf;
+  rtl_setcc(&t2, subcode);
+  if (t2) {
+    operand_write(id_dest, &id_src->val);
+  }
+
+  print_asm("cmov%s %s,%s", get_cc_name(subcode), id_src->str, id_dest->str);
+}
+
+make_EHelper(xchg) {
+  if (id_dest->type == OP_TYPE_MEM) {
+    // xchg with memory is always locked
+    while (!vaddr_cmpxchg(id_dest->addr, id_dest->width, id_dest->val, id_src->val)) {
+      rtl_lm(&id_dest->val, &id_dest->addr, id_dest->width);
+    }
+    operand_write(id_src, &id_dest->val);
+  }
+  else {
+    rtl_mv(&t0, &id_dest->val);
+    operand_write(id_dest, &id_src->val);
+    operand_write(id_src, &t0);
+  }
+
+  print_asm_template2(xchg);
+}
+
+make_EHelper(bswap) {
+  rtl_li(&t0, __builtin_bswap32(id_dest->val));
+  operand_write(id_dest, &t0);
+
+  print_asm_template1(bswap);
+}
@@ -1,5 +1,7 @@
 #include "cpu/exec.h"
 #include "all-instr.h"
+#include "cpu/aot.h"
+#include <setjmp.h>
 
 typedef struct {
   DHelper decode;
@@ -14,9 +16,10 @@ typedef struct {
   { NULL, concat(exec_, ex), w }
 #define EX(ex) EXW(ex, 0)
 #define EMPTY EX(inv)
-#define TIMER_IRQ 32
+#define IRQ_BASE 32  // the vector of IRQ 0
 
 extern void raise_intr(uint8_t NO, vaddr_t ret_addr);
+extern void raise_intr_error(uint8_t NO, vaddr_t ret_addr, uint32_t error_code);
 
 static inline void set_width(int width) {
   if (width == 0) {
@@ -49,8 +52,8 @@ make_group(gp1, EX(add), EX(or), EX(adc), EX(sbb), EX(and), EX(sub), EX(xor),
            EX(cmp))
 
     /* 0xc0, 0xc1, 0xd0, 0xd1, 0xd2, 0xd3 */
-    make_group(gp2, EMPTY, EMPTY, EMPTY, EMPTY, EXW(shl, 1), EX(shr), EMPTY,
-               EXW(sar, 1))
+    make_group(gp2, EX(rol), EX(ror), EX(rcl), EX(rcr), EX(shl), EX(shr),
+               EX(shl), EX(sar))
 
     /* 0xf6, 0xf7 */
     make_group(gp3, IDEX(test_I, test), EMPTY, EX(not), EX(neg), EX(mul),
@@ -66,6 +69,13 @@ make_group(gp1, EX(add), EX(or), EX(adc), EX(sbb), EX(and), EX(sub), EX(xor),
     /* 0x0f 0x01*/
     make_group(gp7, EMPTY, EMPTY, EMPTY, EX(lidt), EMPTY, EMPTY, EMPTY, EMPTY)
 
+    /* 0x0f 0xba */
+    make_group(gp8, EMPTY, EMPTY, EMPTY, EMPTY, EX(bt), EX(bts), EX(btr),
+               EX(btc))
+
+    /* 0xc6, 0xc7 */
+    make_group(gp11, EX(mov), EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY)
+
     /* TODO: Add more instructions!!! */
 
     opcode_entry opcode_table[512] = {
@@ -103,8 +113,8 @@ make_group(gp1, EX(add), EX(or), EX(adc), EX(sbb), EX(and), EX(sub), EX(xor),
         /* 0x5c */ IDEX(r, pop), IDEX(r, pop), IDEX(r, pop), IDEX(r, pop),
         /* 0x60 */ EX(pusha), EX(popa), EMPTY, EMPTY,
         /* 0x64 */ EMPTY, EMPTY, EX(operand_size), EMPTY,
-        /* 0x68 */ IDEX(I, push), EMPTY, IDEXW(push_SI, push, 1),
-        IDEX(I_E2G, imul3),
+        /* 0x68 */ IDEX(I, push), IDEX(I_E2G, imul3), IDEXW(push_SI, push, 1),
+        IDEX(SI_E2G, imul3),
         /* 0x6c */ EMPTY, EMPTY, EMPTY, EMPTY,
         /* 0x70 */ IDEXW(J, jcc, 1), IDEXW(J, jcc, 1), IDEXW(J, jcc, 1),
         IDEXW(J, jcc, 1),
@@ -115,19 +125,21 @@ make_group(gp1, EX(add), EX(or), EX(adc), EX(sbb), EX(and), EX(sub), EX(xor),
         /* 0x7c */ IDEXW(J, jcc, 1), IDEXW(J, jcc, 1), IDEXW(J, jcc, 1),
         IDEXW(J, jcc, 1),
         /* 0x80 */ IDEXW(I2E, gp1, 1), IDEX(I2E, gp1), EMPTY, IDEX(SI2E, gp1),
-        /* 0x84 */ IDEXW(G2E, test, 1), IDEX(G2E, test), EMPTY, EMPTY,
+        /* 0x84 */ IDEXW(G2E, test, 1), IDEX(G2E, test), IDEXW(G2E, xchg, 1),
+        IDEX(G2E, xchg),
         /* 0x88 */ IDEXW(mov_G2E, mov, 1), IDEX(mov_G2E, mov),
         IDEXW(mov_E2G, mov, 1), IDEX(mov_E2G, mov),
         /* 0x8c */ EMPTY, IDEX(lea_M2G, lea), EMPTY, EMPTY,
-        /* 0x90 */ EX(nop), EMPTY, EMPTY, EMPTY,
-        /* 0x94 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x98 */ EX(cwtl), EX(cltd), EMPTY, EMPTY,
-        /* 0x9c */ EMPTY, EMPTY, EMPTY, EMPTY,
+        /* 0x90 */ EX(nop), IDEX(a2r, xchg), IDEX(a2r, xchg), IDEX(a2r, xchg),
+        /* 0x94 */ IDEX(a2r, xchg), IDEX(a2r, xchg), IDEX(a2r, xchg),
+        IDEX(a2r, xchg),
+        /* 0x98 */ EX(cwtl), EX(cltd), EMPTY, EX(fwait),
+        /* 0x9c */ EX(pushf), EX(popf), EX(sahf), EX(lahf),
         /* 0xa0 */ IDEXW(O2a, mov, 1), IDEX(O2a, mov), IDEXW(a2O, mov, 1),
         IDEX(a2O, mov),
-        /* 0xa4 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xa8 */ IDEXW(I2a, test, 1), IDEX(I2r, test), EMPTY, EMPTY,
-        /* 0xac */ EMPTY, EMPTY, EMPTY, EMPTY,
+        /* 0xa4 */ EXW(movs, 1), EX(movs), EXW(cmps, 1), EX(cmps),
+        /* 0xa8 */ IDEXW(I2a, test, 1), IDEX(I2a, test), EXW(stos, 1), EX(stos),
+        /* 0xac */ EXW(lods, 1), EX(lods), EXW(scas, 1), EX(scas),
         /* 0xb0 */ IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1),
         IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1),
         /* 0xb4 */ IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1),
@@ -136,25 +148,29 @@ make_group(gp1, EX(add), EX(or), EX(adc), EX(sbb), EX(and), EX(sub), EX(xor),
         IDEX(mov_I2r, mov),
         /* 0xbc */ IDEX(mov_I2r, mov), IDEX(mov_I2r, mov), IDEX(mov_I2r, mov),
         IDEX(mov_I2r, mov),
-        /* 0xc0 */ IDEXW(gp2_Ib2E, gp2, 1), IDEX(gp2_Ib2E, gp2), EMPTY, EX(ret),
-        /* 0xc4 */ EMPTY, EMPTY, IDEXW(mov_I2E, mov, 1), IDEX(mov_I2E, mov),
+        /* 0xc0 */ IDEXW(gp2_Ib2E, gp2, 1), IDEX(gp2_Ib2E, gp2), IDEXW(I, ret_imm, 2),
+        EX(ret),
+        /* 0xc4 */ EMPTY, EMPTY, IDEXW(mov_I2E, gp11, 1), IDEX(mov_I2E, gp11),
         /* 0xc8 */ EMPTY, EX(leave), EMPTY, EMPTY,
         /* 0xcc */ EMPTY, IDEXW(I, int, 1), EMPTY, EX(iret),
         /* 0xd0 */ IDEXW(gp2_1_E, gp2, 1), IDEX(gp2_1_E, gp2),
         IDEXW(gp2_cl2E, gp2, 1), IDEX(gp2_cl2E, gp2),
         /* 0xd4 */ EMPTY, EMPTY, EX(nemu_trap), EMPTY,
-        /* 0xd8 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xdc */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xe0 */ EMPTY, EMPTY, EMPTY, EMPTY,
+        /* 0xd8 */ IDEX(fpu, fpu_d8), IDEX(fpu, fpu_d9), IDEX(fpu, fpu_da),
+        IDEX(fpu, fpu_db),
+        /* 0xdc */ IDEX(fpu, fpu_dc), IDEX(fpu, fpu_dd), IDEX(fpu, fpu_de),
+        IDEX(fpu, fpu_df),
+        /* 0xe0 */ IDEXW(J, loopne, 1), IDEXW(J, loope, 1), IDEXW(J, loop, 1),
+        IDEXW(J, jecxz, 1),
         /* 0xe4 */ IDEXW(in_I2a, in, 1), IDEX(in_I2a, in),
         IDEXW(out_a2I, out, 1), IDEX(out_a2I, out),
         /* 0xe8 */ IDEX(J, call), IDEX(J, jmp), EMPTY, IDEXW(J, jmp, 1),
         /* 0xec */ IDEXW(in_dx2a, in, 1), IDEX(in_dx2a, in),
         IDEXW(out_a2dx, out, 1), IDEX(out_a2dx, out),
-        /* 0xf0 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xf4 */ EMPTY, EMPTY, IDEXW(E, gp3, 1), IDEX(E, gp3),
-        /* 0xf8 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xfc */ EMPTY, EMPTY, IDEXW(E, gp4, 1), IDEX(E, gp5),
+        /* 0xf0 */ EX(lock), EMPTY, EX(repnz), EX(rep),
+        /* 0xf4 */ EX(hlt), EX(cmc), IDEXW(E, gp3, 1), IDEX(E, gp3),
+        /* 0xf8 */ EX(clc), EX(stc), EX(cli), EX(sti),
+        /* 0xfc */ EX(cld), EX(std), IDEXW(E, gp4, 1), IDEX(E, gp5),
 
         /*2 byte_opcode_table */
 
@@ -162,35 +178,53 @@ make_group(gp1, EX(add), EX(or), EX(adc), EX(sbb), EX(and), EX(sub), EX(xor),
         /* 0x04 */ EMPTY, EMPTY, EMPTY, EMPTY,
         /* 0x08 */ EMPTY, EMPTY, EMPTY, EMPTY,
         /* 0x0c */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x10 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x14 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x18 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x1c */ EMPTY, EMPTY, EMPTY, EMPTY,
+        /* 0x10 */ IDEX(xmm_E2G, movups), IDEX(xmm_G2E, movups),
+        IDEX(xmm_E2G, movlps), IDEX(xmm_G2E, movlps),
+        /* 0x14 */ IDEX(xmm_E2G, unpcklps), IDEX(xmm_E2G, unpckhps),
+        IDEX(xmm_E2G, movlps), IDEX(xmm_G2E, movlps),
+        /* 0x18 */ IDEX(gp7_E, nop), EMPTY, EMPTY, EMPTY,
+        /* 0x1c */ EMPTY, EMPTY, EMPTY, IDEX(gp7_E, nop),
         /* 0x20 */ IDEX(mov_load_cr, mov), EMPTY,
         IDEX(mov_store_cr, mov_store_cr), EMPTY,
         /* 0x24 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x28 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x2c */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x30 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x34 */ EMPTY, EMPTY, EMPTY, EMPTY,
+        /* 0x28 */ IDEX(xmm_E2G, movups), IDEX(xmm_G2E, movups), IDEX(E2xmm, cvtsi2ss),
+        IDEX(xmm_G2E, movups),
+        /* 0x2c */ IDEX(xmm2r, cvtss2si), IDEX(xmm2r, cvtss2si), IDEX(xmm_E2G, comiss),
+        IDEX(xmm_E2G, comiss),
+        /* 0x30 */ EX(wrmsr), EMPTY, EX(rdmsr), EMPTY,
+        /* 0x34 */ EX(sysenter), EX(sysexit), EMPTY, EMPTY,
         /* 0x38 */ EMPTY, EMPTY, EMPTY, EMPTY,
         /* 0x3c */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x40 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x44 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x48 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x4c */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x50 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x54 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x58 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x5c */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x60 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x64 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x68 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x6c */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x70 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x74 */ EMPTY, EMPTY, EMPTY, EMPTY,
+        /* 0x40 */ IDEX(E2G, cmovcc), IDEX(E2G, cmovcc), IDEX(E2G, cmovcc),
+        IDEX(E2G, cmovcc),
+        /* 0x44 */ IDEX(E2G, cmovcc), IDEX(E2G, cmovcc), IDEX(E2G, cmovcc),
+        IDEX(E2G, cmovcc),
+        /* 0x48 */ IDEX(E2G, cmovcc), IDEX(E2G, cmovcc), IDEX(E2G, cmovcc),
+        IDEX(E2G, cmovcc),
+        /* 0x4c */ IDEX(E2G, cmovcc), IDEX(E2G, cmovcc), IDEX(E2G, cmovcc),
+        IDEX(E2G, cmovcc),
+        /* 0x50 */ IDEX(xmm2r, movmskps), IDEX(xmm_E2G, sqrtps), IDEX(xmm_E2G, sqrtps),
+        IDEX(xmm_E2G, sqrtps),
+        /* 0x54 */ IDEX(xmm_E2G, andps), IDEX(xmm_E2G, andnps), IDEX(xmm_E2G, orps),
+        IDEX(xmm_E2G, xorps),
+        /* 0x58 */ IDEX(xmm_E2G, addps), IDEX(xmm_E2G, mulps), IDEX(xmm_E2G, cvtps2pd),
+        IDEX(xmm_E2G, cvtdq2ps),
+        /* 0x5c */ IDEX(xmm_E2G, subps), IDEX(xmm_E2G, minps), IDEX(xmm_E2G, divps),
+        IDEX(xmm_E2G, maxps),
+        /* 0x60 */ IDEX(xmm_E2G, punpcklbw), IDEX(xmm_E2G, punpcklwd),
+        IDEX(xmm_E2G, punpckldq), IDEX(xmm_E2G, packsswb),
+        /* 0x64 */ IDEX(xmm_E2G, pcmpgtb), IDEX(xmm_E2G, pcmpgtw), IDEX(xmm_E2G, pcmpgtd),
+        IDEX(xmm_E2G, packuswb),
+        /* 0x68 */ IDEX(xmm_E2G, punpckhbw), IDEX(xmm_E2G, punpckhwd),
+        IDEX(xmm_E2G, punpckhdq), IDEX(xmm_E2G, packssdw),
+        /* 0x6c */ IDEX(xmm_E2G, punpcklqdq), IDEX(xmm_E2G, punpckhqdq),
+        IDEX(E2xmm, movd_E2xmm), IDEX(xmm_E2G, movdq),
+        /* 0x70 */ IDEX(xmm_Ib_E2G, pshufd), IDEX(xmm_Ib_E, sse_shift_imm),
+        IDEX(xmm_Ib_E, sse_shift_imm), IDEX(xmm_Ib_E, sse_shift_imm),
+        /* 0x74 */ IDEX(xmm_E2G, pcmpeqb), IDEX(xmm_E2G, pcmpeqw), IDEX(xmm_E2G, pcmpeqd),
+        EMPTY,
         /* 0x78 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0x7c */ EMPTY, EMPTY, EMPTY, EMPTY,
+        /* 0x7c */ EMPTY, EMPTY, IDEX(xmm_G2E, movd_xmm2E), IDEX(xmm_G2E, movdq),
         /* 0x80 */ IDEX(J, jcc), IDEX(J, jcc), IDEX(J, jcc), IDEX(J, jcc),
         /* 0x84 */ IDEX(J, jcc), IDEX(J, jcc), IDEX(J, jcc), IDEX(J, jcc),
         /* 0x88 */ IDEX(J, jcc), IDEX(J, jcc), IDEX(J, jcc), IDEX(J, jcc),
@@ -203,30 +237,66 @@ make_group(gp1, EX(add), EX(or), EX(adc), EX(sbb), EX(and), EX(sub), EX(xor),
         IDEXW(E, setcc, 1),
         /* 0x9c */ IDEXW(E, setcc, 1), IDEXW(E, setcc, 1), IDEXW(E, setcc, 1),
         IDEXW(E, setcc, 1),
-        /* 0xa0 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xa4 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xa8 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xac */ EMPTY, EMPTY, EMPTY, IDEX(E2G, imul2),
-        /* 0xb0 */ EMPTY, EMPTY, EMPTY, EMPTY,
+        /* 0xa0 */ EMPTY, EMPTY, EX(cpuid), IDEX(bt_G2E, bt),
+        /* 0xa4 */ IDEX(Ib_G2E, shld), IDEX(cl_G2E, shld), EMPTY, EMPTY,
+        /* 0xa8 */ EMPTY, EMPTY, EMPTY, IDEX(bt_G2E, bts),
+        /* 0xac */ IDEX(Ib_G2E, shrd), IDEX(cl_G2E, shrd), IDEX(gp7_E, sse_ctl),
+        IDEX(E2G, imul2),
+        /* 0xb0 */ IDEXW(G2E, cmpxchg, 1), IDEX(G2E, cmpxchg), EMPTY,
+        IDEX(bt_G2E, btr),
         /* 0xb4 */ EMPTY, EMPTY, IDEXW(E2G, movzx, 1), IDEXW(E2G, movzx, 2),
-        /* 0xb8 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xbc */ EMPTY, EMPTY, IDEXW(E2G, movsx, 1), IDEXW(E2G, movsx, 2),
-        /* 0xc0 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xc4 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xc8 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xcc */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xd0 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xd4 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xd8 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xdc */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xe0 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xe4 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xe8 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xec */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xf0 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xf4 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xf8 */ EMPTY, EMPTY, EMPTY, EMPTY,
-        /* 0xfc */ EMPTY, EMPTY, EMPTY, EMPTY};
+        /* 0xb8 */ EMPTY, EMPTY, IDEX(gp2_Ib2E, gp8), IDEX(bt_G2E, btc),
+        /* 0xbc */ IDEX(E2G, bsf), IDEX(E2G, bsr), IDEXW(E2G, movsx, 1),
+        IDEXW(E2G, movsx, 2),
+        /* 0xc0 */ IDEXW(G2E, xadd, 1), IDEX(G2E, xadd), IDEX(xmm_Ib_E2G, cmpps), EMPTY,
+        /* 0xc4 */ IDEX(Ib_E2xmm, pinsrw), IDEX(Ib_xmm2r, pextrw),
+        IDEX(xmm_Ib_E2G, shufps), EMPTY,
+        /* 0xc8 */ IDEX(r, bswap), IDEX(r, bswap), IDEX(r, bswap), IDEX(r, bswap),
+        /* 0xcc */ IDEX(r, bswap), IDEX(r, bswap), IDEX(r, bswap), IDEX(r, bswap),
+        /* 0xd0 */ EMPTY, IDEX(xmm_E2G, psrlw), IDEX(xmm_E2G, psrld), IDEX(xmm_E2G, psrlq),
+        /* 0xd4 */ IDEX(xmm_E2G, paddq), IDEX(xmm_E2G, pmullw), IDEX(xmm_G2E, movq_G2E),
+        IDEX(xmm2r, pmovmskb),
+        /* 0xd8 */ IDEX(xmm_E2G, psubusb), IDEX(xmm_E2G, psubusw), IDEX(xmm_E2G, pminub),
+        IDEX(xmm_E2G, pand),
+        /* 0xdc */ IDEX(xmm_E2G, paddusb), IDEX(xmm_E2G, paddusw), IDEX(xmm_E2G, pmaxub),
+        IDEX(xmm_E2G, pandn),
+        /* 0xe0 */ IDEX(xmm_E2G, pavgb), IDEX(xmm_E2G, psraw), IDEX(xmm_E2G, psrad),
+        IDEX(xmm_E2G, pavgw),
+        /* 0xe4 */ IDEX(xmm_E2G, pmulhuw), IDEX(xmm_E2G, pmulhw), IDEX(xmm_E2G, cvtdq2ps),
+        IDEX(xmm_G2E, movups),
+        /* 0xe8 */ IDEX(xmm_E2G, psubsb), IDEX(xmm_E2G, psubsw), IDEX(xmm_E2G, pminsw),
+        IDEX(xmm_E2G, por),
+        /* 0xec */ IDEX(xmm_E2G, paddsb), IDEX(xmm_E2G, paddsw), IDEX(xmm_E2G, pmaxsw),
+        IDEX(xmm_E2G, pxor),
+        /* 0xf0 */ EMPTY, IDEX(xmm_E2G, psllw), IDEX(xmm_E2G, pslld), IDEX(xmm_E2G, psllq),
+        /* 0xf4 */ IDEX(xmm_E2G, pmuludq), IDEX(xmm_E2G, pmaddwd), IDEX(xmm_E2G, psadbw),
+        EMPTY,
+        /* 0xf8 */ IDEX(xmm_E2G, psubb), IDEX(xmm_E2G, psubw), IDEX(xmm_E2G, psubd),
+        IDEX(xmm_E2G, psubq),
+        /* 0xfc */ IDEX(xmm_E2G, paddb), IDEX(xmm_E2G, paddw), IDEX(xmm_E2G, paddd),
+        EMPTY};
+
+/* For the fuzzer: whether `opcode' is implemented, with ModR/M reg
+ * field `ext' if it is a group.
+ */
+bool opcode_is_valid(uint32_t opcode, int ext) {
+  static const struct {
+    EHelper group;
+    opcode_entry *table;
+  } groups[] = {
+    { exec_gp1, opcode_table_gp1 }, { exec_gp2, opcode_table_gp2 },
+    { exec_gp3, opcode_table_gp3 }, { exec_gp4, opcode_table_gp4 },
+    { exec_gp5, opcode_table_gp5 }, { exec_gp7, opcode_table_gp7 },
+    { exec_gp8, opcode_table_gp8 }, { exec_gp11, opcode_table_gp11 },
+  };
+  opcode_entry *e = &opcode_table[opcode];
+  if (e->execute == exec_inv) return false;
+  int i;
+  for (i = 0; i < sizeof(groups) / sizeof(groups[0]); i ++) {
+    if (e->execute == groups[i].group) return groups[i].table[ext].execute != exec_inv;
+  }
+  return true;
+}
 
 static make_EHelper(2byte_esc) {
   uint32_t opcode = instr_fetch(eip, 1) | 0x100;
@@ -235,11 +305,31 @@ static make_EHelper(2byte_esc) {
   idex(eip, &opcode_table[opcode]);
 }
 
+extern bool fusion_enabled, fusion_count_pairs;
+bool fuse(vaddr_t *eip);
+void fusion_record(uint32_t opcode);
+
+#ifndef DEBUG
+extern EHelper specialized_table[256];
+#endif
+
 make_EHelper(real) {
   uint32_t opcode = instr_fetch(eip, 1);
   decoding.opcode = opcode;
+#ifndef DEBUG
+  if (specialized_table[opcode] && !decoding.is_operand_size_16) {
+    specialized_table[opcode](eip);
+    return;
+  }
+#endif
   set_width(opcode_table[opcode].width);
-  idex(eip, &opcode_table[opcode]);
+  opcode_entry *e = &opcode_table[opcode];
+  if (e->decode)
+    e->decode(eip);
+  // execute it together with the next instruction if they are a fused pair
+  if (fusion_enabled && fuse(eip))
+    return;
+  e->execute(eip);
 }
 
 static inline void update_eip(void) {
@@ -247,14 +337,151 @@ static inline void update_eip(void) {
                              : decoding.seq_eip);
 }
 
+/* An exception like a page fault aborts the instruction raising it:
+ * raise_exception() jumps back to exec_once(), which undoes the register
+ * changes of the instruction and delivers the exception instead. The
+ * instruction is executed again after the handler returns.
+ */
+static __thread jmp_buf exception_buf;
+static __thread uint8_t exception_NO;
+static __thread uint32_t exception_error_code;
+static __thread bool in_instr, in_exception;
+static __thread struct {
+  rtlreg_t gpr[8];
+  uint32_t eflags;
+} restart_point;
+
+/* The fuzzer compares the exceptions with the host instead of
+ * delivering them, see monitor/fuzz.h.
+ */
+bool exception_deliver = true;
+int exception_caught = -1;
+
+/* for the exceptions which push an error code, like #PF */
+void raise_exception(uint8_t NO, uint32_t error_code) {
+  // e.g. the monitor reading an unmapped address
+  Assert(in_instr, "exception %d outside of an instruction", NO);
+  Assert(!in_exception, "exception %d while delivering exception %d", NO, exception_NO);
+  exception_NO = NO;
+  exception_error_code = error_code;
+  longjmp(exception_buf, 1);
+}
+
+/* A REP string instruction keeps the elements done so far when it is
+ * aborted, so it calls this after each of them.
+ */
+void update_restart_point(void) {
+  memcpy(restart_point.gpr, &cpu.gpr, sizeof(restart_point.gpr));
+  restart_point.eflags = cpu.eflags.val;
+}
+
+extern bool aot_enabled, aot_recording;
+
+static void exec_once(void) {
+  decoding.seq_eip = cpu.eip;
+#if !defined(DEBUG) && !defined(DIFF_TEST)
+  if (aot_enabled) {
+    const AOTBlock *block = aot_lookup(cpu.eip);
+    if (block != NULL && block->nr_instr <= aot_max_instr) {
+      // sets `decoding.seq_eip' to the next instruction
+      block->run();
+      // exec_wrapper() counts the first one
+      cpu_steps += block->nr_instr - 1;
+      return;
+    }
+  }
+#endif
+  update_restart_point();
+  in_instr = true;
+  if (setjmp(exception_buf) == 0) {
+    exec_real(&decoding.seq_eip);
+    if (fusion_count_pairs)
+      fusion_record(decoding.opcode);
+    if (aot_recording)
+      aot_record(cpu.eip, decoding.seq_eip);
+    in_instr = false;
+    return;
+  }
+
+  memcpy(&cpu.gpr, restart_point.gpr, sizeof(restart_point.gpr));
+  cpu.eflags.val = restart_point.eflags;
+  // the prefix helpers did not get the chance to clean up
+  decoding.is_operand_size_16 = false;
+  decoding.rep = 0;
+  decoding.lock = decoding.lock_failed = false;
+
+  if (!exception_deliver) {
+    exception_caught = exception_NO;
+    decoding.is_jmp = 1;
+    decoding.jmp_eip = cpu.eip;
+    in_instr = false;
+    return;
+  }
+
+  in_exception = true;
+  raise_intr_error(exception_NO, cpu.eip, exception_error_code);
+  in_exception = false;
+  in_instr = false;
+#ifdef DEBUG
+  sprintf(decoding.assembly, "exception %d (error code = 0x%x)", exception_NO, exception_error_code);
+#endif
+
+#ifdef DIFF_TEST
+  void diff_test_skip_qemu();
+  diff_test_skip_qemu();
+#endif
+}
+
+/* Take the lowest pending interrupt. This ends a halt, also one by the
+ * hlt just executed.
+ */
+static void exec_intr() {
+  cpu.halted = false;
+
+#ifdef DIFF_TEST
+  void difftest_intr_begin(void);
+  difftest_intr_begin();
+#endif
+
+  /* other CPUs may raise interrupts at the same time */
+  int irq = __builtin_ctz(cpu.INTR);
+  __sync_fetch_and_and(&cpu.INTR, ~(1u << irq));
+  raise_intr(IRQ_BASE + irq, cpu.eip);
+  update_eip();
+
+#ifdef DIFF_TEST
+  void difftest_intr_end(void);
+  difftest_intr_end();
+#endif
+}
+
 void exec_wrapper(bool print_flag) {
+  if (cpu.halted) {
+    /* The return address of the interrupt is after the hlt. It stays
+     * halted with IF clear, as there is no NMI. */
+    if (cpu.INTR && cpu.eflags.IF) {
+      exec_intr();
+    }
+    else {
+      void cpu_idle(void);
+      cpu_idle();
+    }
+    return;
+  }
+
+  cpu_steps ++;
+
+#ifdef DIFF_TEST
+  void difftest_begin_step(void);
+  difftest_begin_step();
+#endif
+
 #ifdef DEBUG
   decoding.p = decoding.asm_buf;
   decoding.p += sprintf(decoding.p, "%8x:   ", cpu.eip);
 #endif
 
-  decoding.seq_eip = cpu.eip;
-  exec_real(&decoding.seq_eip);
+  exec_once();
 
 #ifdef DEBUG
   int instr_len = decoding.seq_eip - cpu.eip;
@@ -277,9 +504,20 @@ void exec_wrapper(bool print_flag) {
   difftest_step(eip);
 #endif
 
-  if (cpu.INTR & cpu.eflags.IF) {
-    cpu.INTR = false;
-    raise_intr(TIMER_IRQ, cpu.eip);
-    update_eip();
+  if (cpu.intr_shadow) {
+    cpu.intr_shadow = false;
   }
+  else if (cpu.INTR && cpu.eflags.IF) {
+    exec_intr();
+  }
+}
+
+/* Execute one instruction for difftest replay: no logging, no interrupt
+ * delivery and no difftest hooks. */
+void exec_replay(void) {
+#ifdef DEBUG
+  decoding.p = decoding.asm_buf;
+#endif
+  exec_once();
+  update_eip();
 }
@@ -0,0 +1,778 @@
+#include "cpu/exec.h"
+#include <fenv.h>
+#include <math.h>
+
+make_EHelper(inv);
+
+/* x87 FPU on top of host long double.
+ *
+ * All exceptions behave as masked: an invalid operation gives the
+ * default NaN and a division by zero gives an infinity. Only the stack
+ * fault, invalid operation and zero divide flags are recorded in the
+ * status word. The precision control is applied by rounding the result
+ * of an arithmetic instruction. The rounding control is applied by
+ * switching the host rounding mode around the instruction, which is
+ * skipped for the default round-to-nearest. The transcendental
+ * instructions and the others libm has no exact match for run on the
+ * host x87, see host_x87().
+ */
+
+#define SW_IE 0x0001
+#define SW_ZE 0x0004
+#define SW_SF 0x0040
+#define SW_C0 0x0100
+#define SW_C1 0x0200
+#define SW_C2 0x0400
+#define SW_TOP 0x3800
+#define SW_C3 0x4000
+#define SW_CC (SW_C0 | SW_C1 | SW_C2 | SW_C3)
+
+#define CW_PC(cw) (((cw) >> 8) & 0x3)
+#define CW_RC(cw) (((cw) >> 10) & 0x3)
+enum { RC_NEAREST, RC_DOWN, RC_UP, RC_CHOP };
+
+/* the reg field of the arithmetic instructions in d8, da, dc and de */
+enum { OP_ADD, OP_MUL, OP_COM, OP_COMP, OP_SUB, OP_SUBR, OP_DIV, OP_DIVR };
+
+/* Keep a floating point value in memory at this point, so that the
+ * compiler can not move the computation across fesetround().
+ */
+#define FP_BARRIER(x) asm volatile ("" : "+m"(x))
+
+static const long double default_nan = -__builtin_nanl("");
+
+void fpu_reset(void) {
+  cpu.fpu.cw = 0x37f;
+  cpu.fpu.sw = 0;
+  cpu.fpu.top = 0;
+  cpu.fpu.valid = 0;
+}
+
+static inline uint16_t fpu_sw(void) {
+  return (cpu.fpu.sw & ~SW_TOP) | (cpu.fpu.top << 11);
+}
+
+static inline void set_cc(uint16_t cc) {
+  cpu.fpu.sw = (cpu.fpu.sw & ~SW_CC) | cc;
+}
+
+/* register stack */
+
+static inline int phys(int i) {
+  return (cpu.fpu.top + i) & 0x7;
+}
+
+static inline bool is_empty(int i) {
+  return !(cpu.fpu.valid & (1 << phys(i)));
+}
+
+static inline void stack_underflow(void) {
+  cpu.fpu.sw = (cpu.fpu.sw & ~SW_C1) | SW_IE | SW_SF;
+}
+
+static inline long double st(int i) {
+  if (is_empty(i)) {
+    stack_underflow();
+    return default_nan;
+  }
+  return cpu.fpu.st[phys(i)];
+}
+
+static inline void set_st(int i, long double val) {
+  int p = phys(i);
+  cpu.fpu.st[p] = val;
+  cpu.fpu.valid |= 1 << p;
+}
+
+static inline void fpu_push(long double val) {
+  cpu.fpu.top = (cpu.fpu.top - 1) & 0x7;
+  if (!is_empty(0)) {
+    /* stack overflow */
+    cpu.fpu.sw |= SW_IE | SW_SF | SW_C1;
+    val = default_nan;
+  }
+  set_st(0, val);
+}
+
+static inline void fpu_pop(void) {
+  cpu.fpu.valid &= ~(1 << cpu.fpu.top);
+  cpu.fpu.top = (cpu.fpu.top + 1) & 0x7;
+}
+
+/* memory operands */
+
+static inline uint64_t read_64(vaddr_t addr) {
+  return vaddr_read(addr, 4) | ((uint64_t)vaddr_read(addr + 4, 4) << 32);
+}
+
+static inline void write_64(vaddr_t addr, uint64_t val) {
+  vaddr_write(addr, 4, val);
+  vaddr_write(addr + 4, 4, val >> 32);
+}
+
+static long double load_real(vaddr_t addr, int width) {
+  switch (width) {
+    case 4: {
+      union { uint32_t i; float f; } u = { .i = vaddr_read(addr, 4) };
+      return u.f;
+    }
+    case 8: {
+      union { uint64_t i; double f; } u = { .i = read_64(addr) };
+      return u.f;
+    }
+    case 10: {
+      union { struct { uint64_t m; uint16_t e; }; long double f; } u = { .f = 0 };
+      u.m = read_64(addr);
+      u.e = vaddr_read(addr + 8, 2);
+      return u.f;
+    }
+    default: assert(0);
+  }
+}
+
+static long double load_int(vaddr_t addr, int width) {
+  switch (width) {
+    case 2: return (int16_t)vaddr_read(addr, 2);
+    case 4: return (int32_t)vaddr_read(addr, 4);
+    case 8: return (int64_t)read_64(addr);
+    default: assert(0);
+  }
+}
+
+static inline int host_rc(void) {
+  static const int rc[] = { FE_TONEAREST, FE_DOWNWARD, FE_UPWARD, FE_TOWARDZERO };
+  return rc[CW_RC(cpu.fpu.cw)];
+}
+
+static void store_real(vaddr_t addr, int width, long double val) {
+  bool rc = CW_RC(cpu.fpu.cw) != RC_NEAREST;
+  if (rc) { fesetround(host_rc()); FP_BARRIER(val); }
+
+  switch (width) {
+    case 4: {
+      union { uint32_t i; float f; } u = { .f = val };
+      if (rc) { FP_BARRIER(u.f); }
+      vaddr_write(addr, 4, u.i);
+      break;
+    }
+    case 8: {
+      union { uint64_t i; double f; } u = { .f = val };
+      if (rc) { FP_BARRIER(u.f); }
+      write_64(addr, u.i);
+      break;
+    }
+    case 10: {
+      union { struct { uint64_t m; uint16_t e; }; long double f; } u = { .f = val };
+      write_64(addr, u.m);
+      vaddr_write(addr + 8, 2, u.e);
+      break;
+    }
+    default: assert(0);
+  }
+
+  if (rc) { fesetround(FE_TONEAREST); }
+}
+
+static inline long double round_int(long double val, int rc) {
+  switch (rc) {
+    case RC_NEAREST: return nearbyintl(val);
+    case RC_DOWN: return floorl(val);
+    case RC_UP: return ceill(val);
+    default: return truncl(val);
+  }
+}
+
+/* Convert to an integer of `width' bytes. An out-of-range value gives
+ * the integer indefinite, i.e. the most negative integer.
+ */
+static int64_t to_int(long double val, int width, bool chop) {
+  long double r = round_int(val, chop ? RC_CHOP : CW_RC(cpu.fpu.cw));
+  long double limit = ldexpl(1, width * 8 - 1);
+  if (isnan(r) || r < -limit || r >= limit) {
+    cpu.fpu.sw |= SW_IE;
+    // -2^63 does not convert from the long double at width 8
+    return -(int64_t)((1ull << (width * 8 - 1)) - 1) - 1;
+  }
+  return (int64_t)r;
+}
+
+static void store_int(vaddr_t addr, int width, long double val, bool chop) {
+  int64_t i = to_int(val, width, chop);
+  if (width == 8) {
+    write_64(addr, i);
+  }
+  else {
+    vaddr_write(addr, width, i);
+  }
+}
+
+/* arithmetic */
+
+static inline long double round_precision(long double val) {
+  switch (CW_PC(cpu.fpu.cw)) {
+    case 0: return (float)val;
+    case 2: return (double)val;
+    default: return val;
+  }
+}
+
+static inline long double do_arith(int op, long double a, long double b) {
+  switch (op) {
+    case OP_ADD: return round_precision(a + b);
+    case OP_MUL: return round_precision(a * b);
+    case OP_SUB: return round_precision(a - b);
+    case OP_SUBR: return round_precision(b - a);
+    case OP_DIV: return round_precision(a / b);
+    case OP_DIVR: return round_precision(b / a);
+    default: assert(0);
+  }
+}
+
+static long double fpu_arith(int op, long double a, long double b) {
+  long double r;
+  if (CW_RC(cpu.fpu.cw) == RC_NEAREST) {
+    r = do_arith(op, a, b);
+  }
+  else {
+    fesetround(host_rc());
+    FP_BARRIER(a);
+    FP_BARRIER(b);
+    r = do_arith(op, a, b);
+    FP_BARRIER(r);
+    fesetround(FE_TONEAREST);
+  }
+
+  if (isnan(r) && !isnan(a) && !isnan(b)) {
+    cpu.fpu.sw |= SW_IE;
+  }
+  else if (isinf(r) && !isinf(a) && !isinf(b) &&
+      ((op == OP_DIV && b == 0) || (op == OP_DIVR && a == 0))) {
+    cpu.fpu.sw |= SW_ZE;
+  }
+  return r;
+}
+
+/* Return C3, C2 and C0 of comparing `a' with `b'. */
+static uint16_t fpu_compare(long double a, long double b, bool quiet) {
+  if (isnan(a) || isnan(b)) {
+    if (!quiet) {
+      cpu.fpu.sw |= SW_IE;
+    }
+    return SW_C3 | SW_C2 | SW_C0;
+  }
+  if (a > b) { return 0; }
+  if (a < b) { return SW_C0; }
+  return SW_C3;
+}
+
+/* fcomi and fucomi report the result in ZF, PF and CF */
+static void compare_eflags(long double a, long double b, bool quiet) {
+  uint16_t cc = fpu_compare(a, b, quiet);
+  cpu.eflags.ZF = !!(cc & SW_C3);
+  cpu.eflags.PF = !!(cc & SW_C2);
+  cpu.eflags.CF = !!(cc & SW_C0);
+  cpu.eflags.OF = 0;
+  cpu.eflags.SF = 0;
+  cpu.fpu.sw &= ~SW_C1;
+}
+
+/* st(0) <- st(0) op val, or the default NaN, not a NaN operand, if
+ * st(0) is empty */
+static void arith_st0(int op, long double val) {
+  long double a = st(0);
+  if (op != OP_COM && op != OP_COMP && is_empty(0)) {
+    set_st(0, default_nan);
+    return;
+  }
+  if (op == OP_COM || op == OP_COMP) {
+    set_cc(fpu_compare(a, val, false));
+    if (op == OP_COMP) {
+      fpu_pop();
+    }
+    return;
+  }
+  set_st(0, fpu_arith(op, a, val));
+}
+
+/* st(i) <- st(i) op st(0) */
+static void arith_sti(int op, int i, bool pop) {
+  if (is_empty(i) || is_empty(0)) {
+    stack_underflow();
+    set_st(i, default_nan);
+  }
+  else {
+    set_st(i, fpu_arith(op, st(i), st(0)));
+  }
+  if (pop) {
+    fpu_pop();
+  }
+}
+
+/* The tag word: 00 valid, 01 zero, 10 special, 11 empty. */
+static uint16_t fpu_tw(void) {
+  uint16_t tw = 0;
+  int p;
+  for (p = 0; p < 8; p ++) {
+    int tag;
+    if (!(cpu.fpu.valid & (1 << p))) { tag = 3; }
+    else {
+      switch (fpclassify(cpu.fpu.st[p])) {
+        case FP_ZERO: tag = 1; break;
+        case FP_NORMAL: tag = 0; break;
+        default: tag = 2; break;
+      }
+    }
+    tw |= tag << (p * 2);
+  }
+  return tw;
+}
+
+/* The 28-byte protected mode environment. The instruction and data
+ * pointers are not recorded and are stored as 0.
+ */
+static void store_env(vaddr_t addr) {
+  int i;
+  vaddr_write(addr, 4, 0xffff0000 | cpu.fpu.cw);
+  vaddr_write(addr + 4, 4, 0xffff0000 | fpu_sw());
+  vaddr_write(addr + 8, 4, 0xffff0000 | fpu_tw());
+  for (i = 12; i < 28; i += 4) {
+    vaddr_write(addr + i, 4, 0);
+  }
+}
+
+static void load_env(vaddr_t addr) {
+  uint16_t sw = vaddr_read(addr + 4, 2);
+  uint16_t tw = vaddr_read(addr + 8, 2);
+  int p;
+  cpu.fpu.cw = vaddr_read(addr, 2);
+  cpu.fpu.sw = sw & ~SW_TOP;
+  cpu.fpu.top = (sw & SW_TOP) >> 11;
+  cpu.fpu.valid = 0;
+  for (p = 0; p < 8; p ++) {
+    if (((tw >> (p * 2)) & 0x3) != 3) {
+      cpu.fpu.valid |= 1 << p;
+    }
+  }
+}
+
+/* An empty operand is a stack underflow, even if the condition is false. */
+static void fcmov(int cc) {
+  int i = id_dest->reg;
+  rtl_setcc(&t1, cc);
+  if (is_empty(0) || is_empty(i)) {
+    stack_underflow();
+    set_st(0, default_nan);
+  }
+  else if (t1) {
+    set_st(0, st(i));
+  }
+}
+
+/* Run the d9 instruction `op' on the host x87 under the guest control
+ * word, with st(0) = *x and st(1) = *y. Return the host status word,
+ * with st(0) and st(1) afterwards in *x and *y. The results are those
+ * of the hardware bit for bit, also for NaNs and unsupported formats.
+ */
+#define X87_ENTER "fnstcw %[host]; fldcw %[cw]; fnclex; "
+#define X87_LEAVE "; fnstsw %[sw]; fldcw %[host]"
+#define X87_UNARY(insn) asm volatile (X87_ENTER insn X87_LEAVE \
+    : "=t"(a), [sw] "=m"(sw), [host] "=m"(host_cw) : "0"(a), [cw] "m"(cw))
+#define X87_BINARY(insn) asm volatile (X87_ENTER insn X87_LEAVE \
+    : "=t"(a), [sw] "=m"(sw), [host] "=m"(host_cw) : "0"(a), "u"(b), [cw] "m"(cw))
+#define X87_POP(insn) asm volatile (X87_ENTER insn X87_LEAVE \
+    : "=t"(a), [sw] "=m"(sw), [host] "=m"(host_cw) : "0"(a), "u"(b), [cw] "m"(cw) : "st(1)")
+#define X87_PUSH(insn) asm volatile (X87_ENTER insn X87_LEAVE \
+    : "=t"(a), "=u"(b), [sw] "=m"(sw), [host] "=m"(host_cw) : "0"(a), [cw] "m"(cw))
+
+static uint16_t host_x87(int op, long double *x, long double *y) {
+  uint16_t cw = cpu.fpu.cw | 0x3f, host_cw, sw;
+  long double a = *x, b = *y;
+  switch (op) {
+    case 0x25: X87_UNARY("fxam"); break;
+    case 0x30: X87_UNARY("f2xm1"); break;
+    case 0x31: X87_POP("fyl2x"); break;
+    case 0x32: X87_PUSH("fptan"); break;
+    case 0x33: X87_POP("fpatan"); break;
+    case 0x34: X87_PUSH("fxtract"); break;
+    case 0x35: X87_BINARY("fprem1"); break;
+    case 0x38: X87_BINARY("fprem"); break;
+    case 0x39: X87_POP("fyl2xp1"); break;
+    case 0x3b: X87_PUSH("fsincos"); break;
+    case 0x3d: X87_BINARY("fscale"); break;
+    case 0x3e: X87_UNARY("fsin"); break;
+    case 0x3f: X87_UNARY("fcos"); break;
+    default: assert(0);
+  }
+  *x = a;
+  *y = b;
+  return sw;
+}
+
+/* The d9 instructions run by host_x87(), with two operands, popping one,
+ * or pushing a result. C2 is defined by the reductions and fprem, C0 and
+ * C3 also by fprem, the others keep them.
+ */
+static void x87_on_host(int op) {
+  bool two = (op == 0x31 || op == 0x33 || op == 0x35 || op == 0x38 || op == 0x39 || op == 0x3d);
+  bool pop = (op == 0x31 || op == 0x33 || op == 0x39);
+  bool push = (op == 0x32 || op == 0x34 || op == 0x3b);
+  bool reduce = (op == 0x32 || op == 0x3b || op == 0x3e || op == 0x3f);
+  bool rem = (op == 0x35 || op == 0x38);
+  uint16_t mask = SW_C1 | (reduce || rem ? SW_C2 : 0) | (rem ? SW_C0 | SW_C3 : 0);
+  long double x, y = 0;
+
+  if (is_empty(0) || (two && is_empty(1))) {
+    stack_underflow();
+    cpu.fpu.sw &= ~(mask & SW_C2);
+    if (pop) { fpu_pop(); }
+    set_st(0, default_nan);
+    if (push) { fpu_push(default_nan); }
+    return;
+  }
+
+  x = st(0);
+  if (two) { y = st(1); }
+  if (reduce && isfinite(x) && fabsl(x) >= 0x1p63L) {
+    /* out of range, st(0) is left as it is */
+    set_cc((cpu.fpu.sw & (SW_C0 | SW_C3)) | SW_C2);
+    return;
+  }
+  uint16_t sw = host_x87(op, &x, &y);
+  cpu.fpu.sw = (cpu.fpu.sw & ~mask) | (sw & mask) | (sw & (SW_IE | SW_ZE));
+  if (pop) { fpu_pop(); }
+  if (push) {
+    set_st(0, y);
+    fpu_push(x);
+  }
+  else {
+    set_st(0, x);
+  }
+}
+
+#ifdef DEBUG
+static const char *arith_name[] = {
+  "fadd", "fmul", "fcom", "fcomp", "fsub", "fsubr", "fdiv", "fdivr"
+};
+static const char *fcmov_name[] = { "b", "e", "be", "u" };
+static const char *d9_host_name[] = {
+  "f2xm1", "fyl2x", "fptan", "fpatan", "fxtract", "fprem1", "", "",
+  "fprem", "fyl2xp1", "", "fsincos", "", "fscale", "fsin", "fcos"
+};
+#endif
+
+/* d8: arithmetic on st(0) with m32fp or st(i) */
+make_EHelper(fpu_d8) {
+  int op = decoding.ext_opcode;
+  if (id_dest->type == OP_TYPE_MEM) {
+    arith_st0(op, load_real(id_dest->addr, 4));
+    print_asm("%ss %s", arith_name[op], id_dest->str);
+  }
+  else {
+    arith_st0(op, st(id_dest->reg));
+    print_asm("%s %s,%%st", arith_name[op], id_dest->str);
+  }
+}
+
+/* d9: load/store m32fp, control word, environment, and the operations
+ * without an explicit operand
+ */
+make_EHelper(fpu_d9) {
+  int op = decoding.ext_opcode;
+  if (id_dest->type == OP_TYPE_MEM) {
+    vaddr_t addr = id_dest->addr;
+    switch (op) {
+      case 0: fpu_push(load_real(addr, 4)); print_asm("flds %s", id_dest->str); return;
+      case 2: store_real(addr, 4, st(0)); print_asm("fsts %s", id_dest->str); return;
+      case 3: store_real(addr, 4, st(0)); fpu_pop(); print_asm("fstps %s", id_dest->str); return;
+      case 4: load_env(addr); print_asm("fldenv %s", id_dest->str); return;
+      case 5: cpu.fpu.cw = vaddr_read(addr, 2); print_asm("fldcw %s", id_dest->str); return;
+      case 6: store_env(addr); cpu.fpu.cw |= 0x3f; print_asm("fnstenv %s", id_dest->str); return;
+      case 7: vaddr_write(addr, 2, cpu.fpu.cw); print_asm("fnstcw %s", id_dest->str); return;
+      default: exec_inv(eip); return;
+    }
+  }
+
+  int i = id_dest->reg;
+  long double x, y;
+  switch (op) {
+    case 0: fpu_push(st(i)); print_asm("fld %s", id_dest->str); return;
+    case 1:
+      x = st(0);
+      set_st(0, st(i));
+      set_st(i, x);
+      cpu.fpu.sw &= ~SW_C1;
+      print_asm("fxch %s", id_dest->str);
+      return;
+    case 2:
+      if (i != 0) { exec_inv(eip); return; }
+      print_asm("fnop");
+      return;
+    case 3: exec_inv(eip); return;
+  }
+
+  switch ((op << 3) | i) {
+    /* the default NaN of an underflow keeps its sign */
+    case 0x20: x = st(0); set_st(0, is_empty(0) ? x : -x); print_asm("fchs"); return;
+    case 0x21: x = st(0); set_st(0, is_empty(0) ? x : fabsl(x)); print_asm("fabs"); return;
+    case 0x24: set_cc(fpu_compare(st(0), 0, false)); print_asm("ftst"); return;
+    case 0x25:
+      /* fxam, an empty register is 101 */
+      if (is_empty(0)) {
+        x = cpu.fpu.st[phys(0)];
+        set_cc(SW_C3 | SW_C0 | (signbit(x) ? SW_C1 : 0));
+      }
+      else {
+        x = st(0);
+        y = 0;
+        set_cc(host_x87(0x25, &x, &y) & SW_CC);
+      }
+      print_asm("fxam");
+      return;
+    case 0x28: fpu_push(1); print_asm("fld1"); return;
+    case 0x29: fpu_push(3.321928094887362347870319429489390175865L); print_asm("fldl2t"); return;
+    case 0x2a: fpu_push(1.442695040888963407359924681001892137427L); print_asm("fldl2e"); return;
+    case 0x2b: fpu_push(3.141592653589793238462643383279502884197L); print_asm("fldpi"); return;
+    case 0x2c: fpu_push(0.301029995663981195213738894724493026768L); print_asm("fldlg2"); return;
+    case 0x2d: fpu_push(0.693147180559945309417232121458176568076L); print_asm("fldln2"); return;
+    case 0x2e: fpu_push(0); print_asm("fldz"); return;
+    case 0x30 ... 0x35: case 0x38: case 0x39: case 0x3b: case 0x3d ... 0x3f:
+      x87_on_host((op << 3) | i);
+      print_asm("%s", d9_host_name[((op << 3) | i) - 0x30]);
+      return;
+    case 0x36: cpu.fpu.top = (cpu.fpu.top - 1) & 0x7; print_asm("fdecstp"); return;
+    case 0x37: cpu.fpu.top = (cpu.fpu.top + 1) & 0x7; print_asm("fincstp"); return;
+    case 0x3a:
+      x = st(0);
+      if (x < 0) { cpu.fpu.sw |= SW_IE; }
+      set_st(0, round_precision(sqrtl(x)));
+      print_asm("fsqrt");
+      return;
+    case 0x3c: set_st(0, round_int(st(0), CW_RC(cpu.fpu.cw))); print_asm("frndint"); return;
+    default: exec_inv(eip); return;
+  }
+}
+
+/* da: arithmetic with m32int, fcmovcc */
+make_EHelper(fpu_da) {
+  int op = decoding.ext_opcode;
+  if (id_dest->type == OP_TYPE_MEM) {
+    arith_st0(op, load_int(id_dest->addr, 4));
+    print_asm("fi%sl %s", arith_name[op] + 1, id_dest->str);
+    return;
+  }
+
+  if (op < 4) {
+    static const uint8_t cc[] = { 0x2, 0x4, 0x6, 0xa };
+    fcmov(cc[op]);
+    print_asm("fcmov%s %s,%%st", fcmov_name[op], id_dest->str);
+  }
+  else if (op == 5 && id_dest->reg == 1) {
+    set_cc(fpu_compare(st(0), st(1), true));
+    fpu_pop();
+    fpu_pop();
+    print_asm("fucompp");
+  }
+  else {
+    exec_inv(eip);
+  }
+}
+
+/* db: m32int load/store, m80fp load/store, fcmovncc, fcomi, control */
+make_EHelper(fpu_db) {
+  int op = decoding.ext_opcode;
+  if (id_dest->type == OP_TYPE_MEM) {
+    vaddr_t addr = id_dest->addr;
+    switch (op) {
+      case 0: fpu_push(load_int(addr, 4)); print_asm("fildl %s", id_dest->str); return;
+      case 1: store_int(addr, 4, st(0), true); fpu_pop(); print_asm("fisttpl %s", id_dest->str); return;
+      case 2: store_int(addr, 4, st(0), false); print_asm("fistl %s", id_dest->str); return;
+      case 3: store_int(addr, 4, st(0), false); fpu_pop(); print_asm("fistpl %s", id_dest->str); return;
+      case 5: fpu_push(load_real(addr, 10)); print_asm("fldt %s", id_dest->str); return;
+      case 7: store_real(addr, 10, st(0)); fpu_pop(); print_asm("fstpt %s", id_dest->str); return;
+      default: exec_inv(eip); return;
+    }
+  }
+
+  int i = id_dest->reg;
+  switch (op) {
+    case 0: case 1: case 2: case 3: {
+      static const uint8_t cc[] = { 0x3, 0x5, 0x7, 0xb };
+      fcmov(cc[op]);
+      print_asm("fcmovn%s %s,%%st", fcmov_name[op], id_dest->str);
+      return;
+    }
+    case 4:
+      switch (i) {
+        case 2: cpu.fpu.sw &= 0x7f00; print_asm("fnclex"); return;
+        case 3: fpu_reset(); print_asm("fninit"); return;
+        /* feni, fdisi and fsetpm are no-ops since the 80387 */
+        case 0: case 1: case 4: print_asm("fnop"); return;
+        default: exec_inv(eip); return;
+      }
+    case 5: compare_eflags(st(0), st(i), true); print_asm("fucomi %s,%%st", id_dest->str); return;
+    case 6: compare_eflags(st(0), st(i), false); print_asm("fcomi %s,%%st", id_dest->str); return;
+    default: exec_inv(eip); return;
+  }
+}
+
+/* dc: arithmetic on st(0) with m64fp, or st(i) <- st(i) op st(0) */
+make_EHelper(fpu_dc) {
+  int op = decoding.ext_opcode;
+  if (id_dest->type == OP_TYPE_MEM) {
+    arith_st0(op, load_real(id_dest->addr, 8));
+    print_asm("%sl %s", arith_name[op], id_dest->str);
+  }
+  else if (op == OP_COM || op == OP_COMP) {
+    arith_st0(op, st(id_dest->reg));
+    print_asm("%s %s,%%st", arith_name[op], id_dest->str);
+  }
+  else {
+    /* the sub and div forms are reversed in the register encoding */
+    op = op < 4 ? op : op ^ 1;
+    arith_sti(op, id_dest->reg, false);
+    print_asm("%s %%st,%s", arith_name[op], id_dest->str);
+  }
+}
+
+/* dd: m64fp load/store, state save/restore, fst/fstp st(i), fucom */
+make_EHelper(fpu_dd) {
+  int op = decoding.ext_opcode;
+  int i;
+  if (id_dest->type == OP_TYPE_MEM) {
+    vaddr_t addr = id_dest->addr;
+    switch (op) {
+      case 0: fpu_push(load_real(addr, 8)); print_asm("fldl %s", id_dest->str); return;
+      case 1: store_int(addr, 8, st(0), true); fpu_pop(); print_asm("fisttpll %s", id_dest->str); return;
+      case 2: store_real(addr, 8, st(0)); print_asm("fstl %s", id_dest->str); return;
+      case 3: store_real(addr, 8, st(0)); fpu_pop(); print_asm("fstpl %s", id_dest->str); return;
+      case 4:
+        load_env(addr);
+        for (i = 0; i < 8; i ++) {
+          cpu.fpu.st[phys(i)] = load_real(addr + 28 + i * 10, 10);
+        }
+        print_asm("frstor %s", id_dest->str);
+        return;
+      case 6:
+        store_env(addr);
+        for (i = 0; i < 8; i ++) {
+          store_real(addr + 28 + i * 10, 10, cpu.fpu.st[phys(i)]);
+        }
+        fpu_reset();
+        print_asm("fnsave %s", id_dest->str);
+        return;
+      case 7: vaddr_write(addr, 2, fpu_sw()); print_asm("fnstsw %s", id_dest->str); return;
+      default: exec_inv(eip); return;
+    }
+  }
+
+  i = id_dest->reg;
+  switch (op) {
+    case 0: cpu.fpu.valid &= ~(1 << phys(i)); print_asm("ffree %s", id_dest->str); return;
+    case 2: set_st(i, st(0)); print_asm("fst %s", id_dest->str); return;
+    case 3: set_st(i, st(0)); fpu_pop(); print_asm("fstp %s", id_dest->str); return;
+    case 4: set_cc(fpu_compare(st(0), st(i), true)); print_asm("fucom %s", id_dest->str); return;
+    case 5:
+      set_cc(fpu_compare(st(0), st(i), true));
+      fpu_pop();
+      print_asm("fucomp %s", id_dest->str);
+      return;
+    default: exec_inv(eip); return;
+  }
+}
+
+/* de: arithmetic with m16int, or st(i) <- st(i) op st(0) and pop */
+make_EHelper(fpu_de) {
+  int op = decoding.ext_opcode;
+  if (id_dest->type == OP_TYPE_MEM) {
+    arith_st0(op, load_int(id_dest->addr, 2));
+    print_asm("fi%ss %s", arith_name[op] + 1, id_dest->str);
+  }
+  else if (op == OP_COMP && id_dest->reg == 1) {
+    set_cc(fpu_compare(st(0), st(1), false));
+    fpu_pop();
+    fpu_pop();
+    print_asm("fcompp");
+  }
+  else if (op == OP_COM || op == OP_COMP) {
+    exec_inv(eip);
+  }
+  else {
+    op = op < 4 ? op : op ^ 1;
+    arith_sti(op, id_dest->reg, true);
+    print_asm("%sp %%st,%s", arith_name[op], id_dest->str);
+  }
+}
+
+/* df: m16int and m64int load/store, fnstsw %ax, fcomip */
+make_EHelper(fpu_df) {
+  int op = decoding.ext_opcode;
+  if (id_dest->type == OP_TYPE_MEM) {
+    vaddr_t addr = id_dest->addr;
+    switch (op) {
+      case 0: fpu_push(load_int(addr, 2)); print_asm("filds %s", id_dest->str); return;
+      case 1: store_int(addr, 2, st(0), true); fpu_pop(); print_asm("fisttps %s", id_dest->str); return;
+      case 2: store_int(addr, 2, st(0), false); print_asm("fists %s", id_dest->str); return;
+      case 3: store_int(addr, 2, st(0), false); fpu_pop(); print_asm("fistps %s", id_dest->str); return;
+      case 5: fpu_push(load_int(addr, 8)); print_asm("fildll %s", id_dest->str); return;
+      case 7: store_int(addr, 8, st(0), false); fpu_pop(); print_asm("fistpll %s", id_dest->str); return;
+      default: exec_inv(eip); return;
+    }
+  }
+
+  int i = id_dest->reg;
+  switch (op) {
+    case 0: cpu.fpu.valid &= ~(1 << phys(i)); fpu_pop(); print_asm("ffreep %s", id_dest->str); return;
+    case 4:
+      if (i != 0) { exec_inv(eip); return; }
+      reg_w(R_AX) = fpu_sw();
+      print_asm("fnstsw %%ax");
+      return;
+    case 5:
+      compare_eflags(st(0), st(i), true);
+      fpu_pop();
+      print_asm("fucomip %s,%%st", id_dest->str);
+      return;
+    case 6:
+      compare_eflags(st(0), st(i), false);
+      fpu_pop();
+      print_asm("fcomip %s,%%st", id_dest->str);
+      return;
+    default: exec_inv(eip); return;
+  }
+}
+
+/* Exceptions are never pending, so there is nothing to wait for. */
+make_EHelper(fwait) {
+  print_asm("fwait");
+}
+
+/* The x87 part of the 512-byte fxsave image, used by sse_ctl. The tag
+ * word is abridged to one valid bit per physical register, and the
+ * registers are stored in stack order 16 bytes apart. Unlike fnsave,
+ * fxsave leaves the unit as it is.
+ */
+void fpu_fxsave(vaddr_t addr) {
+  int i;
+  vaddr_write(addr, 2, cpu.fpu.cw);
+  vaddr_write(addr + 2, 2, fpu_sw());
+  vaddr_write(addr + 4, 2, cpu.fpu.valid);
+  vaddr_write(addr + 6, 2, 0);
+  for (i = 8; i < 24; i += 4) {
+    vaddr_write(addr + i, 4, 0);
+  }
+  for (i = 0; i < 8; i ++) {
+    store_real(addr + 32 + i * 16, 10, cpu.fpu.st[phys(i)]);
+  }
+}
+
+void fpu_fxrstor(vaddr_t addr) {
+  uint16_t sw = vaddr_read(addr + 2, 2);
+  int i;
+  cpu.fpu.cw = vaddr_read(addr, 2);
+  cpu.fpu.sw = sw & ~SW_TOP;
+  cpu.fpu.top = (sw & SW_TOP) >> 11;
+  cpu.fpu.valid = vaddr_read(addr + 4, 1);
+  for (i = 0; i < 8; i ++) {
+    cpu.fpu.st[phys(i)] = load_real(addr + 32 + i * 16, 10);
+  }
+}
@@ -0,0 +1,283 @@
+#include "cpu/exec.h"
+#include "memory/mmu.h"
+#include <stdlib.h>
+
+/* Macro-op fusion. The pairs below are the most frequent ones in the
+ * histogram reported by `-P' for the cputests. exec_real() calls fuse()
+ * after decoding the first instruction of a pair; fuse() then executes
+ * both of them as one superinstruction, so the second one is neither
+ * fetched twice nor dispatched by exec_wrapper(). An exception raised
+ * by the pair restarts it from the first instruction.
+ *
+ * The pairs are fused only when each instruction need not be seen, that
+ * is not for `si' with a few instructions, DEBUG or DIFF_TEST. A pair
+ * counts as two instructions in `cpu_steps' and for cpu_exec().
+ */
+
+enum { FUSED_CMP_JCC, FUSED_TEST_JCC, FUSED_PROLOGUE, FUSED_LEAVE_RET,
+  FUSED_POP_RET, FUSED_LOAD_ADD, NR_FUSED };
+
+static const char *fused_name[] = {
+  [FUSED_CMP_JCC] = "cmp; jcc",
+  [FUSED_TEST_JCC] = "test; jcc",
+  [FUSED_PROLOGUE] = "push %ebp; mov %esp,%ebp",
+  [FUSED_LEAVE_RET] = "leave; ret",
+  [FUSED_POP_RET] = "pop r; ret",
+  [FUSED_LOAD_ADD] = "mov r/m,r; add $imm,r",
+};
+
+#define NR_OPCODE 512
+
+bool fusion_enabled = false;
+
+/* Only kept for `-P'. The counters are not atomic, so they are
+ * approximate with multiple CPUs.
+ */
+bool fusion_count_pairs = false;
+static uint64_t fused_count[NR_FUSED];
+static uint32_t (*pair_count)[NR_OPCODE] = NULL;
+static __thread uint32_t last_opcode = 0;
+
+#define EFLAGS_ARITH 0x8c5  // OF, SF, ZF, PF and CF
+
+/* Read the next instruction. It must be in the page of the last byte
+ * of the current instruction, which has been translated, so the read
+ * can not fault.
+ */
+static inline bool peek(vaddr_t eip, int len, uint32_t *instr) {
+  if (((eip - 1) ^ (eip + len - 1)) & ~PAGE_MASK) return false;
+  *instr = vaddr_ifetch(eip, len);
+  return true;
+}
+
+static inline void set_arith_flags(uint32_t r, int width, bool CF, bool OF) {
+  uint32_t sign = 1u << (width * 8 - 1);
+  uint32_t mask = sign | (sign - 1);
+  r &= mask;
+  uint32_t flags = (CF ? 0x1 : 0) | (__builtin_parity(r & 0xff) ? 0 : 0x4) |
+    (r == 0 ? 0x40 : 0) | (r & sign ? 0x80 : 0) | (OF ? 0x800 : 0);
+  cpu.eflags.val = (cpu.eflags.val & ~EFLAGS_ARITH) | flags;
+}
+
+/* cmp/test; jcc: the condition is evaluated from the operands, and the
+ * flags are written once, since they may be read after the branch.
+ * Whether they are is not checked: that needs the instructions at both
+ * successors, and the target is often in another page, so decoding them
+ * costs more than setting the flags.
+ */
+static int fuse_jcc(vaddr_t *eip, uint32_t next, bool is_test) {
+  uint32_t op, disp;
+  int len;
+  if ((next & 0xf0) == 0x70) {
+    op = next & 0xff;
+    disp = (int8_t)(next >> 8);
+    len = 2;
+  }
+  else if ((next & 0xf0ff) == 0x800f) {
+    if (!peek(*eip + 2, 4, &disp)) return -1;
+    op = ((next >> 8) & 0xff) | 0x100;
+    len = 6;
+  }
+  else {
+    return -1;
+  }
+
+  int width = id_dest->width;
+  uint32_t sign = 1u << (width * 8 - 1);
+  uint32_t mask = sign | (sign - 1);
+  uint32_t a = id_dest->val & mask, b = id_src->val & mask;
+  uint32_t r = (is_test ? a & b : a - b) & mask;
+  bool CF = !is_test && a < b;
+  bool OF = !is_test && ((a ^ b) & (a ^ r) & sign) != 0;
+  bool ZF = (r == 0), SF = (r & sign) != 0;
+  set_arith_flags(r, width, CF, OF);
+
+  bool cond;
+  switch (op & 0xe) {
+    case 0x0: cond = OF; break;
+    case 0x2: cond = CF; break;
+    case 0x4: cond = ZF; break;
+    case 0x6: cond = CF || ZF; break;
+    case 0x8: cond = SF; break;
+    case 0xa: cond = !__builtin_parity(r & 0xff); break;
+    case 0xc: cond = SF != OF; break;
+    default:  cond = ZF || SF != OF; break;
+  }
+  if (op & 0x1) cond = !cond;
+
+  *eip += len;
+  if (cond) {
+    decoding.is_jmp = 1;
+    decoding.jmp_eip = *eip + disp;
+  }
+  decoding.opcode = op;
+  return (is_test ? FUSED_TEST_JCC : FUSED_CMP_JCC);
+}
+
+/* push %ebp; mov %esp,%ebp */
+static int fuse_prologue(vaddr_t *eip, uint32_t next) {
+  next &= 0xffff;
+  if (next != 0xe589 && next != 0xec8b) return -1;
+
+  rtl_push(&cpu.ebp);
+  cpu.ebp = cpu.esp;
+  *eip += 2;
+  decoding.opcode = next & 0xff;
+  return FUSED_PROLOGUE;
+}
+
+/* mov r/m,r; add $imm,r with the same register, e.g. a counter or a
+ * pointer loaded and advanced. The flags are those of the add.
+ */
+static int fuse_load_add(vaddr_t *eip, uint32_t next) {
+  int r = id_dest->reg;
+  uint32_t b;
+  int len;
+  if ((next & 0xffff) == (0x83 | (0xc0 | r) << 8)) {
+    b = (int8_t)(next >> 16);
+    len = 3;
+  }
+  else if ((next & 0xffff) == (0x81 | (0xc0 | r) << 8)) {
+    if (!peek(*eip + 2, 4, &b)) return -1;
+    len = 6;
+  }
+  else if ((next & 0xff) == 0x05 && r == R_EAX) {
+    if (!peek(*eip + 1, 4, &b)) return -1;
+    len = 5;
+  }
+  else {
+    return -1;
+  }
+
+  uint32_t a = id_src->val;
+  uint32_t s = a + b;
+  set_arith_flags(s, 4, s < a, (~(a ^ b) & (a ^ s) & 0x80000000u) != 0);
+  reg_l(r) = s;
+  *eip += len;
+  decoding.opcode = next & 0xff;
+  return FUSED_LOAD_ADD;
+}
+
+/* leave or pop r; ret */
+static int fuse_ret(vaddr_t *eip, uint32_t next, bool is_leave) {
+  if ((next & 0xff) != 0xc3) return -1;
+
+  if (is_leave) {
+    cpu.esp = cpu.ebp;
+    rtl_pop(&cpu.ebp);
+  }
+  else {
+    rtl_pop(&t0);
+    reg_l(id_dest->reg) = t0;
+  }
+  rtl_pop(&decoding.jmp_eip);
+  decoding.is_jmp = 1;
+  *eip += 1;
+  decoding.opcode = 0xc3;
+  return (is_leave ? FUSED_LEAVE_RET : FUSED_POP_RET);
+}
+
+/* Called after the instruction at the head of `decoding' is decoded,
+ * with `eip' pointing to the next one. Return whether both of them
+ * have been executed.
+ */
+bool fuse(vaddr_t *eip) {
+  uint32_t opcode = decoding.opcode;
+  switch (opcode) {
+    case 0x38 ... 0x3d: case 0x80: case 0x81: case 0x83:
+    case 0x84: case 0x85: case 0xa8: case 0xa9:
+    case 0x55: case 0xc9: case 0x58 ... 0x5b: case 0x5d ... 0x5f: case 0x8b: break;
+    default: return false;
+  }
+  if (decoding.is_operand_size_16 || decoding.rep || decoding.lock) {
+    return false;
+  }
+
+  // the first bytes of the next instruction, which are enough to match it
+  uint32_t next;
+  if (!peek(*eip, 4, &next)) return false;
+
+  int fused;
+  switch (opcode) {
+    case 0x80: case 0x81: case 0x83:
+      if (decoding.ext_opcode != 7) return false;
+      // fall through
+    case 0x38 ... 0x3d: fused = fuse_jcc(eip, next, false); break;
+    case 0x84: case 0x85: case 0xa8: case 0xa9: fused = fuse_jcc(eip, next, true); break;
+    case 0x55: fused = fuse_prologue(eip, next); break;
+    case 0xc9: fused = fuse_ret(eip, next, true); break;
+    case 0x8b: fused = fuse_load_add(eip, next); break;
+    default: fused = fuse_ret(eip, next, false); break;
+  }
+
+  if (fused == -1) {
+    return false;
+  }
+  // the second instruction
+  cpu_steps ++;
+  if (fusion_count_pairs) {
+    fused_count[fused] ++;
+    pair_count[last_opcode][opcode] ++;
+    last_opcode = opcode;
+  }
+  return true;
+}
+
+/* Count the pair ending with the instruction just executed. */
+void fusion_record(uint32_t opcode) {
+  pair_count[last_opcode][opcode] ++;
+  last_opcode = opcode;
+}
+
+static const char *opcode_str(uint32_t opcode) {
+  static char buf[2][8];
+  static int i = 0;
+  i = !i;
+  sprintf(buf[i], (opcode & 0x100 ? "0f %02x" : "%02x"), opcode & 0xff);
+  return buf[i];
+}
+
+#define NR_TOP 20
+
+static void fusion_report() {
+  int i, j, k;
+  printf("Fused instruction pairs:\n");
+  for (i = 0; i < NR_FUSED; i ++) {
+    printf("  %-28s %12llu\n", fused_name[i], (unsigned long long)fused_count[i]);
+  }
+
+  /* the pairs which are executed the most, including the fused ones */
+  uint64_t total = 0;
+  uint32_t top[NR_TOP][2];
+  int nr_top = 0;
+  for (i = 0; i < NR_OPCODE; i ++) {
+    for (j = 0; j < NR_OPCODE; j ++) {
+      uint32_t n = pair_count[i][j];
+      if (n == 0) continue;
+      total += n;
+      if (nr_top == NR_TOP && pair_count[top[NR_TOP - 1][0]][top[NR_TOP - 1][1]] >= n) continue;
+
+      k = (nr_top < NR_TOP ? nr_top ++ : NR_TOP - 1);
+      for (; k > 0 && pair_count[top[k - 1][0]][top[k - 1][1]] < n; k --) {
+        top[k][0] = top[k - 1][0];
+        top[k][1] = top[k - 1][1];
+      }
+      top[k][0] = i;
+      top[k][1] = j;
+    }
+  }
+
+  printf("Most frequent instruction pairs (%llu in total):\n", (unsigned long long)total);
+  for (k = 0; k < nr_top; k ++) {
+    uint32_t n = pair_count[top[k][0]][top[k][1]];
+    printf("  %-6s %-6s %12u (%.2f%%)\n", opcode_str(top[k][0]), opcode_str(top[k][1]),
+        n, n * 100.0 / total);
+  }
+}
+
+void fusion_set_report() {
+  pair_count = calloc(NR_OPCODE, sizeof(*pair_count));
+  assert(pair_count != NULL);
+  fusion_count_pairs = true;
+  atexit(fusion_report);
+}
@@ -1,80 +1,220 @@
 #include "cpu/exec.h"
+#include "cpu/alu.h"
 
 make_EHelper(test) {
-  rtl_and(&t0, &id_dest->val, &id_src->val);
-  t1 = 0;
-  rtl_set_CF(&t1);
-  rtl_set_OF(&t1);
-  rtl_update_ZFSF(&t0, id_dest->width);
-
+  do_test(id_dest->width);
   print_asm_template2(test);
 }
 
 make_EHelper(and) {
-  rtl_and(&t0, &id_dest->val, &id_src->val);
-  operand_write(id_dest, &t0);
-  t1 = 0;
-  rtl_set_CF(&t1);
-  rtl_set_OF(&t1);
-  rtl_update_ZFSF(&t0, id_dest->width);
-
+  do_and(id_dest->width);
   print_asm_template2(and);
 }
 
 make_EHelper(xor) {
-  rtl_xor(&t0, &id_dest->val, &id_src->val);
-  operand_write(id_dest, &t0);
-  rtl_update_ZFSF(&t0, id_dest->width);
-
-  t1 = 0;
-  rtl_set_CF(&t1);
-  rtl_set_OF(&t1);
-
+  do_xor(id_dest->width);
   print_asm_template2(xor);
 }
 
 make_EHelper(or) {
-  rtl_or(&t0, &id_dest->val, &id_src->val);
-  operand_write(id_dest, &t0);
-  t1 = 0;
-  rtl_set_CF(&t1);
-  rtl_set_OF(&t1);
-  rtl_update_ZFSF(&t0, id_dest->width);
-
+  do_or(id_dest->width);
   print_asm_template2(or);
 }
 
 make_EHelper(sar) {
+  // the count is masked to 5 bits, and a zero count affects no flags
+  rtl_andi(&t3, &id_src->val, 0x1f);
+  if (t3 != 0) {
+    rtl_sext(&t1, &id_dest->val, id_dest->width);
+    rtl_subi(&t2, &t3, 1);
+    rtl_sar(&t0, &t1, &t2);
+    rtl_andi(&t0, &t0, 1);
+    rtl_set_CF(&t0);
+    rtl_set_OF(&tzero);
 
-  // unnecessary to update CF and OF in NEMU
-  rtl_sext(&t1, &id_dest->val, id_dest->width);
-  rtl_sar(&t1, &t1, &id_src->val);
-  operand_write(id_dest, &t1);
+    rtl_sar(&t1, &t1, &t3);
+    operand_write(id_dest, &t1);
+    rtl_update_ZFSF(&t1, id_dest->width);
+  }
 
-  rtl_update_ZFSF(&t1, id_dest->width);
   print_asm_template2(sar);
 }
 
 make_EHelper(shl) {
-  rtl_shl(&t1, &id_dest->val, &id_src->val);
-  operand_write(id_dest, &t1);
+  rtl_andi(&t3, &id_src->val, 0x1f);
+  if (t3 != 0) {
+    rtl_shl(&t1, &id_dest->val, &t3);
+    operand_write(id_dest, &t1);
+    rtl_update_ZFSF(&t1, id_dest->width);
+
+    // CF is the last bit shifted out
+    if (t3 <= id_dest->width * 8) {
+      rtl_subi(&t2, &t3, 1);
+      rtl_shl(&t0, &id_dest->val, &t2);
+      rtl_msb(&t0, &t0, id_dest->width);
+    }
+    else {
+      rtl_li(&t0, 0);
+    }
+    rtl_set_CF(&t0);
 
-  rtl_update_ZFSF(&t1, id_dest->width);
-  // unnecessary to update CF and OF in NEMU
+    rtl_msb(&t2, &t1, id_dest->width);
+    rtl_xor(&t0, &t0, &t2);
+    rtl_set_OF(&t0);
+  }
 
   print_asm_template2(shl);
 }
 
 make_EHelper(shr) {
-  rtl_shr(&t1, &id_dest->val, &id_src->val);
-  operand_write(id_dest, &t1);
+  rtl_andi(&t3, &id_src->val, 0x1f);
+  if (t3 != 0) {
+    rtl_subi(&t2, &t3, 1);
+    rtl_shr(&t0, &id_dest->val, &t2);
+    rtl_andi(&t0, &t0, 1);
+    rtl_set_CF(&t0);
+    rtl_msb(&t0, &id_dest->val, id_dest->width);
+    rtl_set_OF(&t0);
 
-  rtl_update_ZFSF(&t1, id_dest->width);
-  // unnecessary to update CF and OF in NEMU
+    rtl_shr(&t1, &id_dest->val, &t3);
+    operand_write(id_dest, &t1);
+    rtl_update_ZFSF(&t1, id_dest->width);
+  }
 
   print_asm_template2(shr);
 }
 
+/* Rotations only affect CF and OF. */
+
+make_EHelper(rol) {
+  int bits = id_dest->width * 8;
+  rtl_andi(&t3, &id_src->val, 0x1f);
+  if (t3 != 0) {
+    t2 = t3 % bits;
+    t1 = (t2 == 0 ? id_dest->val : (id_dest->val << t2) | (id_dest->val >> (bits - t2)));
+    operand_write(id_dest, &t1);
+
+    rtl_andi(&t0, &t1, 1);
+    rtl_set_CF(&t0);
+    rtl_msb(&t2, &t1, id_dest->width);
+    rtl_xor(&t0, &t0, &t2);
+    rtl_set_OF(&t0);
+  }
+
+  print_asm_template2(rol);
+}
+
+make_EHelper(ror) {
+  int bits = id_dest->width * 8;
+  rtl_andi(&t3, &id_src->val, 0x1f);
+  if (t3 != 0) {
+    t2 = t3 % bits;
+    t1 = (t2 == 0 ? id_dest->val : (id_dest->val >> t2) | (id_dest->val << (bits - t2)));
+    operand_write(id_dest, &t1);
+
+    rtl_msb(&t0, &t1, id_dest->width);
+    rtl_set_CF(&t0);
+    rtl_shli(&t2, &t1, 1);
+    rtl_msb(&t2, &t2, id_dest->width);
+    rtl_xor(&t0, &t0, &t2);
+    rtl_set_OF(&t0);
+  }
+
+  print_asm_template2(ror);
+}
+
+make_EHelper(rcl) {
+  int bits = id_dest->width * 8;
+  rtl_andi(&t3, &id_src->val, 0x1f);
+  t3 %= bits + 1;
+  if (t3 != 0) {
+    rtl_get_CF(&t0);
+    t1 = id_dest->val;
+    while (t3 --) {
+      rtl_msb(&t2, &t1, id_dest->width);
+      t1 = (t1 << 1) | t0;
+      t0 = t2;
+    }
+    operand_write(id_dest, &t1);
+    rtl_set_CF(&t0);
+
+    rtl_msb(&t2, &t1, id_dest->width);
+    rtl_xor(&t0, &t0, &t2);
+    rtl_set_OF(&t0);
+  }
+
+  print_asm_template2(rcl);
+}
+
+make_EHelper(rcr) {
+  int bits = id_dest->width * 8;
+  rtl_andi(&t3, &id_src->val, 0x1f);
+  t3 %= bits + 1;
+  if (t3 != 0) {
+    rtl_get_CF(&t0);
+    rtl_msb(&t2, &id_dest->val, id_dest->width);
+    rtl_xor(&t2, &t2, &t0);
+    rtl_set_OF(&t2);
+
+    t1 = id_dest->val;
+    while (t3 --) {
+      rtl_andi(&t2, &t1, 1);
+      t1 = (t1 >> 1) | (t0 << (bits - 1));
+      t0 = t2;
+    }
+    operand_write(id_dest, &t1);
+    rtl_set_CF(&t0);
+  }
+
+  print_asm_template2(rcr);
+}
+
+/* id_dest <- id_dest:id_src2 shifted by id_src */
+
+make_EHelper(shld) {
+  int bits = id_dest->width * 8;
+  rtl_andi(&t3, &id_src->val, 0x1f);
+  if (t3 != 0) {
+    uint64_t v = ((uint64_t)id_dest->val << bits) | id_src2->val;
+    t1 = (v << t3) >> bits;
+    operand_write(id_dest, &t1);
+    rtl_update_ZFSF(&t1, id_dest->width);
+
+    rtl_subi(&t2, &t3, 1);
+    rtl_shl(&t0, &id_dest->val, &t2);
+    rtl_msb(&t0, &t0, id_dest->width);
+    rtl_set_CF(&t0);
+
+    rtl_xor(&t0, &t1, &id_dest->val);
+    rtl_msb(&t0, &t0, id_dest->width);
+    rtl_set_OF(&t0);
+  }
+
+  print_asm_template3(shld);
+}
+
+make_EHelper(shrd) {
+  int bits = id_dest->width * 8;
+  rtl_andi(&t3, &id_src->val, 0x1f);
+  if (t3 != 0) {
+    uint64_t v = ((uint64_t)id_src2->val << bits) | id_dest->val;
+    t1 = v >> t3;
+    operand_write(id_dest, &t1);
+    rtl_update_ZFSF(&t1, id_dest->width);
+
+    rtl_subi(&t2, &t3, 1);
+    rtl_shr(&t0, &id_dest->val, &t2);
+    rtl_andi(&t0, &t0, 1);
+    rtl_set_CF(&t0);
+
+    rtl_xor(&t0, &t1, &id_dest->val);
+    rtl_msb(&t0, &t0, id_dest->width);
+    rtl_set_OF(&t0);
+  }
+
+  print_asm_template3(shrd);
+}
+
 make_EHelper(setcc) {
   uint8_t subcode = decoding.opcode & 0xf;
   rtl_setcc(&t2, subcode);
@@ -84,7 +224,145 @@ make_EHelper(setcc) {
 }
 
 make_EHelper(not) {
-  rtl_not(&id_dest->val);
-  operand_write(id_dest, &id_dest->val);
+  // keep id_dest->val as loaded, a locked write compares against it
+  rtl_mv(&t2, &id_dest->val);
+  rtl_not(&t2);
+  operand_write(id_dest, &t2);
   print_asm_template1(not);
 }
+
+make_EHelper(bsf) {
+  if (id_src->val == 0) {
+    rtl_li(&t0, 1);
+    rtl_set_ZF(&t0);
+  }
+  else {
+    rtl_set_ZF(&tzero);
+    rtl_li(&t0, __builtin_ctz(id_src->val));
+    operand_write(id_dest, &t0);
+  }
+
+  print_asm_template2(bsf);
+}
+
+make_EHelper(bsr) {
+  if (id_src->val == 0) {
+    rtl_li(&t0, 1);
+    rtl_set_ZF(&t0);
+  }
+  else {
+    rtl_set_ZF(&tzero);
+    rtl_li(&t0, 31 - __builtin_clz(id_src->val));
+    operand_write(id_dest, &t0);
+  }
+
+  print_asm_template2(bsr);
+}
+
+/* Put the index of the bit selected by id_src into t2, and CF <- the bit.
+ * A register bit offset may select a bit outside of a memory operand.
+ */
+static inline void bit_test(void) {
+  int bits = id_dest->width * 8;
+  if (id_dest->type == OP_TYPE_MEM && id_src->type == OP_TYPE_REG) {
+    rtl_sext(&t0, &id_src->val, id_src->width);
+    rtl_sari(&t0, &t0, (bits == 32 ? 5 : 4));
+    rtl_shli(&t0, &t0, (bits == 32 ? 2 : 1));
+    rtl_add(&id_dest->addr, &id_dest->addr, &t0);
+    rtl_lm(&id_dest->val, &id_dest->addr, id_dest->width);
+  }
+  rtl_andi(&t2, &id_src->val, bits - 1);
+
+  rtl_shr(&t0, &id_dest->val, &t2);
+  rtl_andi(&t0, &t0, 1);
+  rtl_set_CF(&t0);
+  rtl_li(&t3, 1);
+  rtl_shl(&t3, &t3, &t2);
+}
+
+make_EHelper(bt) {
+  bit_test();
+
+  print_asm_template2(bt);
+}
+
+make_EHelper(bts) {
+  bit_test();
+  rtl_or(&t1, &id_dest->val, &t3);
+  operand_write(id_dest, &t1);
+
+  print_asm_template2(bts);
+}
+
+make_EHelper(btr) {
+  bit_test();
+  rtl_not(&t3);
+  rtl_and(&t1, &id_dest->val, &t3);
+  operand_write(id_dest, &t1);
+
+  print_asm_template2(btr);
+}
+
+make_EHelper(btc) {
+  bit_test();
+  rtl_xor(&t1, &id_dest->val, &t3);
+  operand_write(id_dest, &t1);
+
+  print_asm_template2(btc);
+}
+
+make_EHelper(clc) {
+  rtl_set_CF(&tzero);
+
+  print_asm("clc");
+}
+
+make_EHelper(stc) {
+  rtl_li(&t0, 1);
+  rtl_set_CF(&t0);
+
+  print_asm("stc");
+}
+
+make_EHelper(cmc) {
+  rtl_get_CF(&t0);
+  rtl_xori(&t0, &t0, 1);
+  rtl_set_CF(&t0);
+
+  print_asm("cmc");
+}
+
+/* AF is not emulated. It reads as 0 and is ignored by sahf. */
+make_EHelper(sahf) {
+  rtl_lr_b(&t1, R_AH);
+  rtl_andi(&t0, &t1, 0x1);
+  rtl_set_CF(&t0);
+  rtl_shri(&t0, &t1, 2);
+  rtl_andi(&t0, &t0, 0x1);
+  rtl_set_PF(&t0);
+  rtl_shri(&t0, &t1, 6);
+  rtl_andi(&t0, &t0, 0x1);
+  rtl_set_ZF(&t0);
+  rtl_shri(&t0, &t1, 7);
+  rtl_set_SF(&t0);
+
+  print_asm("sahf");
+}
+
+make_EHelper(lahf) {
+  rtl_li(&t1, 0x2);
+  rtl_get_CF(&t0);
+  rtl_or(&t1, &t1, &t0);
+  rtl_get_PF(&t0);
+  rtl_shli(&t0, &t0, 2);
+  rtl_or(&t1, &t1, &t0);
+  rtl_get_ZF(&t0);
+  rtl_shli(&t0, &t0, 6);
+  rtl_or(&t1, &t1, &t0);
+  rtl_get_SF(&t0);
+  rtl_shli(&t0, &t0, 7);
+  rtl_or(&t1, &t1, &t0);
+  rtl_sr_b(R_AH, &t1);
+
+  print_asm("lahf");
+}
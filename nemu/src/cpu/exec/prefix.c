@@ -7,3 +7,44 @@ make_EHelper(operand_size) {
   exec_real(eip);
   decoding.is_operand_size_16 = false;
 }
+
+make_EHelper(rep) {
+  decoding.rep = 0xf3;
+  exec_real(eip);
+  decoding.rep = 0;
+}
+
+make_EHelper(repnz) {
+  decoding.rep = 0xf2;
+  exec_real(eip);
+  decoding.rep = 0;
+}
+
+/* The memory operand of a locked instruction is written with a
+ * compare-and-swap against the value the decoder loaded (see
+ * operand_write()). If another CPU has changed it in between, the
+ * registers are rolled back and the instruction is executed again.
+ */
+make_EHelper(lock) {
+  vaddr_t ori_eip = *eip;
+  rtlreg_t gpr[8];
+  uint32_t eflags = cpu.eflags.val;
+  memcpy(gpr, &cpu.gpr, sizeof(gpr));
+#ifdef DEBUG
+  char *p = decoding.p;
+#endif
+
+  decoding.lock = true;
+  exec_real(eip);
+  while (decoding.lock_failed) {
+    decoding.lock_failed = false;
+    memcpy(&cpu.gpr, gpr, sizeof(gpr));
+    cpu.eflags.val = eflags;
+    *eip = ori_eip;
+#ifdef DEBUG
+    decoding.p = p;
+#endif
+    exec_real(eip);
+  }
+  decoding.lock = false;
+}
@@ -14,6 +14,9 @@ make_EHelper(inv) {
   temp[0] = instr_fetch(eip, 4);
   temp[1] = instr_fetch(eip, 4);
 
+  extern void serial_flush();
+  serial_flush();
+
   uint8_t *p = (void *)temp;
   printf("invalid opcode(eip = 0x%08x): %02x %02x %02x %02x %02x %02x %02x %02x ...\n\n",
       ori_eip, p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]);
@@ -35,6 +38,10 @@ make_EHelper(inv) {
 make_EHelper(nemu_trap) {
   print_asm("nemu trap (eax = %d)", cpu.eax);
 
+  // the output of the program goes before the message
+  extern void serial_flush();
+  serial_flush();
+
   printf("\33[1;31mnemu: HIT %s TRAP\33[0m at eip = 0x%08x\n\n",
       (cpu.eax == 0 ? "GOOD" : "BAD"), cpu.eip);
   nemu_state = NEMU_END;
@@ -0,0 +1,149 @@
+#include "cpu/exec.h"
+#include "all-instr.h"
+#include "cpu/alu.h"
+
+/* Handlers specialized for one opcode with a fixed operand width. They
+ * are generated from SPECIALIZED_TABLE below, and each of them inlines
+ * the decoding of its operands and the semantics from alu.h with the
+ * width as a constant, so the switches on the width in rtl_lr(),
+ * rtl_sr(), rtl_lm() and the flag updates are folded away. exec_real()
+ * dispatches to them instead of opcode_table when there is no operand
+ * size prefix.
+ *
+ * They fill in `decoding' the same way as the generic decode helpers,
+ * since fuse() and the group helpers read it. DEBUG builds do not use
+ * them, so that every instruction gets its assembly string.
+ */
+
+#ifndef DEBUG
+
+extern bool fusion_enabled;
+bool fuse(vaddr_t *eip);
+
+/* decode forms, see decode.c */
+
+static inline void sdecode_G2E(vaddr_t *eip, int width) {
+  read_ModR_M_w(eip, id_dest, true, id_src, true, width, width);
+}
+
+static inline void sdecode_mov_G2E(vaddr_t *eip, int width) {
+  read_ModR_M_w(eip, id_dest, false, id_src, true, width, width);
+}
+
+static inline void sdecode_E2G(vaddr_t *eip, int width) {
+  read_ModR_M_w(eip, id_src, true, id_dest, true, width, width);
+}
+
+static inline void sdecode_mov_E2G(vaddr_t *eip, int width) {
+  read_ModR_M_w(eip, id_src, true, id_dest, false, width, width);
+}
+
+static inline void sdecode_lea_M2G(vaddr_t *eip, int width) {
+  read_ModR_M_w(eip, id_src, false, id_dest, false, width, width);
+}
+
+static inline void sdecode_imm(vaddr_t *eip, Operand *op, int width) {
+  op->type = OP_TYPE_IMM;
+  op->imm = instr_fetch(eip, width);
+  rtl_li(&op->val, op->imm);
+}
+
+static inline void sdecode_reg(Operand *op, int reg, bool load_val, int width) {
+  op->type = OP_TYPE_REG;
+  op->reg = reg;
+  if (load_val) {
+    rtl_lr(&op->val, reg, width);
+  }
+}
+
+static inline void sdecode_I2a(vaddr_t *eip, int width) {
+  sdecode_reg(id_dest, R_EAX, true, width);
+  sdecode_imm(eip, id_src, width);
+}
+
+static inline void sdecode_r(vaddr_t *eip, int width) {
+  sdecode_reg(id_dest, decoding.opcode & 0x7, true, width);
+}
+
+static inline void sdecode_mov_I2r(vaddr_t *eip, int width) {
+  sdecode_reg(id_dest, decoding.opcode & 0x7, false, width);
+  sdecode_imm(eip, id_src, width);
+}
+
+static inline void sdecode_I2E(vaddr_t *eip, int width) {
+  read_ModR_M_w(eip, id_dest, true, NULL, false, width, width);
+  sdecode_imm(eip, id_src, width);
+}
+
+static inline void sdecode_SI2E(vaddr_t *eip, int width) {
+  read_ModR_M_w(eip, id_dest, true, NULL, false, width, width);
+  id_src->width = 1;
+  id_src->type = OP_TYPE_IMM;
+  id_src->simm = (int8_t)instr_fetch(eip, 1);
+  rtl_li(&id_src->val, id_src->simm);
+}
+
+/* 0x80, 0x81, 0x83 */
+static inline void do_gp1(int width) {
+  switch (decoding.ext_opcode) {
+    case 0: do_add(width); break;
+    case 1: do_or(width); break;
+    // rare enough to be left to the generic helpers, which do not use `eip'
+    case 2: exec_adc(&decoding.seq_eip); break;
+    case 3: exec_sbb(&decoding.seq_eip); break;
+    case 4: do_and(width); break;
+    case 5: do_sub(width); break;
+    case 6: do_xor(width); break;
+    default: do_cmp(width); break;
+  }
+}
+
+/* (opcode, semantics, decode form, width) */
+#define SPECIALIZED_TABLE(_) \
+  _(0x00, add, G2E, 1) _(0x01, add, G2E, 4) _(0x02, add, E2G, 1) _(0x03, add, E2G, 4) \
+  _(0x04, add, I2a, 1) _(0x05, add, I2a, 4) \
+  _(0x08, or, G2E, 1) _(0x09, or, G2E, 4) _(0x0a, or, E2G, 1) _(0x0b, or, E2G, 4) \
+  _(0x0c, or, I2a, 1) _(0x0d, or, I2a, 4) \
+  _(0x20, and, G2E, 1) _(0x21, and, G2E, 4) _(0x22, and, E2G, 1) _(0x23, and, E2G, 4) \
+  _(0x24, and, I2a, 1) _(0x25, and, I2a, 4) \
+  _(0x28, sub, G2E, 1) _(0x29, sub, G2E, 4) _(0x2a, sub, E2G, 1) _(0x2b, sub, E2G, 4) \
+  _(0x2c, sub, I2a, 1) _(0x2d, sub, I2a, 4) \
+  _(0x30, xor, G2E, 1) _(0x31, xor, G2E, 4) _(0x32, xor, E2G, 1) _(0x33, xor, E2G, 4) \
+  _(0x34, xor, I2a, 1) _(0x35, xor, I2a, 4) \
+  _(0x38, cmp, G2E, 1) _(0x39, cmp, G2E, 4) _(0x3a, cmp, E2G, 1) _(0x3b, cmp, E2G, 4) \
+  _(0x3c, cmp, I2a, 1) _(0x3d, cmp, I2a, 4) \
+  _(0x40, inc, r, 4) _(0x41, inc, r, 4) _(0x42, inc, r, 4) _(0x43, inc, r, 4) \
+  _(0x44, inc, r, 4) _(0x45, inc, r, 4) _(0x46, inc, r, 4) _(0x47, inc, r, 4) \
+  _(0x48, dec, r, 4) _(0x49, dec, r, 4) _(0x4a, dec, r, 4) _(0x4b, dec, r, 4) \
+  _(0x4e, dec, r, 4) _(0x4f, dec, r, 4) \
+  _(0x50, push, r, 4) _(0x51, push, r, 4) _(0x52, push, r, 4) _(0x53, push, r, 4) \
+  _(0x54, push, r, 4) _(0x55, push, r, 4) _(0x56, push, r, 4) _(0x57, push, r, 4) \
+  _(0x58, pop, r, 4) _(0x59, pop, r, 4) _(0x5a, pop, r, 4) _(0x5b, pop, r, 4) \
+  _(0x5c, pop, r, 4) _(0x5d, pop, r, 4) _(0x5e, pop, r, 4) _(0x5f, pop, r, 4) \
+  _(0x80, gp1, I2E, 1) _(0x81, gp1, I2E, 4) _(0x83, gp1, SI2E, 4) \
+  _(0x84, test, G2E, 1) _(0x85, test, G2E, 4) \
+  _(0x88, mov, mov_G2E, 1) _(0x89, mov, mov_G2E, 4) _(0x8a, mov, mov_E2G, 1) _(0x8b, mov, mov_E2G, 4) \
+  _(0x8d, lea, lea_M2G, 4) \
+  _(0xa8, test, I2a, 1) \
+  _(0xb0, mov, mov_I2r, 1) _(0xb1, mov, mov_I2r, 1) _(0xb2, mov, mov_I2r, 1) _(0xb3, mov, mov_I2r, 1) \
+  _(0xb4, mov, mov_I2r, 1) _(0xb5, mov, mov_I2r, 1) _(0xb6, mov, mov_I2r, 1) _(0xb7, mov, mov_I2r, 1) \
+  _(0xb8, mov, mov_I2r, 4) _(0xb9, mov, mov_I2r, 4) _(0xba, mov, mov_I2r, 4) _(0xbb, mov, mov_I2r, 4) \
+  _(0xbc, mov, mov_I2r, 4) _(0xbd, mov, mov_I2r, 4) _(0xbe, mov, mov_I2r, 4) _(0xbf, mov, mov_I2r, 4)
+
+#define make_specialized(opcode, name, form, w) \
+  static make_EHelper(concat(spec_, opcode)) { \
+    decoding.src.width = decoding.dest.width = decoding.src2.width = w; \
+    concat(sdecode_, form)(eip, w); \
+    if (fusion_enabled && fuse(eip)) return; \
+    concat(do_, name)(w); \
+  }
+
+SPECIALIZED_TABLE(make_specialized)
+
+#define specialized_entry(opcode, name, form, w) [opcode] = concat(exec_spec_, opcode),
+
+EHelper specialized_table[256] = {
+  SPECIALIZED_TABLE(specialized_entry)
+};
+
+#endif
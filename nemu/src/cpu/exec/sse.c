@@ -0,0 +1,801 @@
+#include "cpu/exec.h"
+#include <emmintrin.h>
+#include <math.h>
+
+make_EHelper(inv);
+void fpu_fxsave(vaddr_t addr);
+void fpu_fxrstor(vaddr_t addr);
+
+/* The SSE and SSE2 instructions, executed with the host SSE2 intrinsics.
+ * The MMX forms without the 0x66 prefix are not supported. Alignment is
+ * not checked for movdqa and movaps.
+ */
+
+static inline __m128i xmm_read(Operand *op) {
+  if (op->type == OP_TYPE_REG) {
+    return _mm_loadu_si128((__m128i *)cpu.xmm[op->reg]._8);
+  }
+  uint32_t v[4];
+  int i;
+  for (i = 0; i < 4; i ++) {
+    v[i] = vaddr_read(op->addr + i * 4, 4);
+  }
+  return _mm_loadu_si128((__m128i *)v);
+}
+
+static inline void xmm_write(Operand *op, __m128i val) {
+  if (op->type == OP_TYPE_REG) {
+    _mm_storeu_si128((__m128i *)cpu.xmm[op->reg]._8, val);
+    return;
+  }
+  uint32_t v[4];
+  int i;
+  _mm_storeu_si128((__m128i *)v, val);
+  for (i = 0; i < 4; i ++) {
+    vaddr_write(op->addr + i * 4, 4, v[i]);
+  }
+}
+
+/* the low 64 bits of an xmm register or m64 */
+static inline uint64_t xmm_read_64(Operand *op) {
+  if (op->type == OP_TYPE_REG) {
+    return cpu.xmm[op->reg]._64[0];
+  }
+  return vaddr_read(op->addr, 4) | ((uint64_t)vaddr_read(op->addr + 4, 4) << 32);
+}
+
+static inline void mem_write_64(vaddr_t addr, uint64_t val) {
+  vaddr_write(addr, 4, val);
+  vaddr_write(addr + 4, 4, val >> 32);
+}
+
+/* the r/m32 or r/m16 operand of the E2xmm forms */
+static inline void rm_load(Operand *op) {
+  if (op->type == OP_TYPE_MEM) {
+    rtl_lm(&op->val, &op->addr, op->width);
+  }
+}
+
+/* The 0x66 prefix selects the SSE2 form. Without it, the instruction is
+ * the MMX form, which is not supported.
+ */
+static inline bool is_sse2(vaddr_t *eip) {
+  if (!decoding.is_operand_size_16 || decoding.rep) {
+    exec_inv(eip);
+    return false;
+  }
+  return true;
+}
+
+/* dest <- op(dest, src) */
+#define make_sse2_binop(name, expr)                                           \
+  make_EHelper(name) {                                                        \
+    if (!is_sse2(eip)) { return; }                                            \
+    __m128i a = xmm_read(id_dest), b = xmm_read(id_src);                      \
+    xmm_write(id_dest, expr);                                                 \
+    print_asm(str(name) " %s,%s", id_src->str, id_dest->str);                 \
+  }
+
+make_sse2_binop(paddb, _mm_add_epi8(a, b))
+make_sse2_binop(paddw, _mm_add_epi16(a, b))
+make_sse2_binop(paddd, _mm_add_epi32(a, b))
+make_sse2_binop(paddq, _mm_add_epi64(a, b))
+make_sse2_binop(paddusb, _mm_adds_epu8(a, b))
+make_sse2_binop(paddusw, _mm_adds_epu16(a, b))
+make_sse2_binop(paddsb, _mm_adds_epi8(a, b))
+make_sse2_binop(paddsw, _mm_adds_epi16(a, b))
+make_sse2_binop(psubb, _mm_sub_epi8(a, b))
+make_sse2_binop(psubw, _mm_sub_epi16(a, b))
+make_sse2_binop(psubd, _mm_sub_epi32(a, b))
+make_sse2_binop(psubq, _mm_sub_epi64(a, b))
+make_sse2_binop(psubusb, _mm_subs_epu8(a, b))
+make_sse2_binop(psubusw, _mm_subs_epu16(a, b))
+make_sse2_binop(psubsb, _mm_subs_epi8(a, b))
+make_sse2_binop(psubsw, _mm_subs_epi16(a, b))
+
+make_sse2_binop(pmullw, _mm_mullo_epi16(a, b))
+make_sse2_binop(pmulhw, _mm_mulhi_epi16(a, b))
+make_sse2_binop(pmulhuw, _mm_mulhi_epu16(a, b))
+make_sse2_binop(pmuludq, _mm_mul_epu32(a, b))
+make_sse2_binop(pmaddwd, _mm_madd_epi16(a, b))
+make_sse2_binop(psadbw, _mm_sad_epu8(a, b))
+make_sse2_binop(pavgb, _mm_avg_epu8(a, b))
+make_sse2_binop(pavgw, _mm_avg_epu16(a, b))
+make_sse2_binop(pmaxub, _mm_max_epu8(a, b))
+make_sse2_binop(pminub, _mm_min_epu8(a, b))
+make_sse2_binop(pmaxsw, _mm_max_epi16(a, b))
+make_sse2_binop(pminsw, _mm_min_epi16(a, b))
+
+make_sse2_binop(pand, _mm_and_si128(a, b))
+make_sse2_binop(pandn, _mm_andnot_si128(a, b))
+make_sse2_binop(por, _mm_or_si128(a, b))
+make_sse2_binop(pxor, _mm_xor_si128(a, b))
+
+make_sse2_binop(pcmpeqb, _mm_cmpeq_epi8(a, b))
+make_sse2_binop(pcmpeqw, _mm_cmpeq_epi16(a, b))
+make_sse2_binop(pcmpeqd, _mm_cmpeq_epi32(a, b))
+make_sse2_binop(pcmpgtb, _mm_cmpgt_epi8(a, b))
+make_sse2_binop(pcmpgtw, _mm_cmpgt_epi16(a, b))
+make_sse2_binop(pcmpgtd, _mm_cmpgt_epi32(a, b))
+
+make_sse2_binop(punpcklbw, _mm_unpacklo_epi8(a, b))
+make_sse2_binop(punpcklwd, _mm_unpacklo_epi16(a, b))
+make_sse2_binop(punpckldq, _mm_unpacklo_epi32(a, b))
+make_sse2_binop(punpcklqdq, _mm_unpacklo_epi64(a, b))
+make_sse2_binop(punpckhbw, _mm_unpackhi_epi8(a, b))
+make_sse2_binop(punpckhwd, _mm_unpackhi_epi16(a, b))
+make_sse2_binop(punpckhdq, _mm_unpackhi_epi32(a, b))
+make_sse2_binop(punpckhqdq, _mm_unpackhi_epi64(a, b))
+make_sse2_binop(packsswb, _mm_packs_epi16(a, b))
+make_sse2_binop(packssdw, _mm_packs_epi32(a, b))
+make_sse2_binop(packuswb, _mm_packus_epi16(a, b))
+
+/* shift by the count in xmm/m128 */
+make_sse2_binop(psrlw, _mm_srl_epi16(a, b))
+make_sse2_binop(psrld, _mm_srl_epi32(a, b))
+make_sse2_binop(psrlq, _mm_srl_epi64(a, b))
+make_sse2_binop(psraw, _mm_sra_epi16(a, b))
+make_sse2_binop(psrad, _mm_sra_epi32(a, b))
+make_sse2_binop(psllw, _mm_sll_epi16(a, b))
+make_sse2_binop(pslld, _mm_sll_epi32(a, b))
+make_sse2_binop(psllq, _mm_sll_epi64(a, b))
+
+/* The bitwise operations on packed singles are also used for integer
+ * data. With the 0x66 prefix they are the packed double forms, which
+ * do the same.
+ */
+#define make_sse_binop(name, expr)                                            \
+  make_EHelper(name) {                                                        \
+    if (decoding.rep) { exec_inv(eip); return; }                              \
+    __m128i a = xmm_read(id_dest), b = xmm_read(id_src);                      \
+    xmm_write(id_dest, expr);                                                 \
+    print_asm(str(name) " %s,%s", id_src->str, id_dest->str);                 \
+  }
+
+make_sse_binop(andps, _mm_and_si128(a, b))
+make_sse_binop(andnps, _mm_andnot_si128(a, b))
+make_sse_binop(orps, _mm_or_si128(a, b))
+make_sse_binop(xorps, _mm_xor_si128(a, b))
+
+/* unpcklps/unpckhps, or unpcklpd/unpckhpd with the 0x66 prefix */
+make_sse_binop(unpcklps, decoding.is_operand_size_16 ?
+    _mm_unpacklo_epi64(a, b) : _mm_unpacklo_epi32(a, b))
+make_sse_binop(unpckhps, decoding.is_operand_size_16 ?
+    _mm_unpackhi_epi64(a, b) : _mm_unpackhi_epi32(a, b))
+
+/* 0x0f 0x71, 0x72, 0x73: shift by imm8 */
+make_EHelper(sse_shift_imm) {
+  if (!is_sse2(eip)) { return; }
+  __m128i a = xmm_read(id_dest);
+  int count = id_src->val;
+
+  switch ((decoding.opcode & 0xff) << 4 | decoding.ext_opcode) {
+    case 0x712: a = _mm_srli_epi16(a, count); break;
+    case 0x714: a = _mm_srai_epi16(a, count); break;
+    case 0x716: a = _mm_slli_epi16(a, count); break;
+    case 0x722: a = _mm_srli_epi32(a, count); break;
+    case 0x724: a = _mm_srai_epi32(a, count); break;
+    case 0x726: a = _mm_slli_epi32(a, count); break;
+    case 0x732: a = _mm_srli_epi64(a, count); break;
+    case 0x736: a = _mm_slli_epi64(a, count); break;
+    case 0x733: case 0x737: {
+      /* psrldq and pslldq shift by bytes */
+      uint8_t src[16], dst[16];
+      int i, n = count > 16 ? 16 : count;
+      _mm_storeu_si128((__m128i *)src, a);
+      for (i = 0; i < 16; i ++) {
+        int j = decoding.ext_opcode == 3 ? i + n : i - n;
+        dst[i] = (j >= 0 && j < 16) ? src[j] : 0;
+      }
+      a = _mm_loadu_si128((__m128i *)dst);
+      break;
+    }
+    default: exec_inv(eip); return;
+  }
+
+  xmm_write(id_dest, a);
+#ifdef DEBUG
+  static const char *name[3][8] = {
+    { NULL, NULL, "psrlw", NULL, "psraw", NULL, "psllw", NULL },
+    { NULL, NULL, "psrld", NULL, "psrad", NULL, "pslld", NULL },
+    { NULL, NULL, "psrlq", "psrldq", NULL, NULL, "psllq", "pslldq" },
+  };
+#endif
+  print_asm("%s %s,%s", name[(decoding.opcode & 0xff) - 0x71][decoding.ext_opcode],
+      id_src->str, id_dest->str);
+}
+
+/* 0x0f 0x70: pshufd, or pshuflw (0xf2) and pshufhw (0xf3) */
+make_EHelper(pshufd) {
+  uint32_t imm = id_src2->val;
+  int i;
+  if (decoding.rep == 0 && !decoding.is_operand_size_16) {
+    exec_inv(eip);
+    return;
+  }
+
+  union { __m128i v; uint32_t _32[4]; uint16_t _16[8]; } s, d;
+  s.v = xmm_read(id_src);
+  d.v = s.v;
+  if (decoding.rep == 0xf2) {
+    for (i = 0; i < 4; i ++) { d._16[i] = s._16[(imm >> (i * 2)) & 0x3]; }
+    print_asm("pshuflw %s,%s,%s", id_src2->str, id_src->str, id_dest->str);
+  }
+  else if (decoding.rep == 0xf3) {
+    for (i = 0; i < 4; i ++) { d._16[i + 4] = s._16[4 + ((imm >> (i * 2)) & 0x3)]; }
+    print_asm("pshufhw %s,%s,%s", id_src2->str, id_src->str, id_dest->str);
+  }
+  else {
+    for (i = 0; i < 4; i ++) { d._32[i] = s._32[(imm >> (i * 2)) & 0x3]; }
+    print_asm("pshufd %s,%s,%s", id_src2->str, id_src->str, id_dest->str);
+  }
+  xmm_write(id_dest, d.v);
+}
+
+/* 0x0f 0xc6: shufps, or shufpd with the 0x66 prefix */
+make_EHelper(shufps) {
+  uint32_t imm = id_src2->val;
+  if (decoding.rep) {
+    exec_inv(eip);
+    return;
+  }
+
+  union { __m128i v; uint32_t _32[4]; uint64_t _64[2]; } a, b, d;
+  a.v = xmm_read(id_dest);
+  b.v = xmm_read(id_src);
+  if (decoding.is_operand_size_16) {
+    d._64[0] = a._64[imm & 0x1];
+    d._64[1] = b._64[(imm >> 1) & 0x1];
+  }
+  else {
+    d._32[0] = a._32[imm & 0x3];
+    d._32[1] = a._32[(imm >> 2) & 0x3];
+    d._32[2] = b._32[(imm >> 4) & 0x3];
+    d._32[3] = b._32[(imm >> 6) & 0x3];
+  }
+  xmm_write(id_dest, d.v);
+
+  print_asm("shufp%c %s,%s,%s", decoding.is_operand_size_16 ? 'd' : 's',
+      id_src2->str, id_src->str, id_dest->str);
+}
+
+/* data movement */
+
+/* 0x0f 0x6f, 0x7f: movdqa (0x66) or movdqu (0xf3) */
+make_EHelper(movdq) {
+  if (decoding.rep != 0xf3 && !is_sse2(eip)) { return; }
+  xmm_write(id_dest, xmm_read(id_src));
+
+  print_asm("movdq%c %s,%s", decoding.rep ? 'u' : 'a', id_src->str, id_dest->str);
+}
+
+/* 0x0f 0x10, 0x11: movss (0xf3) and movsd (0xf2). A load from memory
+ * clears the rest of the register, a move between registers keeps it.
+ */
+static void movss(vaddr_t *eip) {
+  int width = decoding.rep == 0xf3 ? 4 : 8;
+  if (id_dest->type == OP_TYPE_MEM) {
+    if (width == 4) { vaddr_write(id_dest->addr, 4, cpu.xmm[id_src->reg]._32[0]); }
+    else { mem_write_64(id_dest->addr, cpu.xmm[id_src->reg]._64[0]); }
+  }
+  else if (id_src->type == OP_TYPE_MEM) {
+    uint64_t val = (width == 4 ? vaddr_read(id_src->addr, 4) : xmm_read_64(id_src));
+    xmm_write(id_dest, _mm_set_epi64x(0, val));
+  }
+  else if (width == 4) {
+    cpu.xmm[id_dest->reg]._32[0] = cpu.xmm[id_src->reg]._32[0];
+  }
+  else {
+    cpu.xmm[id_dest->reg]._64[0] = cpu.xmm[id_src->reg]._64[0];
+  }
+
+  print_asm("movs%c %s,%s", width == 4 ? 's' : 'd', id_src->str, id_dest->str);
+}
+
+/* 0x0f 0x10, 0x11, 0x28, 0x29, 0x2b, 0xe7: movups, movaps, movntps and
+ * movntdq, and their packed double forms. The non-temporal hint is
+ * ignored, but those forms only store to memory. 0xe7 without 0x66 is
+ * the MMX movntq.
+ */
+make_EHelper(movups) {
+  int nt = (decoding.opcode & 0xff) == 0x2b || (decoding.opcode & 0xff) == 0xe7;
+  if (decoding.rep && (decoding.opcode & 0xf0) == 0x10) { movss(eip); return; }
+  if (decoding.rep || (nt && id_dest->type != OP_TYPE_MEM) ||
+      ((decoding.opcode & 0xff) == 0xe7 && !decoding.is_operand_size_16)) {
+    exec_inv(eip);
+    return;
+  }
+  xmm_write(id_dest, xmm_read(id_src));
+
+  print_asm("mov%s %s,%s", (decoding.opcode & 0xf0) == 0x10 ? "ups" :
+      ((decoding.opcode & 0xf0) == 0x20 ? (nt ? "ntps" : "aps") : "ntdq"),
+      id_src->str, id_dest->str);
+}
+
+/* 0x0f 0x12, 0x13, 0x16, 0x17: movlps, movhps and their packed double
+ * forms, or movhlps and movlhps between registers
+ */
+make_EHelper(movlps) {
+  int high = (decoding.opcode & 0x4) != 0;
+  bool reg = (id_dest->type == OP_TYPE_REG && id_src->type == OP_TYPE_REG);
+  // no movhlpd or movlhpd
+  if (decoding.rep || (reg && decoding.is_operand_size_16)) { exec_inv(eip); return; }
+
+  if (id_dest->type == OP_TYPE_MEM) {
+    /* store */
+    mem_write_64(id_dest->addr, cpu.xmm[id_src->reg]._64[high]);
+  }
+  else if (id_src->type == OP_TYPE_MEM) {
+    /* load */
+    cpu.xmm[id_dest->reg]._64[high] = xmm_read_64(id_src);
+  }
+  else {
+    /* movhlps, movlhps */
+    cpu.xmm[id_dest->reg]._64[high] = cpu.xmm[id_src->reg]._64[!high];
+  }
+
+  print_asm("mov%cp%c %s,%s", high ? 'h' : 'l', decoding.is_operand_size_16 ? 'd' : 's',
+      id_src->str, id_dest->str);
+}
+
+/* 0x0f 0x6e: movd r/m32 to xmm */
+make_EHelper(movd_E2xmm) {
+  if (!is_sse2(eip)) { return; }
+  rm_load(id_src);
+  xmm_write(id_dest, _mm_cvtsi32_si128(id_src->val));
+
+  print_asm("movd %s,%s", id_src->str, id_dest->str);
+}
+
+/* 0x0f 0x7e: movd xmm to r/m32 (0x66), or movq xmm/m64 to xmm (0xf3) */
+make_EHelper(movd_xmm2E) {
+  if (decoding.rep == 0xf3) {
+    /* the operands are the other way round */
+    uint64_t val = xmm_read_64(id_dest);
+    xmm_write(id_src, _mm_set_epi64x(0, val));
+    print_asm("movq %s,%s", id_dest->str, id_src->str);
+    return;
+  }
+  if (!is_sse2(eip)) { return; }
+
+  t0 = cpu.xmm[id_src->reg]._32[0];
+  id_dest->width = 4;
+  operand_write(id_dest, &t0);
+#ifdef DEBUG
+  if (id_dest->type == OP_TYPE_REG) {
+    sprintf(id_dest->str, "%%%s", reg_name(id_dest->reg, 4));
+  }
+#endif
+
+  print_asm("movd %s,%s", id_src->str, id_dest->str);
+}
+
+/* 0x0f 0xd6: movq xmm to xmm/m64, zeroing the high half of a register */
+make_EHelper(movq_G2E) {
+  if (!is_sse2(eip)) { return; }
+  uint64_t val = cpu.xmm[id_src->reg]._64[0];
+  if (id_dest->type == OP_TYPE_MEM) {
+    mem_write_64(id_dest->addr, val);
+  }
+  else {
+    xmm_write(id_dest, _mm_set_epi64x(0, val));
+  }
+
+  print_asm("movq %s,%s", id_src->str, id_dest->str);
+}
+
+/* 0x0f 0xd7: pmovmskb */
+make_EHelper(pmovmskb) {
+  if (!is_sse2(eip)) { return; }
+  t0 = _mm_movemask_epi8(xmm_read(id_src));
+  rtl_sr_l(id_dest->reg, &t0);
+
+  print_asm("pmovmskb %s,%s", id_src->str, id_dest->str);
+}
+
+/* 0x0f 0xc5: pextrw */
+make_EHelper(pextrw) {
+  if (!is_sse2(eip)) { return; }
+  t0 = cpu.xmm[id_src->reg]._16[id_src2->val & 0x7];
+  rtl_sr_l(id_dest->reg, &t0);
+
+  print_asm("pextrw %s,%s,%s", id_src2->str, id_src->str, id_dest->str);
+}
+
+/* 0x0f 0xc4: pinsrw */
+make_EHelper(pinsrw) {
+  if (!is_sse2(eip)) { return; }
+  rm_load(id_src);
+  cpu.xmm[id_dest->reg]._16[id_src2->val & 0x7] = id_src->val;
+
+  print_asm("pinsrw %s,%s,%s", id_src2->str, id_src->str, id_dest->str);
+}
+
+/* floating point
+ *
+ * The operations run on the host SSE unit under the guest MXCSR, so the
+ * rounding control, DAZ and FTZ apply as on hardware. All exceptions
+ * behave as masked, as on the x87: their flags are recorded in the
+ * MXCSR, and #XM is never raised.
+ */
+
+/* the forms selected by the prefix: packed single, packed double (0x66),
+ * scalar single (0xf3) and scalar double (0xf2)
+ */
+enum { FP_PS, FP_PD, FP_SS, FP_SD };
+
+#ifdef DEBUG
+static const char *fp_suffix[] = { "ps", "pd", "ss", "sd" };
+#endif
+
+typedef union {
+  __m128i i;
+  __m128 s;
+  __m128d d;
+} XMM;
+
+/* Keep the operands and the result in registers at this point, so that
+ * the compiler can not move the computation across the MXCSR switch.
+ */
+#define SSE_BARRIER(x) asm volatile ("" : "+x"(x))
+
+static inline int fp_form(void) {
+  switch (decoding.rep) {
+    case 0xf3: return FP_SS;
+    case 0xf2: return FP_SD;
+    default: return decoding.is_operand_size_16 ? FP_PD : FP_PS;
+  }
+}
+
+/* The source operand. A scalar form only reads 4 or 8 bytes from memory,
+ * which are zero extended.
+ */
+static inline __m128i fp_read(Operand *op, int width) {
+  if (op->type == OP_TYPE_REG || width == 16) {
+    return xmm_read(op);
+  }
+  return _mm_set_epi64x(0, width == 4 ? vaddr_read(op->addr, 4) : xmm_read_64(op));
+}
+
+static inline int fp_width(int form) {
+  switch (form) {
+    case FP_SS: return 4;
+    case FP_SD: return 8;
+    default: return 16;
+  }
+}
+
+static inline uint32_t fp_begin(void) {
+  uint32_t host = _mm_getcsr();
+  _mm_setcsr((cpu.mxcsr | 0x1f80) & ~0x3f);
+  return host;
+}
+
+static inline void fp_end(uint32_t host) {
+  cpu.mxcsr |= _mm_getcsr() & 0x3f;
+  _mm_setcsr(host);
+}
+
+/* dest <- dest op src, in any of the four forms */
+#define make_sse_fp_binop(name, op)                                           \
+  make_EHelper(name) {                                                        \
+    int form = fp_form();                                                     \
+    XMM a, b, r;                                                              \
+    a.i = xmm_read(id_dest);                                                  \
+    b.i = fp_read(id_src, fp_width(form));                                    \
+    uint32_t host = fp_begin();                                               \
+    SSE_BARRIER(a.i);                                                         \
+    SSE_BARRIER(b.i);                                                         \
+    switch (form) {                                                           \
+      case FP_PS: r.s = _mm_##op##_ps(a.s, b.s); break;                      \
+      case FP_PD: r.d = _mm_##op##_pd(a.d, b.d); break;                      \
+      case FP_SS: r.s = _mm_##op##_ss(a.s, b.s); break;                      \
+      default:    r.d = _mm_##op##_sd(a.d, b.d); break;                      \
+    }                                                                         \
+    SSE_BARRIER(r.i);                                                         \
+    fp_end(host);                                                             \
+    xmm_write(id_dest, r.i);                                                  \
+    print_asm(str(op) "%s %s,%s", fp_suffix[form], id_src->str, id_dest->str); \
+  }
+
+make_sse_fp_binop(addps, add)
+make_sse_fp_binop(subps, sub)
+make_sse_fp_binop(mulps, mul)
+make_sse_fp_binop(divps, div)
+make_sse_fp_binop(minps, min)
+make_sse_fp_binop(maxps, max)
+
+/* 0x0f 0x51, 0x52, 0x53: sqrt in any form, rsqrt and rcp in the single
+ * precision forms. The scalar forms keep the rest of dest.
+ */
+make_EHelper(sqrtps) {
+  int op = decoding.opcode & 0xff;
+  int form = fp_form();
+  XMM a, b, r;
+  if (op != 0x51 && (form == FP_PD || form == FP_SD)) {
+    exec_inv(eip);
+    return;
+  }
+
+  a.i = xmm_read(id_dest);
+  b.i = fp_read(id_src, fp_width(form));
+  uint32_t host = fp_begin();
+  SSE_BARRIER(a.i);
+  SSE_BARRIER(b.i);
+  switch (op << 4 | form) {
+    case 0x510: r.s = _mm_sqrt_ps(b.s); break;
+    case 0x511: r.d = _mm_sqrt_pd(b.d); break;
+    case 0x512: r.s = _mm_move_ss(a.s, _mm_sqrt_ss(b.s)); break;
+    case 0x513: r.d = _mm_sqrt_sd(a.d, b.d); break;
+    case 0x520: r.s = _mm_rsqrt_ps(b.s); break;
+    case 0x522: r.s = _mm_move_ss(a.s, _mm_rsqrt_ss(b.s)); break;
+    case 0x530: r.s = _mm_rcp_ps(b.s); break;
+    default:    r.s = _mm_move_ss(a.s, _mm_rcp_ss(b.s)); break;
+  }
+  SSE_BARRIER(r.i);
+  fp_end(host);
+  xmm_write(id_dest, r.i);
+
+#ifdef DEBUG
+  static const char *name[] = { "sqrt", "rsqrt", "rcp" };
+#endif
+  print_asm("%s%s %s,%s", name[op - 0x51], fp_suffix[form], id_src->str, id_dest->str);
+}
+
+/* 0x0f 0xc2: cmpps and the other forms. The predicate is in the low three
+ * bits of imm8. The result is a mask of all ones or zeros per element.
+ */
+#define CMP_CASES(r, form, a, b)                                              \
+  case 0: r = _mm_cmpeq_##form(a, b); break;                                  \
+  case 1: r = _mm_cmplt_##form(a, b); break;                                  \
+  case 2: r = _mm_cmple_##form(a, b); break;                                  \
+  case 3: r = _mm_cmpunord_##form(a, b); break;                               \
+  case 4: r = _mm_cmpneq_##form(a, b); break;                                 \
+  case 5: r = _mm_cmpnlt_##form(a, b); break;                                 \
+  case 6: r = _mm_cmpnle_##form(a, b); break;                                 \
+  default: r = _mm_cmpord_##form(a, b); break;
+
+make_EHelper(cmpps) {
+  int form = fp_form();
+  int pred = id_src2->val & 0x7;
+  XMM a, b, r;
+  a.i = xmm_read(id_dest);
+  b.i = fp_read(id_src, fp_width(form));
+  uint32_t host = fp_begin();
+  SSE_BARRIER(a.i);
+  SSE_BARRIER(b.i);
+  switch (form) {
+    case FP_PS: switch (pred) { CMP_CASES(r.s, ps, a.s, b.s) } break;
+    case FP_PD: switch (pred) { CMP_CASES(r.d, pd, a.d, b.d) } break;
+    case FP_SS: switch (pred) { CMP_CASES(r.s, ss, a.s, b.s) } break;
+    default:    switch (pred) { CMP_CASES(r.d, sd, a.d, b.d) } break;
+  }
+  SSE_BARRIER(r.i);
+  fp_end(host);
+  xmm_write(id_dest, r.i);
+
+  print_asm("cmp%s %s,%s,%s", fp_suffix[form], id_src2->str, id_src->str, id_dest->str);
+}
+
+/* 0x0f 0x2e, 0x2f: ucomiss and comiss, or ucomisd and comisd with the 0x66
+ * prefix. The result is in ZF, PF and CF as for fcomi. comiss also raises
+ * the invalid operation exception for a quiet NaN.
+ */
+make_EHelper(comiss) {
+  bool quiet = (decoding.opcode & 0xff) == 0x2e;
+  bool dbl = decoding.is_operand_size_16;
+  XMM a, b;
+  int lt, eq, unord;
+  if (decoding.rep) {
+    exec_inv(eip);
+    return;
+  }
+
+  a.i = xmm_read(id_dest);
+  b.i = fp_read(id_src, dbl ? 8 : 4);
+  uint32_t host = fp_begin();
+  SSE_BARRIER(a.i);
+  SSE_BARRIER(b.i);
+  if (dbl) {
+    double x = _mm_cvtsd_f64(a.d), y = _mm_cvtsd_f64(b.d);
+    /* `<' is a signaling compare, `==' a quiet one */
+    lt = quiet ? isless(x, y) : x < y;
+    eq = x == y;
+    unord = isunordered(x, y);
+  }
+  else {
+    float x = _mm_cvtss_f32(a.s), y = _mm_cvtss_f32(b.s);
+    lt = quiet ? isless(x, y) : x < y;
+    eq = x == y;
+    unord = isunordered(x, y);
+  }
+  fp_end(host);
+
+  cpu.eflags.ZF = eq || unord;
+  cpu.eflags.PF = unord;
+  cpu.eflags.CF = lt || unord;
+  cpu.eflags.OF = 0;
+  cpu.eflags.SF = 0;
+
+  print_asm("%scomis%c %s,%s", quiet ? "u" : "", dbl ? 'd' : 's', id_src->str, id_dest->str);
+}
+
+/* 0x0f 0x50: movmskps, or movmskpd with the 0x66 prefix */
+make_EHelper(movmskps) {
+  XMM a;
+  if (decoding.rep || id_src->type != OP_TYPE_REG) {
+    exec_inv(eip);
+    return;
+  }
+  a.i = xmm_read(id_src);
+  t0 = decoding.is_operand_size_16 ? _mm_movemask_pd(a.d) : _mm_movemask_ps(a.s);
+  rtl_sr_l(id_dest->reg, &t0);
+
+  print_asm("movmskp%c %s,%s", decoding.is_operand_size_16 ? 'd' : 's', id_src->str, id_dest->str);
+}
+
+/* conversions */
+
+/* 0x0f 0x2a: cvtsi2ss (0xf3) and cvtsi2sd (0xf2) from r/m32. The forms
+ * from an MMX register are not supported.
+ */
+make_EHelper(cvtsi2ss) {
+  int form = fp_form();
+  XMM a, r;
+  if (form != FP_SS && form != FP_SD) {
+    exec_inv(eip);
+    return;
+  }
+
+  rm_load(id_src);
+  a.i = xmm_read(id_dest);
+  uint32_t host = fp_begin();
+  SSE_BARRIER(a.i);
+  if (form == FP_SS) { r.s = _mm_cvtsi32_ss(a.s, id_src->val); }
+  else { r.d = _mm_cvtsi32_sd(a.d, id_src->val); }
+  SSE_BARRIER(r.i);
+  fp_end(host);
+  xmm_write(id_dest, r.i);
+
+  print_asm("cvtsi2%s %s,%s", fp_suffix[form], id_src->str, id_dest->str);
+}
+
+/* 0x0f 0x2c, 0x2d: cvttss2si and cvtss2si (0xf3), cvttsd2si and cvtsd2si
+ * (0xf2) to r32. An out of range value gives the integer indefinite.
+ */
+make_EHelper(cvtss2si) {
+  bool chop = (decoding.opcode & 0xff) == 0x2c;
+  int form = fp_form();
+  XMM b;
+  if (form != FP_SS && form != FP_SD) {
+    exec_inv(eip);
+    return;
+  }
+
+  b.i = fp_read(id_src, fp_width(form));
+  uint32_t host = fp_begin();
+  SSE_BARRIER(b.i);
+  if (form == FP_SS) { t0 = chop ? _mm_cvttss_si32(b.s) : _mm_cvtss_si32(b.s); }
+  else { t0 = chop ? _mm_cvttsd_si32(b.d) : _mm_cvtsd_si32(b.d); }
+  fp_end(host);
+  rtl_sr_l(id_dest->reg, &t0);
+
+  print_asm("cvt%s%s2si %s,%s", chop ? "t" : "", fp_suffix[form], id_src->str, id_dest->str);
+}
+
+/* 0x0f 0x5a: cvtps2pd, cvtpd2ps (0x66), cvtss2sd (0xf3), cvtsd2ss (0xf2).
+ * cvtps2pd reads two singles.
+ */
+make_EHelper(cvtps2pd) {
+  static const int width[] = { 8, 16, 4, 8 };
+  int form = fp_form();
+  XMM a, b, r;
+  a.i = xmm_read(id_dest);
+  b.i = fp_read(id_src, width[form]);
+  uint32_t host = fp_begin();
+  SSE_BARRIER(a.i);
+  SSE_BARRIER(b.i);
+  switch (form) {
+    case FP_PS: r.d = _mm_cvtps_pd(b.s); break;
+    case FP_PD: r.s = _mm_cvtpd_ps(b.d); break;
+    case FP_SS: r.d = _mm_cvtss_sd(a.d, b.s); break;
+    default:    r.s = _mm_cvtsd_ss(a.s, b.d); break;
+  }
+  SSE_BARRIER(r.i);
+  fp_end(host);
+  xmm_write(id_dest, r.i);
+
+#ifdef DEBUG
+  static const char *name[] = { "cvtps2pd", "cvtpd2ps", "cvtss2sd", "cvtsd2ss" };
+#endif
+  print_asm("%s %s,%s", name[form], id_src->str, id_dest->str);
+}
+
+/* 0x0f 0x5b: cvtdq2ps, cvtps2dq (0x66) and cvttps2dq (0xf3)
+ * 0x0f 0xe6: cvttpd2dq (0x66), cvtpd2dq (0xf2) and cvtdq2pd (0xf3)
+ * cvtdq2pd reads two integers, and the pd2dq forms clear the high half.
+ */
+make_EHelper(cvtdq2ps) {
+  int op = (decoding.opcode & 0xff) << 4 | fp_form();
+  XMM b, r;
+  if (op == 0x5b3 || op == 0xe60) {
+    exec_inv(eip);
+    return;
+  }
+
+  b.i = fp_read(id_src, op == 0xe62 ? 8 : 16);
+  uint32_t host = fp_begin();
+  SSE_BARRIER(b.i);
+  switch (op) {
+    case 0x5b0: r.s = _mm_cvtepi32_ps(b.i); break;
+    case 0x5b1: r.i = _mm_cvtps_epi32(b.s); break;
+    case 0x5b2: r.i = _mm_cvttps_epi32(b.s); break;
+    case 0xe61: r.i = _mm_cvttpd_epi32(b.d); break;
+    case 0xe63: r.i = _mm_cvtpd_epi32(b.d); break;
+    default:    r.d = _mm_cvtepi32_pd(b.i); break;
+  }
+  SSE_BARRIER(r.i);
+  fp_end(host);
+  xmm_write(id_dest, r.i);
+
+#ifdef DEBUG
+  const char *name;
+  switch (op) {
+    case 0x5b0: name = "cvtdq2ps"; break;
+    case 0x5b1: name = "cvtps2dq"; break;
+    case 0x5b2: name = "cvttps2dq"; break;
+    case 0xe61: name = "cvttpd2dq"; break;
+    case 0xe63: name = "cvtpd2dq"; break;
+    default:    name = "cvtdq2pd"; break;
+  }
+#endif
+  print_asm("%s %s,%s", name, id_src->str, id_dest->str);
+}
+
+/* 0x0f 0xae: fences, fxsave, fxrstor, ldmxcsr and stmxcsr. The fxsave
+ * image is 512 bytes: the x87 state, the MXCSR at 24 and its mask at
+ * 28, and the XMM registers from 160.
+ */
+#define MXCSR_MASK 0xffff
+
+static void fxsave(vaddr_t addr) {
+  int i, j;
+  fpu_fxsave(addr);
+  vaddr_write(addr + 24, 4, cpu.mxcsr);
+  vaddr_write(addr + 28, 4, MXCSR_MASK);
+  for (i = 0; i < 8; i ++) {
+    for (j = 0; j < 4; j ++) {
+      vaddr_write(addr + 160 + i * 16 + j * 4, 4, cpu.xmm[i]._32[j]);
+    }
+  }
+}
+
+static void fxrstor(vaddr_t addr) {
+  int i, j;
+  fpu_fxrstor(addr);
+  cpu.mxcsr = vaddr_read(addr + 24, 4) & MXCSR_MASK;
+  for (i = 0; i < 8; i ++) {
+    for (j = 0; j < 4; j ++) {
+      cpu.xmm[i]._32[j] = vaddr_read(addr + 160 + i * 16 + j * 4, 4);
+    }
+  }
+}
+
+make_EHelper(sse_ctl) {
+  if (id_dest->type == OP_TYPE_MEM) {
+    switch (decoding.ext_opcode) {
+      case 0: fxsave(id_dest->addr); print_asm("fxsave %s", id_dest->str); return;
+      case 1: fxrstor(id_dest->addr); print_asm("fxrstor %s", id_dest->str); return;
+      case 2: cpu.mxcsr = vaddr_read(id_dest->addr, 4); print_asm("ldmxcsr %s", id_dest->str); return;
+      case 3: vaddr_write(id_dest->addr, 4, cpu.mxcsr); print_asm("stmxcsr %s", id_dest->str); return;
+      default: exec_inv(eip); return;
+    }
+  }
+
+  switch (decoding.ext_opcode) {
+    case 5: print_asm("lfence"); return;
+    case 6: __sync_synchronize(); print_asm("mfence"); return;
+    case 7: print_asm("sfence"); return;
+    default: exec_inv(eip); return;
+  }
+}
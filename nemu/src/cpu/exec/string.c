@@ -0,0 +1,291 @@
+#include "cpu/exec.h"
+#include "device/mmio.h"
+#include "memory/mmu.h"
+#include "memory/dirty.h"
+
+#ifdef DIFF_TEST
+void diff_test_skip_qemu();
+void difftest_mark_dirty(paddr_t, int);
+#endif
+
+/* A REP-prefixed string instruction is executed as a whole. When the
+ * source and the destination of a run of elements are plain RAM inside
+ * one page, the run is done by the host directly. Otherwise, e.g. when
+ * touching MMIO, crossing a page or with DF set, elements are moved one
+ * by one through the normal memory interface. A page fault in the
+ * middle keeps the elements already done.
+ */
+
+void update_restart_point(void);
+
+static inline int str_delta(int width) {
+  return cpu.eflags.DF ? -width : width;
+}
+
+/* The number of elements of `width' bytes from `addr' upward which do
+ * not cross a page.
+ */
+static inline uint32_t page_room(vaddr_t addr, int width) {
+  return (PAGE_SIZE - (addr & (PAGE_SIZE - 1))) / width;
+}
+
+/* Return the host address of [addr, addr + len) if it is plain RAM
+ * inside one page, otherwise NULL.
+ */
+static inline uint8_t *ram_ptr(vaddr_t addr, uint32_t len, bool is_write) {
+  paddr_t paddr = page_translate(addr, is_write);
+  if (is_mmio(paddr) != -1 || paddr + len > PMEM_SIZE) {
+    return NULL;
+  }
+#ifdef DIFF_TEST
+  if (is_write) {
+    difftest_mark_dirty(paddr, len);
+  }
+#endif
+  return guest_to_host(paddr);
+}
+
+/* The number of elements the next host run can cover, 0 for none. */
+static inline uint32_t run_len(int width, bool use_esi, bool use_edi) {
+  if (cpu.eflags.DF) {
+    return 0;
+  }
+  uint32_t n = cpu.ecx;
+  if (use_esi && page_room(cpu.esi, width) < n) {
+    n = page_room(cpu.esi, width);
+  }
+  if (use_edi && page_room(cpu.edi, width) < n) {
+    n = page_room(cpu.edi, width);
+  }
+  return n;
+}
+
+static inline uint32_t host_load(const uint8_t *p, int width) {
+  uint32_t val = 0;
+  memcpy(&val, p, width);
+  return val;
+}
+
+/* Set the flags as `cmp' does for `dest - src'. */
+static inline void cmp_flags(rtlreg_t dest, rtlreg_t src, int width) {
+  rtl_sub(&t2, &dest, &src);
+  rtl_sltu(&t3, &dest, &t2);
+  rtl_update_ZFSF(&t2, width);
+
+  rtl_set_CF(&t3);
+
+  rtl_xor(&t0, &dest, &src);
+  rtl_xor(&t1, &dest, &t2);
+  rtl_and(&t0, &t0, &t1);
+  rtl_msb(&t0, &t0, width);
+  rtl_set_OF(&t0);
+}
+
+/* Whether a REPE/REPNE loop goes on after a comparison. */
+static inline bool rep_cond(void) {
+  return decoding.rep == 0xf3 ? cpu.eflags.ZF : !cpu.eflags.ZF;
+}
+
+static inline void string_end(const char *name, int width) {
+  print_asm("%s%s%c", (decoding.rep == 0 ? "" : (decoding.rep == 0xf3 ? "rep " : "repne ")),
+      name, suffix_char(width));
+
+#ifdef DIFF_TEST
+  // QEMU stops after every iteration when single stepping
+  if (decoding.rep) {
+    diff_test_skip_qemu();
+  }
+#endif
+}
+
+static inline void movs_one(int width) {
+  rtl_lm(&t0, &cpu.esi, width);
+  rtl_sm(&cpu.edi, width, &t0);
+  cpu.esi += str_delta(width);
+  cpu.edi += str_delta(width);
+}
+
+make_EHelper(movs) {
+  int width = id_dest->width;
+
+  if (!decoding.rep) {
+    movs_one(width);
+  }
+  while (decoding.rep && cpu.ecx != 0) {
+    update_restart_point();
+    uint32_t n = run_len(width, true, true);
+    uint32_t len = n * width;
+    uint8_t *src, *dest;
+    // an overlapping forward copy repeats the pattern, leave it to the slow path
+    if (n > 0 && (src = ram_ptr(cpu.esi, len, false)) != NULL &&
+        (dest = ram_ptr(cpu.edi, len, true)) != NULL && (dest <= src || dest >= src + len)) {
+      memmove(dest, src, len);
+      dirty_mark(host_to_guest(dest));
+      cpu.esi += len;
+      cpu.edi += len;
+      cpu.ecx -= n;
+    }
+    else {
+      movs_one(width);
+      cpu.ecx --;
+    }
+  }
+
+  string_end("movs", width);
+}
+
+static inline void stos_one(int width) {
+  rtl_sm(&cpu.edi, width, &cpu.eax);
+  cpu.edi += str_delta(width);
+}
+
+make_EHelper(stos) {
+  int width = id_dest->width;
+
+  if (!decoding.rep) {
+    stos_one(width);
+  }
+  while (decoding.rep && cpu.ecx != 0) {
+    update_restart_point();
+    uint32_t n = run_len(width, false, true);
+    uint8_t *dest;
+    if (n > 0 && (dest = ram_ptr(cpu.edi, n * width, true)) != NULL) {
+      if (width == 1) {
+        memset(dest, cpu.eax & 0xff, n);
+      }
+      else {
+        int i;
+        for (i = 0; i < n; i ++) {
+          memcpy(dest + i * width, &cpu.eax, width);
+        }
+      }
+      dirty_mark(host_to_guest(dest));
+      cpu.edi += n * width;
+      cpu.ecx -= n;
+    }
+    else {
+      stos_one(width);
+      cpu.ecx --;
+    }
+  }
+
+  string_end("stos", width);
+}
+
+make_EHelper(lods) {
+  int width = id_dest->width;
+
+  do {
+    if (decoding.rep && cpu.ecx == 0) {
+      break;
+    }
+    update_restart_point();
+    rtl_lm(&t0, &cpu.esi, width);
+    rtl_sr(R_EAX, width, &t0);
+    cpu.esi += str_delta(width);
+    if (decoding.rep) {
+      cpu.ecx --;
+    }
+  } while (decoding.rep);
+
+  string_end("lods", width);
+}
+
+/* Compare `dest' with `src' element by element in host memory until the
+ * REPE/REPNE condition fails or `n' elements are done. Return the number
+ * of elements compared, and leave the last pair in `dest' and `src'.
+ */
+static inline uint32_t host_compare(const uint8_t *p_dest, const uint8_t *p_src, bool dest_is_eax,
+    uint32_t n, int width, rtlreg_t *dest, rtlreg_t *src) {
+  bool want_equal = (decoding.rep == 0xf3);
+  uint32_t i = 0;
+  while (i < n) {
+    if (!dest_is_eax) {
+      *dest = host_load(p_dest + i * width, width);
+    }
+    *src = host_load(p_src + i * width, width);
+    i ++;
+    if ((*dest == *src) != want_equal) {
+      break;
+    }
+  }
+  return i;
+}
+
+make_EHelper(cmps) {
+  int width = id_dest->width;
+  rtlreg_t dest, src;
+
+  do {
+    if (decoding.rep && cpu.ecx == 0) {
+      break;
+    }
+    update_restart_point();
+
+    uint32_t n = (decoding.rep ? run_len(width, true, true) : 0);
+    uint8_t *p_dest, *p_src;
+    if (n > 0 && (p_dest = ram_ptr(cpu.esi, n * width, false)) != NULL &&
+        (p_src = ram_ptr(cpu.edi, n * width, false)) != NULL) {
+      n = host_compare(p_dest, p_src, false, n, width, &dest, &src);
+      cpu.esi += n * width;
+      cpu.edi += n * width;
+      cpu.ecx -= n;
+    }
+    else {
+      rtl_lm(&dest, &cpu.esi, width);
+      rtl_lm(&src, &cpu.edi, width);
+      cpu.esi += str_delta(width);
+      cpu.edi += str_delta(width);
+      if (decoding.rep) {
+        cpu.ecx --;
+      }
+    }
+    cmp_flags(dest, src, width);
+  } while (decoding.rep && rep_cond());
+
+  string_end("cmps", width);
+}
+
+make_EHelper(scas) {
+  int width = id_dest->width;
+  rtlreg_t dest, src;
+
+  rtl_lr(&dest, R_EAX, width);
+  do {
+    if (decoding.rep && cpu.ecx == 0) {
+      break;
+    }
+    update_restart_point();
+
+    uint32_t n = (decoding.rep ? run_len(width, false, true) : 0);
+    uint8_t *p_src;
+    if (n > 0 && (p_src = ram_ptr(cpu.edi, n * width, false)) != NULL) {
+      n = host_compare(NULL, p_src, true, n, width, &dest, &src);
+      cpu.edi += n * width;
+      cpu.ecx -= n;
+    }
+    else {
+      rtl_lm(&src, &cpu.edi, width);
+      cpu.edi += str_delta(width);
+      if (decoding.rep) {
+        cpu.ecx --;
+      }
+    }
+    cmp_flags(dest, src, width);
+  } while (decoding.rep && rep_cond());
+
+  string_end("scas", width);
+}
+
+make_EHelper(cld) {
+  rtl_set_DF(&tzero);
+
+  print_asm("cld");
+}
+
+make_EHelper(std) {
+  rtl_li(&t0, 1);
+  rtl_set_DF(&t0);
+
+  print_asm("std");
+}
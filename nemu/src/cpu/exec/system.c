@@ -3,6 +3,9 @@
 void diff_test_skip_qemu();
 void diff_test_skip_nemu();
 extern void raise_intr(uint8_t NO, vaddr_t ret_addr);
+void raise_exception(uint8_t, uint32_t) __attribute__((noreturn));
+
+#define GP_VECTOR 13
 
 make_EHelper(lidt) {
   rtl_li(&t0, id_dest->addr);
@@ -50,6 +53,142 @@ make_EHelper(iret) {
   print_asm("iret");
 }
 
+make_EHelper(pushf) {
+  rtl_push(&cpu.eflags.val);
+
+  print_asm("pushf");
+}
+
+make_EHelper(popf) {
+  rtl_pop(&t1);
+  memcpy(&cpu.eflags, &t1, sizeof(cpu.eflags));
+
+  print_asm("popf");
+}
+
+make_EHelper(cli) {
+  cpu.eflags.IF = 0;
+
+  print_asm("cli");
+}
+
+/* An interrupt is recognized only after the next instruction, so that
+ * an interrupt pending before "sti; hlt" wakes the hlt up.
+ */
+make_EHelper(sti) {
+  if (!cpu.eflags.IF) {
+    cpu.intr_shadow = true;
+  }
+  cpu.eflags.IF = 1;
+
+  print_asm("sti");
+}
+
+/* The CPU waits in exec_wrapper() for an interrupt. */
+make_EHelper(hlt) {
+  cpu.halted = true;
+
+  print_asm("hlt");
+
+#ifdef DIFF_TEST
+  // QEMU would wait for an interrupt which never comes
+  extern void diff_test_skip_qemu();
+  diff_test_skip_qemu();
+#endif
+}
+
+/* Report family 6 with the features NEMU implements: FPU, PSE, SEP,
+ * CMOV, FXSR, SSE and SSE2. The vendor string is "NJU NEMU x86".
+ */
+#define CPUID_FPU  (1 << 0)
+#define CPUID_PSE  (1 << 3)
+#define CPUID_SEP  (1 << 11)
+#define CPUID_CMOV (1 << 15)
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE  (1 << 25)
+#define CPUID_SSE2 (1 << 26)
+
+make_EHelper(cpuid) {
+  switch (cpu.eax) {
+    case 0:
+      cpu.eax = 1;
+      cpu.ebx = 0x20554a4e;  // "NJU "
+      cpu.edx = 0x554d454e;  // "NEMU"
+      cpu.ecx = 0x36387820;  // " x86"
+      break;
+    case 1:
+      cpu.eax = 0x600;
+      cpu.ebx = cpu.ecx = 0;
+      cpu.edx = CPUID_FPU | CPUID_PSE | CPUID_SEP | CPUID_CMOV | CPUID_FXSR |
+        CPUID_SSE | CPUID_SSE2;
+      break;
+    default:
+      cpu.eax = cpu.ebx = cpu.ecx = cpu.edx = 0;
+      break;
+  }
+
+  print_asm("cpuid");
+
+#ifdef DIFF_TEST
+  diff_test_skip_qemu();
+#endif
+}
+
+/* Only the SYSENTER MSRs are implemented; the others raise #GP. */
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+static uint32_t *msr(uint32_t index) {
+  switch (index) {
+    case MSR_SYSENTER_CS: return &cpu.sysenter.cs;
+    case MSR_SYSENTER_ESP: return &cpu.sysenter.esp;
+    case MSR_SYSENTER_EIP: return &cpu.sysenter.eip;
+    default: raise_exception(GP_VECTOR, 0);
+  }
+}
+
+make_EHelper(rdmsr) {
+  cpu.eax = *msr(cpu.ecx);
+  cpu.edx = 0;
+
+  print_asm("rdmsr");
+}
+
+make_EHelper(wrmsr) {
+  *msr(cpu.ecx) = cpu.eax;
+
+  print_asm("wrmsr");
+}
+
+/* SYSENTER enters the flat code segment in SYSENTER_CS at SYSENTER_EIP
+ * with the stack at SYSENTER_ESP. Nothing is saved: by convention the
+ * caller passes its stack pointer in ECX and its return address in EDX,
+ * which SYSEXIT loads back.
+ */
+make_EHelper(sysenter) {
+  if (cpu.sysenter.cs == 0) raise_exception(GP_VECTOR, 0);
+
+  cpu.eflags.IF = 0;
+  cpu.cs = cpu.sysenter.cs & ~0x3;
+  cpu.esp = cpu.sysenter.esp;
+  decoding.jmp_eip = cpu.sysenter.eip;
+  decoding.is_jmp = 1;
+
+  print_asm("sysenter");
+}
+
+make_EHelper(sysexit) {
+  if (cpu.sysenter.cs == 0) raise_exception(GP_VECTOR, 0);
+
+  cpu.cs = (cpu.sysenter.cs + 16) | 0x3;
+  cpu.esp = cpu.ecx;
+  decoding.jmp_eip = cpu.edx;
+  decoding.is_jmp = 1;
+
+  print_asm("sysexit");
+}
+
 uint32_t pio_read(ioaddr_t, int);
 void pio_write(ioaddr_t, int, uint32_t);
 
@@ -1,5 +1,9 @@
 #include "cpu/exec.h"
 #include "memory/mmu.h"
+#include "device/intr.h"
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 void raise_intr(uint8_t NO, vaddr_t ret_addr) {
   /* TODO: Trigger an interrupt/exception with ``NO''.
@@ -23,4 +27,15 @@ void raise_intr(uint8_t NO, vaddr_t ret_addr) {
   decoding.jmp_eip = offset;
 }
 
-void dev_raise_intr() { cpu.INTR = 1; }
+/* Exceptions like #PF push an error code after the return address. */
+void raise_intr_error(uint8_t NO, vaddr_t ret_addr, uint32_t error_code) {
+  raise_intr(NO, ret_addr);
+  rtl_li(&t0, error_code);
+  rtl_push(&t0);
+}
+
+void dev_raise_intr(int cpu_no, int irq) {
+  __sync_fetch_and_or(&cpus[cpu_no]->INTR, 1u << irq);
+  // the CPU may sleep on its interrupt lines in cpu_idle()
+  syscall(SYS_futex, &cpus[cpu_no]->INTR, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
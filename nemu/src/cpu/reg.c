@@ -2,7 +2,10 @@
 #include <stdlib.h>
 #include <time.h>
 
-CPU_state cpu;
+__thread CPU_state cpu;
+__thread uint64_t cpu_steps = 0;
+CPU_state *cpus[MAX_CPU];
+int nr_cpu = 1;
 
 const char *regsl[] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi"};
 const char *regsw[] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"};
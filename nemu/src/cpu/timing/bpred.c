@@ -0,0 +1,171 @@
+#include "nemu.h"
+#include "cpu/timing.h"
+#include <stdlib.h>
+
+/* Branch prediction. The direction of a conditional branch is predicted
+ * by 2-bit counters indexed by the EIP (bimodal), or by the EIP XORed
+ * with the global history (gshare), or statically as taken only when
+ * the branch goes backward. The target of a taken branch comes from a
+ * direct-mapped BTB, and the target of a return from the return stack.
+ *
+ * A wrong direction or a wrong indirect target is a misprediction,
+ * resolved at the execute stage. A direct target which is missing in
+ * the BTB is a misfetch, resolved at the decode stage.
+ */
+
+int bpred_type = BPRED_GSHARE;
+
+static uint8_t pht[BPRED_TABLE_SIZE];
+static uint32_t ghr = 0;
+
+static struct {
+  bool valid;
+  vaddr_t eip, target;
+} btb[BTB_SIZE];
+
+static vaddr_t ras[RAS_SIZE];
+static int ras_top = 0, ras_size = 0;
+
+/* the statistics of each branch, for the report */
+typedef struct {
+  vaddr_t eip;
+  int type;
+  uint64_t count, mispredict;
+} BranchStat;
+
+static BranchStat *branch_stat;
+static uint32_t branch_stat_size = 1024, nr_branch = 0;
+
+static BranchStat *branch_stat_lookup(vaddr_t eip) {
+  uint32_t mask = branch_stat_size - 1;
+  uint32_t i = (eip * 0x9e3779b1) & mask;
+  for (; branch_stat[i].count != 0; i = (i + 1) & mask) {
+    if (branch_stat[i].eip == eip) return &branch_stat[i];
+  }
+
+  // a new branch, keep the table at most half full
+  if ((nr_branch + 1) * 2 > branch_stat_size) {
+    BranchStat *old = branch_stat;
+    uint32_t old_size = branch_stat_size, j;
+    branch_stat_size *= 2;
+    branch_stat = calloc(branch_stat_size, sizeof(branch_stat[0]));
+    assert(branch_stat != NULL);
+    nr_branch = 0;
+    for (j = 0; j < old_size; j ++) {
+      if (old[j].count != 0) *branch_stat_lookup(old[j].eip) = old[j];
+    }
+    free(old);
+    return branch_stat_lookup(eip);
+  }
+  nr_branch ++;
+  branch_stat[i].eip = eip;
+  return &branch_stat[i];
+}
+
+static inline uint32_t pht_index(vaddr_t eip) {
+  return (bpred_type == BPRED_GSHARE ? eip ^ ghr : eip) & (BPRED_TABLE_SIZE - 1);
+}
+
+static inline bool predict_taken(vaddr_t eip, vaddr_t target) {
+  if (bpred_type == BPRED_STATIC) return target < eip;
+  return pht[pht_index(eip)] >= 2;
+}
+
+static inline void update_direction(vaddr_t eip, bool taken) {
+  if (bpred_type == BPRED_STATIC) return;
+  uint8_t *c = &pht[pht_index(eip)];
+  if (taken && *c < 3) (*c) ++;
+  else if (!taken && *c > 0) (*c) --;
+  ghr = ((ghr << 1) | taken) & ((1u << BPRED_HISTORY_BITS) - 1);
+}
+
+static inline bool btb_hit(vaddr_t eip, vaddr_t target) {
+  int i = eip & (BTB_SIZE - 1);
+  return btb[i].valid && btb[i].eip == eip && btb[i].target == target;
+}
+
+static inline void btb_update(vaddr_t eip, vaddr_t target) {
+  int i = eip & (BTB_SIZE - 1);
+  btb[i].valid = true;
+  btb[i].eip = eip;
+  btb[i].target = target;
+}
+
+/* Called by the branch at `eip' with the next instruction at `next',
+ * after it resolves to `target' or to `next' if not taken.
+ */
+void bpred_branch(int type, vaddr_t eip, vaddr_t next, vaddr_t target, bool taken) {
+  bool mispredict = false, misfetch = false;
+  switch (type) {
+    case BR_COND:
+      if (predict_taken(eip, target) != taken) mispredict = true;
+      else if (taken && !btb_hit(eip, target)) misfetch = true;
+      update_direction(eip, taken);
+      break;
+    case BR_JMP: case BR_CALL:
+      misfetch = !btb_hit(eip, target);
+      break;
+    case BR_JMP_IND: case BR_CALL_IND:
+      mispredict = !btb_hit(eip, target);
+      break;
+    case BR_RET:
+      if (ras_size == 0) mispredict = true;
+      else {
+        ras_top = (ras_top + RAS_SIZE - 1) % RAS_SIZE;
+        ras_size --;
+        mispredict = (ras[ras_top] != target);
+      }
+      break;
+    default: assert(0);
+  }
+
+  if (type == BR_CALL || type == BR_CALL_IND) {
+    // the oldest return address is overwritten when the stack is full
+    ras[ras_top] = next;
+    ras_top = (ras_top + 1) % RAS_SIZE;
+    if (ras_size < RAS_SIZE) ras_size ++;
+  }
+  if (taken && type != BR_RET) {
+    btb_update(eip, target);
+  }
+
+  timing_stat.branch[type] ++;
+  timing_stat.mispredict[type] += mispredict;
+  timing_stat.misfetch += misfetch;
+
+  BranchStat *s = branch_stat_lookup(eip);
+  s->type = type;
+  s->count ++;
+  s->mispredict += mispredict;
+}
+
+void init_bpred() {
+  memset(pht, 2, sizeof(pht));  // weakly taken
+  branch_stat = calloc(branch_stat_size, sizeof(branch_stat[0]));
+  assert(branch_stat != NULL);
+}
+
+static int cmp_mispredict(const void *a, const void *b) {
+  uint64_t x = ((const BranchStat *)a)->mispredict, y = ((const BranchStat *)b)->mispredict;
+  return (x < y) - (x > y);
+}
+
+/* Print the `n' branches mispredicted the most. */
+void bpred_report(int n, const char **type_name) {
+  BranchStat *sorted = malloc(nr_branch * sizeof(sorted[0]) + 1);
+  assert(sorted != NULL);
+  uint32_t i, nr = 0;
+  for (i = 0; i < branch_stat_size; i ++) {
+    if (branch_stat[i].mispredict != 0) sorted[nr ++] = branch_stat[i];
+  }
+  qsort(sorted, nr, sizeof(sorted[0]), cmp_mispredict);
+
+  printf("Most mispredicted branches:\n");
+  printf("  %8s %-8s %12s %12s %8s\n", "eip", "type", "executed", "mispredicted", "rate");
+  for (i = 0; i < nr && i < n; i ++) {
+    printf("  %8x %-8s %12llu %12llu %7.2f%%\n", sorted[i].eip, type_name[sorted[i].type],
+        (unsigned long long)sorted[i].count, (unsigned long long)sorted[i].mispredict,
+        sorted[i].mispredict * 100.0 / sorted[i].count);
+  }
+  free(sorted);
+}
@@ -0,0 +1,103 @@
+#include "nemu.h"
+#include "cpu/timing.h"
+#include "memory/cache.h"
+#include "monitor/simpoint.h"
+#include <stdlib.h>
+
+/* An in-order scalar pipeline which issues one instruction per cycle,
+ * and stalls for the branch mispredictions and misfetches, and for the
+ * misses of the L1 caches, see memory/cache.h. `-T predictor' turns it
+ * on, together with the cache models. The estimate is reported at exit,
+ * or for each simulation point with `-R'.
+ */
+
+bool timing_enabled = false;
+TimingStat timing_stat;
+
+extern int bpred_type;
+void init_bpred(void);
+void bpred_report(int, const char **);
+
+static const char *bpred_name[] = {
+  [BPRED_BIMODAL] = "bimodal", [BPRED_GSHARE] = "gshare", [BPRED_STATIC] = "static",
+};
+
+static const char *br_type_name[] = {
+  [BR_COND] = "jcc", [BR_JMP] = "jmp", [BR_JMP_IND] = "jmp *",
+  [BR_CALL] = "call", [BR_CALL_IND] = "call *", [BR_RET] = "ret",
+};
+
+void timing_set_predictor(const char *name) {
+  int i;
+  for (i = 0; i < sizeof(bpred_name) / sizeof(bpred_name[0]); i ++) {
+    if (strcmp(name, bpred_name[i]) == 0) {
+      bpred_type = i;
+      timing_enabled = true;
+      return;
+    }
+  }
+  panic("Unknown branch predictor '%s', should be bimodal, gshare or static", name);
+}
+
+void timing_reset_stat() {
+  memset(&timing_stat, 0, sizeof(timing_stat));
+  cache_reset_stat();
+}
+
+uint64_t timing_cycles(const TimingStat *s, const uint64_t *cache_miss) {
+  uint64_t cycles = s->instr + s->misfetch * MISFETCH_PENALTY;
+  int i;
+  for (i = 0; i < NR_BR_TYPE; i ++) {
+    cycles += s->mispredict[i] * MISPREDICT_PENALTY;
+  }
+  for (i = 0; i < NR_CACHE; i ++) {
+    cycles += cache_miss[i] * CACHE_MISS_PENALTY;
+  }
+  return cycles;
+}
+
+static void timing_report() {
+  uint64_t access[NR_CACHE], miss[NR_CACHE];
+  int i;
+  for (i = 0; i < NR_CACHE; i ++) {
+    cache_get_stat(i, &access[i], &miss[i]);
+  }
+  uint64_t instr = timing_stat.instr, cycles = timing_cycles(&timing_stat, miss);
+
+  printf("Timing model (%s predictor):\n", bpred_name[bpred_type]);
+  printf("  %-14s %12llu\n", "instructions", (unsigned long long)instr);
+  printf("  %-14s %12llu  CPI %.3f\n", "cycles", (unsigned long long)cycles,
+      instr == 0 ? 0 : (double)cycles / instr);
+  const char *cache_name[] = { [CACHE_I] = "L1I misses", [CACHE_D] = "L1D misses" };
+  for (i = 0; i < NR_CACHE; i ++) {
+    printf("  %-14s %12llu  %.2f%% of %llu accesses\n", cache_name[i], (unsigned long long)miss[i],
+        access[i] == 0 ? 0 : miss[i] * 100.0 / access[i], (unsigned long long)access[i]);
+  }
+  printf("  %-14s %12llu\n", "misfetches", (unsigned long long)timing_stat.misfetch);
+
+  printf("Branches:\n");
+  printf("  %-8s %12s %12s %8s\n", "type", "executed", "mispredicted", "rate");
+  for (i = 0; i < NR_BR_TYPE; i ++) {
+    uint64_t n = timing_stat.branch[i], m = timing_stat.mispredict[i];
+    if (n == 0) continue;
+    printf("  %-8s %12llu %12llu %7.2f%%\n", br_type_name[i], (unsigned long long)n,
+        (unsigned long long)m, m * 100.0 / n);
+  }
+  bpred_report(20, br_type_name);
+}
+
+void init_timing() {
+  if (!timing_enabled) return;
+  Assert(nr_cpu == 1, "the timing model does not support %d CPUs", nr_cpu);
+  Assert(simpoint_mode == SIMPOINT_NONE || simpoint_mode == SIMPOINT_DETAIL,
+      "the timing model can only be used with -R");
+
+  init_bpred();
+  init_cache();
+  cache_enabled = true;
+  timing_reset_stat();
+  // the simulation points are reported by simpoint_detail()
+  if (simpoint_mode == SIMPOINT_NONE) {
+    atexit(timing_report);
+  }
+}
@@ -0,0 +1,154 @@
+#include "common.h"
+
+#ifdef HAS_IOE
+
+#include "device/mmio.h"
+#include "device/vga.h"
+#include "memory/memory.h"
+#include "memory/mmu.h"
+#include "memory/dirty.h"
+
+/* A 2D blitter which draws into the frame buffer on the host, or into
+ * a frame buffer of SCREEN_W x SCREEN_H pixels in guest memory. The
+ * guest fills in a descriptor and writes the operation to CMD. The
+ * source, the palette and the destination are virtual addresses of the
+ * calling CPU.
+ */
+
+#define BLIT_MMIO 0xc0000   // Note that this is not the standard
+#define ID_OFFSET 0         // read: BLIT_ID
+#define SRC_OFFSET 4        // COPY: pixels, PAL8: palette indices
+#define PITCH_OFFSET 8      // pixels between two rows of the source
+#define X_OFFSET 12
+#define Y_OFFSET 16
+#define W_OFFSET 20
+#define H_OFFSET 24
+#define COLOR_OFFSET 28     // FILL: the pixel
+#define PAL_OFFSET 32       // PAL8: 256 pixels
+#define CMD_OFFSET 36       // write: start the operation, read: BLIT_OK or BLIT_FAIL
+#define DST_OFFSET 40       // 0 for the frame buffer at VMEM
+
+#define BLIT_ID 0x54494c42  // "BLIT"
+
+enum { BLIT_COPY = 1, BLIT_FILL, BLIT_PAL8 };
+enum { BLIT_OK = 0, BLIT_FAIL };
+
+static uint32_t *blit_base;
+
+#ifdef DIFF_TEST
+void difftest_mark_dirty(paddr_t, int);
+#endif
+
+/* Copy from the guest, failing if a page is not present. The guest then
+ * falls back to drawing by itself, which faults the page in.
+ */
+static bool read_guest(vaddr_t addr, void *buf, int len) {
+  while (len > 0) {
+    paddr_t paddr;
+    int n = PAGE_SIZE - (addr & PAGE_MASK);
+    if (n > len) n = len;
+    if (!vaddr_probe(addr, &paddr) || paddr + n > PMEM_SIZE) return false;
+
+    memcpy(buf, guest_to_host(paddr), n);
+    addr += n;
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+/* Copy to the guest, failing like read_guest(). */
+static bool write_guest(vaddr_t addr, const void *buf, int len) {
+  while (len > 0) {
+    paddr_t paddr;
+    int n = PAGE_SIZE - (addr & PAGE_MASK);
+    if (n > len) n = len;
+    if (!vaddr_probe(addr, &paddr) || paddr + n > PMEM_SIZE) return false;
+
+#ifdef DIFF_TEST
+    difftest_mark_dirty(paddr, n);
+#endif
+    memcpy(guest_to_host(paddr), buf, n);
+    dirty_mark_range(paddr, n);
+    addr += n;
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+/* Draw a row of `w' pixels at (x, y) of the destination. */
+static bool put_row(vaddr_t dst, uint32_t x, uint32_t y, const uint32_t *pixels, uint32_t w) {
+  if (dst == 0) {
+    memcpy(&vmem[y][x], pixels, w * 4);
+    return true;
+  }
+  return write_guest(dst + (y * SCREEN_W + x) * 4, pixels, w * 4);
+}
+
+static bool blit(int cmd) {
+  uint32_t x = blit_base[X_OFFSET / 4], y = blit_base[Y_OFFSET / 4];
+  uint32_t w = blit_base[W_OFFSET / 4], h = blit_base[H_OFFSET / 4];
+  vaddr_t src = blit_base[SRC_OFFSET / 4], dst = blit_base[DST_OFFSET / 4];
+  uint32_t pitch = blit_base[PITCH_OFFSET / 4];
+
+  if (x >= SCREEN_W || y >= SCREEN_H) return true;
+  if (w > SCREEN_W - x) w = SCREEN_W - x;
+  if (h > SCREEN_H - y) h = SCREEN_H - y;
+  if (dst == 0 && w > 0 && h > 0) {
+    // vmem is written from the host, so mark the rows drawn for the VGA
+    dirty_mark_range(VMEM + (y * SCREEN_W + x) * 4, ((h - 1) * SCREEN_W + w) * 4);
+  }
+
+  uint32_t row[SCREEN_W];
+  int i, j;
+  switch (cmd) {
+    case BLIT_COPY:
+      for (i = 0; i < h; i ++) {
+        if (!read_guest(src + i * pitch * 4, row, w * 4)) return false;
+        if (!put_row(dst, x, y + i, row, w)) return false;
+      }
+      return true;
+
+    case BLIT_FILL:
+      for (j = 0; j < w; j ++) {
+        row[j] = blit_base[COLOR_OFFSET / 4];
+      }
+      for (i = 0; i < h; i ++) {
+        if (!put_row(dst, x, y + i, row, w)) return false;
+      }
+      return true;
+
+    case BLIT_PAL8: {
+      uint32_t pal[256];
+      uint8_t idx[SCREEN_W];
+      if (!read_guest(blit_base[PAL_OFFSET / 4], pal, sizeof(pal))) return false;
+      for (i = 0; i < h; i ++) {
+        if (!read_guest(src + i * pitch, idx, w)) return false;
+        for (j = 0; j < w; j ++) {
+          row[j] = pal[idx[j]];
+        }
+        if (!put_row(dst, x, y + i, row, w)) return false;
+      }
+      return true;
+    }
+
+    default: return false;
+  }
+}
+
+void blit_io_handler(paddr_t addr, int len, bool is_write) {
+  if (!is_write || addr - BLIT_MMIO != CMD_OFFSET) {
+    return;
+  }
+
+  assert(len == 4);
+  bool ok = blit(blit_base[CMD_OFFSET / 4]);
+  blit_base[CMD_OFFSET / 4] = (ok ? BLIT_OK : BLIT_FAIL);
+}
+
+void init_blit() {
+  blit_base = add_mmio_map(BLIT_MMIO, 44, blit_io_handler);
+  blit_base[ID_OFFSET / 4] = BLIT_ID;
+}
+#endif	/* HAS_IOE */
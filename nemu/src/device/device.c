@@ -1,4 +1,12 @@
 #include "common.h"
+#include "device/intr.h"
+#include "device/replay.h"
+#include "device/display.h"
+#include "device/vga.h"
+#include <pthread.h>
+
+/* Serializes device accesses from the CPU threads. */
+pthread_mutex_t device_lock = PTHREAD_MUTEX_INITIALIZER;
 
 #ifdef HAS_IOE
 
@@ -6,9 +14,6 @@
 #include <signal.h>
 #include <SDL2/SDL.h>
 
-#define TIMER_HZ 100
-#define VGA_HZ 50
-
 static uint64_t jiffy = 0;
 static struct itimerval it;
 static int device_update_flag = false;
@@ -17,14 +22,23 @@ static int update_screen_flag = false;
 void init_serial();
 void init_timer();
 void init_vga();
+void init_blit();
 void init_i8042();
+void init_smp_dev();
+void init_disk();
 
+extern void serial_update();
 extern void timer_intr();
 extern void send_key(uint8_t, bool);
+extern void key_script_update(uint64_t);
 extern void update_screen();
 
 
-static void timer_sig_handler(int signum) {
+/* ITIMER_VIRTUAL counts the CPU time of NEMU, which stops while all
+ * the CPUs are halted. CPU 0 then ticks by itself after sleeping for a
+ * whole period, see cpu_idle(). Both go through replay_host_tick().
+ */
+void device_tick() {
   jiffy ++;
   timer_intr();
 
@@ -32,31 +46,53 @@ static void timer_sig_handler(int signum) {
   if (jiffy % (TIMER_HZ / VGA_HZ) == 0) {
     update_screen_flag = true;
   }
+}
+
+static void timer_sig_handler(int signum) {
+  replay_host_tick();
+
+  int ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
+  Assert(ret == 0, "Can not set timer");
+}
 
+/* A polling loop skips to the next tick, see src/device/spin.c. */
+void device_warp() {
+  extern void timer_warp();
+  timer_warp();
+  device_tick();
+
+  // a whole period until the next one
   int ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
   Assert(ret == 0, "Can not set timer");
 }
 
 void device_update() {
+  replay_update();
   if (!device_update_flag) {
     return;
   }
   device_update_flag = false;
 
+  pthread_mutex_lock(&device_lock);
+  serial_update();
   if (update_screen_flag) {
     update_screen();
     update_screen_flag = false;
   }
+  // the keys of a replay are in the recording
+  if (replay_mode != REPLAY_PLAY) {
+    key_script_update(jiffy);
+  }
 
   SDL_Event event;
-  while (SDL_PollEvent(&event)) {
+  while (display_mode == DISPLAY_SDL && SDL_PollEvent(&event)) {
     switch (event.type) {
       case SDL_QUIT: exit(0);
 
                      // If a key was pressed
       case SDL_KEYDOWN:
       case SDL_KEYUP: {
-                        if (event.key.repeat == 0) {
+                        if (event.key.repeat == 0 && replay_mode != REPLAY_PLAY) {
                           uint8_t k = event.key.keysym.scancode;
                           bool is_keydown = (event.key.type == SDL_KEYDOWN);
                           send_key(k, is_keydown);
@@ -66,18 +102,22 @@ void device_update() {
       default: break;
     }
   }
+  pthread_mutex_unlock(&device_lock);
 }
 
 void sdl_clear_event_queue() {
   SDL_Event event;
-  while (SDL_PollEvent(&event));
+  while (display_mode == DISPLAY_SDL && SDL_PollEvent(&event));
 }
 
 void init_device() {
   init_serial();
   init_timer();
   init_vga();
+  init_blit();
   init_i8042();
+  init_smp_dev();
+  init_disk();
 
   struct sigaction s;
   memset(&s, 0, sizeof(s));
@@ -95,4 +135,10 @@ void init_device() {
 void init_device() {
 }
 
+void device_tick() {
+}
+
+void device_warp() {
+}
+
 #endif	/* HAS_IOE */
@@ -0,0 +1,104 @@
+#include "device/port-io.h"
+#include "device/intr.h"
+#include "memory/memory.h"
+#include "memory/mmu.h"
+#include "memory/dirty.h"
+#include "cpu/reg.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* A disk backed by a host file. The guest fills in a request, that is
+ * the first block, the number of blocks and the guest physical address
+ * of the buffer, and writes the command. The data is moved by a single
+ * pread() or pwrite(), and the completion raises IRQ_DISK on the
+ * calling CPU if it is enabled.
+ */
+
+#define DISK_PORT 0x300   // Note that this is not the standard
+#define NR_BLK_OFFSET 0   // read: the number of blocks, 0 without a disk
+#define BLK_OFFSET 4      // the first block of the request
+#define COUNT_OFFSET 8    // the number of blocks of the request
+#define ADDR_OFFSET 12    // guest physical address of the buffer
+#define CMD_OFFSET 16     // write: DISK_READ or DISK_WRITE
+#define STATUS_OFFSET 20  // read: DISK_OK or DISK_ERROR of the last request
+#define CTRL_OFFSET 24    // DISK_INTR: raise IRQ_DISK on completion
+
+#define BLK_SIZE 512
+
+enum { DISK_READ = 1, DISK_WRITE };
+enum { DISK_OK = 0, DISK_ERROR };
+#define DISK_INTR 0x1
+
+#ifdef DIFF_TEST
+void difftest_mark_dirty(paddr_t, int);
+#endif
+
+static const char *disk_file = NULL;
+static int disk_fd = -1;
+static uint32_t *disk_port_base;
+
+void disk_set_file(const char *file) {
+  disk_file = file;
+}
+
+static bool disk_request(int cmd) {
+  uint32_t blk = disk_port_base[BLK_OFFSET / 4];
+  uint32_t count = disk_port_base[COUNT_OFFSET / 4];
+  paddr_t addr = disk_port_base[ADDR_OFFSET / 4];
+  uint32_t nr_blk = disk_port_base[NR_BLK_OFFSET / 4];
+
+  if (disk_fd == -1) return false;
+  if (blk > nr_blk || count > nr_blk - blk) return false;
+  size_t len = (size_t)count * BLK_SIZE;
+  if (addr > PMEM_SIZE || len > PMEM_SIZE - addr) return false;
+  off_t offset = (off_t)blk * BLK_SIZE;
+
+  switch (cmd) {
+    case DISK_READ: {
+#ifdef DIFF_TEST
+      // QEMU gets the pages when the `out' instruction is skipped
+      paddr_t p;
+      for (p = addr & ~PAGE_MASK; p < addr + len; p += PAGE_SIZE) {
+        difftest_mark_dirty(p, 1);
+      }
+#endif
+      ssize_t n = pread(disk_fd, guest_to_host(addr), len, offset);
+      if (n < 0) return false;
+      // the last block of the file may be partial
+      memset(guest_to_host(addr + n), 0, len - n);
+      dirty_mark_range(addr, len);
+      return true;
+    }
+    case DISK_WRITE:
+      return pwrite(disk_fd, guest_to_host(addr), len, offset) == len;
+    default: return false;
+  }
+}
+
+void disk_io_handler(ioaddr_t addr, int len, bool is_write) {
+  if (!is_write || addr - DISK_PORT != CMD_OFFSET) {
+    return;
+  }
+
+  assert(len == 4);
+  bool ok = disk_request(disk_port_base[CMD_OFFSET / 4]);
+  disk_port_base[STATUS_OFFSET / 4] = (ok ? DISK_OK : DISK_ERROR);
+  if (disk_port_base[CTRL_OFFSET / 4] & DISK_INTR) {
+    dev_raise_intr(cpu.id, IRQ_DISK);
+  }
+}
+
+void init_disk() {
+  disk_port_base = add_pio_map(DISK_PORT, 28, disk_io_handler);
+  if (disk_file == NULL) {
+    return;
+  }
+
+  disk_fd = open(disk_file, O_RDWR);
+  Assert(disk_fd != -1, "Can not open disk image '%s'", disk_file);
+  struct stat st;
+  fstat(disk_fd, &st);
+  disk_port_base[NR_BLK_OFFSET / 4] = (st.st_size + BLK_SIZE - 1) / BLK_SIZE;
+  Log("The disk image is %s, %d blocks", disk_file, disk_port_base[NR_BLK_OFFSET / 4]);
+}
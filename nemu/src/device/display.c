@@ -0,0 +1,205 @@
+#include "common.h"
+#include "device/display.h"
+#include "device/vga.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+/* Without SDL, `-D none' discards the frames, `-D y4m:file' writes all
+ * of them as a YUV4MPEG2 stream at VGA_HZ frames per second of virtual
+ * time, and `-D png:dir' writes each frame the VGA has changed as
+ * dir/<vblank>.png. The frames are copied at the vblank, and
+ * converted and written by an encoder thread, so that the CPU only
+ * waits when the thread falls NR_FRAME frames behind.
+ */
+
+#define NR_FRAME 8
+#define FRAME_SIZE (SCREEN_W * SCREEN_H * sizeof(uint32_t))
+
+int display_mode = DISPLAY_SDL;
+bool display_is_set = false;
+static const char *display_path = NULL;
+
+typedef struct {
+  uint32_t pixels[SCREEN_H][SCREEN_W];
+  uint64_t no;  // the vblank it was shown at
+} Frame;
+
+static Frame *frames;
+static int frame_r = 0, frame_w = 0, nr_queued = 0;
+static bool encoder_done = false;
+static pthread_mutex_t frame_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t frame_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t encoder;
+
+static uint64_t nr_vblank = 0, nr_written = 0;
+static FILE *y4m_fp;
+
+void display_set(const char *arg) {
+  display_is_set = true;
+  if (strcmp(arg, "sdl") == 0) display_mode = DISPLAY_SDL;
+  else if (strcmp(arg, "none") == 0) display_mode = DISPLAY_NONE;
+  else if (strncmp(arg, "y4m:", 4) == 0) { display_mode = DISPLAY_Y4M; display_path = arg + 4; }
+  else if (strncmp(arg, "png:", 4) == 0) { display_mode = DISPLAY_PNG; display_path = arg + 4; }
+  else panic("Unknown display '%s', should be sdl, none, y4m:file or png:dir", arg);
+}
+
+static inline void rgb(uint32_t p, int *r, int *g, int *b) {
+  *r = (p >> 16) & 0xff;
+  *g = (p >> 8) & 0xff;
+  *b = p & 0xff;
+}
+
+/* full-range BT.601 with 4:2:0 chroma at the center of each 2x2 block,
+ * as said by C420jpeg */
+static void write_y4m(Frame *f) {
+  static uint8_t y[SCREEN_H][SCREEN_W], u[SCREEN_H / 2][SCREEN_W / 2], v[SCREEN_H / 2][SCREEN_W / 2];
+  int i, j, r, g, b;
+  for (i = 0; i < SCREEN_H; i ++) {
+    for (j = 0; j < SCREEN_W; j ++) {
+      rgb(f->pixels[i][j], &r, &g, &b);
+      y[i][j] = (77 * r + 150 * g + 29 * b + 128) >> 8;
+    }
+  }
+  for (i = 0; i < SCREEN_H / 2; i ++) {
+    for (j = 0; j < SCREEN_W / 2; j ++) {
+      int sr = 0, sg = 0, sb = 0, k;
+      for (k = 0; k < 4; k ++) {
+        rgb(f->pixels[2 * i + k / 2][2 * j + k % 2], &r, &g, &b);
+        sr += r; sg += g; sb += b;
+      }
+      u[i][j] = (128 * 4 * 256 - 43 * sr - 85 * sg + 128 * sb + 512) >> 10;
+      v[i][j] = (128 * 4 * 256 + 128 * sr - 107 * sg - 21 * sb + 512) >> 10;
+    }
+  }
+  fputs("FRAME\n", y4m_fp);
+  fwrite(y, sizeof(y), 1, y4m_fp);
+  fwrite(u, sizeof(u), 1, y4m_fp);
+  fwrite(v, sizeof(v), 1, y4m_fp);
+}
+
+static void png_chunk(FILE *fp, const char *type, const uint8_t *data, uint32_t len) {
+  uint8_t be[4] = { len >> 24, len >> 16, len >> 8, len };
+  fwrite(be, 4, 1, fp);
+  fwrite(type, 4, 1, fp);
+  fwrite(data, len, 1, fp);
+  uint32_t crc = crc32(crc32(0, (const uint8_t *)type, 4), data, len);
+  uint8_t crc_be[4] = { crc >> 24, crc >> 16, crc >> 8, crc };
+  fwrite(crc_be, 4, 1, fp);
+}
+
+/* 8-bit RGB, each row with the Sub filter */
+static void write_png(Frame *f) {
+  static uint8_t raw[SCREEN_H * (1 + SCREEN_W * 3)];
+  static uint8_t z[SCREEN_H * (1 + SCREEN_W * 3) + 1024];
+  uint8_t *p = raw;
+  int i, j, r, g, b;
+  for (i = 0; i < SCREEN_H; i ++) {
+    int pr = 0, pg = 0, pb = 0;
+    *p ++ = 1;
+    for (j = 0; j < SCREEN_W; j ++) {
+      rgb(f->pixels[i][j], &r, &g, &b);
+      *p ++ = r - pr; *p ++ = g - pg; *p ++ = b - pb;
+      pr = r; pg = g; pb = b;
+    }
+  }
+  uLongf zlen = sizeof(z);
+  int ret = compress2(z, &zlen, raw, sizeof(raw), Z_DEFAULT_COMPRESSION);
+  Assert(ret == Z_OK, "Can not compress a frame");
+
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%08llu.png", display_path, (unsigned long long)f->no);
+  FILE *fp = fopen(path, "wb");
+  Assert(fp, "Can not open '%s'", path);
+  static const uint8_t sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  uint8_t ihdr[13] = {
+    SCREEN_W >> 24, SCREEN_W >> 16, SCREEN_W >> 8, SCREEN_W & 0xff,
+    SCREEN_H >> 24, SCREEN_H >> 16, SCREEN_H >> 8, SCREEN_H & 0xff,
+    8, 2, 0, 0, 0 };
+  fwrite(sig, sizeof(sig), 1, fp);
+  png_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+  png_chunk(fp, "IDAT", z, zlen);
+  png_chunk(fp, "IEND", (const uint8_t *)"", 0);
+  fclose(fp);
+}
+
+static void *encoder_main(void *arg) {
+  pthread_mutex_lock(&frame_lock);
+  while (1) {
+    while (nr_queued == 0 && !encoder_done) {
+      pthread_cond_wait(&frame_cond, &frame_lock);
+    }
+    if (nr_queued == 0) break;
+    Frame *f = &frames[frame_r];
+    pthread_mutex_unlock(&frame_lock);
+
+    if (display_mode == DISPLAY_Y4M) write_y4m(f);
+    else write_png(f);
+
+    pthread_mutex_lock(&frame_lock);
+    frame_r = (frame_r + 1) % NR_FRAME;
+    nr_queued --;
+    pthread_cond_broadcast(&frame_cond);
+  }
+  pthread_mutex_unlock(&frame_lock);
+  return NULL;
+}
+
+static void display_finish() {
+  pthread_mutex_lock(&frame_lock);
+  encoder_done = true;
+  pthread_cond_broadcast(&frame_cond);
+  pthread_mutex_unlock(&frame_lock);
+  pthread_join(encoder, NULL);
+  if (y4m_fp) fclose(y4m_fp);
+  Log("%llu frames written to %s", (unsigned long long)nr_written, display_path);
+}
+
+void init_display() {
+  if (display_mode != DISPLAY_Y4M && display_mode != DISPLAY_PNG) return;
+
+  if (display_mode == DISPLAY_Y4M) {
+    y4m_fp = fopen(display_path, "wb");
+    Assert(y4m_fp, "Can not open '%s'", display_path);
+    fprintf(y4m_fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", SCREEN_W, SCREEN_H, VGA_HZ);
+  }
+  frames = malloc(NR_FRAME * sizeof(Frame));
+  assert(frames);
+
+  // the encoder must not take the timer signal
+  sigset_t set, old;
+  sigemptyset(&set);
+  sigaddset(&set, SIGVTALRM);
+  pthread_sigmask(SIG_BLOCK, &set, &old);
+  int ret = pthread_create(&encoder, NULL, encoder_main, NULL);
+  Assert(ret == 0, "Can not create the encoder thread");
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  atexit(display_finish);
+}
+
+/* Called at every vblank with the frame shown, and whether it may
+ * differ from the one at the vblank before.
+ */
+void display_frame(const uint32_t *pixels, bool changed) {
+  nr_vblank ++;
+  if (display_mode != DISPLAY_Y4M && display_mode != DISPLAY_PNG) return;
+  if (display_mode == DISPLAY_PNG && !changed && nr_vblank > 1) return;
+
+  pthread_mutex_lock(&frame_lock);
+  while (nr_queued == NR_FRAME) {
+    pthread_cond_wait(&frame_cond, &frame_lock);
+  }
+  Frame *f = &frames[frame_w];
+  pthread_mutex_unlock(&frame_lock);
+
+  memcpy(f->pixels, pixels, FRAME_SIZE);
+  f->no = nr_vblank;
+
+  pthread_mutex_lock(&frame_lock);
+  frame_w = (frame_w + 1) % NR_FRAME;
+  nr_queued ++;
+  nr_written ++;
+  pthread_cond_broadcast(&frame_cond);
+  pthread_mutex_unlock(&frame_lock);
+}
@@ -1,7 +1,9 @@
 #include "common.h"
 #include "device/mmio.h"
+#include "device/spin.h"
+#include <pthread.h>
 
-#define MMIO_SPACE_MAX (512 * 1024)
+#define MMIO_SPACE_MAX (1024 * 1024)
 #define NR_MAP 8
 
 static uint8_t mmio_space_pool[MMIO_SPACE_MAX];
@@ -17,6 +19,8 @@ typedef struct {
 static MMIO_t maps[NR_MAP];
 static int nr_map = 0;
 
+extern pthread_mutex_t device_lock;
+
 /* device interface */
 void* add_mmio_map(paddr_t addr, int len, mmio_callback_t callback) {
   assert(nr_map < NR_MAP);
@@ -46,9 +50,12 @@ int is_mmio(paddr_t addr) {
 uint32_t mmio_read(paddr_t addr, int len, int map_NO) {
   assert(len >= 1 && len <= 4);
   MMIO_t *map = &maps[map_NO];
+  spin_io();
+  pthread_mutex_lock(&device_lock);
   uint32_t data = *(uint32_t *)(map->mmio_space + (addr - map->low)) 
     & (~0u >> ((4 - len) << 3));
   map->callback(addr, len, false);
+  pthread_mutex_unlock(&device_lock);
   return data;
 }
 
@@ -59,6 +66,8 @@ void mmio_write(paddr_t addr, int len, uint32_t data, int map_NO) {
   uint8_t *p = map->mmio_space + (addr - map->low);
   uint8_t *p_data = (uint8_t *)&data;
 
+  spin_io();
+  pthread_mutex_lock(&device_lock);
   switch (len) {
     case 4: p[3] = p_data[3];
     case 3: p[2] = p_data[2];
@@ -67,4 +76,18 @@ void mmio_write(paddr_t addr, int len, uint32_t data, int map_NO) {
   }
 
   maps[map_NO].callback(addr, len, true);
+  pthread_mutex_unlock(&device_lock);
+}
+
+/* checkpoint interface: the device registers and memory, but not the
+ * state kept inside the devices */
+void mmio_save(FILE *fp) {
+  fwrite(&mmio_space_free_index, sizeof(mmio_space_free_index), 1, fp);
+  fwrite(mmio_space_pool, mmio_space_free_index, 1, fp);
+}
+
+bool mmio_load(FILE *fp) {
+  uint32_t size;
+  if (fread(&size, sizeof(size), 1, fp) != 1 || size != mmio_space_free_index) return false;
+  return size == 0 || fread(mmio_space_pool, size, 1, fp) == 1;
 }
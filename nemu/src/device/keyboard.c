@@ -1,6 +1,9 @@
 #include "device/port-io.h"
 #include "monitor/monitor.h"
+#include "device/spin.h"
+#include "device/replay.h"
 #include <SDL2/SDL.h>
+#include <stdlib.h>
 
 #define I8042_DATA_PORT 0x60
 #define I8042_STATUS_PORT 0x64
@@ -40,6 +43,7 @@ static int key_f = 0, key_r = 0;
 void send_key(uint8_t scancode, bool is_keydown) {
   if (nemu_state == NEMU_RUNNING &&
       keymap[scancode] != _KEY_NONE) {
+    replay_key(scancode, is_keydown);
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
     key_queue[key_r] = am_scancode;
     key_r = (key_r + 1) % KEY_QUEUE_LEN;
@@ -58,13 +62,90 @@ void i8042_io_handler(ioaddr_t addr, int len, bool is_write) {
           i8042_status_port_base[0] |= I8042_STATUS_HASKEY_MASK;
           key_f = (key_f + 1) % KEY_QUEUE_LEN;
         }
+        else {
+          spin_poll();
+        }
       }
     }
   }
 }
 
+/* A key script (-k) types the keys without SDL. Each line is
+ *   <tick> kd|ku <key>
+ * where the tick counts the timer from 0 at TIMER_HZ per second of
+ * virtual time, and the key is named as in _KEYS, like A or RETURN.
+ * The lines are in the order of the ticks, and # starts a comment.
+ */
+typedef struct {
+  uint64_t tick;
+  uint8_t scancode;
+  bool is_keydown;
+} KeyEvent;
+
+#define KEY_SCANCODE(k) { #k, concat(SDL_SCANCODE_, k) },
+static const struct {
+  const char *name;
+  int scancode;
+} key_scancodes[] = { _KEYS(KEY_SCANCODE) };
+
+static const char *key_script_file = NULL;
+static KeyEvent *key_script;
+static int nr_key_event = 0, next_key_event = 0;
+
+void key_script_set(const char *file) {
+  key_script_file = file;
+}
+
+static void load_key_script() {
+  FILE *fp = fopen(key_script_file, "r");
+  Assert(fp, "Can not open '%s'", key_script_file);
+
+  int size = 64, line_no = 0;
+  key_script = malloc(size * sizeof(KeyEvent));
+  char line[128], action[8], name[32];
+  unsigned long long tick;
+  while (fgets(line, sizeof(line), fp)) {
+    line_no ++;
+    char *p = strchr(line, '#');
+    if (p) *p = '\0';
+    int n = sscanf(line, "%llu %7s %31s", &tick, action, name);
+    if (n <= 0) continue;
+    Assert(n == 3 && (strcmp(action, "kd") == 0 || strcmp(action, "ku") == 0),
+        "%s:%d: should be <tick> kd|ku <key>", key_script_file, line_no);
+
+    int i;
+    for (i = 0; i < sizeof(key_scancodes) / sizeof(key_scancodes[0]); i ++) {
+      if (strcmp(key_scancodes[i].name, name) == 0) break;
+    }
+    Assert(i < sizeof(key_scancodes) / sizeof(key_scancodes[0]),
+        "%s:%d: unknown key '%s'", key_script_file, line_no, name);
+
+    if (nr_key_event == size) {
+      size *= 2;
+      key_script = realloc(key_script, size * sizeof(KeyEvent));
+    }
+    KeyEvent *e = &key_script[nr_key_event ++];
+    e->tick = tick;
+    e->scancode = key_scancodes[i].scancode;
+    e->is_keydown = (action[1] == 'd');
+  }
+  fclose(fp);
+}
+
+/* Called at each tick with the number of ticks so far. */
+void key_script_update(uint64_t tick) {
+  while (next_key_event < nr_key_event && key_script[next_key_event].tick <= tick) {
+    KeyEvent *e = &key_script[next_key_event ++];
+    send_key(e->scancode, e->is_keydown);
+  }
+}
+
 void init_i8042() {
   i8042_data_port_base = add_pio_map(I8042_DATA_PORT, 4, i8042_io_handler);
   i8042_status_port_base = add_pio_map(I8042_STATUS_PORT, 1, i8042_io_handler);
   i8042_status_port_base[0] = 0x0;
+
+  if (key_script_file != NULL) {
+    load_key_script();
+  }
 }
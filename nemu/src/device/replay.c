@@ -0,0 +1,221 @@
+#include "nemu.h"
+#include "monitor/monitor.h"
+#include "device/replay.h"
+#include "device/spin.h"
+#include "device/display.h"
+#include <stdlib.h>
+
+/* The inputs which make a run differ from the next are the ticks of the
+ * host timer, the RTC and the keys. -r records each of them with the
+ * number of steps of CPU 0 at the time, and -p feeds them back at the
+ * same steps, with the host timer ignored and no SDL, unless -D says so.
+ * Everything else, including the ticks of -W, follows from them.
+ *
+ * A tick of the host timer is taken at the next instruction boundary,
+ * when it is recorded, rather than in the signal handler. The keys are
+ * queued at the boundaries anyway, and an RTC value is recorded when it
+ * is read. The steps are counted one instruction each, as fusion and
+ * the translated code are turned off.
+ *
+ * Each record is a LEB128 number, the steps since the previous record
+ * shifted left by 3 with the kind in the low bits, followed by
+ *   REC_TICK     nothing
+ *   REC_RTC      LEB128 of the difference from the previous RTC value
+ *   REC_KEYUP,
+ *   REC_KEYDOWN  the SDL scancode
+ *   REC_END      nothing, NEMU exits here
+ */
+
+#define REC_MAGIC "NEMUREC1"
+
+enum { REC_TICK, REC_RTC, REC_KEYUP, REC_KEYDOWN, REC_END };
+
+typedef struct {
+  uint64_t steps;
+  int kind;
+  uint32_t data;
+} Record;
+
+int replay_mode = REPLAY_NONE;
+static const char *rec_file = NULL;
+static FILE *rec_fp = NULL;
+static volatile bool tick_pending = false;
+
+static uint64_t last_steps = 0;
+static uint32_t last_rtc = 0;
+
+static Record *recs = NULL;
+static int nr_rec = 0, next_rec = 0;
+
+void replay_set(int mode, const char *file) {
+  replay_mode = mode;
+  rec_file = file;
+}
+
+static void put_leb128(uint64_t x) {
+  do {
+    uint8_t b = x & 0x7f;
+    x >>= 7;
+    fputc(b | (x ? 0x80 : 0), rec_fp);
+  } while (x);
+}
+
+static bool get_leb128(FILE *fp, uint64_t *x) {
+  int shift = 0, b;
+  *x = 0;
+  do {
+    if ((b = fgetc(fp)) == EOF) return false;
+    *x |= (uint64_t)(b & 0x7f) << shift;
+    shift += 7;
+  } while (b & 0x80);
+  return true;
+}
+
+static void record(int kind) {
+  put_leb128(((cpu_steps - last_steps) << 3) | kind);
+  last_steps = cpu_steps;
+}
+
+static void record_close() {
+  record(REC_END);
+  fclose(rec_fp);
+  Log("%s: recorded %llu steps", rec_file, (unsigned long long)cpu_steps);
+}
+
+static void load_records(FILE *fp) {
+  int size = 1024;
+  recs = malloc(size * sizeof(Record));
+  uint64_t steps = 0, x;
+  int64_t data;
+  uint32_t rtc = 0;
+  while (get_leb128(fp, &x)) {
+    Record r;
+    steps += x >> 3;
+    r.steps = steps;
+    r.kind = x & 7;
+    r.data = 0;
+    switch (r.kind) {
+      case REC_RTC:
+        Assert(get_leb128(fp, &x), "%s is truncated", rec_file);
+        rtc += x;
+        r.data = rtc;
+        break;
+      case REC_KEYUP: case REC_KEYDOWN:
+        data = fgetc(fp);
+        Assert(data != EOF, "%s is truncated", rec_file);
+        r.data = data;
+        break;
+      case REC_TICK: case REC_END: break;
+      default: panic("%s is corrupted", rec_file);
+    }
+    if (nr_rec == size) {
+      size *= 2;
+      recs = realloc(recs, size * sizeof(Record));
+    }
+    recs[nr_rec ++] = r;
+  }
+}
+
+void init_replay() {
+  if (replay_mode == REPLAY_NONE) return;
+  Assert(nr_cpu == 1, "record and replay do not support %d CPUs", nr_cpu);
+
+  char magic[8];
+  uint8_t spin;
+  if (replay_mode == REPLAY_RECORD) {
+    rec_fp = fopen(rec_file, "wb");
+    Assert(rec_fp, "Can not open '%s'", rec_file);
+    fwrite(REC_MAGIC, 8, 1, rec_fp);
+    // -W changes the ticks, and must be the same in the replay
+    fputc(spin_enabled, rec_fp);
+    atexit(record_close);
+    at_abort(record_close);
+  }
+  else {
+    FILE *fp = fopen(rec_file, "rb");
+    Assert(fp, "Can not open '%s'", rec_file);
+    Assert(fread(magic, 8, 1, fp) == 1 && memcmp(magic, REC_MAGIC, 8) == 0,
+        "%s is not a recording of NEMU", rec_file);
+    spin = fgetc(fp);
+    Assert(spin == spin_enabled, "%s is recorded %s -W", rec_file, spin ? "with" : "without");
+    load_records(fp);
+    fclose(fp);
+    Log("%s: replaying %d inputs", rec_file, nr_rec);
+
+    // no window and no input from the host
+    if (!display_is_set) display_mode = DISPLAY_NONE;
+  }
+}
+
+/* A tick of the host timer, or of CPU 0 sleeping a whole period. */
+void replay_host_tick() {
+  extern void device_tick();
+  switch (replay_mode) {
+    case REPLAY_NONE: device_tick(); break;
+    case REPLAY_RECORD: tick_pending = true; break;
+    case REPLAY_PLAY: break;
+  }
+}
+
+static void replay_diverged(const char *what) {
+  panic("%s: the replay diverged at %llu steps, %s", rec_file, (unsigned long long)cpu_steps, what);
+}
+
+/* Called by CPU 0 at each instruction boundary. */
+void replay_update() {
+  extern void device_tick();
+  extern void send_key(uint8_t, bool);
+
+  if (replay_mode == REPLAY_RECORD) {
+    if (tick_pending) {
+      tick_pending = false;
+      record(REC_TICK);
+      device_tick();
+    }
+  }
+  else if (replay_mode == REPLAY_PLAY) {
+    while (next_rec < nr_rec && recs[next_rec].steps == cpu_steps) {
+      Record *r = &recs[next_rec];
+      if (r->kind == REC_RTC) break;
+      next_rec ++;
+      switch (r->kind) {
+        case REC_TICK: device_tick(); break;
+        case REC_KEYUP: case REC_KEYDOWN: send_key(r->data, r->kind == REC_KEYDOWN); break;
+        case REC_END: next_rec = nr_rec; break;
+      }
+    }
+    if (next_rec < nr_rec && recs[next_rec].steps < cpu_steps) {
+      replay_diverged("an input is missed");
+    }
+    if (next_rec == nr_rec) {
+      // continue without the recording after stopping here
+      Log("%s: the replay ends at %llu steps", rec_file, (unsigned long long)cpu_steps);
+      if (nemu_state == NEMU_RUNNING) nemu_state = NEMU_STOP;
+      replay_mode = REPLAY_NONE;
+      free(recs);
+    }
+  }
+}
+
+/* The RTC reads `now', or the value recorded. */
+uint32_t replay_rtc(uint32_t now) {
+  if (replay_mode == REPLAY_RECORD) {
+    record(REC_RTC);
+    put_leb128((uint32_t)(now - last_rtc));
+    last_rtc = now;
+  }
+  else if (replay_mode == REPLAY_PLAY) {
+    if (next_rec == nr_rec || recs[next_rec].kind != REC_RTC || recs[next_rec].steps != cpu_steps) {
+      replay_diverged("the RTC is read");
+    }
+    now = recs[next_rec ++].data;
+  }
+  return now;
+}
+
+void replay_key(uint8_t scancode, bool is_keydown) {
+  if (replay_mode == REPLAY_RECORD) {
+    record(is_keydown ? REC_KEYDOWN : REC_KEYUP);
+    fputc(scancode, rec_fp);
+  }
+}
@@ -1,29 +1,203 @@
 #include "common.h"
 #include "device/port-io.h"
+#include "memory/memory.h"
+#include "memory/mmu.h"
+#include "cpu/reg.h"
+#include <pthread.h>
+#include <stdlib.h>
 
 /* http://en.wikibooks.org/wiki/Serial_Programming/8250_UART_Programming */
 
 #define SERIAL_PORT 0x3F8
 #define CH_OFFSET 0
+#define FCR_OFFSET 2		/* write: FIFO control register, read: interrupt identification register */
+#define LCR_OFFSET 3		/* line control register */
 #define LSR_OFFSET 5		/* line status register */
 
+#define FCR_FIFO_ENABLE 0x01
+#define FCR_FIFO_64 0x20	/* 16750 only */
+#define IIR_NO_INTR 0x01
+#define IIR_FIFO_64 0x20
+#define IIR_FIFO_ENABLED 0xc0
+#define LCR_DLAB 0x80		/* ports 0 and 1 are the divisor latch */
+#define LSR_THRE 0x20		/* the TX FIFO (or holding register) is empty */
+#define LSR_TEMT 0x40		/* and so is the transmitter */
+
+/* The characters are sent to the host as soon as they are written, and
+ * the transmitter is modelled only for what LSR reports. `tx_count'
+ * characters are in the TX FIFO, which the transmitter empties while the
+ * guest polls: a read of LSR sees the FIFO busy if anything was written
+ * since the previous read, and the next read sees it empty. Writing more
+ * than tx_depth() characters between two reads overruns the FIFO.
+ *
+ * `fifo_size' is set with -f: 1 for an 8250, which has no FIFO, 16 for a
+ * 16550A, and 64 for a 16750, whose FIFO is 16 characters deep unless
+ * FCR bit 5 is set as well.
+ */
+static int fifo_size = 16;
+static int tx_count = 0;
+static bool tx_overrun = false;
+
+/* A paravirtual port to output a whole string with one `out'. */
+#define SERIAL_STR_PORT 0x3E0   // Note that this is not the standard
+#define STR_ADDR_OFFSET 0       // virtual address of the string
+#define STR_LEN_OFFSET 4        // write: output the string, read: the number of characters output
+
+/* We bind the serial port with the host stdout in NEMU. The output is
+ * kept in `obuf' and written to the host when it is full, on the timer,
+ * when the CPU stops, before a Log() and at exit or abort. `obuf_lock'
+ * is taken only around the buffer, so that the output can be flushed
+ * whatever other lock is held.
+ */
+#define OBUF_SIZE (64 * 1024)
+
 static uint8_t *serial_port_base;
+static uint32_t *serial_str_port_base;
+static char obuf[OBUF_SIZE];
+static int obuf_len = 0;
+static vaddr_t str_addr[MAX_CPU];
+static uint32_t str_done[MAX_CPU];
+static pthread_mutex_t obuf_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Called with `obuf_lock' held. */
+static void write_obuf() {
+  if (obuf_len > 0) {
+    fwrite(obuf, 1, obuf_len, stdout);
+    fflush(stdout);
+    obuf_len = 0;
+  }
+}
+
+static void flush_obuf() {
+  pthread_mutex_lock(&obuf_lock);
+  write_obuf();
+  pthread_mutex_unlock(&obuf_lock);
+}
+
+static void serial_write(const char *buf, int len) {
+  pthread_mutex_lock(&obuf_lock);
+  if (obuf_len + len > OBUF_SIZE) {
+    write_obuf();
+    if (len > OBUF_SIZE) {
+      fwrite(buf, 1, len, stdout);
+      pthread_mutex_unlock(&obuf_lock);
+      return;
+    }
+  }
+  memcpy(obuf + obuf_len, buf, len);
+  obuf_len += len;
+  pthread_mutex_unlock(&obuf_lock);
+}
+
+/* Output the string of the calling CPU until a page is not present.
+ * The guest then outputs the rest by itself, which faults the page in.
+ */
+static uint32_t serial_puts(vaddr_t addr, uint32_t len) {
+  uint32_t done = 0;
+  while (done < len) {
+    paddr_t paddr;
+    uint32_t n = PAGE_SIZE - (addr & PAGE_MASK);
+    if (n > len - done) n = len - done;
+    if (!vaddr_probe(addr, &paddr) || paddr + n > PMEM_SIZE) break;
+
+    serial_write(guest_to_host(paddr), n);
+    addr += n;
+    done += n;
+  }
+  return done;
+}
+
+void serial_set_fifo(const char *arg) {
+  fifo_size = atoi(arg);
+  if (fifo_size != 1 && fifo_size != 16 && fifo_size != 64)
+    panic("The serial FIFO should be 1, 16 or 64 characters, not '%s'", arg);
+}
+
+/* Read back from IIR, which is restored with a checkpoint. */
+static int tx_depth() {
+  uint8_t iir = serial_port_base[FCR_OFFSET];
+  if (!(iir & IIR_FIFO_ENABLED)) return 1;
+  return (iir & IIR_FIFO_64) ? 64 : 16;
+}
+
+static void tx_push() {
+  if (tx_count == tx_depth()) {
+    if (!tx_overrun) {
+      Log("serial: more than %d characters written without polling LSR", tx_depth());
+      tx_overrun = true;
+    }
+    return;
+  }
+  tx_count ++;
+}
+
+/* Called with `device_lock' held. */
+static void fcr_write(uint8_t fcr) {
+  int depth = 1;
+  uint8_t iir = IIR_NO_INTR;
+  if (fifo_size > 1 && (fcr & FCR_FIFO_ENABLE)) {
+    depth = (fifo_size == 64 && (fcr & FCR_FIFO_64)) ? 64 : 16;
+    iir |= IIR_FIFO_ENABLED | (depth == 64 ? IIR_FIFO_64 : 0);
+  }
+  // the characters are out already, whatever FCR clears or resizes
+  tx_count = 0;
+  serial_port_base[FCR_OFFSET] = iir;
+}
+
+/* Called with `device_lock' held. */
+void serial_update() {
+  flush_obuf();
+}
+
+void serial_flush() {
+  flush_obuf();
+}
 
 void serial_io_handler(ioaddr_t addr, int len, bool is_write) {
   if (is_write) {
     assert(len == 1);
-    if (addr == SERIAL_PORT + CH_OFFSET) {
-      char c = serial_port_base[CH_OFFSET];
-      /* We bind the serial port with the host stdout in NEMU. */
-      putc(c, stdout);
-      if (c == '\n') {
-        fflush(stdout);
-      }
+    switch (addr - SERIAL_PORT) {
+      case CH_OFFSET:
+        if (serial_port_base[LCR_OFFSET] & LCR_DLAB) break;
+        serial_write((char *)&serial_port_base[CH_OFFSET], 1);
+        tx_push();
+        break;
+      case FCR_OFFSET: fcr_write(serial_port_base[FCR_OFFSET]); break;
     }
   }
+  else if (addr - SERIAL_PORT == LSR_OFFSET) {
+    serial_port_base[LSR_OFFSET] = (tx_count == 0 ? LSR_THRE | LSR_TEMT : 0);
+    tx_count = 0;
+  }
+}
+
+/* The registers are per CPU, since the lock is released between the `out's. */
+void serial_str_io_handler(ioaddr_t addr, int len, bool is_write) {
+  assert(len == 4);
+  switch (addr - SERIAL_STR_PORT) {
+    case STR_ADDR_OFFSET:
+      if (is_write) {
+        str_addr[cpu.id] = serial_str_port_base[STR_ADDR_OFFSET / 4];
+      }
+      break;
+    case STR_LEN_OFFSET:
+      if (is_write) {
+        str_done[cpu.id] = serial_puts(str_addr[cpu.id], serial_str_port_base[STR_LEN_OFFSET / 4]);
+      }
+      else {
+        serial_str_port_base[STR_LEN_OFFSET / 4] = str_done[cpu.id];
+      }
+      break;
+  }
 }
 
 void init_serial() {
   serial_port_base = add_pio_map(SERIAL_PORT, 8, serial_io_handler);
-  serial_port_base[LSR_OFFSET] = 0x20; /* the status is always free */
+  serial_port_base[FCR_OFFSET] = IIR_NO_INTR;
+  serial_port_base[LSR_OFFSET] = LSR_THRE | LSR_TEMT;
+  serial_str_port_base = add_pio_map(SERIAL_STR_PORT, 8, serial_str_io_handler);
+
+  log_flush = flush_obuf;
+  atexit(flush_obuf);
+  at_abort(flush_obuf);
 }
@@ -0,0 +1,48 @@
+#include "device/port-io.h"
+#include "device/intr.h"
+#include "cpu/reg.h"
+
+#define SMP_PORT 0x200   // Note that this is not the standard
+#define CPU_ID_OFFSET 0  // read: the number of the calling CPU
+#define NR_CPU_OFFSET 4  // read: the number of CPUs
+#define EIP_OFFSET 8     // entry of the AP to start
+#define ESP_OFFSET 12    // stack of the AP to start
+#define START_OFFSET 16  // write n: start AP n at EIP with ESP
+#define IPI_OFFSET 20    // write n: raise IRQ_IPI on CPU n
+#define STOP_OFFSET 24   // write: stop the calling AP
+
+void cpu_start(int, vaddr_t, vaddr_t);
+void cpu_stop(void);
+
+static uint32_t *smp_port_base;
+
+void smp_io_handler(ioaddr_t addr, int len, bool is_write) {
+  int reg = addr - SMP_PORT;
+  if (!is_write) {
+    if (reg == CPU_ID_OFFSET) {
+      smp_port_base[CPU_ID_OFFSET / 4] = cpu.id;
+    }
+    return;
+  }
+
+  assert(len == 4);
+  uint32_t data = smp_port_base[reg / 4];
+  switch (reg) {
+    case START_OFFSET:
+      cpu_start(data, smp_port_base[EIP_OFFSET / 4], smp_port_base[ESP_OFFSET / 4]);
+      break;
+    case IPI_OFFSET:
+      if (data < nr_cpu) {
+        dev_raise_intr(data, IRQ_IPI);
+      }
+      break;
+    case STOP_OFFSET:
+      cpu_stop();
+      break;
+  }
+}
+
+void init_smp_dev() {
+  smp_port_base = add_pio_map(SMP_PORT, 28, smp_io_handler);
+  smp_port_base[NR_CPU_OFFSET / 4] = nr_cpu;
+}
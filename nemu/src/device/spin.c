@@ -0,0 +1,58 @@
+#include "nemu.h"
+#include "device/spin.h"
+
+/* A guest waiting for time to pass or for a key often just polls: it
+ * reads the RTC or finds no key in the i8042 over and over, and touches
+ * no other device. Such a loop is detected when SPIN_THRESHOLD polls in
+ * a row are each at most SPIN_DISTANCE steps after the previous
+ * one with no other I/O in between. At each further poll by the same
+ * instruction, the virtual time jumps to the next timer tick, and the
+ * tick is raised at once. The RTC, the timer interrupt and the screen
+ * refresh all follow the virtual time, so the guest sees a consistent
+ * clock which runs faster than the host one.
+ *
+ * This is only done with one CPU, since the others may be doing real
+ * work while one of them polls.
+ */
+
+#define SPIN_THRESHOLD 16
+#define SPIN_DISTANCE 4096
+
+bool spin_enabled = false;
+
+static __thread uint64_t nr_io = 0;
+static __thread uint64_t last_io = 0, last_steps = 0;
+static __thread int nr_poll = 0;
+static __thread vaddr_t poll_eip;
+
+void spin_set() {
+  spin_enabled = true;
+}
+
+/* Called for every port or MMIO access, including the polls. */
+void spin_io() {
+  nr_io ++;
+}
+
+/* Called by the device when the access is a poll. */
+void spin_poll() {
+  if (!spin_enabled || nr_cpu > 1) return;
+
+  bool tight = (nr_io - last_io == 1 && cpu_steps - last_steps <= SPIN_DISTANCE);
+  last_io = nr_io;
+  last_steps = cpu_steps;
+  if (!tight) {
+    nr_poll = 0;
+    return;
+  }
+
+  nr_poll ++;
+  if (nr_poll == SPIN_THRESHOLD) {
+    // once per iteration of the loop
+    poll_eip = cpu.eip;
+  }
+  else if (nr_poll > SPIN_THRESHOLD && cpu.eip == poll_eip) {
+    void device_warp(void);
+    device_warp();
+  }
+}
@@ -1,13 +1,40 @@
 #include "device/port-io.h"
+#include "device/intr.h"
+#include "device/spin.h"
+#include "device/replay.h"
+#include "cpu/reg.h"
 #include "monitor/monitor.h"
 #include <sys/time.h>
 
 #define RTC_PORT 0x48   // Note that this is not the standard
 
+static uint64_t warp_us = 0;       // the virtual time skipped by timer_warp()
+static uint64_t last_tick_us = 0;
+
+/* the virtual time, which is the host time unless -W skips some */
+static uint64_t now_us() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec * 1000000ull + now.tv_usec + warp_us;
+}
+
+/* every CPU has its own timer, all driven by the same host signal */
 void timer_intr() {
+  last_tick_us = now_us();
   if (nemu_state == NEMU_RUNNING) {
-    extern void dev_raise_intr(void);
-    dev_raise_intr();
+    int i;
+    for (i = 0; i < nr_cpu; i ++) {
+      dev_raise_intr(i, IRQ_TIMER);
+    }
+  }
+}
+
+/* Skip the virtual time to the next tick, see src/device/spin.c. */
+void timer_warp() {
+  uint64_t next = last_tick_us + 1000000 / TIMER_HZ;
+  uint64_t now = now_us();
+  if (next > now) {
+    warp_us += next - now;
   }
 }
 
@@ -15,11 +42,8 @@ static uint32_t *rtc_port_base;
 
 void rtc_io_handler(ioaddr_t addr, int len, bool is_write) {
   if (!is_write) {
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    uint32_t seconds = now.tv_sec;
-    uint32_t useconds = now.tv_usec;
-    rtc_port_base[0] = seconds * 1000 + (useconds + 500) / 1000;
+    spin_poll();
+    rtc_port_base[0] = replay_rtc((now_us() + 500) / 1000);
   }
 }
 
@@ -3,36 +3,144 @@
 #ifdef HAS_IOE
 
 #include "device/mmio.h"
+#include "device/port-io.h"
+#include "device/intr.h"
+#include "device/vga.h"
+#include "device/display.h"
+#include "memory/memory.h"
+#include "memory/dirty.h"
 #include <SDL2/SDL.h>
 
-#define VMEM 0x40000
+/* The display controller shows either the MMIO frame buffer at VMEM,
+ * whose rows on the pages written since the last vblank are uploaded at
+ * every vblank, or one of NR_BUF frame buffers in guest memory, which
+ * is uploaded only when it is presented. A present takes effect at the
+ * next vblank.
+ */
+#define DISPLAY_PORT 0x100   // Note that this is not the standard
+#define NR_BUF_OFFSET 0      // read: the number of frame buffers
+#define BUF_OFFSET 4         // the frame buffer ADDR refers to
+#define ADDR_OFFSET 8        // guest physical address of frame buffer BUF
+#define PRESENT_OFFSET 12    // write n: show frame buffer n, or VMEM if n >= NR_BUF
+#define STATUS_OFFSET 16     // read: DISP_VBLANK and DISP_PENDING
+#define CTRL_OFFSET 20       // DISP_VBLANK_INTR: raise IRQ_VBLANK at every vblank
 
-#define SCREEN_H 300
-#define SCREEN_W 400
+#define NR_BUF 4
+#define DISP_VBLANK 0x1      // a vblank happened since STATUS was last read
+#define DISP_PENDING 0x2     // a present waits for the next vblank
+#define DISP_VBLANK_INTR 0x1
+
+#define BUF_VMEM NR_BUF
+
+static uint32_t *display_port_base;
+static paddr_t buf_addr[NR_BUF];
+static uint32_t front = BUF_VMEM, pending = BUF_VMEM;
+static bool is_pending, vblank;
+static DirtyClient vmem_dirty;
 
 static SDL_Window *window;
 static SDL_Renderer *renderer;
 static SDL_Texture *texture;
 
-static uint32_t (*vmem) [SCREEN_W];
+uint32_t (*vmem) [SCREEN_W];
 
 void vga_vmem_io_handler(paddr_t addr, int len, bool is_write) {
 }
 
+void display_io_handler(ioaddr_t addr, int len, bool is_write) {
+  int reg = addr - DISPLAY_PORT;
+  if (!is_write) {
+    if (reg == STATUS_OFFSET) {
+      display_port_base[STATUS_OFFSET / 4] = (vblank ? DISP_VBLANK : 0) | (is_pending ? DISP_PENDING : 0);
+      vblank = false;
+    }
+    return;
+  }
+
+  assert(len == 4);
+  uint32_t data = display_port_base[reg / 4];
+  switch (reg) {
+    case ADDR_OFFSET: {
+      uint32_t n = display_port_base[BUF_OFFSET / 4];
+      if (n < NR_BUF && data + SCREEN_W * SCREEN_H * 4 <= PMEM_SIZE) {
+        buf_addr[n] = data;
+      }
+      break;
+    }
+    case PRESENT_OFFSET:
+      pending = (data < NR_BUF ? data : BUF_VMEM);
+      is_pending = true;
+      break;
+  }
+}
+
+#define ROW_SIZE (SCREEN_W * sizeof(vmem[0][0]))
+
+/* The rows of VMEM on the pages written since the last vblank, from
+ * the first such page to the last, as [*y0, *y1).
+ */
+static void vmem_dirty_rows(int *y0, int *y1) {
+  const uint32_t end = (VMEM + SCREEN_H * ROW_SIZE - 1) / PAGE_SIZE + 1;
+  int first = dirty_next(&vmem_dirty, VMEM / PAGE_SIZE, end), last = first, pg = first;
+  *y0 = *y1 = 0;
+  if (first == -1) return;
+  while ((pg = dirty_next(&vmem_dirty, pg + 1, end)) != -1) {
+    last = pg;
+  }
+  *y0 = (first * PAGE_SIZE - VMEM) / ROW_SIZE;
+  *y1 = ((last + 1) * PAGE_SIZE - VMEM + ROW_SIZE - 1) / ROW_SIZE;
+  if (*y1 > SCREEN_H) *y1 = SCREEN_H;
+}
+
+/* Called at every vblank. */
 void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(vmem[0][0]));
-  SDL_RenderClear(renderer);
-  SDL_RenderCopy(renderer, texture, NULL, NULL);
-  SDL_RenderPresent(renderer);
+  int y0 = 0, y1 = 0;
+  dirty_sync();
+  if (is_pending) {
+    front = pending;
+    is_pending = false;
+    y1 = SCREEN_H;
+  }
+  else if (front == BUF_VMEM) {
+    vmem_dirty_rows(&y0, &y1);
+  }
+  dirty_reset(&vmem_dirty);
+  display_port_base[PRESENT_OFFSET / 4] = front;
+
+  void *pixels = (front == BUF_VMEM ? (void *)vmem : guest_to_host(buf_addr[front]));
+  if (display_mode != DISPLAY_SDL) {
+    display_frame(pixels, y1 > y0);
+  }
+  else if (y1 > y0) {
+    SDL_Rect rect = { .x = 0, .y = y0, .w = SCREEN_W, .h = y1 - y0 };
+    SDL_UpdateTexture(texture, &rect, pixels + y0 * ROW_SIZE, ROW_SIZE);
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+  }
+
+  vblank = true;
+  if (display_port_base[CTRL_OFFSET / 4] & DISP_VBLANK_INTR) {
+    dev_raise_intr(0, IRQ_VBLANK);
+  }
 }
 
 void init_vga() {
-  SDL_Init(SDL_INIT_VIDEO);
-  SDL_CreateWindowAndRenderer(SCREEN_W * 2, SCREEN_H * 2, 0, &window, &renderer);
-  SDL_SetWindowTitle(window, "NEMU");
-  texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-      SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
+  if (display_mode == DISPLAY_SDL) {
+    SDL_Init(SDL_INIT_VIDEO);
+    SDL_CreateWindowAndRenderer(SCREEN_W * 2, SCREEN_H * 2, 0, &window, &renderer);
+    SDL_SetWindowTitle(window, "NEMU");
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
+  }
+  else {
+    init_display();
+  }
 
   vmem = add_mmio_map(VMEM, 0x80000, vga_vmem_io_handler);
+
+  display_port_base = add_pio_map(DISPLAY_PORT, 24, display_io_handler);
+  display_port_base[NR_BUF_OFFSET / 4] = NR_BUF;
+  display_port_base[PRESENT_OFFSET / 4] = BUF_VMEM;
 }
 #endif	/* HAS_IOE */
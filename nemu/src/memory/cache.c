@@ -0,0 +1,82 @@
+#include "memory/cache.h"
+#include <stdlib.h>
+
+/* Set-associative caches with LRU replacement, indexed by the physical
+ * address. vaddr_ifetch() feeds the instruction cache, and the other
+ * virtual memory accesses feed the data cache, when `cache_enabled' is
+ * set. Page table walks and device accesses are not counted.
+ */
+
+#define NR_SET (CACHE_SIZE / (CACHE_LINE * CACHE_WAYS))
+
+typedef struct {
+  bool valid;
+  uint32_t tag;
+  uint64_t last_use;
+} CacheLine;
+
+typedef struct {
+  CacheLine (*set)[CACHE_WAYS];
+  uint64_t clock;
+  uint64_t access, miss;
+} Cache;
+
+bool cache_enabled = false;
+static Cache caches[NR_CACHE];
+
+void init_cache() {
+  int i;
+  for (i = 0; i < NR_CACHE; i ++) {
+    free(caches[i].set);
+    caches[i].set = calloc(NR_SET, sizeof(caches[i].set[0]));
+    assert(caches[i].set != NULL);
+    caches[i].clock = 0;
+  }
+  cache_reset_stat();
+}
+
+static void cache_access_line(Cache *c, uint32_t line) {
+  CacheLine *set = c->set[line % NR_SET];
+  uint32_t tag = line / NR_SET;
+  c->access ++;
+  c->clock ++;
+
+  int i, victim = 0;
+  for (i = 0; i < CACHE_WAYS; i ++) {
+    if (set[i].valid && set[i].tag == tag) {
+      set[i].last_use = c->clock;
+      return;
+    }
+    if (!set[i].valid || (set[victim].valid && set[i].last_use < set[victim].last_use)) {
+      victim = i;
+    }
+  }
+
+  c->miss ++;
+  set[victim].valid = true;
+  set[victim].tag = tag;
+  set[victim].last_use = c->clock;
+}
+
+/* An access crossing a line boundary touches both lines. */
+void cache_access(int type, paddr_t addr, int len) {
+  Cache *c = &caches[type];
+  uint32_t first = addr / CACHE_LINE, last = (addr + len - 1) / CACHE_LINE;
+  cache_access_line(c, first);
+  if (last != first) {
+    cache_access_line(c, last);
+  }
+}
+
+/* Only clear the counters, so that a warmed-up cache stays warm. */
+void cache_reset_stat() {
+  int i;
+  for (i = 0; i < NR_CACHE; i ++) {
+    caches[i].access = caches[i].miss = 0;
+  }
+}
+
+void cache_get_stat(int type, uint64_t *access, uint64_t *miss) {
+  *access = caches[type].access;
+  *miss = caches[type].miss;
+}
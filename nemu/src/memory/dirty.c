@@ -0,0 +1,78 @@
+#include "memory/dirty.h"
+
+/* Each page has the generation it was last seen dirty at. dirty_sync()
+ * starts a new generation and moves the pages marked in `dirty_map' to
+ * it, so a client has a page dirty if the generation of the page is
+ * newer than that of the client. The writers never take a lock: the map
+ * holds a byte rather than a bit per page so that the CPUs do not race
+ * on a word, and the writes mark the page after the data is written, so
+ * that a write racing with dirty_sync() is seen in one generation or the
+ * next.
+ *
+ * A client calls dirty_sync() first, and the other functions work as of
+ * that sync. A page marked after the sync is in the next generation, so
+ * it is dirty for a client reset by then. The clients all run on the
+ * thread of CPU 0.
+ */
+
+uint8_t dirty_map[NR_DIRTY_PAGE] __attribute__((aligned(8)));
+static uint32_t page_gen[NR_DIRTY_PAGE];
+static uint32_t gen = 0;
+
+void dirty_sync() {
+  uint64_t *w = (uint64_t *)dirty_map;
+  uint32_t i, pg;
+  gen ++;
+  for (i = 0; i < NR_DIRTY_PAGE / 8; i ++) {
+    if (w[i] == 0) continue;
+    for (pg = i * 8; pg < i * 8 + 8; pg ++) {
+      if (dirty_map[pg] && __atomic_exchange_n(&dirty_map[pg], 0, __ATOMIC_RELAXED)) {
+        page_gen[pg] = gen;
+      }
+    }
+  }
+}
+
+/* for writes which do not go through paddr_write() */
+void dirty_mark_range(paddr_t addr, uint32_t len) {
+  if (len == 0) return;
+  paddr_t pg;
+  for (pg = addr / PAGE_SIZE; pg <= (addr + len - 1) / PAGE_SIZE; pg ++) {
+    dirty_map[pg & (NR_DIRTY_PAGE - 1)] = 1;
+  }
+}
+
+/* Start over with no page dirty for `c'. */
+void dirty_reset(DirtyClient *c) {
+  c->gen = gen;
+}
+
+/* Whether page `pg' is written since `c' was reset. */
+bool dirty_test(DirtyClient *c, uint32_t pg) {
+  return page_gen[pg] > c->gen;
+}
+
+/* Whether page `pg' is written since `c' was reset, counting the writes
+ * after the last sync as well, e.g. to tell the first write to a page.
+ */
+bool dirty_written(DirtyClient *c, uint32_t pg) {
+  return page_gen[pg] > c->gen || dirty_map[pg];
+}
+
+/* The first page in [pg, end) written since `c' was reset, or -1. */
+int dirty_next(DirtyClient *c, uint32_t pg, uint32_t end) {
+  for (; pg < end; pg ++) {
+    if (page_gen[pg] > c->gen) return pg;
+  }
+  return -1;
+}
+
+/* The number of pages written since `c' was reset. */
+int dirty_count(DirtyClient *c) {
+  int n = 0;
+  uint32_t pg;
+  for (pg = 0; pg < NR_DIRTY_PAGE; pg ++) {
+    if (page_gen[pg] > c->gen) n ++;
+  }
+  return n;
+}
@@ -1,9 +1,9 @@
 #include "device/mmio.h"
 #include "memory/mmu.h"
+#include "memory/cache.h"
+#include "memory/dirty.h"
 #include "nemu.h"
 
-#define PMEM_SIZE (128 * 1024 * 1024)
-
 #define pmem_rw(addr, type)                                                    \
   *(type *)({                                                                  \
     Assert(addr < PMEM_SIZE, "physical address(0x%08x) is out of bound",       \
@@ -20,6 +20,21 @@
 
 uint8_t pmem[PMEM_SIZE];
 
+#ifdef DIFF_TEST
+void difftest_mark_dirty(paddr_t, int);
+#endif
+
+void raise_exception(uint8_t, uint32_t) __attribute__((noreturn));
+
+#define PF_VECTOR 14
+#define PF_ERR_WRITE 0x2
+
+/* The page is not present: set CR2 and abort the instruction with #PF. */
+static __attribute__((noreturn)) void page_fault(vaddr_t addr, bool worr) {
+  cpu.CR2 = addr;
+  raise_exception(PF_VECTOR, worr ? PF_ERR_WRITE : 0);
+}
+
 /* Memory accessing interfaces */
 
 uint32_t paddr_read(paddr_t addr, int len) {
@@ -32,53 +47,131 @@ uint32_t paddr_read(paddr_t addr, int len) {
 void paddr_write(paddr_t addr, int len, uint32_t data) {
   if (is_mmio(addr) != -1)
     mmio_write(addr, len, data, is_mmio(addr));
-  else
+  else {
+#ifdef DIFF_TEST
+    difftest_mark_dirty(addr, len);
+#endif
     memcpy(guest_to_host(addr), &data, len);
+  }
+  dirty_mark(addr);
 }
 
-paddr_t page_translate(vaddr_t addr, bool worr) {
+/* Walk the page tables of the running CPU. Return false if the page
+ * is not present.
+ */
+static inline bool page_walk(vaddr_t addr, paddr_t *paddr) {
   CR0 cr0 = (CR0)cpu.CR0;
   if (cr0.paging && cr0.protect_enable) {
     CR3 cr3 = (CR3)cpu.CR3;
     PDE *pgdir = (PDE *)PTE_ADDR(cr3.val);
     PDE pde = (PDE)paddr_read((uint32_t)(pgdir + PDX(addr)), 4);
-    Assert(pde.present, "addr=0x%x", addr);
-    pde.accessed = 1;
+    if (!pde.present) return false;
+
+    /* a 4MB page maps the whole directory entry */
+    if (pde.page_size && ((CR4)cpu.CR4).page_size_extension) {
+      *paddr = (pde.val & ~LARGE_PAGE_MASK) | (addr & LARGE_PAGE_MASK);
+      return true;
+    }
 
     PTE *ptab = (PTE *)PTE_ADDR(pde.val);
     PTE pte = (PTE)paddr_read((uint32_t)(ptab + PTX(addr)), 4);
-    Assert(pte.present, "addr=0x%x", addr);
-    pte.accessed = 1;
-    pte.dirty = worr ? 1 : pte.dirty;
-    return PTE_ADDR(pte.val) | OFF(addr);
+    if (!pte.present) return false;
+    *paddr = PTE_ADDR(pte.val) | OFF(addr);
+    return true;
   }
-  return addr;
+  *paddr = addr;
+  return true;
 }
 
-uint32_t vaddr_read(vaddr_t addr, int len) {
+paddr_t page_translate(vaddr_t addr, bool worr) {
+  paddr_t paddr;
+  if (!page_walk(addr, &paddr)) page_fault(addr, worr);
+  return paddr;
+}
+
+/* Translate `addr' for a device working on behalf of the running CPU.
+ * Unlike page_translate() this never faults.
+ */
+bool vaddr_probe(vaddr_t addr, paddr_t *paddr) {
+  return page_walk(addr, paddr);
+}
+
+/* `cache' is the cache model to feed, see memory/cache.h */
+static inline uint32_t vaddr_read_cache(vaddr_t addr, int len, int cache) {
   if (PTE_ADDR(addr) != PTE_ADDR(addr + len - 1)) {
     uint32_t data = 0;
     for (int i = 0; i < len; i++) {
       paddr_t paddr = page_translate(addr + i, false);
+      if (cache_enabled) cache_access(cache, paddr, 1);
       data += (paddr_read(paddr, 1)) << 8 * i;
     }
     return data;
   } else {
     paddr_t paddr = page_translate(addr, false);
+    if (cache_enabled) cache_access(cache, paddr, len);
     return paddr_read(paddr, len);
   }
 }
 
+uint32_t vaddr_read(vaddr_t addr, int len) {
+  return vaddr_read_cache(addr, len, CACHE_D);
+}
+
+/* the same as vaddr_read(), for instruction fetch */
+uint32_t vaddr_ifetch(vaddr_t addr, int len) {
+  return vaddr_read_cache(addr, len, CACHE_I);
+}
+
 void vaddr_write(vaddr_t addr, int len, uint32_t data) {
   if (PTE_ADDR(addr) != PTE_ADDR(addr + len - 1)) {
+    // fault before writing anything, at the first page not present
+    page_translate(addr, true);
+    page_translate(addr + len - 1, true);
     for (int i = 0; i < len; i++) {
       paddr_t paddr = page_translate(addr + i, true);
+      if (cache_enabled) cache_access(CACHE_D, paddr, 1);
       paddr_write(paddr, 1, data >> 8 * i);
     }
     return;
   } else {
     paddr_t paddr = page_translate(addr, true);
+    if (cache_enabled) cache_access(CACHE_D, paddr, len);
     paddr_write(paddr, len, data);
     return;
   }
 }
+
+/* Write `data' to `addr' only if it still holds `old', atomically with
+ * respect to the other CPUs. This is how LOCK-prefixed instructions
+ * update memory. An access crossing a page boundary or hitting MMIO
+ * can not be mapped to a host atomic and is done as a plain
+ * read-compare-write.
+ */
+bool vaddr_cmpxchg(vaddr_t addr, int len, uint32_t old, uint32_t data) {
+  if (PTE_ADDR(addr) != PTE_ADDR(addr + len - 1)) {
+    if (vaddr_read(addr, len) != old) return false;
+    vaddr_write(addr, len, data);
+    return true;
+  }
+
+  paddr_t paddr = page_translate(addr, true);
+  if (cache_enabled) cache_access(CACHE_D, paddr, len);
+  if (is_mmio(paddr) != -1) {
+    if (paddr_read(paddr, len) != old) return false;
+    paddr_write(paddr, len, data);
+    return true;
+  }
+
+#ifdef DIFF_TEST
+  difftest_mark_dirty(paddr, len);
+#endif
+  bool ok;
+  switch (len) {
+    case 1: ok = __sync_bool_compare_and_swap(&pmem_rw(paddr, uint8_t), old, data); break;
+    case 2: ok = __sync_bool_compare_and_swap(&pmem_rw(paddr, uint16_t), old, data); break;
+    case 4: ok = __sync_bool_compare_and_swap(&pmem_rw(paddr, uint32_t), old, data); break;
+    default: assert(0);
+  }
+  if (ok) dirty_mark(paddr);
+  return ok;
+}
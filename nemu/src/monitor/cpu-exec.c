@@ -1,6 +1,16 @@
 #include "nemu.h"
 #include "monitor/monitor.h"
 #include "monitor/watchpoint.h"
+#include "monitor/simpoint.h"
+#include "cpu/timing.h"
+#include "device/intr.h"
+#include "device/replay.h"
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 /* The assembly code of instructions executed is only output to the screen
  * when the number of instructions executed is less than this value.
@@ -12,6 +22,123 @@
 int nemu_state = NEMU_STOP;
 
 void exec_wrapper(bool);
+void fpu_reset(void);
+
+/* CPU 0 runs in cpu_exec() on the monitor thread, and every other CPU
+ * (AP) runs on its own host thread over the shared pmem. An AP sleeps
+ * until it is started through the SMP device, and only runs while
+ * NEMU is running.
+ */
+static pthread_mutex_t smp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t smp_cond = PTHREAD_COND_INITIALIZER;
+static pthread_barrier_t smp_barrier;
+static bool ap_running[MAX_CPU];  // with smp_lock held
+static __thread bool ap_stop;     // set by cpu_stop() on the AP itself
+
+static void *ap_main(void *arg) {
+  cpu.id = (intptr_t)arg;
+  cpus[cpu.id] = &cpu;
+  fpu_reset();
+  cpu.mxcsr = 0x1f80;
+  pthread_barrier_wait(&smp_barrier);
+
+  pthread_mutex_lock(&smp_lock);
+  while (1) {
+    while (!(ap_running[cpu.id] && nemu_state == NEMU_RUNNING)) {
+      pthread_cond_wait(&smp_cond, &smp_lock);
+    }
+    pthread_mutex_unlock(&smp_lock);
+
+    ap_stop = false;
+    while (!ap_stop && nemu_state == NEMU_RUNNING) {
+      exec_wrapper(false);
+    }
+
+    pthread_mutex_lock(&smp_lock);
+    // only now that it no longer runs can it be started again
+    if (ap_stop) {
+      ap_running[cpu.id] = false;
+    }
+  }
+  return NULL;
+}
+
+void init_smp() {
+  cpus[0] = &cpu;
+  if (nr_cpu == 1) return;
+
+#ifdef DIFF_TEST
+  panic("differential testing does not support %d CPUs", nr_cpu);
+#endif
+
+  /* the timer signal must only interrupt the monitor thread */
+  sigset_t set, old;
+  sigemptyset(&set);
+  sigaddset(&set, SIGVTALRM);
+  pthread_sigmask(SIG_BLOCK, &set, &old);
+
+  pthread_barrier_init(&smp_barrier, NULL, nr_cpu);
+  intptr_t i;
+  for (i = 1; i < nr_cpu; i ++) {
+    pthread_t tid;
+    int ret = pthread_create(&tid, NULL, ap_main, (void *)i);
+    Assert(ret == 0, "Can not create the thread of CPU %d", (int)i);
+  }
+  pthread_barrier_wait(&smp_barrier);
+
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* Start AP `cpu_no' at `eip' with stack `esp'. It shares the paging and
+ * interrupt setup of the calling CPU, since NEMU does not model the
+ * real-mode startup of an AP.
+ */
+void cpu_start(int cpu_no, vaddr_t eip, vaddr_t esp) {
+  if (cpu_no <= 0 || cpu_no >= nr_cpu) return;
+
+  pthread_mutex_lock(&smp_lock);
+  if (!ap_running[cpu_no]) {
+    CPU_state *c = cpus[cpu_no];
+    c->eip = eip;
+    c->esp = esp;
+    c->eflags.val = 0x2;
+    c->cs = cpu.cs;
+    c->CR0 = cpu.CR0;
+    c->CR3 = cpu.CR3;
+    c->CR4 = cpu.CR4;
+    c->idtr = cpu.idtr;
+    c->sysenter = cpu.sysenter;
+    c->INTR = 0;
+    c->halted = false;
+    c->intr_shadow = false;
+    ap_running[cpu_no] = true;
+    pthread_cond_broadcast(&smp_cond);
+  }
+  pthread_mutex_unlock(&smp_lock);
+}
+
+/* Stop the calling AP until it is started again. */
+void cpu_stop() {
+  if (cpu.id != 0) {
+    ap_stop = true;
+  }
+}
+
+/* Sleep while the CPU is halted, until dev_raise_intr() changes its
+ * interrupt lines, or for at most a timer period so that an AP sees
+ * NEMU stop. The virtual timer does not run while all the CPUs sleep,
+ * so CPU 0 ticks the devices itself when the period passes.
+ */
+void cpu_idle() {
+  // the ticks come at the same step as recorded, which is now
+  if (replay_mode == REPLAY_PLAY) return;
+
+  struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000000 / TIMER_HZ };
+  long ret = syscall(SYS_futex, &cpu.INTR, FUTEX_WAIT_PRIVATE, cpu.INTR, &ts, NULL, 0);
+  if (ret == -1 && errno == ETIMEDOUT && cpu.id == 0) {
+    replay_host_tick();
+  }
+}
 
 /* Simulate how the CPU works. */
 void cpu_exec(uint64_t n) {
@@ -19,14 +146,47 @@ void cpu_exec(uint64_t n) {
     printf("Program execution has ended. To restart the program, exit NEMU and run again.\n");
     return;
   }
+  pthread_mutex_lock(&smp_lock);
   nemu_state = NEMU_RUNNING;
+  pthread_cond_broadcast(&smp_cond);
+  pthread_mutex_unlock(&smp_lock);
 
   bool print_flag = n < MAX_INSTR_TO_PRINT;
 
+#if !defined(DEBUG) && !defined(DIFF_TEST)
+  /* `si' with a few instructions steps through each of them */
+  extern bool fusion_enabled;
+  extern __thread uint64_t aot_max_instr;
+  void aot_set_enabled(bool);
+  bool aot_is_recording(void);
+  // the translator needs the length of each instruction, SimPoint
+  // counts each instruction, the timing model sees each branch, and
+  // the inputs are replayed at the same instruction
+  bool count_each = simpoint_mode != SIMPOINT_NONE || timing_enabled || replay_mode != REPLAY_NONE;
+  fusion_enabled = !print_flag && !aot_is_recording() && !count_each;
+  aot_set_enabled(!print_flag && !count_each);
+#endif
+
   for (; n > 0; n --) {
+#if !defined(DEBUG) && !defined(DIFF_TEST)
+    // a pair would go past the last instruction, and so would a longer
+    // block
+    if (n == 1) fusion_enabled = false;
+    aot_max_instr = n;
+#endif
+
     /* Execute one instruction, including instruction fetch,
      * instruction decode, and the actual execution. */
+    bool idle = cpu.halted;
+    uint64_t steps = cpu_steps;
     exec_wrapper(print_flag);
+    // a fused pair is two instructions, a block is all of its own
+    if (cpu_steps - steps > 1) n -= cpu_steps - steps - 1;
+
+    if (!idle) {
+      if (simpoint_mode != SIMPOINT_NONE) { simpoint_step(); }
+      if (timing_enabled) { timing_stat.instr ++; }
+    }
 
 #ifdef DEBUG
     /* TODO: check watchpoints here. */
@@ -39,8 +199,11 @@ void cpu_exec(uint64_t n) {
     device_update();
 #endif
 
-    if (nemu_state != NEMU_RUNNING) { return; }
+    if (nemu_state != NEMU_RUNNING) { break; }
   }
 
+  extern void serial_flush();
+  serial_flush();
+
   if (nemu_state == NEMU_RUNNING) { nemu_state = NEMU_STOP; }
 }
@@ -1,6 +1,7 @@
 #include "monitor/monitor.h"
 #include "monitor/expr.h"
 #include "monitor/watchpoint.h"
+#include "memory/dirty.h"
 #include "nemu.h"
 
 #include <stdlib.h>
@@ -48,6 +49,34 @@ static int cmd_si(char *args){
   return 0;
 }
 
+/* The working set: the number of physical pages written by every
+ * INTERVAL instructions, and by all N of them.
+ */
+static int cmd_ws(char *args) {
+  unsigned long long n = 1000000, interval = 0, done = 0;
+  if (args != NULL) {
+    sscanf(args, "%llu %llu", &n, &interval);
+  }
+  if (interval == 0 || interval > n) interval = n;
+
+  DirtyClient total, part;
+  dirty_sync();
+  dirty_reset(&total);
+  while (done < n) {
+    unsigned long long step = (n - done < interval ? n - done : interval);
+    uint64_t start = cpu_steps;
+    dirty_reset(&part);
+    cpu_exec(step);
+    dirty_sync();
+    done += cpu_steps - start;
+    printf("%llu: %d pages written\n", done, dirty_count(&part));
+    if (cpu_steps - start < step || nemu_state != NEMU_STOP) break;
+  }
+  printf("%d pages (%d KB) written in %llu instructions\n",
+      dirty_count(&total), dirty_count(&total) * (PAGE_SIZE / 1024), done);
+  return 0;
+}
+
 static int cmd_info(char *args){
   char op;
   if(args==NULL){;}
@@ -63,6 +92,7 @@ static int cmd_info(char *args){
         printf("%s: 0x%x\n",regsb[i],reg_b(i)); //8位寄存器名称+当前存储的值
       printf("CR0: 0x%x\n", cpu.CR0); //CR0
       printf("CR3: 0x%x\n", cpu.CR3); //CR3
+      printf("CR4: 0x%x\n", cpu.CR4); //CR4
     }
     if(op=='w')show_wp();  // 打印监视点状态
   }
@@ -126,6 +156,7 @@ static struct {
   { "p", "p EXPR 求出表达式EXPR的值", cmd_p},
   { "w", "w EXPR 当EXPR的值发生变化时，暂停程序", cmd_w},
   { "d", "d N 删除N号监视点", cmd_d},
+  { "ws", "ws [N [INTERVAL]] 执行N条指令，每INTERVAL条及最后输出写过的物理页数", cmd_ws},
   /* TODO: Add more commands */
 
 };
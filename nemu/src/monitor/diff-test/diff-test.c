@@ -1,7 +1,12 @@
 #include "nemu.h"
 #include "monitor/monitor.h"
+#include "memory/mmu.h"
+#include "memory/dirty.h"
+#include "device/mmio.h"
 #include <unistd.h>
 #include <sys/prctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <signal.h>
 
 #include "protocol.h"
@@ -9,10 +14,12 @@
 
 bool gdb_connect_qemu(void);
 bool gdb_memcpy_to_qemu(uint32_t, void *, int);
+bool gdb_memcpy_from_qemu(uint32_t, void *, int);
 bool gdb_getregs(union gdb_regs *);
 bool gdb_setregs(union gdb_regs *);
 bool gdb_si(void);
 void gdb_exit(void);
+void exec_replay(void);
 
 static bool is_skip_qemu;
 static bool is_skip_nemu;
@@ -31,6 +38,7 @@ void diff_test_skip_nemu() { is_skip_nemu = true; }
     regs.esi = cpu.esi; \
     regs.edi = cpu.edi; \
     regs.eip = cpu.eip; \
+    regs.eflags = cpu.eflags.val; \
   } while (0)
 
 static uint8_t mbr[] = {
@@ -63,7 +71,61 @@ static uint8_t mbr[] = {
   0x17, 0x00, 0x2c, 0x7c, 0x00, 0x00
 };
 
+/* With `-s', the physical memory of QEMU is a file under /dev/shm which is
+ * also mapped here, so that memory is synchronized by memcpy() instead of
+ * going through the GDB protocol.
+ */
+static bool use_shm;
+static char shm_path[64];
+static uint8_t *qemu_pmem;
+
+void difftest_set_shm(void) {
+  use_shm = true;
+}
+
+static void init_shm(void) {
+  snprintf(shm_path, sizeof(shm_path), "/dev/shm/nemu-difftest-%d", getpid());
+  int fd = open(shm_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  Assert(fd != -1, "Can not open '%s'", shm_path);
+  int ret = ftruncate(fd, PMEM_SIZE);
+  assert(ret == 0);
+  qemu_pmem = mmap(NULL, PMEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  assert(qemu_pmem != MAP_FAILED);
+  close(fd);
+}
+
+/* Copy physical memory to and from QEMU. Without shared memory this
+ * relies on QEMU mapping physical memory at the same virtual address,
+ * which holds before paging is enabled and for the kernel part of every
+ * address space set up by AM.
+ */
+static void qemu_pmem_write(paddr_t addr, void *src, int len) {
+  if (qemu_pmem != NULL) {
+    memcpy(qemu_pmem + addr, src, len);
+  }
+  else {
+    gdb_memcpy_to_qemu(addr, src, len);
+  }
+}
+
+static void qemu_pmem_read(paddr_t addr, void *dest, int len) {
+  if (qemu_pmem != NULL) {
+    memcpy(dest, qemu_pmem + addr, len);
+  }
+  else {
+    gdb_memcpy_from_qemu(addr, dest, len);
+  }
+}
+
+void difftest_memcpy_to_qemu(paddr_t addr, void *src, int len) {
+  qemu_pmem_write(addr, src, len);
+}
+
 void init_difftest(void) {
+  if (use_shm) {
+    init_shm();
+  }
+
   int ppid_before_fork = getpid();
   int pid = fork();
   if (pid == -1) {
@@ -85,7 +147,16 @@ void init_difftest(void) {
     }
 
     close(STDIN_FILENO);
-    execlp("qemu-system-i386", "qemu-system-i386", "-S", "-s", "-nographic", NULL);
+    if (use_shm) {
+      char backend[128];
+      snprintf(backend, sizeof(backend),
+          "memory-backend-file,id=pmem,size=%d,mem-path=%s,share=on", PMEM_SIZE, shm_path);
+      execlp("qemu-system-i386", "qemu-system-i386", "-S", "-s", "-nographic",
+          "-m", "128M", "-object", backend, "-machine", "memory-backend=pmem", NULL);
+    }
+    else {
+      execlp("qemu-system-i386", "qemu-system-i386", "-S", "-s", "-nographic", NULL);
+    }
     perror("exec");
     panic("exec error");
   }
@@ -97,9 +168,13 @@ void init_difftest(void) {
 
     atexit(gdb_exit);
 
+    if (use_shm) {
+      // QEMU has opened the file
+      unlink(shm_path);
+    }
+
     // put the MBR code to QEMU to enable protected mode
-    bool ok = gdb_memcpy_to_qemu(0x7c00, mbr, sizeof(mbr));
-    assert(ok == 1);
+    qemu_pmem_write(0x7c00, mbr, sizeof(mbr));
 
     union gdb_regs r;
     gdb_getregs(&r);
@@ -107,7 +182,7 @@ void init_difftest(void) {
     // set cs:eip to 0000:7c00
     r.eip = 0x7c00;
     r.cs = 0x0000;
-    ok = gdb_setregs(&r);
+    bool ok = gdb_setregs(&r);
     assert(ok == 1);
 
     // execute enough instructions to enter protected mode
@@ -118,57 +193,318 @@ void init_difftest(void) {
   }
 }
 
+static void checkpoint(union gdb_regs *);
+
 void init_qemu_reg() {
   union gdb_regs r;
   gdb_getregs(&r);
   regcpy_from_nemu(r);
   bool ok = gdb_setregs(&r);
   assert(ok == 1);
+  checkpoint(&r);
+}
+
+/* Batched checking: NEMU runs `batch' instructions ahead before QEMU is
+ * stepped and the two states are compared. The pages written since the
+ * last agreed state (the checkpoint) are those dirty for the client
+ * `ckpt', see src/memory/dirty.c, and the old contents of each are saved
+ * before its first write, so that a mismatch can be bisected down to the
+ * first diverging instruction by rolling both sides back and replaying.
+ * `batch' = 1, the default, checks every instruction the same way, the
+ * registers with the flags of EFLAGS_MASK and the pages written.
+ */
+
+#define NR_PAGE NR_DIRTY_PAGE
+#define EFLAGS_MASK 0x8c1   // CF, ZF, SF, OF
+
+static int batch = 1;
+
+static int nr_pending;          // QEMU steps owed since the checkpoint
+static CPU_state pre_cpu;       // NEMU state before the current instruction
+static CPU_state ckpt_cpu;
+static union gdb_regs ckpt_regs;
+
+static DirtyClient ckpt;        // pages written since the checkpoint
+static DirtyClient step;        // pages written by the current instruction
+static bool step_written;       // whether the instruction has written RAM, and reset `step'
+static uint8_t *preimage[NR_PAGE];
+
+void difftest_set_batch(int n) {
+  batch = (n > 1 ? n : 1);
+}
+
+/* The first page of RAM from `pg' on dirty for `c' as of the last
+ * dirty_sync(), or -1. The pages of the memory-mapped devices are marked
+ * too, but only NEMU has the devices.
+ */
+static int next_dirty(DirtyClient *c, int pg) {
+  while ((pg = dirty_next(c, pg, NR_PAGE)) != -1 && is_mmio(pg * PAGE_SIZE) != -1) {
+    pg ++;
+  }
+  return pg;
+}
+
+#define for_each_dirty(pg, c) \
+  for (pg = next_dirty(c, 0); pg != -1; pg = next_dirty(c, pg + 1))
+
+static inline void mark_page(uint32_t pg) {
+  if (!dirty_written(&ckpt, pg)) {
+    if (preimage[pg] == NULL) {
+      preimage[pg] = malloc(PAGE_SIZE);
+      assert(preimage[pg] != NULL);
+    }
+    memcpy(preimage[pg], guest_to_host(pg * PAGE_SIZE), PAGE_SIZE);
+  }
+}
+
+/* Called before a write to RAM. The first write of an instruction starts
+ * `step' over, so only the instructions writing RAM cost a dirty_sync().
+ */
+void difftest_mark_dirty(paddr_t addr, int len) {
+  if (!step_written) {
+    dirty_sync();
+    dirty_reset(&step);
+    step_written = true;
+  }
+  mark_page(addr / PAGE_SIZE);
+  if ((addr + len - 1) / PAGE_SIZE != addr / PAGE_SIZE) {
+    mark_page((addr + len - 1) / PAGE_SIZE);
+  }
+}
+
+static inline bool step_has(uint32_t pg) {
+  return step_written && dirty_test(&step, pg);
+}
+
+static void checkpoint(union gdb_regs *r) {
+  dirty_sync();
+  dirty_reset(&ckpt);
+  nr_pending = 0;
+  ckpt_cpu = cpu;
+  ckpt_regs = *r;
+}
+
+/* Roll both sides back to the checkpoint. The pages stay dirty for
+ * `ckpt', with the same old contents.
+ */
+static void restore(void) {
+  int pg;
+  dirty_sync();
+  for_each_dirty(pg, &ckpt) {
+    assert(preimage[pg] != NULL);
+    memcpy(guest_to_host(pg * PAGE_SIZE), preimage[pg], PAGE_SIZE);
+    qemu_pmem_write(pg * PAGE_SIZE, preimage[pg], PAGE_SIZE);
+  }
+  nr_pending = 0;
+  cpu = ckpt_cpu;
+  gdb_setregs(&ckpt_regs);
+}
+
+/* Advance both sides by `n' QEMU steps. An instruction QEMU cannot stop
+ * after (`int') is executed together with the next one.
+ */
+static void step_both(int n) {
+  int i;
+  for (i = 0; i < n; i ++) {
+    exec_replay();
+    if (is_skip_nemu) {
+      is_skip_nemu = false;
+      exec_replay();
+    }
+    gdb_si();
+  }
+}
+
+static bool regs_equal(CPU_state *c, union gdb_regs *r) {
+  return c->eax == r->eax && c->ecx == r->ecx && c->edx == r->edx &&
+    c->ebx == r->ebx && c->esp == r->esp && c->ebp == r->ebp &&
+    c->esi == r->esi && c->edi == r->edi && c->eip == r->eip &&
+    ((c->eflags.val ^ r->eflags) & EFLAGS_MASK) == 0;
+}
+
+/* With shared memory the page of QEMU is compared in place. */
+static bool page_equal(paddr_t addr) {
+  static uint8_t buf[PAGE_SIZE];
+  const uint8_t *q = buf;
+  if (qemu_pmem != NULL) {
+    q = qemu_pmem + addr;
+  }
+  else {
+    qemu_pmem_read(addr, buf, PAGE_SIZE);
+  }
+  return memcmp(guest_to_host(addr), q, PAGE_SIZE) == 0;
+}
+
+/* Compare the pages written since the checkpoint, except those written
+ * by the current instruction if `skip_step' is set. Return the first
+ * differing page, or -1 if they are all the same.
+ */
+static int mem_diff(bool skip_step) {
+  int pg;
+  dirty_sync();
+  for_each_dirty(pg, &ckpt) {
+    if (skip_step && step_has(pg)) {
+      continue;
+    }
+    if (!page_equal(pg * PAGE_SIZE)) {
+      return pg;
+    }
+  }
+  return -1;
+}
+
+static void report(vaddr_t eip, union gdb_regs *r) {
+  printf("difftest: first different instruction at eip = 0x%08x\n", eip);
+
+  uint32_t qemu_regs[] = { r->eax, r->ecx, r->edx, r->ebx, r->esp, r->ebp, r->esi, r->edi };
+  int i;
+  printf("%-8s %-10s %-10s\n", "", "NEMU", "QEMU");
+  for (i = R_EAX; i <= R_EDI; i ++) {
+    printf("%-8s 0x%08x 0x%08x%s\n", regsl[i], reg_l(i), qemu_regs[i],
+        reg_l(i) != qemu_regs[i] ? "  <--" : "");
+  }
+  printf("%-8s 0x%08x 0x%08x%s\n", "eip", cpu.eip, r->eip, cpu.eip != r->eip ? "  <--" : "");
+  printf("%-8s 0x%08x 0x%08x%s\n", "eflags", cpu.eflags.val, r->eflags,
+      (cpu.eflags.val ^ r->eflags) & EFLAGS_MASK ? "  <--" : "");
+
+  int pg = mem_diff(false);
+  if (pg != -1) {
+    static uint8_t buf[PAGE_SIZE];
+    uint32_t addr = pg * PAGE_SIZE;
+    uint8_t *p = guest_to_host(addr);
+    int n = 0;
+    qemu_pmem_read(addr, buf, PAGE_SIZE);
+    for (i = 0; i < PAGE_SIZE && n < 8; i ++) {
+      if (p[i] != buf[i]) {
+        printf("mem[0x%08x]: NEMU = 0x%02x, QEMU = 0x%02x\n", addr + i, p[i], buf[i]);
+        n ++;
+      }
+    }
+  }
+}
+
+/* The states after `n' QEMU steps from the checkpoint differ. Find the
+ * first step where they diverge and report it.
+ */
+static void bisect(int n) {
+  union gdb_regs r;
+  int lo = 0, hi = n;
+  while (hi - lo > 1) {
+    int mid = (lo + hi) / 2;
+    restore();
+    step_both(mid - lo);
+    gdb_getregs(&r);
+    if (regs_equal(&cpu, &r) && mem_diff(false) == -1) {
+      checkpoint(&r);
+      lo = mid;
+    }
+    else {
+      hi = mid;
+    }
+  }
+
+  restore();
+  vaddr_t eip = cpu.eip;
+  step_both(1);
+  gdb_getregs(&r);
+  report(eip, &r);
+}
+
+/* Catch QEMU up and compare it with `c'. On success, `r' holds the
+ * registers of QEMU.
+ */
+static bool flush(CPU_state *c, union gdb_regs *r, bool skip_step) {
+  int i;
+  for (i = 0; i < nr_pending; i ++) {
+    gdb_si();
+  }
+  gdb_getregs(r);
+
+  if (regs_equal(c, r) && mem_diff(skip_step) == -1) {
+    return true;
+  }
+
+  bisect(nr_pending);
+  nemu_state = NEMU_END;
+  return false;
+}
+
+/* The instruction skipped by QEMU may have written memory, e.g. by DMA.
+ * Copy the pages it has written which differ. Without shared memory,
+ * reading a page back from QEMU costs more than writing it, so the pages
+ * are always copied.
+ */
+static void sync_step_pages(void) {
+  int pg;
+  if (!step_written) return;
+  dirty_sync();
+  for_each_dirty(pg, &step) {
+    uint32_t addr = pg * PAGE_SIZE;
+    if (qemu_pmem == NULL || memcmp(qemu_pmem + addr, guest_to_host(addr), PAGE_SIZE) != 0) {
+      qemu_pmem_write(addr, guest_to_host(addr), PAGE_SIZE);
+    }
+  }
+}
+
+void difftest_begin_step(void) {
+  step_written = false;
+  pre_cpu = cpu;
 }
 
 void difftest_step(uint32_t eip) {
   union gdb_regs r;
-  bool diff = false;
 
   if (is_skip_nemu) {
+    // QEMU will execute it together with the next instruction
     is_skip_nemu = false;
     return;
   }
 
   if (is_skip_qemu) {
-    // to skip the checking of an instruction, just copy the reg state to qemu
-    gdb_getregs(&r);
+    is_skip_qemu = false;
+    if (!flush(&pre_cpu, &r, true)) {
+      return;
+    }
+    sync_step_pages();
     regcpy_from_nemu(r);
     gdb_setregs(&r);
-    is_skip_qemu = false;
+    checkpoint(&r);
     return;
   }
 
-  gdb_si();
-  gdb_getregs(&r);
+  nr_pending ++;
+  if (nr_pending >= batch && flush(&cpu, &r, false)) {
+    checkpoint(&r);
+  }
+}
+
+/* QEMU does not see the timer interrupt. Bring it up to date before the
+ * interrupt is raised, then copy the effect of the interrupt to it.
+ */
+void difftest_intr_begin(void) {
+  union gdb_regs r;
+  if (nr_pending > 0 && nemu_state != NEMU_END) {
+    flush(&cpu, &r, false);
+  }
+}
+
+void difftest_intr_end(void) {
+  union gdb_regs r;
+  uint8_t frame[12];
+  int i;
+
+  if (nemu_state == NEMU_END) {
+    return;
+  }
 
-  // TODO: Check the registers state with QEMU.
-  // Set `diff` as `true` if they are not the same.
-  if (cpu.eax != r.eax)
-      diff = true;
-  else if (cpu.ecx != r.ecx)
-      diff = true;
-  else if (cpu.edx != r.edx)
-      diff = true;
-  else if (cpu.ebx != r.ebx)
-      diff = true;
-  else if (cpu.esp != r.esp)
-      diff = true;
-  else if (cpu.ebp != r.ebp)
-      diff = true;
-  else if (cpu.esi != r.esi)
-      diff = true;
-  else if (cpu.edi != r.edi)
-      diff = true;
-  else if (cpu.eip != r.eip)
-      diff = true;
-
-  if (diff) {
-    nemu_state = NEMU_END;
+  // the pushed eflags, cs and eip
+  for (i = 0; i < sizeof(frame); i ++) {
+    frame[i] = vaddr_read(cpu.esp + i, 1);
   }
+  gdb_memcpy_to_qemu(cpu.esp, frame, sizeof(frame));
+
+  gdb_getregs(&r);
+  regcpy_from_nemu(r);
+  gdb_setregs(&r);
+  checkpoint(&r);
 }
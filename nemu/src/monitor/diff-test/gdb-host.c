@@ -5,16 +5,77 @@
 
 static struct gdb_conn *conn;
 
+// the largest packet QEMU accepts, negotiated with qSupported
+static int packet_size = 1500;
+// whether QEMU accepts binary `X' packets
+static bool has_x_packet = true;
+
+static void gdb_negotiate(void) {
+  const char *cmd = "qSupported:PacketSize=10000";
+  gdb_send(conn, (const uint8_t *)cmd, strlen(cmd));
+
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  char *p = strstr((const char *)reply, "PacketSize=");
+  if (p != NULL) {
+    packet_size = strtol(p + strlen("PacketSize="), NULL, 16);
+  }
+  free(reply);
+
+  gdb_start_noack(conn);
+}
+
 bool gdb_connect_qemu(void) {
   // connect to gdbserver on localhost port 1234
   while ((conn = gdb_begin_inet("127.0.0.1", 1234)) == NULL) {
     usleep(1);
   }
 
+  gdb_negotiate();
+
   return true;
 }
 
+// the largest chunk of memory which fits in a packet even if it is
+// hex encoded or every byte is escaped
+static inline int mem_chunk_size(void) {
+  return (packet_size - 32) / 2;
+}
+
+static bool gdb_memcpy_to_qemu_x(uint32_t dest, void *src, int len) {
+  char *buf = malloc(len * 2 + 128);
+  assert(buf != NULL);
+  int p = sprintf(buf, "X%x,%x:", dest, len);
+  int i;
+  for (i = 0; i < len; i ++) {
+    uint8_t c = ((uint8_t *)src)[i];
+    if (c == '#' || c == '$' || c == '}' || c == '*') {
+      buf[p ++] = '}';
+      c ^= 0x20;
+    }
+    buf[p ++] = c;
+  }
+
+  gdb_send(conn, (const uint8_t *)buf, p);
+  free(buf);
+
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  bool ok = !strcmp((const char*)reply, "OK");
+  if (size == 0) {
+    // an empty reply means the packet is not supported
+    has_x_packet = false;
+  }
+  free(reply);
+
+  return ok;
+}
+
 static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
+  if (has_x_packet && gdb_memcpy_to_qemu_x(dest, src, len)) {
+    return true;
+  }
+
   char *buf = malloc(len * 2 + 128);
   assert(buf != NULL);
   int p = sprintf(buf, "M0x%x,%x:", dest, len);
@@ -35,7 +96,7 @@ static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
 }
 
 bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
-  const int mtu = 1500;
+  const int mtu = mem_chunk_size();
   bool ok = true;
   while (len > mtu) {
     ok &= gdb_memcpy_to_qemu_small(dest, src, mtu);
@@ -47,6 +108,36 @@ bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
   return ok;
 }
 
+static bool gdb_memcpy_from_qemu_small(uint32_t src, void *dest, int len) {
+  char buf[32];
+  sprintf(buf, "m0x%x,%x", src, len);
+  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  bool ok = (size == len * 2);
+  int i;
+  for (i = 0; ok && i < len; i ++) {
+    ((uint8_t *)dest)[i] = gdb_decode_hex(reply[i * 2], reply[i * 2 + 1]);
+  }
+  free(reply);
+
+  return ok;
+}
+
+bool gdb_memcpy_from_qemu(uint32_t src, void *dest, int len) {
+  const int mtu = mem_chunk_size();
+  bool ok = true;
+  while (len > mtu) {
+    ok &= gdb_memcpy_from_qemu_small(src, dest, mtu);
+    src += mtu;
+    dest += mtu;
+    len -= mtu;
+  }
+  ok &= gdb_memcpy_from_qemu_small(src, dest, len);
+  return ok;
+}
+
 bool gdb_getregs(union gdb_regs *r) {
   gdb_send(conn, (const uint8_t *)"g", 1);
   size_t size;
@@ -0,0 +1,642 @@
+#include "monitor/fuzz.h"
+#include "monitor/monitor.h"
+#include "cpu/decode.h"
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/time.h>
+
+/* A case is a random initial state with up to FUZZ_MAX_INSTR random
+ * instructions. The host runs it first, generating the instructions one
+ * by one, and NEMU then runs the same instructions from the same state,
+ * comparing the registers after each of them, the exception raised, if
+ * any, and finally the window. The memory is put back by copying only
+ * the pages which differ from the snapshot.
+ *
+ * A mismatch is reported once for each instruction encoding and kind of
+ * difference. It is minimized first, by dropping the other instructions,
+ * clearing the registers and the memory as long as the same mismatch
+ * remains, and is written as fuzz-<n>.c in the style of the cputests.
+ * An encoding NEMU does not implement is only counted, and skipped.
+ */
+
+#define DE_VECTOR 0
+#define UD_VECTOR 6
+#define GP_VECTOR 13
+#define PF_VECTOR 14
+
+#define EFLAGS_COMPARED 0xcc5  // CF PF ZF SF DF OF
+#define FPU_CC 0x4500          // C3 C2 C0, C1 also reports rounding
+#define MAX_REPORT 100
+
+enum { KIND_REG, KIND_FLAGS, KIND_SSE, KIND_FPU, KIND_MEM, KIND_FAULT, KIND_CRASH, NR_KIND };
+enum { CASE_PASS, CASE_FAIL, CASE_SKIP, CASE_UNSUPPORTED, CASE_BAD };
+
+static const char *kind_name[] = {
+  [KIND_REG] = "registers", [KIND_FLAGS] = "flags", [KIND_SSE] = "SSE", [KIND_FPU] = "x87",
+  [KIND_MEM] = "memory", [KIND_FAULT] = "exception", [KIND_CRASH] = "crash",
+};
+
+typedef struct {
+  int step, kind;  // the instruction after which the states differ
+  char what[160];
+} Mismatch;
+
+extern bool exception_deliver;
+extern int exception_caught;
+void exec_replay(void);
+
+static uint64_t nr_case = 0;
+static uint32_t seed;
+static FILE *out;  // stdout is for the guest, like exec_inv()
+
+static uint8_t base_mem[FUZZ_SIZE];  // the memory of the cases
+static uint8_t case_mem[FUZZ_SIZE];  // that of the case being minimized
+static const uint8_t *snapshot = base_mem;
+#define nemu_mem ((uint8_t *)guest_to_host(FUZZ_BASE))
+
+static int reported[MAX_REPORT], nr_report = 0;
+
+void fuzz_set(const char *arg) {
+  char *end;
+  nr_case = strtoull(arg, &end, 0);
+  seed = (*end == ',' ? strtoul(end + 1, NULL, 0) : time(NULL));
+  Assert(nr_case > 0, "Usage: -F cases[,seed]");
+}
+
+/* the memory */
+
+static void init_base_mem() {
+  uint32_t *p = (uint32_t *)(base_mem + PAGE_SIZE);
+  int i;
+  memset(base_mem, 0, PAGE_SIZE);
+  for (i = 0; i < FUZZ_DATA_SIZE / 4; i ++) {
+    switch (fuzz_rand() % 4) {
+      case 0: p[i] = 0; break;
+      // something to load into ESP or jump to
+      case 1: p[i] = FUZZ_BASE + fuzz_rand() % FUZZ_SIZE; break;
+      default: p[i] = fuzz_rand() >> (fuzz_rand() % 32); break;
+    }
+  }
+}
+
+static void setup_mem(uint8_t *mem, const FuzzCase *c) {
+  int i;
+  for (i = 0; i < FUZZ_PAGES; i ++) {
+    uint8_t *p = mem + i * PAGE_SIZE;
+    const uint8_t *q = snapshot + i * PAGE_SIZE;
+    if (memcmp(p, q, PAGE_SIZE) != 0) memcpy(p, q, PAGE_SIZE);
+  }
+  memcpy(mem + (c->init.gpr[R_ESP] - FUZZ_BASE), &c->stack0, 4);
+}
+
+static void init_page_table() {
+  uint32_t *pdir = guest_to_host(FUZZ_PDIR), *ptab = guest_to_host(FUZZ_PDIR + PAGE_SIZE);
+  memset(pdir, 0, 2 * PAGE_SIZE);
+  pdir[FUZZ_BASE >> 22] = (FUZZ_PDIR + PAGE_SIZE) | 0x7;
+  int i;
+  for (i = 0; i < FUZZ_PAGES; i ++) {
+    ptab[((FUZZ_BASE >> 12) & 0x3ff) + i] = (FUZZ_BASE + i * PAGE_SIZE) | 0x7;
+  }
+  cpu.CR0 |= 0x80000001;
+  cpu.CR3 = FUZZ_PDIR;
+  cpu.CR4 = 0;
+}
+
+/* the state of NEMU */
+
+static void nemu_load(const FuzzState *s) {
+  int i;
+  for (i = 0; i < 8; i ++) {
+    cpu.gpr[i]._32 = s->gpr[i];
+  }
+  cpu.eip = s->eip;
+  cpu.eflags.val = s->eflags;
+  memcpy(cpu.fpu.st, s->fpu.st, sizeof(cpu.fpu.st));
+  cpu.fpu.cw = s->fpu.cw;
+  cpu.fpu.sw = s->fpu.sw;
+  cpu.fpu.top = s->fpu.top;
+  cpu.fpu.valid = s->fpu.valid;
+  memcpy(cpu.xmm, s->xmm, sizeof(cpu.xmm));
+  cpu.mxcsr = s->mxcsr;
+  cpu.INTR = 0;
+}
+
+static void nemu_save(FuzzState *s) {
+  int i;
+  memset(s, 0, sizeof(*s));
+  for (i = 0; i < 8; i ++) {
+    s->gpr[i] = cpu.gpr[i]._32;
+    memcpy(&s->fpu.st[i], &cpu.fpu.st[i], 10);
+  }
+  s->eip = cpu.eip;
+  s->eflags = cpu.eflags.val;
+  s->fpu.cw = cpu.fpu.cw;
+  s->fpu.sw = cpu.fpu.sw;
+  s->fpu.top = cpu.fpu.top;
+  s->fpu.valid = cpu.fpu.valid;
+  memcpy(s->xmm, cpu.xmm, sizeof(s->xmm));
+  s->mxcsr = cpu.mxcsr;
+}
+
+/* Execute an instruction. Return the exception it raises, or -1. */
+static int nemu_step(int *crash) {
+  nemu_state = NEMU_RUNNING;
+  exception_caught = -1;
+  fuzz_in_nemu = true;
+  *crash = sigsetjmp(fuzz_nemu_env, 0);
+  if (*crash == 0) {
+    exec_replay();
+  }
+  fuzz_in_nemu = false;
+  if (*crash != 0) {
+    decoding.is_operand_size_16 = false;
+    decoding.rep = 0;
+    decoding.lock = decoding.lock_failed = decoding.is_jmp = false;
+    return -1;
+  }
+  // exec_inv()
+  if (nemu_state == NEMU_END) return UD_VECTOR;
+  return exception_caught;
+}
+
+/* comparing */
+
+static bool mismatch(Mismatch *m, int kind, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(m->what, sizeof(m->what), fmt, ap);
+  va_end(ap);
+  m->kind = kind;
+  return false;
+}
+
+static void hex_str(char *buf, const void *p, int len) {
+  const uint8_t *b = p;
+  while (len -- > 0) {
+    buf += sprintf(buf, "%02x", b[len]);
+  }
+}
+
+static bool compare_state(const FuzzInstr *in, const FuzzState *before, const FuzzState *n,
+    const FuzzState *h, Mismatch *m) {
+  int i;
+  for (i = 0; i < 8; i ++) {
+    if (n->gpr[i] != h->gpr[i]) {
+      return mismatch(m, KIND_REG, "%s = 0x%08x, host 0x%08x", regsl[i], n->gpr[i], h->gpr[i]);
+    }
+  }
+  if (n->eip != h->eip) {
+    return mismatch(m, KIND_REG, "eip = 0x%08x, host 0x%08x", n->eip, h->eip);
+  }
+  uint32_t mask = EFLAGS_COMPARED & ~fuzz_undefined_flags(in, before);
+  if ((n->eflags ^ h->eflags) & mask) {
+    return mismatch(m, KIND_FLAGS, "eflags = 0x%08x, host 0x%08x, compared 0x%03x",
+        n->eflags & mask, h->eflags & mask, mask);
+  }
+
+  char a[40], b[40];
+  for (i = 0; i < 8; i ++) {
+    if (memcmp(n->xmm[i], h->xmm[i], 16) != 0) {
+      hex_str(a, n->xmm[i], 16);
+      hex_str(b, h->xmm[i], 16);
+      return mismatch(m, KIND_SSE, "xmm%d = %s, host %s", i, a, b);
+    }
+  }
+  if (n->mxcsr != h->mxcsr) {
+    return mismatch(m, KIND_SSE, "mxcsr = 0x%08x, host 0x%08x", n->mxcsr, h->mxcsr);
+  }
+
+  if (n->fpu.top != h->fpu.top || n->fpu.valid != h->fpu.valid) {
+    return mismatch(m, KIND_FPU, "TOP = %d, valid = 0x%02x, host %d, 0x%02x",
+        n->fpu.top, n->fpu.valid, h->fpu.top, h->fpu.valid);
+  }
+  if (n->fpu.cw != h->fpu.cw || ((n->fpu.sw ^ h->fpu.sw) & FPU_CC)) {
+    return mismatch(m, KIND_FPU, "cw = 0x%04x, sw = 0x%04x, host 0x%04x, 0x%04x, compared 0xffff, 0x%04x",
+        n->fpu.cw, n->fpu.sw, h->fpu.cw, h->fpu.sw, FPU_CC);
+  }
+  for (i = 0; i < 8; i ++) {
+    int k = (n->fpu.top + i) & 7;
+    if ((n->fpu.valid & (1 << k)) && memcmp(&n->fpu.st[k], &h->fpu.st[k], 10) != 0) {
+      hex_str(a, &n->fpu.st[k], 10);
+      hex_str(b, &h->fpu.st[k], 10);
+      return mismatch(m, KIND_FPU, "st(%d) = %s (%Lg), host %s (%Lg)", i, a, n->fpu.st[k], b, h->fpu.st[k]);
+    }
+  }
+  return true;
+}
+
+static bool compare_mem(Mismatch *m) {
+  int i;
+  for (i = 0; i < FUZZ_SIZE; i += PAGE_SIZE) {
+    if (memcmp(nemu_mem + i, fuzz_host_mem + i, PAGE_SIZE) == 0) continue;
+    int j = i;
+    while (nemu_mem[j] == fuzz_host_mem[j]) j ++;
+    return mismatch(m, KIND_MEM, "memory at 0x%08x = 0x%02x, host 0x%02x",
+        FUZZ_BASE + j, nemu_mem[j], fuzz_host_mem[j]);
+  }
+  return true;
+}
+
+static int code_len(const FuzzCase *c) {
+  int i, len = 0;
+  for (i = 0; i < c->nr_instr; i ++) {
+    len += c->instr[i].len;
+  }
+  return len;
+}
+
+/* Run `c' on the host, generating the instructions if `generate', and
+ * then on NEMU.
+ */
+static int run_case(FuzzCase *c, bool generate, Mismatch *m) {
+  setup_mem(fuzz_host_mem, c);
+  fuzz_host_run(c, generate);
+  m->step = 0;
+  if (c->fault == FUZZ_BAD_LENGTH) return CASE_BAD;
+  // NEMU does not raise #DE, and its division would crash the host. The
+  // code which changes itself is not generated on purpose.
+  if (c->nr_instr == 0 || c->fault == DE_VECTOR || c->fault == FUZZ_CODE_CHANGED) return CASE_SKIP;
+
+  setup_mem(nemu_mem, c);
+  int i, len = 0;
+  for (i = 0; i < c->nr_instr; i ++) {
+    memcpy(nemu_mem + len, c->instr[i].bytes, c->instr[i].len);
+    len += c->instr[i].len;
+  }
+  nemu_load(&c->init);
+
+  int nr_step = c->nr_done + (c->fault != FUZZ_NO_FAULT);
+  const FuzzState *before = &c->init;
+  FuzzState now;
+  for (i = 0; i < nr_step; i ++) {
+    const FuzzInstr *in = &c->instr[i];
+    bool host_fault = (i == c->nr_done);
+    int crash, e = nemu_step(&crash);
+    m->step = i;
+    if (crash != 0) {
+      mismatch(m, KIND_CRASH, "NEMU crashes with signal %d", crash);
+      return CASE_FAIL;
+    }
+    if (e == UD_VECTOR) return CASE_UNSUPPORTED;
+    if (host_fault && c->fault == GP_VECTOR && fuzz_is_sse(in) && in->mod != 3) {
+      // an unaligned operand, see rand_data_addr()
+      return CASE_SKIP;
+    }
+
+    nemu_save(&now);
+    if (host_fault) {
+      if (e != c->fault) {
+        mismatch(m, KIND_FAULT, "exception %d, host %d", e, c->fault);
+        return CASE_FAIL;
+      }
+      // movs and cmps may access their two operands in any order
+      bool two_mem = (in->opcode >= 0xa4 && in->opcode <= 0xa7);
+      if (e == PF_VECTOR && !two_mem && (cpu.CR2 >> 12) != c->fault_page) {
+        mismatch(m, KIND_FAULT, "page fault at 0x%08x, host at page 0x%05x", cpu.CR2, c->fault_page);
+        return CASE_FAIL;
+      }
+      // Nothing is changed by the faulting instruction, except for the
+      // elements a REP string instruction has done. Its flags are not
+      // specified then: the host leaves them as they were before.
+      FuzzState h = *before;
+      if (fuzz_is_rep_string(in)) {
+        h = c->host[i];
+        h.eflags = now.eflags;
+      }
+      if (!compare_state(in, before, &now, &h, m)) return CASE_FAIL;
+      break;
+    }
+    if (e != -1) {
+      mismatch(m, KIND_FAULT, "exception %d, host none", e);
+      return CASE_FAIL;
+    }
+    if (!compare_state(in, before, &now, &c->host[i], m)) return CASE_FAIL;
+    // the undefined flags of the host, for the next instruction
+    nemu_load(&c->host[i]);
+    before = &c->host[i];
+  }
+  return (compare_mem(m) ? CASE_PASS : CASE_FAIL);
+}
+
+static inline int bucket(const FuzzCase *c, const Mismatch *m) {
+  return fuzz_instr_key(&c->instr[m->step]) * NR_KIND + m->kind;
+}
+
+static bool fails_same(FuzzCase *c, int key, Mismatch *m) {
+  Mismatch t;
+  if (run_case(c, false, &t) != CASE_FAIL || bucket(c, &t) != key) return false;
+  *m = t;
+  return true;
+}
+
+static void minimize_mem(FuzzCase *c, int key, Mismatch *m, int offset, int size, int chunk) {
+  static uint8_t saved[PAGE_SIZE];
+  int i, j;
+  for (i = offset; i < offset + size; i += chunk) {
+    for (j = 0; j < chunk && case_mem[i + j] == 0; j ++);
+    if (j == chunk) continue;
+    memcpy(saved, case_mem + i, chunk);
+    memset(case_mem + i, 0, chunk);
+    if (!fails_same(c, key, m)) {
+      memcpy(case_mem + i, saved, chunk);
+      if (chunk > 16) minimize_mem(c, key, m, i, chunk, chunk / 16);
+    }
+  }
+}
+
+/* Make `c' as simple as possible while it fails the same way. */
+static void minimize(FuzzCase *c, Mismatch *m) {
+  int key = bucket(c, m), i;
+  FuzzCase t = *c;
+  memcpy(case_mem, snapshot, FUZZ_SIZE);
+  snapshot = case_mem;
+
+  // the instructions after the failing one
+  t.nr_instr = m->step + 1;
+  if (!fails_same(&t, key, m)) goto out;
+  *c = t;
+
+#define TRY(change) do { t = *c; change; if (fails_same(&t, key, m)) *c = t; } while (0)
+  for (i = c->nr_instr - 2; i >= 0; i --) {
+    TRY(memmove(&t.instr[i], &t.instr[i + 1], (t.nr_instr - i - 1) * sizeof(t.instr[0])); t.nr_instr --);
+  }
+  for (i = 0; i < 8; i ++) {
+    if (i != R_ESP && c->init.gpr[i] != 0) TRY(t.init.gpr[i] = 0);
+  }
+  TRY(t.init.eflags = 0x202);
+  TRY(t.stack0 = 0);
+  for (i = 0; i < 8; i ++) {
+    TRY(memset(t.init.xmm[i], 0, 16));
+  }
+  TRY(t.init.fpu.valid = 0; t.init.fpu.top = 0; memset(t.init.fpu.st, 0, sizeof(t.init.fpu.st)));
+#undef TRY
+  minimize_mem(c, key, m, PAGE_SIZE, FUZZ_DATA_SIZE, PAGE_SIZE);
+
+out:
+  // the results of the case left in the host and NEMU
+  Assert(fails_same(c, key, m), "the mismatch disappears");
+}
+
+/* The reproducer: the program sets up the state, jumps to the code in
+ * the window, which jumps back with `jmp *fuzz_back', and checks the
+ * results of the host.
+ */
+
+static void print_bytes(FILE *fp, const uint8_t *p, int len) {
+  int i;
+  for (i = 0; i < len; i ++) {
+    fprintf(fp, "%s0x%02x", (i == 0 ? "" : ", "), p[i]);
+  }
+}
+
+static void print_chunks(FILE *fp, const char *name, const uint8_t *mem, const uint8_t *a, const uint8_t *b) {
+  fprintf(fp, "static const struct { unsigned addr; unsigned char data[16]; } %s[] = {\n", name);
+  int i;
+  for (i = PAGE_SIZE; i < FUZZ_SIZE; i += 16) {
+    static const uint8_t zero[16];
+    // all the non-zero chunks, or those changed in `a' or `b'
+    if (a == NULL ? memcmp(mem + i, zero, 16) == 0 :
+        memcmp(a + i, mem + i, 16) == 0 && memcmp(b + i, mem + i, 16) == 0) continue;
+    fprintf(fp, "\t{ 0x%08x, { ", FUZZ_BASE + i);
+    print_bytes(fp, mem + i, 16);
+    fprintf(fp, " } },\n");
+  }
+  fprintf(fp, "\t{ 0 }\n};\n\n");
+}
+
+static void write_repro(const FuzzCase *c, const Mismatch *m, const char *path) {
+  const FuzzState *init = &c->init, *h = &c->host[c->nr_instr - 1];
+  int len = code_len(c), i;
+  // also for the instructions which are neither, like MMX
+  bool sse = (m->kind == KIND_SSE), x87 = (m->kind == KIND_FPU);
+  uint32_t mask = EFLAGS_COMPARED;
+  for (i = 0; i < c->nr_instr; i ++) {
+    sse |= fuzz_is_sse(&c->instr[i]);
+    x87 |= fuzz_is_x87(&c->instr[i]);
+    mask &= ~fuzz_undefined_flags(&c->instr[i], (i == 0 ? init : &c->host[i - 1]));
+  }
+
+  // the initial memory of the data pages, and the final
+  static uint8_t mem_init[FUZZ_SIZE];
+  memcpy(mem_init, snapshot, FUZZ_SIZE);
+  memcpy(mem_init + (init->gpr[R_ESP] - FUZZ_BASE), &c->stack0, 4);
+
+  FILE *fp = fopen(path, "w");
+  Assert(fp, "Can not open '%s'", path);
+  char buf[FUZZ_MAX_INSTR * FUZZ_MAX_LEN * 3];
+  fprintf(fp, "#include \"trap.h\"\n\n");
+  fprintf(fp, "/* Found by the instruction fuzzer of NEMU, `nemu -F %llu,%u'.\n",
+      (unsigned long long)nr_case, seed);
+  for (i = 0; i < c->nr_instr; i ++) {
+    fuzz_instr_str(buf, &c->instr[i]);
+    fprintf(fp, " *   %s\n", buf);
+  }
+  fprintf(fp, " * NEMU: %s\n */\n\n", m->what);
+
+  fprintf(fp, "#define CODE 0x%08x\n#define BACK 0x%08x\n", FUZZ_BASE, h->eip);
+  fprintf(fp, "#define EFLAGS_MASK 0x%03x\n\n", mask);
+  fprintf(fp, "static const unsigned char code[] = { ");
+  print_bytes(fp, nemu_mem, len);
+  fprintf(fp, " };\n\n");
+  print_chunks(fp, "mem_init", mem_init, NULL, NULL);
+  print_chunks(fp, "mem_expect", fuzz_host_mem, mem_init, nemu_mem);
+
+  fprintf(fp, "/* eax, ecx, edx, ebx, esp, ebp, esi, edi, eflags */\n");
+  fprintf(fp, "unsigned init_regs[9] = { ");
+  for (i = 0; i < 8; i ++) fprintf(fp, "0x%08x, ", init->gpr[i]);
+  fprintf(fp, "0x%08x };\n", init->eflags & ~0x200);  // no interrupts
+  fprintf(fp, "static const unsigned expect_regs[9] = { ");
+  for (i = 0; i < 8; i ++) fprintf(fp, "0x%08x, ", h->gpr[i]);
+  fprintf(fp, "0x%08x };\n", h->eflags);
+  fprintf(fp, "unsigned regs[9], saved_esp, fuzz_entry = CODE, fuzz_back;\n");
+  if (sse) {
+    fprintf(fp, "unsigned init_xmm[8][4] = {\n");
+    for (i = 0; i < 8; i ++) fprintf(fp, "\t{ 0x%08x, 0x%08x, 0x%08x, 0x%08x },\n",
+        init->xmm[i][0], init->xmm[i][1], init->xmm[i][2], init->xmm[i][3]);
+    fprintf(fp, "};\nstatic const unsigned expect_xmm[8][4] = {\n");
+    for (i = 0; i < 8; i ++) fprintf(fp, "\t{ 0x%08x, 0x%08x, 0x%08x, 0x%08x },\n",
+        h->xmm[i][0], h->xmm[i][1], h->xmm[i][2], h->xmm[i][3]);
+    fprintf(fp, "};\nunsigned xmm[8][4];\n");
+  }
+  if (x87) {
+    // loaded from st(n - 1) to st(0)
+    int n = __builtin_popcount(init->fpu.valid);
+    fprintf(fp, "#define NR_ST_INIT %d\nunsigned char init_st[8][10] = {\n", n);
+    for (i = n - 1; i >= 0; i --) {
+      fprintf(fp, "\t{ ");
+      print_bytes(fp, (uint8_t *)&init->fpu.st[(init->fpu.top + i) & 7], 10);
+      fprintf(fp, " },\n");
+    }
+    fprintf(fp, "};\n/* the status word without C1, the empty registers, and st(i) */\n");
+    fprintf(fp, "static const unsigned expect_sw = 0x%04x, expect_empty = 0x%02x;\n",
+        (h->fpu.sw & FPU_CC) | (h->fpu.top << 11), (uint8_t)~h->fpu.valid);
+    fprintf(fp, "static const unsigned char expect_st[8][10] = {\n");
+    for (i = 0; i < 8; i ++) {
+      fprintf(fp, "\t{ ");
+      print_bytes(fp, (uint8_t *)&h->fpu.st[(h->fpu.top + i) & 7], 10);
+      fprintf(fp, " },\n");
+    }
+    fprintf(fp, "};\nunsigned char fpu[108];\n");
+  }
+
+  fprintf(fp, "\nint main() {\n\tint i;\n");
+  fprintf(fp, "\tfor (i = 0; mem_init[i].addr != 0; i ++) {\n"
+      "\t\tmemcpy((void *)mem_init[i].addr, mem_init[i].data, 16);\n\t}\n");
+  fprintf(fp, "\tmemcpy((void *)CODE, code, sizeof(code));\n");
+  fprintf(fp, "\tunsigned char *back = (void *)BACK;\n"
+      "\tunsigned *back_addr = &fuzz_back;\n"
+      "\tback[0] = 0xff;\n\tback[1] = 0x25;\n"
+      "\tmemcpy(back + 2, &back_addr, 4);\n\n");
+
+  fprintf(fp, "\tasm volatile (\n\t\t\"pushal;\"\n\t\t\"movl %%%%esp, saved_esp;\"\n\t\t\"movl $1f, fuzz_back;\"\n");
+  if (sse) {
+    for (i = 0; i < 8; i ++) fprintf(fp, "\t\t\"movdqu init_xmm+%d, %%%%xmm%d;\"\n", i * 16, i);
+  }
+  if (x87) {
+    fprintf(fp, "\t\t\"fninit;\"\n");
+    int n = __builtin_popcount(init->fpu.valid);
+    for (i = 0; i < n; i ++) fprintf(fp, "\t\t\"fldt init_st+%d;\"\n", i * 10);
+  }
+  fprintf(fp, "\t\t\"pushl init_regs+32;\"\n\t\t\"popfl;\"\n");
+  static const int load_order[] = { R_EAX, R_ECX, R_EDX, R_EBX, R_EBP, R_ESI, R_EDI, R_ESP };
+  for (i = 0; i < 8; i ++) {
+    fprintf(fp, "\t\t\"movl init_regs+%d, %%%%%s;\"\n", load_order[i] * 4, regsl[load_order[i]]);
+  }
+  fprintf(fp, "\t\t\"jmp *fuzz_entry;\"\n\t\t\"1:\"\n");
+  for (i = 0; i < 8; i ++) {
+    fprintf(fp, "\t\t\"movl %%%%%s, regs+%d;\"\n", regsl[i], i * 4);
+  }
+  fprintf(fp, "\t\t\"movl saved_esp, %%%%esp;\"\n\t\t\"pushfl;\"\n\t\t\"popl %%%%eax;\"\n\t\t\"movl %%%%eax, regs+32;\"\n\t\t\"cld;\"\n");
+  if (sse) {
+    for (i = 0; i < 8; i ++) fprintf(fp, "\t\t\"movdqu %%%%xmm%d, xmm+%d;\"\n", i, i * 16);
+  }
+  if (x87) {
+    fprintf(fp, "\t\t\"fnsave fpu;\"\n");
+  }
+  fprintf(fp, "\t\t\"popal;\"\n\t\t: : : \"memory\", \"cc\");\n\n");
+
+  fprintf(fp, "\tfor (i = 0; i < 8; i ++) {\n\t\tnemu_assert(regs[i] == expect_regs[i]);\n\t}\n");
+  fprintf(fp, "\tnemu_assert((regs[8] & EFLAGS_MASK) == (expect_regs[8] & EFLAGS_MASK));\n");
+  if (sse) {
+    fprintf(fp, "\tfor (i = 0; i < 8; i ++) {\n\t\tnemu_assert(memcmp(xmm[i], expect_xmm[i], 16) == 0);\n\t}\n");
+  }
+  if (x87) {
+    fprintf(fp, "\tunsigned sw = fpu[4] | (fpu[5] << 8), tags = fpu[8] | (fpu[9] << 8), empty = 0;\n"
+        "\tfor (i = 0; i < 8; i ++) {\n\t\tif (((tags >> (i * 2)) & 3) == 3) empty |= 1 << i;\n\t}\n"
+        "\tnemu_assert((sw & 0x7d00) == expect_sw && empty == expect_empty);\n"
+        "\tfor (i = 0; i < 8; i ++) {\n"
+        "\t\tif (!(empty & (1 << ((i + (sw >> 11)) & 7)))) nemu_assert(memcmp(fpu + 28 + i * 10, expect_st[i], 10) == 0);\n"
+        "\t}\n");
+  }
+  fprintf(fp, "\tfor (i = 0; mem_expect[i].addr != 0; i ++) {\n"
+      "\t\tnemu_assert(memcmp((void *)mem_expect[i].addr, mem_expect[i].data, 16) == 0);\n\t}\n");
+  fprintf(fp, "\n\treturn 0;\n}\n");
+  fclose(fp);
+}
+
+/* The code must jump back at the end, which needs room for the jump
+ * after the code in the code page. There is no reproducer for the
+ * exceptions, which the cputests can not catch.
+ */
+static bool can_repro(const FuzzCase *c, const Mismatch *m) {
+  if (c->fault != FUZZ_NO_FAULT || m->kind == KIND_FAULT || m->kind == KIND_CRASH) return false;
+  vaddr_t back = c->host[c->nr_instr - 1].eip;
+  return back >= FUZZ_BASE + code_len(c) && back + 6 <= FUZZ_BASE + PAGE_SIZE;
+}
+
+static void report(FuzzCase *c, Mismatch *m) {
+  int key = bucket(c, m), i;
+  for (i = 0; i < nr_report; i ++) {
+    if (reported[i] == key) return;
+  }
+  if (nr_report == MAX_REPORT) return;
+  reported[nr_report ++] = key;
+
+  minimize(c, m);
+  char buf[FUZZ_MAX_INSTR * FUZZ_MAX_LEN * 3];
+  fuzz_instr_str(buf, &c->instr[m->step]);
+  fprintf(out, "Mismatch %d in %s, after %s (instruction %d of %d): %s\n", nr_report, kind_name[m->kind],
+      buf, m->step + 1, c->nr_instr, m->what);
+  if (can_repro(c, m)) {
+    char path[32];
+    snprintf(path, sizeof(path), "fuzz-%d.c", nr_report);
+    write_repro(c, m, path);
+    fprintf(out, "  reproducer: %s\n", path);
+  }
+  snapshot = base_mem;
+}
+
+static inline double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void fuzz_run() {
+  static FuzzCase c;
+  uint64_t n, nr_instr = 0, nr_pass = 0, nr_fail = 0, nr_skip = 0, nr_bad = 0;
+  double start = now();
+  for (n = 0; n < nr_case; n ++) {
+    if (n % 1024 == 0) init_base_mem();
+    fuzz_gen_state(&c);
+    c.nr_instr = (fuzz_rand() % 2 ? 1 : 2 + fuzz_rand() % (FUZZ_MAX_INSTR - 1));
+
+    Mismatch m;
+    int result = run_case(&c, true, &m);
+    if (result == CASE_FAIL && c.nr_instr > 1) {
+      // the host ran without the later instructions in the code page
+      result = run_case(&c, false, &m);
+    }
+    switch (result) {
+      case CASE_PASS: nr_pass ++; nr_instr += c.nr_done; break;
+      case CASE_FAIL: nr_fail ++; report(&c, &m); break;
+      case CASE_SKIP: nr_skip ++; break;
+      case CASE_UNSUPPORTED: fuzz_gen_skip(&c.instr[m.step]); nr_skip ++; break;
+      case CASE_BAD: {
+        char buf[FUZZ_MAX_INSTR * FUZZ_MAX_LEN * 3];
+        fuzz_instr_str(buf, &c.instr[c.nr_done - 1]);
+        fprintf(out, "The host decodes '%s' with another length\n", buf);
+        nr_bad ++;
+        break;
+      }
+    }
+  }
+
+  double t = now() - start;
+  fprintf(out, "%llu cases, %llu instructions in %.2f s, %.0f cases/s\n", (unsigned long long)nr_case,
+      (unsigned long long)nr_instr, t, nr_case / t);
+  fprintf(out, "  %llu passed, %llu failed in %d ways, %llu skipped, %d encodings not supported by NEMU\n",
+      (unsigned long long)nr_pass, (unsigned long long)nr_fail, nr_report,
+      (unsigned long long)(nr_skip + nr_bad), fuzz_nr_skipped());
+  fflush(out);
+  exit(nr_fail == 0 ? 0 : 1);
+}
+
+void init_fuzz() {
+  if (nr_case == 0) return;
+#ifdef DIFF_TEST
+  panic("the fuzzer can not be used with DIFF_TEST");
+#endif
+  Assert(nr_cpu == 1, "the fuzzer does not support %d CPUs", nr_cpu);
+
+  // the messages of exec_inv() and the guest go to /dev/null
+  fflush(stdout);
+  out = fdopen(dup(STDOUT_FILENO), "w");
+  assert(out != NULL);
+  setvbuf(out, NULL, _IOLBF, 0);
+  int null_fd = open("/dev/null", O_WRONLY);
+  if (null_fd >= 0) {
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+  }
+
+  fprintf(out, "Fuzzing %llu cases with seed %u\n", (unsigned long long)nr_case, seed);
+  exception_deliver = false;
+  init_page_table();
+  fuzz_host_init();
+  fuzz_gen_init(seed);
+  fuzz_run();
+}
@@ -0,0 +1,480 @@
+#include "monitor/fuzz.h"
+
+/* Random instructions for the fuzzer. The opcodes come from the ones
+ * NEMU implements, with random prefixes, ModR/M, SIB, displacements and
+ * immediates. Memory operands are steered into the data pages of the
+ * window: for the first instruction by setting the base or the index
+ * register, and for the others by the displacement, which is computed
+ * from the state the host reached. A few are left pointing anywhere to
+ * check the page faults.
+ *
+ * The instructions which depend on the host (the privileged ones, I/O,
+ * CPUID, saving the FPU environment, ...) are never generated, and an
+ * encoding NEMU turns out not to support is skipped from then on.
+ */
+
+bool opcode_is_valid(uint32_t, int);
+
+static uint64_t seed;
+
+/* xorshift64* */
+uint32_t fuzz_rand() {
+  seed ^= seed >> 12;
+  seed ^= seed << 25;
+  seed ^= seed >> 27;
+  return (seed * 0x2545f4914f6cdd1dull) >> 32;
+}
+
+static inline bool chance(int n) {
+  return fuzz_rand() % n == 0;
+}
+
+/* small numbers, boundaries and anything else */
+static uint32_t rand_value() {
+  switch (fuzz_rand() % 8) {
+    case 0: return fuzz_rand() % 16;
+    case 1: return -(fuzz_rand() % 16);
+    case 2: return 0x80000000u - 2 + fuzz_rand() % 4;
+    case 3: return (fuzz_rand() % 4) << (fuzz_rand() % 32);
+    default: return fuzz_rand();
+  }
+}
+
+static inline vaddr_t rand_data_addr(int size) {
+  vaddr_t addr = FUZZ_DATA + fuzz_rand() % (FUZZ_DATA_SIZE - 16);
+  // the host raises #GP for the unaligned SSE operands, which NEMU does not check
+  if (size == 16) return addr & ~15;
+  switch (fuzz_rand() % 4) {
+    case 0: case 1: return addr & ~(size - 1);
+    case 2: return addr & ~15;
+    default: return addr;
+  }
+}
+
+static inline bool in_window(vaddr_t addr, int margin) {
+  return addr >= FUZZ_BASE && addr < FUZZ_BASE + FUZZ_SIZE - margin;
+}
+
+/* the encoding */
+
+static inline bool has_modrm(uint32_t op) {
+  if (op < 0x100) {
+    return (op < 0x40 && (op & 7) < 4) || op == 0x62 || op == 0x63 || op == 0x69 || op == 0x6b ||
+      (op >= 0x80 && op <= 0x8f) || op == 0xc0 || op == 0xc1 || (op >= 0xc4 && op <= 0xc7) ||
+      (op >= 0xd0 && op <= 0xd3) || (op >= 0xd8 && op <= 0xdf) || op == 0xf6 || op == 0xf7 ||
+      op == 0xfe || op == 0xff;
+  }
+  op &= 0xff;
+  return !((op >= 0x05 && op <= 0x0b) || (op >= 0x30 && op <= 0x37) || op == 0x77 ||
+      (op >= 0x80 && op <= 0x8f) || (op >= 0xa0 && op <= 0xa2) || (op >= 0xa8 && op <= 0xaa) ||
+      (op >= 0xc8 && op <= 0xcf));
+}
+
+#define IMM_Z (-1)  // 2 or 4 bytes with the operand size
+
+static inline int imm_size(uint32_t op, int reg) {
+  if (op >= 0x100) {
+    switch (op & 0xff) {
+      case 0x70 ... 0x73: case 0xa4: case 0xac: case 0xba:
+      case 0xc2: case 0xc4: case 0xc5: case 0xc6: return 1;
+      case 0x80 ... 0x8f: return 4;
+      default: return 0;
+    }
+  }
+  if (op < 0x40) {
+    return ((op & 7) == 4 ? 1 : (op & 7) == 5 ? IMM_Z : 0);
+  }
+  switch (op) {
+    case 0x6a: case 0x6b: case 0x70 ... 0x7f: case 0x80: case 0x82: case 0x83: case 0xa8:
+    case 0xb0 ... 0xb7: case 0xc0: case 0xc1: case 0xc6: case 0xcd: case 0xd4: case 0xd5:
+    case 0xe0 ... 0xe7: case 0xeb: return 1;
+    case 0xc2: case 0xca: return 2;
+    case 0xc8: return 3;
+    case 0xa0 ... 0xa3: return 4;
+    case 0x68: case 0x69: case 0x81: case 0xa9: case 0xb8 ... 0xbf: case 0xc7:
+    case 0xe8: case 0xe9: return IMM_Z;
+    case 0xf6: return (reg < 2 ? 1 : 0);
+    case 0xf7: return (reg < 2 ? IMM_Z : 0);
+    default: return 0;
+  }
+}
+
+static inline bool is_string(uint32_t op) {
+  return (op >= 0xa4 && op <= 0xa7) || (op >= 0xaa && op <= 0xaf);
+}
+
+static inline bool is_sse(uint32_t op) {
+  if (op < 0x100) return false;
+  op &= 0xff;
+  return (op >= 0x10 && op <= 0x17) || (op >= 0x28 && op <= 0x2f) || (op >= 0x50 && op <= 0x7f) ||
+    (op >= 0xc2 && op <= 0xc6) || op >= 0xd0;
+}
+
+static inline bool is_branch(uint32_t op, int reg) {
+  return (op >= 0x70 && op <= 0x7f) || (op >= 0xe0 && op <= 0xe3) || op == 0xe8 || op == 0xe9 ||
+    op == 0xeb || op == 0xc2 || op == 0xc3 || (op >= 0x180 && op <= 0x18f) ||
+    (op == 0xff && (reg == 2 || reg == 4));
+}
+
+/* pushf, popf and lahf see the flags the host can not set up, like TF
+ * and AF, so they are only generated alone */
+static inline bool is_alone(uint32_t op) {
+  return op == 0x9c || op == 0x9d || op == 0x9f;
+}
+
+static inline bool is_x87(uint32_t op) {
+  return op >= 0xd8 && op <= 0xdf;
+}
+
+bool fuzz_is_sse(const FuzzInstr *in) {
+  return is_sse(in->opcode) || in->opcode == 0x1ae;
+}
+
+bool fuzz_is_x87(const FuzzInstr *in) {
+  return is_x87(in->opcode);
+}
+
+bool fuzz_is_rep_string(const FuzzInstr *in) {
+  return in->rep && is_string(in->opcode);
+}
+
+/* instructions depending on the host or the privilege level */
+static bool blacklisted(uint32_t op, int reg) {
+  switch (op) {
+    case 0x0f: case 0x26: case 0x2e: case 0x36: case 0x3e: case 0x64: case 0x65:
+    case 0x66: case 0x67: case 0xf0: case 0xf2: case 0xf3:  // prefixes
+    // the segment registers, a new FS or GS breaks the TLS of the host
+    case 0x06: case 0x07: case 0x0e: case 0x16: case 0x17: case 0x1e: case 0x1f:
+    case 0x8c: case 0x8e: case 0xc4: case 0xc5:
+    case 0x1a0: case 0x1a1: case 0x1a8: case 0x1a9: case 0x1b2: case 0x1b4: case 0x1b5:
+    case 0x62: case 0x6c ... 0x6f: case 0x9a:
+    case 0xca: case 0xcb: case 0xcc ... 0xcf: case 0xd6: case 0xe4 ... 0xe7: case 0xea:
+    case 0xec ... 0xef: case 0xf4: case 0xfa: case 0xfb:
+    case 0x100 ... 0x10f: case 0x120 ... 0x127: case 0x130 ... 0x137: case 0x1a2:
+      return true;
+    case 0xff: return reg == 3 || reg == 5;  // far call and jmp
+    default: return false;
+  }
+}
+
+/* the forms of an opcode which are blacklisted, or invalid on the host */
+static bool bad_form(const FuzzInstr *in) {
+  bool mem = (in->mod != 3);
+  switch (in->opcode) {
+    case 0x8d: case 0x113: case 0x117: case 0x12b: case 0x1c3: case 0x1e7: return !mem;
+    case 0x150: case 0x1c5: case 0x1d7: case 0x171 ... 0x173: case 0x1f7: return mem;
+    // fldenv, fldcw, fnstenv, frstor and fnsave
+    case 0xd9: return mem && (in->reg == 4 || in->reg == 5 || in->reg == 6);
+    case 0xdd: return mem && (in->reg == 4 || in->reg == 6);
+    // only stmxcsr and the fences
+    case 0x1ae: return in->reg < 3 || in->reg == 4 || (in->reg == 3 && !mem) || (mem && in->reg != 3 && in->reg != 7);
+    default: return false;
+  }
+}
+
+/* LOCK is valid on these with a memory destination */
+static bool lockable(const FuzzInstr *in) {
+  if (in->mod == 3) return false;
+  uint32_t op = in->opcode;
+  if (op < 0x38 && (op & 7) < 2) return true;
+  switch (op) {
+    case 0x80: case 0x81: case 0x83: return in->reg != 7;
+    case 0x86: case 0x87: case 0x1b0: case 0x1b1: case 0x1c0: case 0x1c1:
+    case 0x1ab: case 0x1b3: case 0x1bb: return true;
+    case 0xf6: case 0xf7: return in->reg == 2 || in->reg == 3;
+    case 0xfe: case 0xff: return in->reg < 2;
+    case 0x1ba: return in->reg >= 5;
+    default: return false;
+  }
+}
+
+/* bit i is set if the instructions with ModR/M reg field i can be generated */
+static uint8_t reg_mask[512];
+static uint16_t pool[512];
+static int nr_pool = 0;
+
+#define KEY_BITS 20
+static uint8_t skipped[(1 << KEY_BITS) / 8];
+static int nr_skipped = 0;
+
+int fuzz_instr_key(const FuzzInstr *in) {
+  int key = in->opcode;
+  key = key * 4 + (in->rep == 0 ? 0 : in->rep == 0xf2 ? 1 : 2);
+  key = key * 2 + in->op16;
+  key = key * 9 + (in->modrm ? in->reg : 8);
+  key = key * 2 + (in->modrm && in->mod == 3);
+  // the x87 instructions on registers are also selected by r/m
+  if (is_x87(in->opcode) && in->mod == 3 && in->opcode != 0xd8 && in->opcode != 0xdc) key = key * 8 + in->rm;
+  else key *= 8;
+  return key & ((1 << KEY_BITS) - 1);
+}
+
+void fuzz_gen_skip(const FuzzInstr *in) {
+  int key = fuzz_instr_key(in);
+  if (!(skipped[key / 8] & (1 << (key % 8)))) {
+    skipped[key / 8] |= 1 << (key % 8);
+    nr_skipped ++;
+  }
+}
+
+int fuzz_nr_skipped() {
+  return nr_skipped;
+}
+
+static inline bool is_skipped(const FuzzInstr *in) {
+  int key = fuzz_instr_key(in);
+  return skipped[key / 8] & (1 << (key % 8));
+}
+
+void fuzz_instr_str(char *buf, const FuzzInstr *in) {
+  int i;
+  buf[0] = '\0';
+  for (i = 0; i < in->len; i ++) {
+    buf += sprintf(buf, "%s%02x", (i == 0 ? "" : " "), in->bytes[i]);
+  }
+}
+
+void fuzz_gen_init(uint32_t s) {
+  seed = s * 0x9e3779b97f4a7c15ull + 1;
+
+  uint32_t op;
+  int reg;
+  for (op = 0; op < 512; op ++) {
+    for (reg = 0; reg < 8; reg ++) {
+      if (opcode_is_valid(op, reg) && !blacklisted(op, reg)) reg_mask[op] |= 1 << reg;
+    }
+    if (reg_mask[op] != 0) pool[nr_pool ++] = op;
+  }
+}
+
+/* the initial state */
+
+void fuzz_gen_state(FuzzCase *c) {
+  FuzzState *s = &c->init;
+  int i, j;
+  for (i = 0; i < 8; i ++) {
+    s->gpr[i] = (chance(2) ? rand_data_addr(4) : rand_value());
+  }
+  s->gpr[R_ESP] = FUZZ_BASE + FUZZ_SIZE - 4 * (16 + fuzz_rand() % 512);
+  s->eip = FUZZ_BASE;
+  // CF PF ZF SF DF OF, with IF set like in the host; AF is not modeled
+  s->eflags = (fuzz_rand() & 0xcc5) | 0x202;
+  // also popped by popf, which should not set TF, NT or AC: the host
+  // keeps NT and AC after the signal, and IRETQ with NT raises #GP
+  c->stack0 = rand_value() & ~0x44100;
+
+  for (i = 0; i < 8; i ++) {
+    for (j = 0; j < 4; j ++) s->xmm[i][j] = rand_value();
+  }
+  s->mxcsr = 0x1f80;
+
+  memset(&s->fpu, 0, sizeof(s->fpu));
+  s->fpu.cw = 0x37f;
+  int n = fuzz_rand() % 4;
+  s->fpu.top = (8 - n) & 7;
+  for (i = 0; i < n; i ++) {
+    int k = (s->fpu.top + i) & 7;
+    switch (fuzz_rand() % 3) {
+      case 0: s->fpu.st[k] = (int32_t)rand_value(); break;
+      case 1: s->fpu.st[k] = (int32_t)fuzz_rand() / (long double)(fuzz_rand() | 1); break;
+      default: {
+        // any bit pattern, including NaNs, infinities and denormals
+        uint16_t raw[5];
+        for (j = 0; j < 5; j ++) raw[j] = fuzz_rand();
+        memcpy(&s->fpu.st[k], raw, sizeof(raw));
+      }
+    }
+    s->fpu.valid |= 1 << k;
+  }
+}
+
+/* ModR/M, SIB and the displacement. `s' is the state before the
+ * instruction, whose registers may be changed if `first'.
+ */
+static bool gen_modrm(FuzzInstr *in, FuzzState *s, bool first, uint8_t **p, int size) {
+  in->mod = (chance(2) ? 3 : fuzz_rand() % 3);
+  in->rm = fuzz_rand() % 8;
+  if (bad_form(in)) {
+    in->mod = (in->mod == 3 ? fuzz_rand() % 3 : 3);
+    if (bad_form(in)) return false;
+  }
+  *(*p) ++ = (in->mod << 6) | (in->reg << 3) | in->rm;
+  if (in->mod == 3) return true;
+
+  int base = in->rm, index = -1, scale = 0, disp_size = (in->mod == 1 ? 1 : in->mod == 2 ? 4 : 0);
+  if (in->rm == 4) {
+    uint8_t sib = fuzz_rand();
+    *(*p) ++ = sib;
+    scale = sib >> 6;
+    index = (sib >> 3) & 7;
+    base = sib & 7;
+    if (index == R_ESP) index = -1;
+  }
+  if (base == R_EBP && in->mod == 0) {
+    base = -1;
+    disp_size = 4;
+  }
+
+  int32_t disp = (disp_size == 1 ? (int8_t)fuzz_rand() : disp_size == 4 ? rand_value() : 0);
+  vaddr_t target = rand_data_addr(size);
+  uint32_t base_val = (base < 0 ? 0 : s->gpr[base]), index_val = (index < 0 ? 0 : s->gpr[index] << scale);
+
+  if (chance(16)) {
+    // anywhere
+  }
+  else if (disp_size == 4) {
+    disp = target - base_val - index_val;
+  }
+  else if (first && base >= 0 && base != R_ESP) {
+    if (index == base) s->gpr[base] = (target - disp) / ((1 << scale) + 1);
+    else s->gpr[base] = target - disp - index_val;
+  }
+  else if (first && index >= 0) {
+    s->gpr[index] = (target - disp - base_val) >> scale;
+  }
+  else if (!in_window(base_val + index_val + disp, 16)) {
+    return false;
+  }
+
+  memcpy(*p, &disp, disp_size);
+  *p += disp_size;
+  return true;
+}
+
+/* The implicit memory operands, like those of the string instructions. */
+static bool fix_implicit(FuzzInstr *in, FuzzState *s, bool first) {
+  uint32_t op = in->opcode;
+  if (is_string(op)) {
+    if (first) {
+      s->gpr[R_ESI] = rand_data_addr(4);
+      s->gpr[R_EDI] = rand_data_addr(4);
+      if (in->rep) s->gpr[R_ECX] = fuzz_rand() % 16;
+    }
+    // the host traps after each element when single-stepping
+    return !in->rep || s->gpr[R_ECX] <= 64;
+  }
+  if (op == 0xc9 && first) {  // leave
+    s->gpr[R_EBP] = s->gpr[R_ESP] + 4 * (fuzz_rand() % 64);
+  }
+  if (first && (op == 0xf6 || op == 0xf7) && in->reg >= 6) {
+    // keep the quotient in range most of the time
+    if (op == 0xf6) s->gpr[R_EAX] = (in->reg == 6 ? (uint8_t)s->gpr[R_EAX] : (int8_t)s->gpr[R_EAX]);
+    else if (in->op16) s->gpr[R_EDX] = (in->reg == 6 ? 0 : -((s->gpr[R_EAX] >> 15) & 1));
+    else s->gpr[R_EDX] = (in->reg == 6 ? 0 : -(s->gpr[R_EAX] >> 31));
+  }
+  if (first && in->modrm && in->mod != 3 && in->reg != R_ESP &&
+      (op == 0x1a3 || op == 0x1ab || op == 0x1b3 || op == 0x1bb)) {
+    // the bit offset in the register also moves the memory operand
+    s->gpr[in->reg] = fuzz_rand() % 256;
+  }
+  return true;
+}
+
+static bool gen_one(FuzzInstr *in, FuzzState *s, bool first, vaddr_t eip) {
+  memset(in, 0, sizeof(*in));
+  uint32_t op = pool[fuzz_rand() % nr_pool];
+  in->opcode = op;
+  in->modrm = has_modrm(op);
+  do { in->reg = fuzz_rand() % 8; } while (!(reg_mask[op] & (1 << in->reg)));
+  if (!in->modrm && in->reg != 0) in->reg = 0;
+  in->last = is_branch(op, in->reg) || is_alone(op);
+  if (is_alone(op) && !first) return false;
+
+  if (is_sse(op)) {
+    switch (fuzz_rand() % 4) {
+      case 0: in->op16 = true; break;
+      case 1: in->rep = 0xf3; break;
+      case 2: in->rep = 0xf2; break;
+    }
+  }
+  else {
+    in->op16 = chance(4) && !is_branch(op, in->reg) && !is_x87(op) && op != 0x9c && op != 0x9d && op != 0xc9 &&
+      !(op >= 0x1a4 && op <= 0x1ad) && op != 0x1ae;
+    if (is_string(op) && chance(2)) {
+      bool cond = (op == 0xa6 || op == 0xa7 || op == 0xae || op == 0xaf);
+      in->rep = (cond && chance(2) ? 0xf2 : 0xf3);
+    }
+  }
+
+  uint8_t *p = in->bytes;
+  uint8_t *lock = p;
+  if (chance(8)) *p ++ = 0xf0;  // kept only if valid
+  if (in->op16) *p ++ = 0x66;
+  if (in->rep) *p ++ = in->rep;
+  if (op >= 0x100) *p ++ = 0x0f;
+  *p ++ = op;
+
+  int size = (op < 0x100 && (op & 1) == 0 && op != 0x8d ? 1 : in->op16 ? 2 : 4);
+  if (is_sse(op)) size = 16;
+  if (in->modrm && !gen_modrm(in, s, first, &p, size)) return false;
+
+  int imm = imm_size(op, in->reg);
+  if (imm == IMM_Z) imm = (in->op16 ? 2 : 4);
+  uint32_t val;
+  if (op >= 0xa0 && op <= 0xa3) val = (chance(16) ? rand_value() : rand_data_addr(size));
+  else if (op == 0xe8 || op == 0xe9 || (op >= 0x180 && op <= 0x18f)) val = (int32_t)(fuzz_rand() % 4096) - 2048;
+  else if (op == 0xc0 || op == 0xc1 || op == 0x1a4 || op == 0x1ac) val = fuzz_rand() % 40;
+  else val = rand_value();
+  memcpy(p, &val, imm);
+  p += imm;
+
+  if (*lock == 0xf0) {
+    if (lockable(in)) in->lock = true;
+    else {
+      memmove(lock, lock + 1, p - lock - 1);
+      p --;
+    }
+  }
+  in->len = p - in->bytes;
+
+  if (is_skipped(in)) return false;
+  if (!fix_implicit(in, s, first)) return false;
+  // the code must not run out of the code page
+  return eip + in->len <= FUZZ_BASE + PAGE_SIZE;
+}
+
+/* Generate the next instruction of `c' at `eip', for the state `s' the
+ * host reached after the previous ones, or for the initial state.
+ */
+bool fuzz_gen_instr(FuzzCase *c, const FuzzState *s, vaddr_t eip) {
+  bool first = (c->nr_instr == 0);
+  FuzzInstr *in = &c->instr[c->nr_instr];
+  int i;
+  for (i = 0; i < 64; i ++) {
+    FuzzState tmp = (first ? c->init : *s);
+    if (gen_one(in, &tmp, first, eip)) {
+      if (first) c->init = tmp;
+      c->nr_instr ++;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* The flags left undefined by `in' when executed from state `s'. AF is
+ * never compared.
+ */
+uint32_t fuzz_undefined_flags(const FuzzInstr *in, const FuzzState *s) {
+  enum { CF = 0x1, PF = 0x4, ZF = 0x40, SF = 0x80, OF = 0x800 };
+  uint32_t op = in->opcode;
+  int width = (op < 0x100 && (op & 1) == 0 ? 8 : in->op16 ? 16 : 32);
+  int count;
+  switch (op) {
+    case 0xf6: case 0xf7:
+      if (in->reg == 4 || in->reg == 5) return SF | ZF | PF;
+      if (in->reg >= 6) return CF | PF | ZF | SF | OF;
+      return 0;
+    case 0x69: case 0x6b: case 0x1af: return SF | ZF | PF;
+    case 0x1bc: case 0x1bd: return CF | OF | SF | PF;
+    case 0x1a3: case 0x1ab: case 0x1b3: case 0x1bb: case 0x1ba: return OF | SF | PF;
+    case 0xc0: case 0xc1: case 0xd0 ... 0xd3:
+      count = (op >= 0xd2 ? s->gpr[R_ECX] : op >= 0xd0 ? 1 : in->bytes[in->len - 1]) & 0x1f;
+      // nothing changes if the count is 0
+      if (count <= 1) return 0;
+      return OF | (in->reg >= 4 && count >= width ? CF : 0);
+    case 0x1a4: case 0x1a5: case 0x1ac: case 0x1ad:
+      count = (op & 1 ? s->gpr[R_ECX] : in->bytes[in->len - 1]) & 0x1f;
+      return (count <= 1 ? 0 : OF);
+    default: return 0;
+  }
+}
@@ -0,0 +1,233 @@
+// the register names of ucontext_t
+#define _GNU_SOURCE
+#include "monitor/fuzz.h"
+#include <stdlib.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+/* The reference model is the host CPU. The window is mapped at the same
+ * address in the host, and the instructions run in 32-bit compatibility
+ * mode with TF set, so that the kernel stops after each of them with a
+ * SIGTRAP carrying the state. An exception of the guest arrives as
+ * another signal with the vector in the trap number. This needs an
+ * x86-64 Linux host.
+ *
+ * The signals run on their own stack, since ESP points into the window.
+ * A signal from 64-bit code is a crash of NEMU itself: it is caught
+ * while NEMU runs a case, and fatal otherwise.
+ */
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define USER32_CS 0x23
+#define USER_DS 0x2b
+#define EFLAGS_TF 0x100
+#define EFLAGS_RF 0x10000
+#define DB_VECTOR 1
+
+/* the argument of fuzz_enter() */
+typedef struct {
+  uint8_t fxsave[512];
+  uint32_t gpr[8], eip, eflags;
+} __attribute__((aligned(16))) EnterFrame;
+
+/* Load the state and return to the 32-bit code with IRETQ. It comes
+ * back with siglongjmp() from the signal handler.
+ */
+void fuzz_enter(EnterFrame *) __attribute__((noreturn));
+asm (
+  ".text\n"
+  "fuzz_enter:\n"
+  "  fxrstor (%rdi)\n"
+  "  movl $" str(USER_DS) ", %eax\n"
+  "  movl %eax, %ds\n"
+  "  movl %eax, %es\n"
+  "  pushq $" str(USER_DS) "\n"
+  "  movl 528(%rdi), %eax\n"            // esp
+  "  pushq %rax\n"
+  "  movl 548(%rdi), %eax\n"            // eflags
+  "  orl $" str(EFLAGS_TF) ", %eax\n"
+  "  pushq %rax\n"
+  "  pushq $" str(USER32_CS) "\n"
+  "  movl 544(%rdi), %eax\n"            // eip
+  "  pushq %rax\n"
+  "  movl 516(%rdi), %ecx\n"
+  "  movl 520(%rdi), %edx\n"
+  "  movl 524(%rdi), %ebx\n"
+  "  movl 532(%rdi), %ebp\n"
+  "  movl 536(%rdi), %esi\n"
+  "  movl 512(%rdi), %eax\n"
+  "  movl 540(%rdi), %edi\n"
+  "  iretq\n"
+);
+
+sigjmp_buf fuzz_nemu_env;
+volatile bool fuzz_in_nemu = false;
+
+static sigjmp_buf host_env;
+static FuzzCase *cur;
+static bool generating;
+static int target;           // the number of instructions to generate
+static vaddr_t instr_eip;    // the instruction being single-stepped
+
+static const int greg_index[8] = {
+  [R_EAX] = REG_RAX, [R_ECX] = REG_RCX, [R_EDX] = REG_RDX, [R_EBX] = REG_RBX,
+  [R_ESP] = REG_RSP, [R_EBP] = REG_RBP, [R_ESI] = REG_RSI, [R_EDI] = REG_RDI,
+};
+
+static void state_from_context(FuzzState *s, ucontext_t *uc) {
+  greg_t *g = uc->uc_mcontext.gregs;
+  struct _libc_fpstate *fp = uc->uc_mcontext.fpregs;
+  int i;
+  memset(s, 0, sizeof(*s));
+  for (i = 0; i < 8; i ++) {
+    s->gpr[i] = g[greg_index[i]];
+  }
+  s->eip = g[REG_RIP];
+  s->eflags = g[REG_EFL] & ~(EFLAGS_TF | EFLAGS_RF);
+
+  s->fpu.cw = fp->cwd;
+  s->fpu.sw = fp->swd & ~0x3800;
+  s->fpu.top = (fp->swd >> 11) & 7;
+  s->fpu.valid = fp->ftw;
+  for (i = 0; i < 8; i ++) {
+    memcpy(&s->fpu.st[(s->fpu.top + i) & 7], &fp->_st[i], 10);
+  }
+  memcpy(s->xmm, fp->_xmm, sizeof(s->xmm));
+  s->mxcsr = fp->mxcsr;
+}
+
+static void frame_from_state(EnterFrame *f, const FuzzState *s) {
+  memset(f->fxsave, 0, sizeof(f->fxsave));
+  uint16_t sw = s->fpu.sw | (s->fpu.top << 11);
+  memcpy(f->fxsave + 0, &s->fpu.cw, 2);
+  memcpy(f->fxsave + 2, &sw, 2);
+  f->fxsave[4] = s->fpu.valid;
+  memcpy(f->fxsave + 24, &s->mxcsr, 4);
+  int i;
+  for (i = 0; i < 8; i ++) {
+    memcpy(f->fxsave + 32 + 16 * i, &s->fpu.st[(s->fpu.top + i) & 7], 10);
+  }
+  memcpy(f->fxsave + 160, s->xmm, sizeof(s->xmm));
+
+  memcpy(f->gpr, s->gpr, sizeof(f->gpr));
+  f->eip = s->eip;
+  f->eflags = s->eflags;
+}
+
+static void handler(int sig, siginfo_t *info, void *ucontext) {
+  ucontext_t *uc = ucontext;
+  greg_t *g = uc->uc_mcontext.gregs;
+  if ((g[REG_CSGSFS] & 0xffff) != USER32_CS) {
+    if (fuzz_in_nemu) siglongjmp(fuzz_nemu_env, sig);
+    // the faulting instruction crashes again with the default action
+    signal(sig, SIG_DFL);
+    if (sig == SIGABRT) raise(sig);
+    return;
+  }
+
+  FuzzCase *c = cur;
+  FuzzInstr *in = &c->instr[c->nr_done];
+  if (sig != SIGTRAP || g[REG_TRAPNO] != DB_VECTOR) {
+    // the host ran other code, overwritten by an instruction before
+    if (memcmp(fuzz_host_mem + (instr_eip - FUZZ_BASE), in->bytes, in->len) != 0) {
+      c->fault = FUZZ_CODE_CHANGED;
+      siglongjmp(host_env, 1);
+    }
+    c->fault = g[REG_TRAPNO];
+    c->fault_page = g[REG_CR2] >> 12;
+    // with the elements a REP string instruction has done so far
+    state_from_context(&c->host[c->nr_done], uc);
+    siglongjmp(host_env, 1);
+  }
+
+  // a REP string instruction traps after each element
+  if (g[REG_RIP] == instr_eip && fuzz_is_rep_string(in)) {
+    // the next element is fetched again, unlike in NEMU
+    if (memcmp(fuzz_host_mem + (instr_eip - FUZZ_BASE), in->bytes, in->len) != 0) {
+      c->fault = FUZZ_CODE_CHANGED;
+      siglongjmp(host_env, 1);
+    }
+    g[REG_EFL] |= EFLAGS_TF;
+    return;
+  }
+
+  FuzzState *s = &c->host[c->nr_done ++];
+  state_from_context(s, uc);
+  if (in->opcode == 0x9c) {
+    // pushf, the trap flag is for the fuzzer
+    *(uint32_t *)(uintptr_t)s->gpr[R_ESP] &= ~EFLAGS_TF;
+  }
+  if (!in->last && s->eip != instr_eip + in->len) {
+    // unless the code is overwritten by the instructions before
+    bool same = memcmp(fuzz_host_mem + (instr_eip - FUZZ_BASE), in->bytes, in->len) == 0;
+    c->fault = (same ? FUZZ_BAD_LENGTH : FUZZ_CODE_CHANGED);
+    siglongjmp(host_env, 1);
+  }
+
+  if (in->last || c->nr_done == (generating ? target : c->nr_instr)) {
+    siglongjmp(host_env, 1);
+  }
+  if (generating) {
+    if (!fuzz_gen_instr(c, s, s->eip)) siglongjmp(host_env, 1);
+    memcpy(fuzz_host_mem + (s->eip - FUZZ_BASE), in[1].bytes, in[1].len);
+  }
+  instr_eip = s->eip;
+  g[REG_EFL] |= EFLAGS_TF;
+}
+
+/* Run `c' from its initial state, with the memory of the window set up
+ * except for the code. The instructions are generated on the way if
+ * `generate', up to `c->nr_instr' of them.
+ */
+void fuzz_host_run(FuzzCase *c, bool generate) {
+  cur = c;
+  generating = generate;
+  c->nr_done = 0;
+  c->fault = FUZZ_NO_FAULT;
+  if (generate) {
+    target = c->nr_instr;
+    c->nr_instr = 0;
+    if (!fuzz_gen_instr(c, &c->init, FUZZ_BASE)) return;
+  }
+
+  uint8_t *p = fuzz_host_mem;
+  int i;
+  for (i = 0; i < c->nr_instr; i ++) {
+    memcpy(p, c->instr[i].bytes, c->instr[i].len);
+    p += c->instr[i].len;
+  }
+
+  static EnterFrame frame;
+  frame_from_state(&frame, &c->init);
+  instr_eip = c->init.eip;
+  if (sigsetjmp(host_env, 0) == 0) {
+    fuzz_enter(&frame);
+  }
+}
+
+void fuzz_host_init() {
+  void *p = mmap((void *)FUZZ_BASE, FUZZ_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  Assert(p == (void *)FUZZ_BASE, "Can not map the window at 0x%08x in the host", FUZZ_BASE);
+
+  stack_t ss;
+  ss.ss_size = 64 * 1024;
+  ss.ss_sp = malloc(ss.ss_size);
+  ss.ss_flags = 0;
+  assert(ss.ss_sp != NULL);
+  Assert(sigaltstack(&ss, NULL) == 0, "Can not set the signal stack");
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = handler;
+  // the handler leaves with siglongjmp(), which does not restore the mask
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+  int sigs[] = { SIGTRAP, SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+  for (int i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i ++) {
+    Assert(sigaction(sigs[i], &sa, NULL) == 0, "Can not set the signal handler");
+  }
+}
@@ -1,5 +1,10 @@
 #include "nemu.h"
+#include "monitor/simpoint.h"
+#include "device/replay.h"
+#include "device/display.h"
 #include <unistd.h>
+#include <stdlib.h>
+#include <signal.h>
 
 #define ENTRY_START 0x100000
 
@@ -7,12 +12,16 @@ void init_difftest();
 void init_regex();
 void init_wp_pool();
 void init_device();
+void init_smp();
+void init_simpoint();
+void init_timing();
 
 void reg_test();
 void init_qemu_reg();
-bool gdb_memcpy_to_qemu(uint32_t, void *, int);
+void difftest_memcpy_to_qemu(paddr_t, void *, int);
 
 FILE *log_fp = NULL;
+void (*log_flush)(void) = NULL;
 static char *log_file = NULL;
 static char *img_file = NULL;
 static int is_batch_mode = false;
@@ -25,6 +34,35 @@ static inline void init_log() {
 #endif
 }
 
+#define NR_ABORT_HOOK 8
+
+static void (*abort_hook[NR_ABORT_HOOK])(void);
+static int nr_abort_hook = 0;
+
+void at_abort(void (*fn)(void)) {
+  assert(nr_abort_hook < NR_ABORT_HOOK);
+  abort_hook[nr_abort_hook ++] = fn;
+}
+
+/* Run the hooks in the reverse order, once. Assert() runs them before
+ * its message, and the SIGABRT handler for a bare assert().
+ */
+void run_abort_hooks() {
+  static bool running = false;
+  // a hook may fail an assertion itself
+  if (running) return;
+  running = true;
+  while (nr_abort_hook > 0) {
+    abort_hook[-- nr_abort_hook]();
+  }
+}
+
+static void abort_handler(int sig) {
+  run_abort_hooks();
+  signal(SIGABRT, SIG_DFL);
+  raise(SIGABRT);
+}
+
 static inline void welcome() {
   printf("Welcome to NEMU!\n");
   Log("Build time: %s, %s", __TIME__, __DATE__);
@@ -51,7 +89,7 @@ static inline int load_default_img() {
   return sizeof(img);
 }
 
-static inline void load_img() {
+static inline long load_img() {
   long size;
   if (img_file == NULL) {
     size = load_default_img();
@@ -75,10 +113,14 @@ static inline void load_img() {
   }
 
 #ifdef DIFF_TEST
-  gdb_memcpy_to_qemu(ENTRY_START, guest_to_host(ENTRY_START), size);
+  difftest_memcpy_to_qemu(ENTRY_START, guest_to_host(ENTRY_START), size);
 #endif
+
+  return size;
 }
 
+void fpu_reset(void);
+
 static inline void restart() {
   /* Set the initial instruction pointer. */
   cpu.eip = ENTRY_START;
@@ -86,24 +128,63 @@ static inline void restart() {
   cpu.eflags.val=0x00000002;  // eflagsֵΪ0x00000002H
   cpu.cs=8;
   cpu.CR0=0x60000011;
+  fpu_reset();
+  cpu.mxcsr=0x1f80;
 
 #ifdef DIFF_TEST
   init_qemu_reg();
 #endif
 }
 
+void difftest_set_batch(int);
+void difftest_set_shm(void);
+void disk_set_file(const char *);
+void fusion_set_report(void);
+void aot_set_file(const char *);
+void aot_set_output(const char *);
+void init_aot(vaddr_t, uint32_t);
+void simpoint_set(int, const char *);
+void simpoint_set_interval(const char *);
+void timing_set_predictor(const char *);
+void fuzz_set(const char *);
+void spin_set(void);
+void serial_set_fifo(const char *);
+void key_script_set(const char *);
+void init_fuzz();
+
 static inline void parse_args(int argc, char *argv[]) {
   int o;
-  while ( (o = getopt(argc, argv, "-bl:")) != -1) {
+  while ( (o = getopt(argc, argv, "-bsPWl:B:c:d:a:t:S:C:R:I:T:F:r:p:D:k:f:")) != -1) {
     switch (o) {
       case 'b': is_batch_mode = true; break;
       case 'l': log_file = optarg; break;
+      case 's': difftest_set_shm(); break;
+      case 'B': difftest_set_batch(atoi(optarg)); break;
+      case 'c': nr_cpu = atoi(optarg);
+                Assert(nr_cpu >= 1 && nr_cpu <= MAX_CPU, "the number of CPUs should be 1 to %d", MAX_CPU);
+                break;
+      case 'd': disk_set_file(optarg); break;
+      case 'P': fusion_set_report(); break;
+      case 'a': aot_set_file(optarg); break;
+      case 't': aot_set_output(optarg); break;
+      case 'S': simpoint_set(SIMPOINT_PROFILE, optarg); break;
+      case 'C': simpoint_set(SIMPOINT_CHECKPOINT, optarg); break;
+      case 'R': simpoint_set(SIMPOINT_DETAIL, optarg); break;
+      case 'I': simpoint_set_interval(optarg); break;
+      case 'T': timing_set_predictor(optarg); break;
+      case 'F': fuzz_set(optarg); break;
+      case 'W': spin_set(); break;
+      case 'r': replay_set(REPLAY_RECORD, optarg); break;
+      case 'p': replay_set(REPLAY_PLAY, optarg); break;
+      case 'D': display_set(optarg); break;
+      case 'k': key_script_set(optarg); break;
+      case 'f': serial_set_fifo(optarg); break;
       case 1:
                 if (img_file != NULL) Log("too much argument '%s', ignored", optarg);
                 else img_file = optarg;
                 break;
       default:
-                panic("Usage: %s [-b] [-l log_file] [img_file]", argv[0]);
+                panic("Usage: %s [-b] [-s] [-l log_file] [-B difftest_batch] [-c nr_cpu] [-d disk_img] [-P] [-a aot_so] [-t aot_c] [-S|-C|-R simpoint_dir] [-I interval] [-T predictor] [-F cases[,seed]] [-W] [-r|-p rec_file] [-D display] [-k key_script] [-f serial_fifo] [img_file]", argv[0]);
     }
   }
 }
@@ -117,6 +198,9 @@ int init_monitor(int argc, char *argv[]) {
   /* Open the log file. */
   init_log();
 
+  /* Finish the output and the recording also when NEMU aborts. */
+  signal(SIGABRT, abort_handler);
+
   /* Test the implementation of the `CPU_state' structure. */
   reg_test();
 
@@ -126,20 +210,38 @@ int init_monitor(int argc, char *argv[]) {
 #endif
 
   /* Load the image to memory. */
-  load_img();
+  long img_size = load_img();
+
+  /* Load or record the code translated ahead of time. */
+  init_aot(ENTRY_START, img_size);
 
   /* Initialize this virtual computer system. */
   restart();
 
+  /* Create the threads of the other CPUs. */
+  init_smp();
+
   /* Compile the regular expressions. */
   init_regex();
 
   /* Initialize the watchpoint pool. */
   init_wp_pool();
 
+  /* Fuzz the instructions against the host CPU instead of running the image. */
+  init_fuzz();
+
+  /* Record the inputs of the devices, or replay them. */
+  init_replay();
+
   /* Initialize devices. */
   init_device();
 
+  /* Start the timing model. */
+  init_timing();
+
+  /* Start profiling, checkpointing or simulating the simulation points. */
+  init_simpoint();
+
   /* Display welcome message. */
   welcome();
 
@@ -0,0 +1,326 @@
+#include "monitor/simpoint.h"
+#include "cpu/decode.h"
+#include <stdlib.h>
+#include <math.h>
+
+/* Profiling. Each interval of `simpoint_interval' instructions gets a
+ * basic block vector (BBV), which counts the instructions executed in
+ * each basic block. A basic block is identified by its first EIP, and
+ * ends at a jump, an exception or an interrupt.
+ *
+ * At exit the BBVs are randomly projected to DIM dimensions and
+ * clustered with k-means, like the SimPoint tools do. k is the smallest
+ * one whose BIC score is close to the best, and each cluster is
+ * represented by the interval closest to its centroid, weighted by the
+ * instructions of the cluster.
+ */
+
+#define DIM 15
+#define MAX_K 10
+#define NR_SEED 5
+#define MAX_ITER 100
+
+/* the basic blocks, numbered from 1 in the order they are found */
+static vaddr_t *bb_key;
+static uint32_t *bb_id;
+static uint32_t bb_hash_size = 4096, nr_bb = 0;
+
+/* the BBV of the current interval */
+static uint64_t *bb_count;
+static uint32_t bb_count_size = 0;
+static uint32_t *touched;
+static uint32_t nr_touched = 0;
+
+static vaddr_t bb_start;
+static uint32_t bb_len = 0;
+static uint64_t interval_len = 0;
+
+typedef struct {
+  double x[DIM];
+  uint64_t len;
+} Interval;
+
+static Interval *intervals;
+static int nr_interval = 0, interval_size = 64;
+
+static FILE *bbv_fp;
+
+static inline uint32_t hash(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352d;
+  x ^= x >> 15;
+  x *= 0x846ca68b;
+  x ^= x >> 16;
+  return x;
+}
+
+static void bb_hash_insert(vaddr_t eip, uint32_t id) {
+  uint32_t i = hash(eip) & (bb_hash_size - 1);
+  while (bb_id[i] != 0) i = (i + 1) & (bb_hash_size - 1);
+  bb_key[i] = eip;
+  bb_id[i] = id;
+}
+
+static uint32_t bb_lookup(vaddr_t eip) {
+  uint32_t i = hash(eip) & (bb_hash_size - 1);
+  for (; bb_id[i] != 0; i = (i + 1) & (bb_hash_size - 1)) {
+    if (bb_key[i] == eip) return bb_id[i];
+  }
+
+  // a new block, keep the table at most half full
+  if ((nr_bb + 1) * 2 > bb_hash_size) {
+    vaddr_t *old_key = bb_key;
+    uint32_t *old_id = bb_id;
+    uint32_t old_size = bb_hash_size;
+    bb_hash_size *= 2;
+    bb_key = malloc(bb_hash_size * sizeof(bb_key[0]));
+    bb_id = calloc(bb_hash_size, sizeof(bb_id[0]));
+    assert(bb_key != NULL && bb_id != NULL);
+    for (i = 0; i < old_size; i ++) {
+      if (old_id[i] != 0) bb_hash_insert(old_key[i], old_id[i]);
+    }
+    free(old_key);
+    free(old_id);
+  }
+  nr_bb ++;
+  bb_hash_insert(eip, nr_bb);
+
+  if (nr_bb >= bb_count_size) {
+    bb_count_size = (bb_count_size == 0 ? 1024 : bb_count_size * 2);
+    bb_count = realloc(bb_count, bb_count_size * sizeof(bb_count[0]));
+    touched = realloc(touched, bb_count_size * sizeof(touched[0]));
+    assert(bb_count != NULL && touched != NULL);
+    memset(bb_count + nr_bb, 0, (bb_count_size - nr_bb) * sizeof(bb_count[0]));
+  }
+  return nr_bb;
+}
+
+/* Account the instructions of the current block done so far. */
+static void bb_flush() {
+  if (bb_len == 0) return;
+  uint32_t id = bb_lookup(bb_start);
+  if (bb_count[id] == 0) touched[nr_touched ++] = id;
+  bb_count[id] += bb_len;
+  bb_len = 0;
+}
+
+/* the random projection matrix, generated from the block number so
+ * that it need not be stored */
+static inline double projection(uint32_t id, int d) {
+  return hash(id * DIM + d) / (double)UINT32_MAX * 2 - 1;
+}
+
+static void interval_end() {
+  if (nr_interval == interval_size) {
+    interval_size *= 2;
+    intervals = realloc(intervals, interval_size * sizeof(intervals[0]));
+    assert(intervals != NULL);
+  }
+  Interval *it = &intervals[nr_interval ++];
+  memset(it, 0, sizeof(*it));
+  it->len = interval_len;
+
+  fprintf(bbv_fp, "T");
+  uint32_t i;
+  int d;
+  for (i = 0; i < nr_touched; i ++) {
+    uint32_t id = touched[i];
+    fprintf(bbv_fp, ":%u:%llu ", id, (unsigned long long)bb_count[id]);
+    double frac = (double)bb_count[id] / interval_len;
+    for (d = 0; d < DIM; d ++) {
+      it->x[d] += frac * projection(id, d);
+    }
+    bb_count[id] = 0;
+  }
+  fprintf(bbv_fp, "\n");
+  nr_touched = 0;
+  interval_len = 0;
+}
+
+void bbv_step() {
+  bb_len ++;
+  interval_len ++;
+  if (cpu.eip != decoding.seq_eip) {
+    bb_flush();
+    bb_start = cpu.eip;
+  }
+  if (interval_len == simpoint_interval) {
+    // a block crossing the boundary is split between both intervals
+    bb_flush();
+    interval_end();
+  }
+}
+
+/* clustering */
+
+static uint32_t rand_state = 1;
+
+static inline uint32_t rand_next() {
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 17;
+  rand_state ^= rand_state << 5;
+  return rand_state;
+}
+
+static inline double dist2(const double *a, const double *b) {
+  double s = 0;
+  int d;
+  for (d = 0; d < DIM; d ++) {
+    s += (a[d] - b[d]) * (a[d] - b[d]);
+  }
+  return s;
+}
+
+/* Return the sum of squared distances to the centroids. */
+static double kmeans(int k, int *label, double (*c)[DIM]) {
+  int n = nr_interval, i, j, d, iter;
+  int *size = malloc(k * sizeof(int));
+  assert(size != NULL);
+
+  // the initial centroids are random intervals, distinct if possible
+  for (j = 0; j < k; j ++) {
+    int p, retry = 0;
+    do {
+      p = rand_next() % n;
+      for (i = 0; i < j && dist2(c[i], intervals[p].x) != 0; i ++);
+    } while (i < j && ++ retry < MAX_ITER);
+    memcpy(c[j], intervals[p].x, sizeof(c[j]));
+  }
+
+  for (i = 0; i < n; i ++) label[i] = -1;
+  for (iter = 0; iter < MAX_ITER; iter ++) {
+    bool changed = false;
+    for (i = 0; i < n; i ++) {
+      int best = 0;
+      for (j = 1; j < k; j ++) {
+        if (dist2(intervals[i].x, c[j]) < dist2(intervals[i].x, c[best])) best = j;
+      }
+      if (label[i] != best) {
+        label[i] = best;
+        changed = true;
+      }
+    }
+    if (!changed) break;
+
+    memset(c, 0, k * sizeof(c[0]));
+    memset(size, 0, k * sizeof(int));
+    for (i = 0; i < n; i ++) {
+      size[label[i]] ++;
+      for (d = 0; d < DIM; d ++) c[label[i]][d] += intervals[i].x[d];
+    }
+    for (j = 0; j < k; j ++) {
+      // an empty cluster takes a random interval
+      if (size[j] == 0) memcpy(c[j], intervals[rand_next() % n].x, sizeof(c[j]));
+      else for (d = 0; d < DIM; d ++) c[j][d] /= size[j];
+    }
+  }
+  free(size);
+
+  double sse = 0;
+  for (i = 0; i < n; i ++) {
+    sse += dist2(intervals[i].x, c[label[i]]);
+  }
+  return sse;
+}
+
+/* the BIC of a clustering as spherical Gaussians with the same variance */
+static double bic(int k, const int *label, double sse) {
+  int n = nr_interval, i, j;
+  double var = (n > k ? sse / ((double)(n - k) * DIM) : 0);
+  if (var < 1e-12) var = 1e-12;
+
+  double loglik = -n * DIM / 2.0 * log(2 * M_PI * var) - (n - k) * DIM / 2.0;
+  for (j = 0; j < k; j ++) {
+    int size = 0;
+    for (i = 0; i < n; i ++) size += (label[i] == j);
+    if (size > 0) loglik += size * log((double)size / n);
+  }
+  int nr_param = (k - 1) + k * DIM + 1;
+  return loglik - nr_param / 2.0 * log(n);
+}
+
+static int cmp_index(const void *a, const void *b) {
+  return (int)((const SimPoint *)a)->index - (int)((const SimPoint *)b)->index;
+}
+
+static void bbv_finish() {
+  bb_flush();
+  if (interval_len > 0) interval_end();
+  fclose(bbv_fp);
+
+  int n = nr_interval;
+  if (n == 0) return;
+  int max_k = (n < MAX_K ? n : MAX_K);
+  int k, j, i, s;
+  int (*label)[n] = malloc(sizeof(int[MAX_K + 1][n]));
+  double (*centroid)[MAX_K][DIM] = malloc(sizeof(double[MAX_K + 1][MAX_K][DIM]));
+  double score[MAX_K + 1];
+  int *tmp_label = malloc(n * sizeof(int));
+  double (*tmp_centroid)[DIM] = malloc(sizeof(double[MAX_K][DIM]));
+  assert(label && centroid && tmp_label && tmp_centroid);
+
+  for (k = 1; k <= max_k; k ++) {
+    double best = INFINITY;
+    for (s = 0; s < NR_SEED; s ++) {
+      double sse = kmeans(k, tmp_label, tmp_centroid);
+      if (sse < best) {
+        best = sse;
+        memcpy(label[k], tmp_label, n * sizeof(int));
+        memcpy(centroid[k], tmp_centroid, k * sizeof(tmp_centroid[0]));
+      }
+    }
+    score[k] = bic(k, label[k], best);
+  }
+
+  double lo = score[1], hi = score[1];
+  for (k = 2; k <= max_k; k ++) {
+    if (score[k] < lo) lo = score[k];
+    if (score[k] > hi) hi = score[k];
+  }
+  for (k = 1; k < max_k && score[k] < lo + 0.9 * (hi - lo); k ++);
+
+  uint64_t total = 0;
+  for (i = 0; i < n; i ++) total += intervals[i].len;
+
+  SimPoint points[MAX_K];
+  int nr_point = 0;
+  for (j = 0; j < k; j ++) {
+    int rep = -1;
+    uint64_t len = 0;
+    for (i = 0; i < n; i ++) {
+      if (label[k][i] != j) continue;
+      len += intervals[i].len;
+      if (rep == -1 || dist2(intervals[i].x, centroid[k][j]) < dist2(intervals[rep].x, centroid[k][j])) {
+        rep = i;
+      }
+    }
+    if (rep == -1) continue;
+    points[nr_point].index = rep;
+    points[nr_point].weight = (double)len / total;
+    nr_point ++;
+  }
+  qsort(points, nr_point, sizeof(points[0]), cmp_index);
+  simpoint_write(points, nr_point);
+
+  printf("SimPoint: %d intervals of %llu instructions, %u basic blocks, %d simulation points\n",
+      n, (unsigned long long)simpoint_interval, nr_bb, nr_point);
+
+  free(label);
+  free(centroid);
+  free(tmp_label);
+  free(tmp_centroid);
+}
+
+void init_bbv() {
+  char path[256];
+  simpoint_path(path, sizeof(path), "bbv", -1);
+  bbv_fp = fopen(path, "w");
+  Assert(bbv_fp, "Can not open '%s'", path);
+
+  bb_key = malloc(bb_hash_size * sizeof(bb_key[0]));
+  bb_id = calloc(bb_hash_size, sizeof(bb_id[0]));
+  intervals = malloc(interval_size * sizeof(intervals[0]));
+  assert(bb_key != NULL && bb_id != NULL && intervals != NULL);
+  bb_start = cpu.eip;
+  atexit(bbv_finish);
+}
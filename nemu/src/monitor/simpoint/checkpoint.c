@@ -0,0 +1,130 @@
+#include "monitor/simpoint.h"
+#include "monitor/monitor.h"
+#include "memory/mmu.h"
+#include "device/port-io.h"
+#include "device/mmio.h"
+#include <stdlib.h>
+
+/* A checkpoint holds the state of CPU 0, the pages of pmem which are not
+ * all zero, and the device registers. The state kept inside the devices,
+ * like the keys queued by the keyboard, is not saved, and the host timer
+ * is not running when a checkpoint is simulated in detail.
+ *
+ * The checkpoint of simulation point i is taken `simpoint_interval'
+ * instructions before the interval, which warm up the caches of the
+ * detailed simulation.
+ */
+
+#define CKPT_MAGIC "NEMUCKPT"
+#define PAGE_END 0xffffffff
+
+static SimPoint *points;
+static int nr_point, next_point = 0;
+
+static inline uint64_t checkpoint_pos(SimPoint *p, uint64_t *warmup) {
+  uint64_t start = p->index * simpoint_interval;
+  *warmup = (start < simpoint_interval ? start : simpoint_interval);
+  return start - *warmup;
+}
+
+static inline bool page_is_zero(const uint8_t *p) {
+  const uint64_t *q = (const uint64_t *)p;
+  int i;
+  for (i = 0; i < PAGE_SIZE / sizeof(*q); i ++) {
+    if (q[i] != 0) return false;
+  }
+  return true;
+}
+
+static void checkpoint_save(SimPoint *p, uint64_t warmup) {
+  char path[256];
+  simpoint_path(path, sizeof(path), "ckpt", p->index);
+  FILE *fp = fopen(path, "wb");
+  Assert(fp, "Can not open '%s'", path);
+
+  CheckpointHeader h;
+  memcpy(h.magic, CKPT_MAGIC, sizeof(h.magic));
+  h.index = p->index;
+  h.interval = simpoint_interval;
+  h.warmup = warmup;
+  fwrite(&h, sizeof(h), 1, fp);
+  fwrite(&cpu, sizeof(cpu), 1, fp);
+
+  uint32_t pg;
+  for (pg = 0; pg < PMEM_SIZE / PAGE_SIZE; pg ++) {
+    uint8_t *page = guest_to_host(pg * PAGE_SIZE);
+    if (page_is_zero(page)) continue;
+    fwrite(&pg, sizeof(pg), 1, fp);
+    fwrite(page, PAGE_SIZE, 1, fp);
+  }
+  pg = PAGE_END;
+  fwrite(&pg, sizeof(pg), 1, fp);
+
+  pio_save(fp);
+  mmio_save(fp);
+  Assert(!ferror(fp), "Can not write '%s'", path);
+  fclose(fp);
+}
+
+/* Restore the state saved in checkpoint `path'. */
+bool checkpoint_load(const char *path, CheckpointHeader *h) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) return false;
+
+  bool ok = false;
+  if (fread(h, sizeof(*h), 1, fp) != 1 || memcmp(h->magic, CKPT_MAGIC, sizeof(h->magic)) != 0) goto out;
+
+  CPU_state c;
+  if (fread(&c, sizeof(c), 1, fp) != 1) goto out;
+  memcpy(&cpu, &c, sizeof(c));
+  cpus[0] = &cpu;
+
+  // only clear the pages which are not zero, so that a forked process
+  // does not copy the others
+  uint32_t pg, next = 0;
+  do {
+    if (fread(&pg, sizeof(pg), 1, fp) != 1) goto out;
+    uint32_t end = (pg == PAGE_END ? PMEM_SIZE / PAGE_SIZE : pg);
+    if (end > PMEM_SIZE / PAGE_SIZE || end < next) goto out;
+    for (; next < end; next ++) {
+      uint8_t *page = guest_to_host(next * PAGE_SIZE);
+      if (!page_is_zero(page)) memset(page, 0, PAGE_SIZE);
+    }
+    if (pg != PAGE_END) {
+      if (fread(guest_to_host(pg * PAGE_SIZE), PAGE_SIZE, 1, fp) != 1) goto out;
+      next = pg + 1;
+    }
+  } while (pg != PAGE_END);
+
+  ok = pio_load(fp) && mmio_load(fp);
+
+out:
+  fclose(fp);
+  return ok;
+}
+
+void checkpoint_step() {
+  uint64_t warmup;
+  while (next_point < nr_point && checkpoint_pos(&points[next_point], &warmup) == simpoint_icount) {
+    checkpoint_save(&points[next_point], warmup);
+    next_point ++;
+  }
+  if (next_point == nr_point) {
+    Log("%d checkpoints are taken", nr_point);
+    nemu_state = NEMU_END;
+  }
+}
+
+static void checkpoint_finish() {
+  if (next_point < nr_point) {
+    Log("the program ends before simulation point %u, %d checkpoints are not taken",
+        points[next_point].index, nr_point - next_point);
+  }
+}
+
+void init_checkpoint() {
+  nr_point = simpoint_read(&points);
+  atexit(checkpoint_finish);
+  // the checkpoints at the beginning
+  checkpoint_step();
+}
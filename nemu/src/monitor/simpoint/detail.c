@@ -0,0 +1,164 @@
+#include "monitor/simpoint.h"
+#include "monitor/monitor.h"
+#include "memory/cache.h"
+#include "cpu/timing.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+/* Detailed simulation. Each simulation point is simulated from its
+ * checkpoint by a forked process, with as many processes running as
+ * there are host CPUs. A process restores the checkpoint, runs the
+ * warm-up instructions, and then the interval with the statistics
+ * cleared, and sends them back through a pipe. The results are
+ * combined with the weights of the simulation points. With `-T', the
+ * cycles are also estimated by the timing model.
+ */
+
+typedef struct {
+  uint32_t index;
+  uint64_t instr;
+  uint64_t access[NR_CACHE], miss[NR_CACHE];
+  TimingStat timing;
+} DetailResult;
+
+void cpu_exec(uint64_t);
+
+static void detail_worker(SimPoint *p, int fd) {
+  char path[256];
+  simpoint_path(path, sizeof(path), "ckpt", p->index);
+  CheckpointHeader h;
+  if (!checkpoint_load(path, &h)) {
+    Log("Can not load checkpoint '%s', take it with -C first", path);
+    _exit(1);
+  }
+
+  // the output of the guest
+  int null_fd = open("/dev/null", O_WRONLY);
+  if (null_fd >= 0) {
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+  }
+
+  init_cache();
+  cache_enabled = true;
+  if (h.warmup > 0) {
+    cpu_exec(h.warmup);
+  }
+  timing_reset_stat();
+  uint64_t start = simpoint_icount;
+  if (nemu_state != NEMU_END) {
+    cpu_exec(h.interval);
+  }
+
+  DetailResult r;
+  r.index = p->index;
+  r.instr = simpoint_icount - start;
+  int i;
+  for (i = 0; i < NR_CACHE; i ++) {
+    cache_get_stat(i, &r.access[i], &r.miss[i]);
+  }
+  r.timing = timing_stat;
+  // smaller than PIPE_BUF, so the results of the workers do not mix
+  Assert(write(fd, &r, sizeof(r)) == sizeof(r), "Can not send the result");
+  _exit(0);
+}
+
+static inline double ratio(uint64_t a, uint64_t b) {
+  return (b == 0 ? 0 : (double)a / b);
+}
+
+static const char *cache_name[] = { [CACHE_I] = "L1I", [CACHE_D] = "L1D" };
+
+static void report(SimPoint *points, int nr_point, DetailResult *results, int nr_result) {
+  printf("%8s %8s %12s", "point", "weight", "instrs");
+  int i, j, c;
+  for (c = 0; c < NR_CACHE; c ++) {
+    printf(" %7s miss%% %8s MPKI", cache_name[c], cache_name[c]);
+  }
+  if (timing_enabled) printf(" %8s %12s", "CPI", "branch MPKI");
+  printf("\n");
+
+  double weight = 0, miss_rate[NR_CACHE] = {0}, mpki[NR_CACHE] = {0}, cpi = 0, br_mpki = 0;
+  for (i = 0; i < nr_point; i ++) {
+    DetailResult *r = NULL;
+    for (j = 0; j < nr_result; j ++) {
+      if (results[j].index == points[i].index) r = &results[j];
+    }
+    printf("%8u %8.4f", points[i].index, points[i].weight);
+    if (r == NULL || r->instr == 0) {
+      printf(" %12s\n", "failed");
+      continue;
+    }
+
+    printf(" %12llu", (unsigned long long)r->instr);
+    weight += points[i].weight;
+    for (c = 0; c < NR_CACHE; c ++) {
+      double m = ratio(r->miss[c], r->access[c]), k = ratio(r->miss[c] * 1000, r->instr);
+      printf(" %11.2f%% %13.3f", m * 100, k);
+      miss_rate[c] += points[i].weight * m;
+      mpki[c] += points[i].weight * k;
+    }
+    if (timing_enabled) {
+      uint64_t mispredict = 0;
+      for (j = 0; j < NR_BR_TYPE; j ++) mispredict += r->timing.mispredict[j];
+      double p = ratio(timing_cycles(&r->timing, r->miss), r->instr), k = ratio(mispredict * 1000, r->instr);
+      printf(" %8.3f %12.3f", p, k);
+      cpi += points[i].weight * p;
+      br_mpki += points[i].weight * k;
+    }
+    printf("\n");
+  }
+
+  if (weight == 0) return;
+  printf("%8s %8.4f %12s", "weighted", weight, "");
+  for (c = 0; c < NR_CACHE; c ++) {
+    printf(" %11.2f%% %13.3f", miss_rate[c] / weight * 100, mpki[c] / weight);
+  }
+  if (timing_enabled) printf(" %8.3f %12.3f", cpi / weight, br_mpki / weight);
+  printf("\n");
+}
+
+void simpoint_detail() {
+  SimPoint *points;
+  int nr_point = simpoint_read(&points);
+  int nr_job = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nr_job < 1) nr_job = 1;
+  printf("Simulating %d simulation points of %llu instructions with %d processes\n",
+      nr_point, (unsigned long long)simpoint_interval, nr_job);
+  fflush(stdout);
+
+  int fd[2];
+  Assert(pipe(fd) == 0, "Can not create the pipe");
+
+  int i, running = 0;
+  for (i = 0; i < nr_point; i ++) {
+    if (running == nr_job) {
+      wait(NULL);
+      running --;
+    }
+    pid_t pid = fork();
+    Assert(pid >= 0, "Can not fork");
+    if (pid == 0) {
+      close(fd[0]);
+      detail_worker(&points[i], fd[1]);
+    }
+    running ++;
+  }
+  for (; running > 0; running --) {
+    wait(NULL);
+  }
+  close(fd[1]);
+
+  DetailResult *results = malloc(nr_point * sizeof(DetailResult) + 1);
+  assert(results != NULL);
+  int nr_result = 0;
+  while (nr_result < nr_point && read(fd[0], &results[nr_result], sizeof(results[0])) == sizeof(results[0])) {
+    nr_result ++;
+  }
+  close(fd[0]);
+
+  report(points, nr_point, results, nr_result);
+  exit(0);
+}
@@ -0,0 +1,102 @@
+#include "monitor/simpoint.h"
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+/* The files in the directory of a run:
+ *   bbv          the basic block vector of each interval, in the format
+ *                of the SimPoint tools
+ *   simpoints    the interval length, and the index and weight of each
+ *                simulation point
+ *   ckpt.<index> the checkpoint before simulation point <index>
+ */
+
+int simpoint_mode = SIMPOINT_NONE;
+const char *simpoint_dir = NULL;
+uint64_t simpoint_interval = DEFAULT_INTERVAL;
+uint64_t simpoint_icount = 0;  // instructions executed in this pass
+
+void simpoint_set(int mode, const char *dir) {
+  Assert(simpoint_mode == SIMPOINT_NONE, "only one of -S, -C and -R can be given");
+  simpoint_mode = mode;
+  simpoint_dir = dir;
+}
+
+void simpoint_set_interval(const char *s) {
+  simpoint_interval = strtoull(s, NULL, 0);
+  Assert(simpoint_interval > 0 && simpoint_interval <= UINT32_MAX,
+      "the interval should be 1 to %u instructions", UINT32_MAX);
+}
+
+void simpoint_path(char *buf, int size, const char *name, uint32_t index) {
+  if (index == -1) snprintf(buf, size, "%s/%s", simpoint_dir, name);
+  else snprintf(buf, size, "%s/%s.%u", simpoint_dir, name, index);
+}
+
+/* Also sets `simpoint_interval' to the one used for profiling. */
+int simpoint_read(SimPoint **points) {
+  char path[256];
+  simpoint_path(path, sizeof(path), "simpoints", -1);
+  FILE *fp = fopen(path, "r");
+  Assert(fp, "Can not open '%s', profile with -S first", path);
+
+  unsigned long long interval;
+  Assert(fscanf(fp, "interval %llu", &interval) == 1, "'%s' is corrupted", path);
+  simpoint_interval = interval;
+
+  int n = 0, size = 16;
+  *points = malloc(size * sizeof(SimPoint));
+  SimPoint p;
+  while (fscanf(fp, "%u %lf", &p.index, &p.weight) == 2) {
+    if (n == size) {
+      size *= 2;
+      *points = realloc(*points, size * sizeof(SimPoint));
+    }
+    (*points)[n ++] = p;
+  }
+  assert(*points != NULL);
+  fclose(fp);
+  return n;
+}
+
+/* `points' are sorted by index */
+void simpoint_write(SimPoint *points, int n) {
+  char path[256];
+  simpoint_path(path, sizeof(path), "simpoints", -1);
+  FILE *fp = fopen(path, "w");
+  Assert(fp, "Can not open '%s'", path);
+  fprintf(fp, "interval %llu\n", (unsigned long long)simpoint_interval);
+  int i;
+  for (i = 0; i < n; i ++) {
+    fprintf(fp, "%u %.6f\n", points[i].index, points[i].weight);
+  }
+  fclose(fp);
+}
+
+/* Called after each instruction executed by CPU 0. */
+void simpoint_step() {
+  simpoint_icount ++;
+  switch (simpoint_mode) {
+    case SIMPOINT_PROFILE: bbv_step(); break;
+    case SIMPOINT_CHECKPOINT: checkpoint_step(); break;
+    default: break;
+  }
+}
+
+void init_simpoint() {
+  if (simpoint_mode == SIMPOINT_NONE) return;
+
+#ifdef DIFF_TEST
+  panic("differential testing does not support SimPoint");
+#endif
+  Assert(nr_cpu == 1, "SimPoint does not support %d CPUs", nr_cpu);
+
+  switch (simpoint_mode) {
+    case SIMPOINT_PROFILE:
+      Assert(mkdir(simpoint_dir, 0755) == 0 || errno == EEXIST, "Can not create '%s'", simpoint_dir);
+      init_bbv();
+      break;
+    case SIMPOINT_CHECKPOINT: init_checkpoint(); break;
+    case SIMPOINT_DETAIL: simpoint_detail(); break;
+  }
+}
@@ -38,7 +38,7 @@ enum {
 };
 
 #define _EVENTS(_) \
-  _(IRQ_TIME) _(IRQ_IODEV) \
+  _(IRQ_TIME) _(IRQ_IODEV) _(IRQ_IPI) \
   _(ERROR) _(PAGE_FAULT) _(BUS_ERROR) _(NUMERIC) \
   _(TRAP) _(SYSCALL)
 
@@ -60,6 +60,11 @@ typedef struct _Screen {
   int width, height;
 } _Screen;
 
+typedef struct _Disk {
+  int blksz;
+  uint32_t nr_blk;
+} _Disk;
+
 typedef struct _Protect {
   _Area area; 
   void *ptr;
@@ -74,6 +79,7 @@ extern "C" {
 // =======================================================================
 
 void _putc(char ch);
+void _putstr(const char *s, size_t len);
 void _halt(int code);
 extern _Area _heap;
 
@@ -87,6 +93,10 @@ int _read_key();
 void _draw_rect(const uint32_t *pixels, int x, int y, int w, int h);
 void _draw_sync();
 extern _Screen _screen;
+int _disk_read(void *buf, uint32_t blk, uint32_t nr_blk);
+int _disk_write(const void *buf, uint32_t blk, uint32_t nr_blk);
+void _disk_intr(int enable);
+extern _Disk _disk;
 
 // =======================================================================
 // [2] Asynchronous Extension (ASYE)
@@ -96,6 +106,7 @@ void _asye_init(_RegSet* (*l)(_Event ev, _RegSet *regs));
 _RegSet *_make(_Area kstack, void *entry, void *arg);
 void _trap();
 int _istatus(int enable);
+void _idle();
 
 // =======================================================================
 // [3] Protection Extension (PTE)
@@ -105,6 +116,7 @@ void _pte_init(void*(*palloc)(), void (*pfree)(void*));
 void _protect(_Protect *p);
 void _release(_Protect *p);
 void _map(_Protect *p, void *va, void *pa);
+int _map_large(_Protect *p, void *va, void *pa);
 void _unmap(_Protect *p, void *va);
 void _switch(_Protect *p);
 _RegSet *_umake(_Protect *p, _Area ustack, _Area kstack, void *entry, char *const argv[], char *const envp[]);
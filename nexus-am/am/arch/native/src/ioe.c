@@ -14,6 +14,12 @@ unsigned long _uptime() {
 
 void gui_init();
 
+_Disk _disk = { .blksz = 512, .nr_blk = 0 };
+
+int _disk_read(void *buf, uint32_t blk, uint32_t nr_blk) { return -1; }
+int _disk_write(const void *buf, uint32_t blk, uint32_t nr_blk) { return -1; }
+void _disk_intr(int enable) { }
+
 void _ioe_init() {
   gui_init();
   gettimeofday(&boot_time, NULL);
@@ -13,6 +13,10 @@ void _putc(char ch) {
   putchar(ch);
 }
 
+void _putstr(const char *s, size_t len) {
+  fwrite(s, 1, len, stdout);
+}
+
 void _halt(int code) {
   printf("Exit (%d)\n", code);
   _exit(code);
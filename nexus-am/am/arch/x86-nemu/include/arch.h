@@ -5,6 +5,7 @@
 
 #define PMEM_SIZE (128 * 1024 * 1024)
 #define PGSIZE    4096    // Bytes mapped by a page
+#define PGSIZE_LARGE (4 * 1024 * 1024) // Bytes mapped by a large page
 
 struct _RegSet {
   uintptr_t edi,esi,ebp,esp,ebx,edx,ecx,eax;
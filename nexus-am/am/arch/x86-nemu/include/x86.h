@@ -17,6 +17,15 @@
 // Control Register flags
 #define CR0_PE    0x00000001  // Protection Enable
 #define CR0_PG    0x80000000  // Paging
+#define CR4_PSE   0x00000010  // Page Size Extensions
+
+// CPUID.1:EDX feature flags
+#define CPUID_SEP 0x00000800  // SYSENTER/SYSEXIT
+
+// Model specific registers
+#define MSR_SYSENTER_CS   0x174
+#define MSR_SYSENTER_ESP  0x175
+#define MSR_SYSENTER_EIP  0x176
 
 // Page directory and page table constants
 #define NR_PDE    1024    // # directory entries per page directory
@@ -33,6 +42,7 @@
 #define PTE_PCD   0x010     // Cache-Disable
 #define PTE_A     0x020     // Accessed
 #define PTE_D     0x040     // Dirty
+#define PTE_PS    0x080     // Page Size (4MB page, in a PDE)
 
 // GDT entries
 #define NR_SEG    6       // GDT size
@@ -106,10 +116,26 @@ static inline void set_idt(GateDesc *idt, int size) {
   asm volatile("lidt (%0)" : : "r"(data));
 }
 
+static inline uint32_t get_cr2(void) {
+  volatile uint32_t val;
+  asm volatile("movl %%cr2, %0" : "=r"(val));
+  return val;
+}
+
 static inline void set_cr3(void *pdir) {
   asm volatile("movl %0, %%cr3" : : "r"(pdir));
 }
 
+static inline uint32_t get_cr4(void) {
+  volatile uint32_t val;
+  asm volatile("movl %%cr4, %0" : "=r"(val));
+  return val;
+}
+
+static inline void set_cr4(uint32_t cr4) {
+  asm volatile("movl %0, %%cr4" : : "r"(cr4));
+}
+
 static inline uint8_t inb(int port) {
   char data;
   asm volatile("inb %1, %0" : "=a"(data) : "d"((uint16_t)port));
@@ -130,6 +156,19 @@ static inline void outl(int port, uint32_t data) {
   asm volatile("outl %%eax, %%dx" : : "a"(data), "d"((uint16_t)port));
 }
 
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx,
+                         uint32_t *ecx, uint32_t *edx) {
+  asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf));
+}
+
+static inline void wrmsr(uint32_t msr, uint32_t val) {
+  asm volatile("wrmsr" : : "c"(msr), "a"(val), "d"(0));
+}
+
+static inline void rep_movsl(void *dst, const void *src, int n) {
+  asm volatile("cld; rep movsl" : "+D"(dst), "+S"(src), "+c"(n) : : "memory");
+}
+
 #endif
 
 #endif
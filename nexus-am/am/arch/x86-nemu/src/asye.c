@@ -7,6 +7,11 @@ void vecsys();
 void vecnull();
 void vectrap();
 void vectimer();
+void vecipi();
+void vecvblank();
+void vecdisk();
+void vecpf();
+void vecsysenter();
 
 _RegSet *irq_handle(_RegSet *tf) {
   _RegSet *next = tf;
@@ -22,6 +27,17 @@ _RegSet *irq_handle(_RegSet *tf) {
     case 0x20:
       ev.event = _EVENT_IRQ_TIME;
       break;
+    case 0x22:
+      ev.event = _EVENT_IRQ_IPI;
+      break;
+    case 0x23:
+    case 0x2e:
+      ev.event = _EVENT_IRQ_IODEV;
+      break;
+    case 14:
+      ev.event = _EVENT_PAGE_FAULT;
+      ev.cause = get_cr2();
+      break;
     default:
       ev.event = _EVENT_ERROR;
       break;
@@ -48,9 +64,23 @@ void _asye_init(_RegSet *(*h)(_Event, _RegSet *)) {
   idt[0x80] = GATE(STS_TG32, KSEL(SEG_KCODE), vecsys, DPL_USER);
   idt[0x81] = GATE(STS_IG32, KSEL(SEG_KCODE), vectrap, DPL_USER);
   idt[0x20] = GATE(STS_TG32, KSEL(SEG_KCODE), vectimer, DPL_USER);
+  idt[0x22] = GATE(STS_TG32, KSEL(SEG_KCODE), vecipi, DPL_KERN);
+  idt[0x23] = GATE(STS_TG32, KSEL(SEG_KCODE), vecvblank, DPL_KERN);
+  idt[0x2e] = GATE(STS_TG32, KSEL(SEG_KCODE), vecdisk, DPL_KERN);
+  idt[14] = GATE(STS_IG32, KSEL(SEG_KCODE), vecpf, DPL_KERN);
 
   set_idt(idt, sizeof(idt));
 
+  // -------------------- fast system call ----------------------
+  // vecsysenter runs on the stack of the caller, so SYSENTER_ESP is unused
+  uint32_t eax, ebx, ecx, edx;
+  cpuid(1, &eax, &ebx, &ecx, &edx);
+  if (edx & CPUID_SEP) {
+    wrmsr(MSR_SYSENTER_CS, KSEL(SEG_KCODE));
+    wrmsr(MSR_SYSENTER_ESP, 0);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)vecsysenter);
+  }
+
   // register event handler
   H = h;
 }
@@ -60,3 +90,7 @@ _RegSet *_make(_Area stack, void *entry, void *arg) { return NULL; }
 void _trap() { asm volatile("int $0x81"); }
 
 int _istatus(int enable) { return 0; }
+
+// Sleep until an interrupt is taken. Interrupts are enabled only while
+// the CPU is halted, as the caller may be a handler.
+void _idle() { asm volatile("sti; hlt; cli"); }
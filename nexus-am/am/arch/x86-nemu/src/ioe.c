@@ -4,8 +4,85 @@
 #define RTC_PORT 0x48   // Note that this is not standard
 static unsigned long boot_time;
 
+// the blitter of NEMU, see nemu/src/device/blit.c
+#define BLIT_MMIO 0xc0000
+#define BLIT_ID   0x54494c42  // "BLIT"
+enum { BLIT_COPY = 1, BLIT_FILL, BLIT_PAL8 };
+enum { BLIT_OK = 0, BLIT_FAIL };
+
+static volatile struct {
+  uint32_t id, src, pitch, x, y, w, h, color, pal, cmd, dst;
+} * const blit = (void *)BLIT_MMIO;
+static int has_blit;
+
+// the display controller of NEMU, see nemu/src/device/vga.c
+#define DISPLAY_PORT 0x100
+#define BUF_PORT     (DISPLAY_PORT + 4)
+#define ADDR_PORT    (DISPLAY_PORT + 8)
+#define PRESENT_PORT (DISPLAY_PORT + 12)
+
+#define SCREEN_W 400
+#define SCREEN_H 300
+
+// _draw_rect draws into the MMIO frame buffer until the first
+// _draw_sync, and into the back buffer of `fbs' after that. `damage'
+// holds the rects drawn since the last _draw_sync, merged into one
+// when there are too many.
+static uint32_t fbs[2][SCREEN_W * SCREEN_H];
+static uint32_t *canvas;
+static int back;
+
+#define NR_DAMAGE 16
+static struct { int x, y, w, h; } damage[NR_DAMAGE];
+static int nr_damage;
+
+// the disk of NEMU, see nemu/src/device/disk.c
+#define DISK_PORT    0x300
+#define NR_BLK_PORT  (DISK_PORT + 0)
+#define BLK_PORT     (DISK_PORT + 4)
+#define COUNT_PORT   (DISK_PORT + 8)
+#define DMA_PORT     (DISK_PORT + 12)
+#define CMD_PORT     (DISK_PORT + 16)
+#define STATUS_PORT  (DISK_PORT + 20)
+#define CTRL_PORT    (DISK_PORT + 24)
+enum { DISK_READ = 1, DISK_WRITE };
+#define DISK_INTR 0x1
+
+_Disk _disk = { .blksz = 512 };
+
 void _ioe_init() {
   boot_time = inl(RTC_PORT);
+  has_blit = (blit->id == BLIT_ID);
+
+  for (int i = 0; i < 2; i ++) {
+    outl(BUF_PORT, i);
+    outl(ADDR_PORT, (uint32_t)fbs[i]);
+  }
+
+  _disk.nr_blk = inl(NR_BLK_PORT);
+}
+
+// the request is done when the command is written
+static int disk_request(int cmd, const void *buf, uint32_t blk, uint32_t nr_blk) {
+  outl(BLK_PORT, blk);
+  outl(COUNT_PORT, nr_blk);
+  outl(DMA_PORT, (uint32_t)buf);
+  outl(CMD_PORT, cmd);
+  return inl(STATUS_PORT) == 0 ? 0 : -1;
+}
+
+int _disk_read(void *buf, uint32_t blk, uint32_t nr_blk) {
+  return disk_request(DISK_READ, buf, blk, nr_blk);
+}
+
+int _disk_write(const void *buf, uint32_t blk, uint32_t nr_blk) {
+  return disk_request(DISK_WRITE, buf, blk, nr_blk);
+}
+
+// raise _EVENT_IRQ_IODEV when a request is done, off by default since
+// the requests are done when they return
+void _disk_intr(int enable) {
+  outl(CTRL_PORT, enable ? DISK_INTR : 0);
 }
 
 unsigned long _uptime() {  // ǰʱȥʼʱ
@@ -15,20 +92,77 @@ unsigned long _uptime() {  // 
 uint32_t* const fb = (uint32_t *)0x40000;
 
 _Screen _screen = {
-  .width  = 400,
-  .height = 300,
+  .width  = SCREEN_W,
+  .height = SCREEN_H,
 };
 
-extern void* memcpy(void *, const void *, int);
+static void add_damage(int x, int y, int w, int h) {
+  if (nr_damage == NR_DAMAGE) {
+    int x0 = x, y0 = y, x1 = x + w, y1 = y + h;
+    for (int i = 0; i < nr_damage; i ++) {
+      if (damage[i].x < x0) x0 = damage[i].x;
+      if (damage[i].y < y0) y0 = damage[i].y;
+      if (damage[i].x + damage[i].w > x1) x1 = damage[i].x + damage[i].w;
+      if (damage[i].y + damage[i].h > y1) y1 = damage[i].y + damage[i].h;
+    }
+    x = x0; y = y0; w = x1 - x0; h = y1 - y0;
+    nr_damage = 0;
+  }
+  damage[nr_damage].x = x;
+  damage[nr_damage].y = y;
+  damage[nr_damage].w = w;
+  damage[nr_damage].h = h;
+  nr_damage ++;
+}
+
+// copy `pixels', `pitch' pixels a row, to (x, y) of `dst', which is
+// NULL for the MMIO frame buffer
+static void copy_rect(uint32_t *dst, const uint32_t *pixels, int pitch, int x, int y, int w, int h) {
+  if (has_blit) {
+    blit->src = (uint32_t)pixels;
+    blit->pitch = pitch;
+    blit->x = x;
+    blit->y = y;
+    blit->w = w;
+    blit->h = h;
+    blit->dst = (uint32_t)dst;
+    blit->cmd = BLIT_COPY;
+    // a page of `pixels' is not present, draw it here to fault it in
+    if (blit->cmd == BLIT_OK) return;
+  }
+
+  if (dst == NULL) dst = fb;
+  for (int i = 0; i < h; i ++)
+    rep_movsl(dst + (y + i) * SCREEN_W + x, pixels + i * pitch, w);
+}
 
 void _draw_rect(const uint32_t *pixels, int x, int y, int w, int h) {
-  int i;
-  for(i=0;i<h;i++)  // (x,y)-(x+w,y+h)Ŀռ䣬һһ
-    memcpy(fb+(y+i)*_screen.width+x,pixels+i*w,w*4);
-  
+  copy_rect(canvas, pixels, w, x, y, w, h);
+  if (canvas != NULL) {
+    add_damage(x, y, w, h);
+  }
 }
 
+/* Present the back buffer and go on drawing into the other one. That
+ * one is a frame behind, since _draw_rect only draws the parts that
+ * change, so it first gets the rects drawn into the frame presented.
+ */
 void _draw_sync() {
+  if (canvas == NULL) {
+    back = 0;
+    rep_movsl(fbs[back], fb, SCREEN_W * SCREEN_H);
+    nr_damage = 0;
+    add_damage(0, 0, SCREEN_W, SCREEN_H);
+  }
+
+  outl(PRESENT_PORT, back);
+  for (int i = 0; i < nr_damage; i ++) {
+    int x = damage[i].x, y = damage[i].y;
+    copy_rect(fbs[!back], fbs[back] + y * SCREEN_W + x, SCREEN_W, x, y, damage[i].w, damage[i].h);
+  }
+  nr_damage = 0;
+  back = !back;
+  canvas = fbs[back];
 }
 
 int _read_key() {
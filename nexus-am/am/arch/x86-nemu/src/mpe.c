@@ -0,0 +1,56 @@
+#include <am.h>
+#include <x86.h>
+
+#define SMP_PORT 0x200   // Note that this is not standard
+#define CPU_ID_OFFSET 0
+#define NR_CPU_OFFSET 4
+#define EIP_OFFSET 8
+#define ESP_OFFSET 12
+#define START_OFFSET 16
+#define STOP_OFFSET 24
+
+#define STACK_SIZE (32 * 1024)
+
+int _NR_CPU = 1;
+static void (*mp_entry)();
+static volatile int nr_ap_done = 0;
+
+static void ap_start() {
+  mp_entry();
+  asm volatile ("lock incl %0" : "+m"(nr_ap_done) : : "cc");
+  outl(SMP_PORT + STOP_OFFSET, 0);
+  while (1) asm volatile("hlt");
+}
+
+void _mpe_init(void (*entry)()) {
+  mp_entry = entry;
+  _NR_CPU = inl(SMP_PORT + NR_CPU_OFFSET);
+
+  // the stacks of the other CPUs are taken from the top of the heap
+  for (int i = 1; i < _NR_CPU; i ++) {
+    uintptr_t stack_top = (uintptr_t)_heap.end;
+    _heap.end = (void *)(stack_top - STACK_SIZE);
+    outl(SMP_PORT + EIP_OFFSET, (uintptr_t)ap_start);
+    outl(SMP_PORT + ESP_OFFSET, stack_top);
+    outl(SMP_PORT + START_OFFSET, i);
+  }
+
+  entry();
+  // the other CPUs may still be running `entry'
+  while (nr_ap_done < _NR_CPU - 1) ;
+  _halt(0);
+}
+
+int _cpu() {
+  return inl(SMP_PORT + CPU_ID_OFFSET);
+}
+
+intptr_t _atomic_xchg(volatile intptr_t *addr, intptr_t newval) {
+  intptr_t result;
+  asm volatile ("lock xchgl %0, %1" : "+m"(*addr), "=a"(result) : "1"(newval) : "cc");
+  return result;
+}
+
+void _barrier() {
+  asm volatile ("lock addl $0, (%%esp)" : : : "memory", "cc");
+}
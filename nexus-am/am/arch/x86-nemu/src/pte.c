@@ -3,7 +3,6 @@
 #define PG_ALIGN __attribute((aligned(PGSIZE)))
 
 static PDE kpdirs[NR_PDE] PG_ALIGN;
-static PTE kptabs[PMEM_SIZE / PGSIZE] PG_ALIGN;
 static void *(*palloc_f)();
 static void (*pfree_f)(void *);
 
@@ -25,25 +24,17 @@ void _pte_init(void *(*palloc)(), void (*pfree)(void *)) {
     kpdirs[i] = 0;
   }
 
-  PTE *ptab = kptabs;
+  // the kernel segments are identity mapped with 4MB pages
   for (i = 0; i < NR_KSEG_MAP; i++) {
-    uint32_t pdir_idx = (uintptr_t)segments[i].start / (PGSIZE * NR_PTE);
-    uint32_t pdir_idx_end = (uintptr_t)segments[i].end / (PGSIZE * NR_PTE);
+    uint32_t pdir_idx = (uintptr_t)segments[i].start / PGSIZE_LARGE;
+    uint32_t pdir_idx_end = (uintptr_t)segments[i].end / PGSIZE_LARGE;
     for (; pdir_idx < pdir_idx_end; pdir_idx++) {
-      // fill PDE
-      kpdirs[pdir_idx] = (uintptr_t)ptab | PTE_P;
-
-      // fill PTE
-      PTE pte = PGADDR(pdir_idx, 0, 0) | PTE_P;
-      PTE pte_end = PGADDR(pdir_idx + 1, 0, 0) | PTE_P;
-      for (; pte < pte_end; pte += PGSIZE) {
-        *ptab = pte;
-        ptab++;
-      }
+      kpdirs[pdir_idx] = PGADDR(pdir_idx, 0, 0) | PTE_PS | PTE_P;
     }
   }
 
   set_cr3(kpdirs);
+  set_cr4(get_cr4() | CR4_PSE);
   set_cr0(get_cr0() | CR0_PG);
 }
 
@@ -71,12 +62,22 @@ void _map(_Protect *p, void *va, void *pa) {
     pgtab = (PTE *)(palloc_f());
     *pde = (uintptr_t)pgtab | PTE_P;
   }
+  // `va' is in a 4MB page, whose frame is not a page table
+  if (*pde & PTE_PS) _halt(1);
 
   pgtab = (PTE *)PTE_ADDR(*pde);
   PTE *pte = pgtab + PTX(va);
   *pte = (uintptr_t)pa | PTE_P;
 }
 
+int _map_large(_Protect *p, void *va, void *pa) {
+  PDE *pde = (PDE *)p->ptr + PDX(va);
+  if (*pde & PTE_P) return 0;
+
+  *pde = (uintptr_t)pa | PTE_PS | PTE_P;
+  return 1;
+}
+
 void _unmap(_Protect *p, void *va) {}
 
 _RegSet *_umake(_Protect *p, _Area ustack, _Area kstack, void *entry,
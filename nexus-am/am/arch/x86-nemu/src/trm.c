@@ -5,6 +5,8 @@
 #define HAS_SERIAL
 
 #define SERIAL_PORT 0x3f8
+#define SERIAL_STR_PORT 0x3e0
+#define TX_FIFO_SIZE 16
 
 extern char _heap_start;
 extern char _heap_end;
@@ -15,6 +17,10 @@ _Area _heap = {
   .end = &_heap_end,
 };
 
+// the number of characters which can be written without polling LSR
+static int tx_fifo_size = 1;
+static int tx_room = 0;
+
 static void serial_init() {
 #ifdef HAS_SERIAL
   outb(SERIAL_PORT + 1, 0x00);
@@ -24,14 +30,35 @@ static void serial_init() {
   outb(SERIAL_PORT + 3, 0x03);
   outb(SERIAL_PORT + 2, 0xC7);
   outb(SERIAL_PORT + 4, 0x0B);
+  if ((inb(SERIAL_PORT + 2) & 0xc0) == 0xc0) {
+    tx_fifo_size = TX_FIFO_SIZE;
+  }
 #endif
 }
 
 void _putc(char ch) {
 #ifdef HAS_SERIAL
-  while ((inb(SERIAL_PORT + 5) & 0x20) == 0);
+  if (tx_room == 0) {
+    while ((inb(SERIAL_PORT + 5) & 0x20) == 0);
+    tx_room = tx_fifo_size;
+  }
   outb(SERIAL_PORT, ch);
+  tx_room --;
+#endif
+}
+
+void _putstr(const char *s, size_t len) {
+  size_t i = 0;
+#ifdef HAS_SERIAL
+  outl(SERIAL_STR_PORT, (uintptr_t)s);
+  outl(SERIAL_STR_PORT + 4, len);
+  i = inl(SERIAL_STR_PORT + 4);
+  // the rest is not present, or there is no such port
+  if (i > len) i = 0;
 #endif
+  for (; i < len; i ++) {
+    _putc(s[i]);
+  }
 }
 
 void _halt(int code) {
@@ -0,0 +1,84 @@
+#include "trap.h"
+
+unsigned bitmap[4] = {0x00000001, 0x80000000, 0x0000ff00, 0x0};
+
+static unsigned bsf(unsigned x, unsigned *zf) {
+	unsigned r = 0xdead;
+	unsigned char z;
+	asm ("bsfl %2, %0; setz %1" : "+r"(r), "=q"(z) : "r"(x) : "cc");
+	*zf = z;
+	return r;
+}
+
+static unsigned bsr(unsigned x, unsigned *zf) {
+	unsigned r = 0xdead;
+	unsigned char z;
+	asm ("bsrl %2, %0; setz %1" : "+r"(r), "=q"(z) : "r"(x) : "cc");
+	*zf = z;
+	return r;
+}
+
+static unsigned bswap(unsigned x) {
+	asm ("bswap %0" : "+r"(x));
+	return x;
+}
+
+/* bit test on memory with a register offset, which may go beyond the word */
+static int bt_mem(unsigned *base, int off) {
+	unsigned char c;
+	asm ("btl %2, %1; setc %0" : "=q"(c) : "m"(*base), "r"(off) : "cc", "memory");
+	return c;
+}
+
+static int bts_mem(unsigned *base, int off) {
+	unsigned char c;
+	asm volatile ("btsl %2, %1; setc %0" : "=q"(c), "+m"(*base) : "r"(off) : "cc", "memory");
+	return c;
+}
+
+static unsigned btr_reg(unsigned x, int off, int *cf) {
+	unsigned char c;
+	asm ("btrl %2, %0; setc %1" : "+r"(x), "=q"(c) : "r"(off) : "cc");
+	*cf = c;
+	return x;
+}
+
+static unsigned btc_imm(unsigned x, int *cf) {
+	unsigned char c;
+	asm ("btcl $33, %0; setc %1" : "+r"(x), "=q"(c) : : "cc");
+	*cf = c;
+	return x;
+}
+
+int main() {
+	unsigned zf;
+	int cf;
+
+	nemu_assert(bsf(0x00010000, &zf) == 16 && zf == 0);
+	nemu_assert(bsf(0x80000000, &zf) == 31 && zf == 0);
+	nemu_assert(bsf(0, &zf) == 0xdead && zf == 1);
+	nemu_assert(bsr(0x00010001, &zf) == 16 && zf == 0);
+	nemu_assert(bsr(1, &zf) == 0 && zf == 0);
+	nemu_assert(bsr(0, &zf) == 0xdead && zf == 1);
+
+	nemu_assert(bswap(0x12345678) == 0x78563412);
+
+	nemu_assert(bt_mem(bitmap, 0) == 1);
+	nemu_assert(bt_mem(bitmap, 1) == 0);
+	nemu_assert(bt_mem(bitmap, 63) == 1);
+	nemu_assert(bt_mem(bitmap, 72) == 1);
+	nemu_assert(bt_mem(bitmap + 2, -1) == 1);
+	nemu_assert(bt_mem(bitmap + 2, -33) == 0);
+	nemu_assert(bt_mem(bitmap + 2, -64) == 1);
+
+	nemu_assert(bts_mem(bitmap, 100) == 0);
+	nemu_assert(bitmap[3] == 0x10);
+	nemu_assert(bts_mem(bitmap, 100) == 1);
+
+	nemu_assert(btr_reg(0xff, 35, &cf) == 0xf7 && cf == 1);
+	nemu_assert(btr_reg(0xff, 8, &cf) == 0xff && cf == 0);
+	nemu_assert(btc_imm(0x3, &cf) == 0x1 && cf == 1);
+	nemu_assert(btc_imm(0x1, &cf) == 0x3 && cf == 0);
+
+	return 0;
+}
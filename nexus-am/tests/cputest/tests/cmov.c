@@ -0,0 +1,49 @@
+#include "trap.h"
+#define ARR_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+int test_data[] = {0, 1, 2, 0x7fffffff, 0x80000000, 0x80000001, 0xfffffffe, 0xffffffff};
+
+/* cmovl: signed max */
+static int smax(int a, int b) {
+	int r = a;
+	asm ("cmpl %2, %1; cmovl %2, %0" : "+r"(r) : "r"(a), "r"(b) : "cc");
+	return r;
+}
+
+/* cmovb: unsigned max */
+static unsigned umax(unsigned a, unsigned b) {
+	unsigned r = a;
+	asm ("cmpl %2, %1; cmovb %2, %0" : "+r"(r) : "r"(a), "r"(b) : "cc");
+	return r;
+}
+
+/* cmove with a memory source */
+static int sel_eq(int a, int b, int *p) {
+	int r = 0;
+	asm ("cmpl %2, %1; cmove %3, %0" : "+r"(r) : "r"(a), "r"(b), "m"(*p) : "cc");
+	return r;
+}
+
+/* cmovnel on a 16-bit register */
+static unsigned sel_ne16(unsigned a, unsigned b) {
+	unsigned r = 0x12340000;
+	asm ("cmpl %2, %1; cmovnew %w2, %w0" : "+r"(r) : "r"(a), "r"(b) : "cc");
+	return r;
+}
+
+int main() {
+	int i, j;
+	int v = 42;
+
+	for (i = 0; i < ARR_SIZE(test_data); i ++) {
+		for (j = 0; j < ARR_SIZE(test_data); j ++) {
+			int a = test_data[i], b = test_data[j];
+			nemu_assert(smax(a, b) == (a < b ? b : a));
+			nemu_assert(umax(a, b) == ((unsigned)a < (unsigned)b ? b : a));
+			nemu_assert(sel_eq(a, b, &v) == (a == b ? 42 : 0));
+			nemu_assert(sel_ne16(a, b) == (a != b ? 0x12340000 | (b & 0xffff) : 0x12340000));
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,82 @@
+#include "trap.h"
+
+/* return CF and OF after the operation as (CF << 1) | OF */
+#define FLAGS(name, type, insn, cons) \
+	static unsigned name(type x, type y) { \
+		unsigned char c, o; \
+		asm (insn " %3, %0; setc %1; seto %2" : "+" cons(x), "=q"(c), "=q"(o) : cons(y) : "cc"); \
+		return (c << 1) | o; \
+	}
+
+FLAGS(addb_flags, unsigned char, "addb", "q")
+FLAGS(addw_flags, unsigned short, "addw", "r")
+FLAGS(adcb_flags, unsigned char, "stc; adcb", "q")
+FLAGS(subb_flags, unsigned char, "subb", "q")
+FLAGS(sbbb_flags, unsigned char, "stc; sbbb", "q")
+FLAGS(imul_flags, int, "imull", "r")
+
+static unsigned incb_of(unsigned char x) {
+	unsigned char o;
+	asm ("incb %0; seto %1" : "+q"(x), "=q"(o) : : "cc");
+	return o;
+}
+
+static unsigned decw_of(unsigned short x) {
+	unsigned char o;
+	asm ("decw %0; seto %1" : "+r"(x), "=q"(o) : : "cc");
+	return o;
+}
+
+static unsigned negb_of(unsigned char x) {
+	unsigned char o;
+	asm ("negb %0; seto %1" : "+q"(x), "=q"(o) : : "cc");
+	return o;
+}
+
+static unsigned short imulb(signed char x, signed char y, unsigned *flags) {
+	unsigned short r;
+	unsigned char c, o;
+	asm ("imulb %4; setc %1; seto %2" : "=a"(r), "=q"(c), "=q"(o) : "a"(x), "q"(y) : "cc");
+	*flags = (c << 1) | o;
+	return r;
+}
+
+static unsigned mul_flags(unsigned x, unsigned y) {
+	unsigned char c;
+	asm ("mull %2; setc %1" : "+a"(x), "=q"(c) : "r"(y) : "edx", "cc");
+	return c;
+}
+
+int main() {
+	unsigned f;
+
+	nemu_assert(addb_flags(0xff, 1) == 0x2);
+	nemu_assert(addb_flags(0x7f, 1) == 0x1);
+	nemu_assert(addb_flags(0x80, 0x80) == 0x3);
+	nemu_assert(addb_flags(0x10, 0x20) == 0x0);
+	nemu_assert(addw_flags(0xffff, 2) == 0x2);
+	nemu_assert(adcb_flags(0xfe, 1) == 0x2);
+	nemu_assert(adcb_flags(0x7e, 1) == 0x1);
+	// with the carry in, src + CF wraps around
+	nemu_assert(adcb_flags(0x12, 0xff) == 0x2);
+	nemu_assert(subb_flags(0x00, 1) == 0x2);
+	nemu_assert(subb_flags(0x80, 1) == 0x1);
+	nemu_assert(sbbb_flags(0x12, 0xff) == 0x2);
+	nemu_assert(sbbb_flags(0x80, 0) == 0x1);
+
+	nemu_assert(incb_of(0x7f) == 1);
+	nemu_assert(incb_of(0xff) == 0);
+	nemu_assert(decw_of(0x8000) == 1);
+	nemu_assert(decw_of(0x0000) == 0);
+	nemu_assert(negb_of(0x80) == 1);
+	nemu_assert(negb_of(0x01) == 0);
+
+	nemu_assert(imul_flags(0x10000, 0x10000) == 0x3);
+	nemu_assert(imul_flags(-3, 5) == 0x0);
+	nemu_assert(imulb(-1, -1, &f) == 1 && f == 0);
+	nemu_assert(imulb(-128, 2, &f) == 0xff00 && f == 0x3);
+	nemu_assert(mul_flags(0x10000, 0x10000) == 1);
+	nemu_assert(mul_flags(0xffff, 0xffff) == 0);
+
+	return 0;
+}
@@ -0,0 +1,37 @@
+#include "trap.h"
+
+/* fnsave and frstor switch the whole x87 state, the way the kernel
+ * does on a context switch.
+ */
+
+unsigned char env[2][108];
+
+int main() {
+	double a, b;
+	unsigned short cw = 0xf7f, cw2;
+
+	/* the first context: 1.5 and 2.5 on the stack, round toward zero */
+	asm volatile ("fninit; fldcw %0; fldl %1; fldl %2" : : "m"(cw), "m"((double){1.5}), "m"((double){2.5}));
+	asm volatile ("fnsave %0" : "=m"(env[0]));
+
+	/* the second context, saved after a change of the stack top */
+	asm volatile ("fldpi; fld1; faddp");
+	asm volatile ("fnsave %0" : "=m"(env[1]));
+
+	/* fnsave leaves the unit as fninit does */
+	asm volatile ("fnstcw %0" : "=m"(cw2));
+	nemu_assert(cw2 == 0x37f);
+
+	asm volatile ("frstor %0" : : "m"(env[0]));
+	asm volatile ("fnstcw %0; fstpl %1; fstpl %2" : "=m"(cw2), "=m"(a), "=m"(b));
+	nemu_assert(cw2 == 0xf7f);
+	nemu_assert(a == 2.5);
+	nemu_assert(b == 1.5);
+
+	asm volatile ("frstor %0" : : "m"(env[1]));
+	asm volatile ("fnstcw %0; fstpl %1" : "=m"(cw2), "=m"(a));
+	nemu_assert(cw2 == 0x37f);
+	nemu_assert(a > 4.14 && a < 4.15);
+
+	return 0;
+}
@@ -0,0 +1,89 @@
+#include "trap.h"
+
+/* cmp/test followed by jcc, which NEMU may execute as one instruction.
+ * The result is (taken << 12) | the arithmetic flags after the branch,
+ * and it is checked against the same pair with a nop in between.
+ */
+#define EFLAGS_ARITH 0x8c5
+
+#define PAIR(name, insn, jcc, sep, cons) \
+	static unsigned name(unsigned x, unsigned y) { \
+		unsigned taken, flags; \
+		asm (insn ";" sep jcc " 1f; movl $0, %0; jmp 2f; 1: movl $1, %0; 2: pushfl; popl %1" \
+				: "=&r"(taken), "=&r"(flags), "+" cons(x) : cons(y) : "cc"); \
+		return (taken << 12) | (flags & EFLAGS_ARITH); \
+	}
+
+#define TEST_CC(cc) \
+	PAIR(cmpl_j##cc, "cmpl %3, %2", "j" #cc, "", "r") \
+	PAIR(cmpl_nop_j##cc, "cmpl %3, %2", "j" #cc, "nop;", "r") \
+	PAIR(cmpb_j##cc, "cmpb %b3, %b2", "j" #cc, "", "q") \
+	PAIR(cmpb_nop_j##cc, "cmpb %b3, %b2", "j" #cc, "nop;", "q") \
+	PAIR(testl_j##cc, "testl %3, %2", "j" #cc, "", "r") \
+	PAIR(testl_nop_j##cc, "testl %3, %2", "j" #cc, "nop;", "r") \
+	PAIR(cmpl_jmp32_j##cc, "cmpl %3, %2", "%{disp32%} j" #cc, "", "r") \
+	static void check_##cc(unsigned x, unsigned y) { \
+		nemu_assert(cmpl_j##cc(x, y) == cmpl_nop_j##cc(x, y)); \
+		nemu_assert(cmpl_jmp32_j##cc(x, y) == cmpl_nop_j##cc(x, y)); \
+		nemu_assert(cmpb_j##cc(x, y) == cmpb_nop_j##cc(x, y)); \
+		nemu_assert(testl_j##cc(x, y) == testl_nop_j##cc(x, y)); \
+	}
+
+TEST_CC(o)  TEST_CC(no) TEST_CC(b)  TEST_CC(nb)
+TEST_CC(e)  TEST_CC(ne) TEST_CC(be) TEST_CC(nbe)
+TEST_CC(s)  TEST_CC(ns) TEST_CC(p)  TEST_CC(np)
+TEST_CC(l)  TEST_CC(nl) TEST_CC(le) TEST_CC(nle)
+
+static unsigned test_data[] = {
+	0, 1, 2, 0x7f, 0x80, 0xff, 0x100, 0x7fffffff, 0x80000000, 0x80000001, 0xfffffffe, 0xffffffff,
+};
+
+#define NR_DATA (sizeof(test_data) / sizeof(test_data[0]))
+
+/* mov (m),r; add $imm,r with the imm8, imm32 and %eax forms. The
+ * result is checked the same way, as r ^ the flags.
+ */
+#define LOAD_ADD(name, imm, sep, cons) \
+	static unsigned name(unsigned *p) { \
+		unsigned r, flags; \
+		asm ("movl %2, %0;" sep "addl $" #imm ", %0; pushfl; popl %1" \
+				: "=&" cons(r), "=&r"(flags) : "m"(*p) : "cc"); \
+		return r ^ (flags & EFLAGS_ARITH); \
+	}
+
+LOAD_ADD(add8, 4, "", "r")        LOAD_ADD(add8_nop, 4, "nop;", "r")
+LOAD_ADD(add32, 0x40000000, "", "r") LOAD_ADD(add32_nop, 0x40000000, "nop;", "r")
+LOAD_ADD(add_eax, 0x80000001, "", "a") LOAD_ADD(add_eax_nop, 0x80000001, "nop;", "a")
+
+/* leave; ret and pop %ebp; ret */
+static int __attribute__((noinline)) frame(int x) {
+	volatile int a[4];
+	a[x & 3] = x;
+	return a[x & 3] + 1;
+}
+
+int main() {
+	int i, j;
+	for (i = 0; i < NR_DATA; i ++) {
+		for (j = 0; j < NR_DATA; j ++) {
+			unsigned x = test_data[i], y = test_data[j];
+			check_o(x, y);  check_no(x, y); check_b(x, y);  check_nb(x, y);
+			check_e(x, y);  check_ne(x, y); check_be(x, y); check_nbe(x, y);
+			check_s(x, y);  check_ns(x, y); check_p(x, y);  check_np(x, y);
+			check_l(x, y);  check_nl(x, y); check_le(x, y); check_nle(x, y);
+		}
+		nemu_assert(add8(&test_data[i]) == add8_nop(&test_data[i]));
+		nemu_assert(add32(&test_data[i]) == add32_nop(&test_data[i]));
+		nemu_assert(add_eax(&test_data[i]) == add_eax_nop(&test_data[i]));
+	}
+
+	nemu_assert(cmpl_jl(1, 2) >> 12 == 1);
+	nemu_assert(cmpl_jl(2, 1) >> 12 == 0);
+	nemu_assert(cmpb_jb(0x100, 0xff) >> 12 == 1);
+
+	for (i = 0; i < 8; i ++) {
+		nemu_assert(frame(i) == i + 1);
+	}
+
+	return 0;
+}
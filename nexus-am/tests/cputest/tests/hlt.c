@@ -0,0 +1,33 @@
+#include "trap.h"
+
+/* The timer interrupt (IRQ 0, vector 32) wakes the CPU up from hlt. */
+
+volatile int ticks = 0;
+
+void timer_entry();
+asm (".globl timer_entry; timer_entry: incl ticks; iretl");
+
+unsigned long long idt[256];
+
+struct {
+	unsigned short limit;
+	unsigned int base;
+} __attribute__((packed)) idt_desc = { sizeof(idt) - 1, (unsigned int)idt };
+
+void set_gate(int n, void (*entry)()) {
+	unsigned int off = (unsigned int)entry;
+	idt[n] = (off & 0xffff) | (0x8ull << 16) | (0x8eull << 40) | ((unsigned long long)(off >> 16) << 48);
+}
+
+int main() {
+	set_gate(32, timer_entry);
+	asm volatile ("lidt %0" : : "m"(idt_desc));
+
+	int i;
+	for (i = 1; i <= 3; i ++) {
+		asm volatile ("sti; hlt; cli");
+		nemu_assert(ticks >= i);
+	}
+
+	return 0;
+}
@@ -0,0 +1,51 @@
+#include "trap.h"
+
+unsigned word = 0x10;
+unsigned short half = 0xfff0;
+unsigned char byte = 0x7f;
+unsigned bits[2] = { 0, 0 };
+
+static unsigned lock_cmpxchg(unsigned *p, unsigned old, unsigned new, unsigned char *zf) {
+	asm volatile ("lock cmpxchgl %3, %1; setz %2" : "+a"(old), "+m"(*p), "=q"(*zf) : "r"(new) : "cc", "memory");
+	return old;
+}
+
+int main() {
+	unsigned old;
+	unsigned char cf, zf;
+
+	asm volatile ("lock addl $5, %0" : "+m"(word) : : "cc");
+	nemu_assert(word == 0x15);
+	asm volatile ("lock subl $0x15, %0; setz %1" : "+m"(word), "=q"(zf) : : "cc");
+	nemu_assert(word == 0 && zf == 1);
+	asm volatile ("lock incw %0; lock incw %0" : "+m"(half) : : "cc");
+	nemu_assert(half == 0xfff2);
+	asm volatile ("lock addw $0x10, %0; setc %1" : "+m"(half), "=q"(cf) : : "cc");
+	nemu_assert(half == 0x0002 && cf == 1);
+	asm volatile ("lock decb %0" : "+m"(byte) : : "cc");
+	nemu_assert(byte == 0x7e);
+	asm volatile ("lock notb %0" : "+m"(byte));
+	nemu_assert(byte == 0x81);
+	asm volatile ("lock negb %0" : "+m"(byte) : : "cc");
+	nemu_assert(byte == 0x7f);
+	asm volatile ("lock orl $0xf000, %0; lock andl $0xff00, %0; lock xorl $0x1, %0" : "+m"(word) : : "cc");
+	nemu_assert(word == 0xf001);
+
+	old = 3;
+	asm volatile ("lock xaddl %0, %1" : "+r"(old), "+m"(word) : : "cc");
+	nemu_assert(old == 0xf001 && word == 0xf004);
+
+	nemu_assert(lock_cmpxchg(&word, 0xf004, 7, &zf) == 0xf004 && zf == 1 && word == 7);
+	nemu_assert(lock_cmpxchg(&word, 0, 9, &zf) == 7 && zf == 0 && word == 7);
+
+	asm volatile ("lock btsl %2, %0; setc %1" : "+m"(bits), "=q"(cf) : "r"(37) : "cc");
+	nemu_assert(bits[1] == 0x20 && cf == 0);
+	asm volatile ("lock btrl %2, %0; setc %1" : "+m"(bits), "=q"(cf) : "r"(37) : "cc");
+	nemu_assert(bits[1] == 0 && cf == 1);
+
+	old = 0x55;
+	asm volatile ("xchgl %0, %1" : "+r"(old), "+m"(word));
+	nemu_assert(old == 7 && word == 0x55);
+
+	return 0;
+}
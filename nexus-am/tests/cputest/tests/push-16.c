@@ -0,0 +1,29 @@
+#include "trap.h"
+
+/* with 0x66, push, pop, pusha and popa move ESP by 2 for each word */
+
+unsigned sp0, sp1;
+unsigned short w;
+
+int main() {
+	unsigned esp0, esp1, ax = 0, cx;
+
+	asm volatile ("movl %%esp, %0; pushw $0x1234; movl %%esp, %1; popw %w2; movl %%esp, %3"
+			: "=&r"(esp0), "=&r"(esp1), "+r"(ax), "=&r"(cx));
+	nemu_assert(esp0 - esp1 == 2);
+	nemu_assert(ax == 0x1234);
+	nemu_assert(cx == esp0);
+
+	/* popaw writes back the registers, so the results go to globals */
+	asm volatile ("movl %%esp, sp0; pushaw; movl %%esp, sp1; movw 14(%%esp), %%cx; movw %%cx, w; popaw"
+			: : "a"(0xabcd5678) : "ecx", "memory");
+	nemu_assert(sp0 - sp1 == 16);
+	nemu_assert(w == 0x5678);
+
+	/* popaw leaves the high words */
+	asm volatile ("pushl %%eax; pushaw; movw $0x1111, 14(%%esp); popaw; movl %%eax, %0; popl %%eax"
+			: "=&r"(cx) : "a"(0xabcd5678));
+	nemu_assert(cx == 0xabcd1111);
+
+	return 0;
+}
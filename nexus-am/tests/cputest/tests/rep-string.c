@@ -0,0 +1,75 @@
+#include "trap.h"
+
+/* spans several pages to exercise page-crossing runs */
+unsigned char src[10000], dst[10000];
+unsigned buf[16];
+
+static void rep_movsb(void *d, const void *s, int n) {
+	asm volatile ("cld; rep movsb" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+}
+
+static void rep_stosl(void *d, unsigned val, int n) {
+	asm volatile ("cld; rep stosl" : "+D"(d), "+c"(n) : "a"(val) : "memory");
+}
+
+static void rep_stosw(void *d, unsigned val, int n) {
+	asm volatile ("cld; rep stosw" : "+D"(d), "+c"(n) : "a"(val) : "memory");
+}
+
+/* return the number of remaining elements */
+static int repe_cmpsb(const void *a, const void *b, int n) {
+	asm volatile ("cld; repe cmpsb" : "+S"(a), "+D"(b), "+c"(n) : : "memory", "cc");
+	return n;
+}
+
+static int repne_scasb(const void *s, int c, int n) {
+	asm volatile ("cld; repne scasb" : "+D"(s), "+c"(n) : "a"(c) : "memory", "cc");
+	return n;
+}
+
+int main() {
+	int i;
+
+	for (i = 0; i < sizeof(src); i ++) {
+		src[i] = i * 7;
+	}
+
+	rep_movsb(dst + 1, src + 3, 9000);
+	for (i = 0; i < 9000; i ++) {
+		nemu_assert(dst[i + 1] == src[i + 3]);
+	}
+
+	/* overlapping forward copy repeats the first byte */
+	rep_movsb(dst + 1, dst, 100);
+	for (i = 0; i < 101; i ++) {
+		nemu_assert(dst[i] == dst[0]);
+	}
+
+	/* backward copy with DF set */
+	unsigned char *s = src + 99, *d = dst + 99;
+	int n = 100;
+	asm volatile ("std; rep movsb; cld" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+	for (i = 0; i < 100; i ++) {
+		nemu_assert(dst[i] == src[i]);
+	}
+	nemu_assert(d + 1 == dst && s + 1 == src && n == 0);
+
+	rep_stosl(buf, 0x12345678, 16);
+	for (i = 0; i < 16; i ++) {
+		nemu_assert(buf[i] == 0x12345678);
+	}
+	rep_stosw(buf, 0xabcd, 3);
+	nemu_assert(buf[0] == 0xabcdabcd && buf[1] == 0x1234abcd && buf[2] == 0x12345678);
+
+	rep_movsb(dst, src, 5000);
+	nemu_assert(repe_cmpsb(dst, src, 5000) == 0);
+	dst[4097] ^= 1;
+	nemu_assert(repe_cmpsb(dst, src, 5000) == 5000 - 4098);
+
+	dst[4500] = 0x5a;
+	dst[4096] = 0x5a;
+	nemu_assert(repne_scasb(dst + 4000, 0x5a, 1000) == 1000 - 97);
+	nemu_assert(repne_scasb(dst, 0x100 + 0x5b, 0) == 0);
+
+	return 0;
+}
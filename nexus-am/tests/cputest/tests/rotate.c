@@ -0,0 +1,85 @@
+#include "trap.h"
+
+/* return the result, and the CF and OF after the operation in `flags' */
+#define ROT(name, insn) \
+	static unsigned name(unsigned x, unsigned char n, unsigned cf_in, unsigned *flags) { \
+		unsigned char c, o; \
+		asm ("bt $0, %4; " insn " %%cl, %0; setc %1; seto %2" \
+				: "+r"(x), "=q"(c), "=q"(o) : "c"(n), "r"(cf_in) : "cc"); \
+		*flags = (c << 1) | o; \
+		return x; \
+	}
+
+ROT(rol32, "roll")
+ROT(ror32, "rorl")
+ROT(rcl32, "rcll")
+ROT(rcr32, "rcrl")
+ROT(shl32, "shll")
+ROT(shr32, "shrl")
+ROT(sar32, "sarl")
+
+static unsigned char rol8(unsigned char x, unsigned char n) {
+	asm ("rolb %%cl, %0" : "+q"(x) : "c"(n) : "cc");
+	return x;
+}
+
+static unsigned short rcr16(unsigned short x, unsigned char n) {
+	asm ("stc; rcrw %%cl, %0" : "+r"(x) : "c"(n) : "cc");
+	return x;
+}
+
+static unsigned shld(unsigned x, unsigned y, unsigned char n, unsigned *cf) {
+	unsigned char c;
+	asm ("shldl %%cl, %2, %0; setc %1" : "+r"(x), "=q"(c) : "r"(y), "c"(n) : "cc");
+	*cf = c;
+	return x;
+}
+
+static unsigned shrd_imm(unsigned x, unsigned y, unsigned *cf) {
+	unsigned char c;
+	asm ("shrdl $12, %2, %0; setc %1" : "+r"(x), "=q"(c) : "r"(y) : "cc");
+	*cf = c;
+	return x;
+}
+
+static unsigned short shld16(unsigned short x, unsigned short y) {
+	asm ("shldw $4, %1, %0" : "+r"(x) : "r"(y) : "cc");
+	return x;
+}
+
+int main() {
+	unsigned f;
+
+	nemu_assert(rol32(0x80000001, 1, 0, &f) == 0x00000003 && f == 0x3);
+	nemu_assert(rol32(0x12345678, 8, 0, &f) == 0x34567812 && (f >> 1) == 0);
+	nemu_assert(ror32(0x00000001, 1, 0, &f) == 0x80000000 && f == 0x3);
+	nemu_assert(ror32(0x12345678, 36, 0, &f) == 0x81234567 && (f >> 1) == 1);
+	nemu_assert(rcl32(0x80000000, 1, 0, &f) == 0x00000000 && f == 0x3);
+	nemu_assert(rcl32(0x40000000, 1, 1, &f) == 0x80000001 && f == 0x1);
+	nemu_assert(rcr32(0x00000001, 1, 1, &f) == 0x80000000 && f == 0x3);
+	nemu_assert(rcr32(0x12345678, 4, 0, &f) == 0x01234567 && (f >> 1) == 1);
+
+	/* a zero count keeps the flags */
+	nemu_assert(rol32(0x12345678, 32, 1, &f) == 0x12345678 && (f >> 1) == 1);
+
+	nemu_assert(shl32(0x80000001, 1, 0, &f) == 0x00000002 && f == 0x3);
+	nemu_assert(shl32(0x40000000, 1, 0, &f) == 0x80000000 && f == 0x1);
+	nemu_assert(shl32(0x00000003, 31, 0, &f) == 0x80000000 && (f >> 1) == 1);
+	nemu_assert(shr32(0x80000003, 1, 0, &f) == 0x40000001 && f == 0x3);
+	nemu_assert(shr32(0x00000004, 3, 1, &f) == 0x00000000 && (f >> 1) == 1);
+	nemu_assert(sar32(0x80000001, 1, 0, &f) == 0xc0000000 && f == 0x2);
+	nemu_assert(sar32(0xfffffff0, 4, 1, &f) == 0xffffffff && (f >> 1) == 0);
+
+	nemu_assert(rol8(0x81, 1) == 0x03);
+	nemu_assert(rol8(0x81, 9) == 0x03);
+	nemu_assert(rcr16(0x0001, 1) == 0x8000);
+	nemu_assert(rcr16(0x0000, 17) == 0x0000);
+
+	nemu_assert(shld(0x12345678, 0x9abcdef0, 8, &f) == 0x3456789a && f == 0);
+	nemu_assert(shld(0x92345678, 0x9abcdef0, 1, &f) == 0x2468acf1 && f == 1);
+	nemu_assert(shrd_imm(0x12345678, 0x9abcdef0, &f) == 0xef012345 && f == 0);
+	nemu_assert(shrd_imm(0x00000800, 0x00000000, &f) == 0x00000000 && f == 1);
+	nemu_assert(shld16(0x1234, 0xabcd) == 0x234a);
+
+	return 0;
+}
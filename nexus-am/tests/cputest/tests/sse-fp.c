@@ -0,0 +1,220 @@
+#include "trap.h"
+
+#define SSE_FP __attribute__((target("sse2,fpmath=sse"), noinline))
+#define SSE_VEC __attribute__((target("sse2,fpmath=sse"), optimize("tree-vectorize"), noinline))
+
+typedef float v4f32 __attribute__((vector_size(16)));
+typedef double v2f64 __attribute__((vector_size(16)));
+
+typedef union {
+	v4f32 v;
+	v2f64 vd;
+	float f[4];
+	double d[2];
+	unsigned int l[4];
+	unsigned long long q[2];
+} xmm_t;
+
+#define MXCSR_IE 0x01
+#define MXCSR_ZE 0x04
+#define MXCSR_RC_DOWN 0x2000
+#define MXCSR_RC_UP 0x4000
+
+float fx[19], fy[19], fd[19];
+double dx[7], dy[7], dd[7];
+unsigned char fxarea[512] __attribute__((aligned(16)));
+
+/* code the compiler generates with -msse2 -mfpmath=sse */
+
+SSE_VEC void saxpy(float *d, const float *x, const float *y, float k, int n) {
+	int i;
+	for (i = 0; i < n; i ++) d[i] = k * x[i] + y[i];
+}
+
+SSE_VEC void dmax(double *d, const double *x, const double *y, int n) {
+	int i;
+	for (i = 0; i < n; i ++) d[i] = x[i] > y[i] ? x[i] : y[i];
+}
+
+SSE_FP double poly(double x) { return (x * 3.0 - 1.5) / (x + 0.25); }
+SSE_FP int to_int(double x) { return (int)x; }
+SSE_FP double from_int(int x) { return x; }
+SSE_FP float narrow(double x) { return x; }
+SSE_FP int less(double x, double y) { return x < y; }
+
+/* single instructions */
+
+SSE_FP unsigned stmxcsr(void) {
+	unsigned csr;
+	asm volatile ("stmxcsr %0" : "=m"(csr));
+	return csr;
+}
+
+SSE_FP void ldmxcsr(unsigned csr) {
+	asm volatile ("ldmxcsr %0" : : "m"(csr));
+}
+
+SSE_FP xmm_t sqrtps(xmm_t a) {
+	asm ("sqrtps %0, %0" : "+x"(a.v));
+	return a;
+}
+
+SSE_FP xmm_t cmpltps(xmm_t a, xmm_t b) {
+	asm ("cmpltps %1, %0" : "+x"(a.v) : "x"(b.v));
+	return a;
+}
+
+SSE_FP int cvtsd2si(double x) {
+	int r;
+	asm volatile ("cvtsd2si %1, %0" : "=r"(r) : "m"(x));
+	return r;
+}
+
+SSE_FP int cvttss2si(float x) {
+	int r;
+	asm volatile ("cvttss2si %1, %0" : "=r"(r) : "m"(x));
+	return r;
+}
+
+SSE_FP float divss(float x, float y) {
+	asm volatile ("divss %1, %0" : "+x"(x) : "x"(y));
+	return x;
+}
+
+/* ZF, PF and CF of ucomiss in the low three bits */
+SSE_FP int ucomiss(float x, float y) {
+	unsigned char z, p, c;
+	asm volatile ("ucomiss %3, %4; setz %0; setp %1; setc %2"
+			: "=q"(z), "=q"(p), "=q"(c) : "x"(y), "x"(x));
+	return z << 2 | p << 1 | c;
+}
+
+SSE_FP xmm_t movss_reg(xmm_t a, xmm_t b) {
+	asm ("movss %1, %0" : "+x"(a.v) : "x"(b.v));
+	return a;
+}
+
+SSE_FP xmm_t movss_load(xmm_t a, const float *p) {
+	asm ("movss %1, %0" : "+x"(a.v) : "m"(*p));
+	return a;
+}
+
+SSE_FP int movmskpd(xmm_t a) {
+	int r;
+	asm ("movmskpd %1, %0" : "=r"(r) : "x"(a.vd));
+	return r;
+}
+
+SSE_FP xmm_t cvt_round_trip(xmm_t a) {
+	asm ("cvttpd2dq %0, %0; cvtdq2pd %0, %0" : "+x"(a.vd));
+	return a;
+}
+
+/* fxsave, clobber the state, and fxrstor */
+SSE_FP void fxsave_round_trip(void) {
+	xmm_t a = { .l = { 1, 2, 3, 4 } }, b;
+	double x;
+	asm volatile ("fld1; movaps %0, %%xmm3" : : "m"(a.v) : "xmm3");
+	ldmxcsr(0x1f80 | MXCSR_RC_DOWN);
+	asm volatile ("fxsave %0" : "=m"(fxarea));
+	nemu_assert(*(unsigned *)(fxarea + 24) == (0x1f80 | MXCSR_RC_DOWN));
+	nemu_assert(*(unsigned *)(fxarea + 160 + 3 * 16 + 8) == 3);
+	// one register in use
+	nemu_assert(fxarea[4] != 0 && (fxarea[4] & (fxarea[4] - 1)) == 0);
+
+	asm volatile ("fninit; xorps %%xmm3, %%xmm3" : : : "xmm3");
+	ldmxcsr(0x1f80);
+	asm volatile ("fxrstor %0" : : "m"(fxarea));
+	asm volatile ("movaps %%xmm3, %0; fstpl %1" : "=m"(b.v), "=m"(x));
+	nemu_assert(b.q[0] == a.q[0] && b.q[1] == a.q[1]);
+	nemu_assert(x == 1.0);
+	nemu_assert(stmxcsr() == (0x1f80 | MXCSR_RC_DOWN));
+	ldmxcsr(0x1f80);
+}
+
+static void cpuid(unsigned leaf, unsigned *a, unsigned *b, unsigned *c, unsigned *d) {
+	asm volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf));
+}
+
+static void test_loops() {
+	int i;
+	for (i = 0; i < 19; i ++) {
+		fx[i] = i * 0.5f;
+		fy[i] = 100 - i;
+	}
+	saxpy(fd, fx, fy, 4.0f, 19);
+	for (i = 0; i < 19; i ++) nemu_assert(fd[i] == 100 + i);
+
+	for (i = 0; i < 7; i ++) {
+		dx[i] = i * 1.25;
+		dy[i] = 4.0 - i;
+	}
+	dmax(dd, dx, dy, 7);
+	for (i = 0; i < 7; i ++) nemu_assert(dd[i] == (dx[i] > dy[i] ? dx[i] : dy[i]));
+}
+
+static void test_instrs() {
+	xmm_t a = { .f = { 4, 9, 0.25f, 1e6f } }, b = { .f = { 5, 9, 0, 1e7f } }, r;
+
+	nemu_assert(poly(0.25) == -1.5);
+	nemu_assert(to_int(-2.75) == -2);
+	nemu_assert(from_int(-7) == -7.0);
+	nemu_assert(narrow(0.1) == 0.1f);
+	nemu_assert(less(1.0, 2.0) && !less(2.0, 1.0));
+
+	r = sqrtps(a);
+	nemu_assert(r.f[0] == 2 && r.f[1] == 3 && r.f[2] == 0.5f && r.f[3] == 1000);
+
+	r = cmpltps(a, b);
+	nemu_assert(r.l[0] == ~0u && r.l[1] == 0 && r.l[2] == 0 && r.l[3] == ~0u);
+
+	// the rounding control applies
+	nemu_assert(cvtsd2si(2.5) == 2);
+	ldmxcsr(0x1f80 | MXCSR_RC_UP);
+	nemu_assert(cvtsd2si(2.5) == 3);
+	ldmxcsr(0x1f80 | MXCSR_RC_DOWN);
+	nemu_assert(cvtsd2si(-2.5) == -3);
+	ldmxcsr(0x1f80);
+
+	// masked exceptions give the default result and set a flag
+	nemu_assert(cvttss2si(3e9f) == (int)0x80000000);
+	nemu_assert(stmxcsr() & MXCSR_IE);
+	ldmxcsr(0x1f80);
+	nemu_assert(divss(1, 0) == __builtin_inff());
+	nemu_assert((stmxcsr() & 0x3f) == MXCSR_ZE);
+	ldmxcsr(0x1f80);
+
+	nemu_assert(ucomiss(1, 2) == 1);
+	nemu_assert(ucomiss(2, 1) == 0);
+	nemu_assert(ucomiss(2, 2) == 4);
+	nemu_assert(ucomiss(__builtin_nanf(""), 2) == 7);
+	nemu_assert(!(stmxcsr() & MXCSR_IE));
+
+	r = movss_reg(a, b);
+	nemu_assert(r.f[0] == 5 && r.f[1] == 9 && r.f[2] == 0.25f && r.f[3] == 1e6f);
+	r = movss_load(a, &b.f[3]);
+	nemu_assert(r.f[0] == 1e7f && r.l[1] == 0 && r.l[2] == 0 && r.l[3] == 0);
+
+	r.d[0] = -1.0;
+	r.d[1] = 2.0;
+	nemu_assert(movmskpd(r) == 1);
+
+	r.d[0] = -3.75;
+	r.d[1] = 8.5;
+	r = cvt_round_trip(r);
+	nemu_assert(r.d[0] == -3.0 && r.d[1] == 8.0);
+
+	fxsave_round_trip();
+}
+
+int main() {
+	unsigned a, b, c, d;
+	cpuid(1, &a, &b, &c, &d);
+	// FXSR, SSE and SSE2
+	nemu_assert((d & (7 << 24)) == (7 << 24));
+
+	test_loops();
+	test_instrs();
+
+	return 0;
+}
@@ -0,0 +1,261 @@
+#include "trap.h"
+
+#define SSE2 __attribute__((target("sse2"), noinline))
+#define SSE2_VEC __attribute__((target("sse2"), optimize("tree-vectorize"), noinline))
+
+typedef unsigned char v16u8 __attribute__((vector_size(16)));
+typedef unsigned short v8u16 __attribute__((vector_size(16)));
+typedef unsigned int v4u32 __attribute__((vector_size(16)));
+
+typedef union {
+	v16u8 v;
+	unsigned char b[16];
+	unsigned short w[8];
+	unsigned int l[4];
+	unsigned long long q[2];
+} xmm_t;
+
+unsigned char src1[67], src2[67], dst[67];
+unsigned char pal_idx[64];
+unsigned short palette[256], pixels[64];
+
+/* loops the compiler vectorizes with -msse2 -O3 */
+
+SSE2_VEC void add_bytes(unsigned char *d, const unsigned char *x, const unsigned char *y, int n) {
+	int i;
+	for (i = 0; i < n; i ++) d[i] = x[i] + y[i];
+}
+
+SSE2_VEC void blend_bytes(unsigned char *d, const unsigned char *x, const unsigned char *y, int n) {
+	int i;
+	for (i = 0; i < n; i ++) d[i] = (x[i] == 0x5a ? y[i] : (x[i] & y[i]) ^ 0x33);
+}
+
+SSE2_VEC unsigned sum_words(const unsigned short *x, int n) {
+	unsigned s = 0;
+	int i;
+	for (i = 0; i < n; i ++) s += x[i];
+	return s;
+}
+
+SSE2_VEC void widen(unsigned short *d, const unsigned char *x, int n) {
+	int i;
+	for (i = 0; i < n; i ++) d[i] = x[i] << 4;
+}
+
+/* single instructions */
+
+SSE2 xmm_t pshufd_1b(xmm_t a) {
+	xmm_t r;
+	asm ("pshufd $0x1b, %1, %0" : "=x"(r.v) : "x"(a.v));
+	return r;
+}
+
+SSE2 xmm_t pshuflw_hw(xmm_t a) {
+	asm ("pshuflw $0x1b, %0, %0; pshufhw $0xe4, %0, %0" : "+x"(a.v));
+	return a;
+}
+
+SSE2 xmm_t punpcklbw(xmm_t a, xmm_t b) {
+	asm ("punpcklbw %1, %0" : "+x"(a.v) : "x"(b.v));
+	return a;
+}
+
+SSE2 xmm_t punpckhwd(xmm_t a, xmm_t b) {
+	asm ("punpckhwd %1, %0" : "+x"(a.v) : "x"(b.v));
+	return a;
+}
+
+SSE2 xmm_t packuswb(xmm_t a, xmm_t b) {
+	asm ("packuswb %1, %0" : "+x"(a.v) : "x"(b.v));
+	return a;
+}
+
+SSE2 xmm_t packsswb(xmm_t a, xmm_t b) {
+	asm ("packsswb %1, %0" : "+x"(a.v) : "x"(b.v));
+	return a;
+}
+
+SSE2 unsigned pmovmskb(xmm_t a) {
+	unsigned r;
+	asm ("pmovmskb %1, %0" : "=r"(r) : "x"(a.v));
+	return r;
+}
+
+SSE2 xmm_t shifts(xmm_t a) {
+	asm ("psllw $3, %0; psrad $1, %0; psrlq $4, %0" : "+x"(a.v));
+	return a;
+}
+
+SSE2 xmm_t byte_shifts(xmm_t a) {
+	asm ("psrldq $3, %0; pslldq $1, %0" : "+x"(a.v));
+	return a;
+}
+
+SSE2 xmm_t pmul(xmm_t a, xmm_t b, xmm_t *hi) {
+	xmm_t lo = a;
+	asm ("pmullw %2, %0; pmulhuw %2, %1" : "+x"(lo.v), "+x"(a.v) : "x"(b.v));
+	*hi = a;
+	return lo;
+}
+
+SSE2 xmm_t sat(xmm_t a, xmm_t b) {
+	asm ("paddusb %1, %0; psubsb %1, %0" : "+x"(a.v) : "x"(b.v));
+	return a;
+}
+
+SSE2 unsigned movd(unsigned x) {
+	unsigned r;
+	asm ("movd %1, %%xmm7; paddd %%xmm7, %%xmm7; movd %%xmm7, %0" : "=r"(r) : "r"(x) : "xmm7");
+	return r;
+}
+
+SSE2 unsigned long long movq_mem(const unsigned long long *p) {
+	unsigned long long r;
+	asm ("movq %1, %%xmm6; psllq $1, %%xmm6; movq %%xmm6, %0" : "=m"(r) : "m"(*p) : "xmm6");
+	return r;
+}
+
+SSE2 unsigned pextr_pinsr(xmm_t a, unsigned x) {
+	unsigned r;
+	asm ("pinsrw $5, %2, %1; pextrw $5, %1, %0" : "=r"(r), "+x"(a.v) : "r"(x));
+	return r;
+}
+
+SSE2 xmm_t movlhps(xmm_t a, xmm_t b) {
+	asm ("movlhps %1, %0" : "+x"(a.v) : "x"(b.v));
+	return a;
+}
+
+SSE2 xmm_t movhps_load(xmm_t a, const unsigned long long *p) {
+	asm ("movhps %1, %0" : "+x"(a.v) : "m"(*p));
+	return a;
+}
+
+SSE2 void copy_unaligned(unsigned char *d, const unsigned char *s) {
+	asm ("movdqu (%1), %%xmm5; movups %%xmm5, (%0)" : : "r"(d), "r"(s) : "xmm5", "memory");
+}
+
+static void cpuid(unsigned leaf, unsigned *a, unsigned *b, unsigned *c, unsigned *d) {
+	asm volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf));
+}
+
+static void test_loops() {
+	int i, n;
+	for (i = 0; i < 67; i ++) {
+		src1[i] = i * 7 + 3;
+		src2[i] = (i % 5 == 0 ? 0x5a : i * 13);
+	}
+
+	for (n = 0; n <= 67; n += 67 - n > 16 ? 17 : 1) {
+		add_bytes(dst, src1, src2, n);
+		for (i = 0; i < n; i ++) nemu_assert(dst[i] == (unsigned char)(src1[i] + src2[i]));
+	}
+
+	blend_bytes(dst, src2, src1, 67);
+	for (i = 0; i < 67; i ++) {
+		nemu_assert(dst[i] == (src2[i] == 0x5a ? src1[i] : (src2[i] & src1[i]) ^ 0x33));
+	}
+
+	for (i = 0; i < 256; i ++) palette[i] = i * 257;
+	unsigned s = 0;
+	for (i = 0; i < 64; i ++) {
+		pal_idx[i] = i * 3;
+		pixels[i] = palette[pal_idx[i]];
+		s += pixels[i];
+	}
+	nemu_assert(sum_words(pixels, 64) == s);
+
+	widen(pixels, pal_idx, 64);
+	for (i = 0; i < 64; i ++) nemu_assert(pixels[i] == pal_idx[i] << 4);
+}
+
+static void test_instrs() {
+	xmm_t a, b, r, hi;
+	int i;
+	for (i = 0; i < 16; i ++) {
+		a.b[i] = i * 17 + 1;
+		b.b[i] = 0xf0 - i * 9;
+	}
+
+	r = pshufd_1b(a);
+	for (i = 0; i < 4; i ++) nemu_assert(r.l[i] == a.l[3 - i]);
+
+	r = pshuflw_hw(a);
+	for (i = 0; i < 4; i ++) nemu_assert(r.w[i] == a.w[3 - i] && r.w[i + 4] == a.w[i + 4]);
+
+	r = punpcklbw(a, b);
+	for (i = 0; i < 8; i ++) nemu_assert(r.b[2 * i] == a.b[i] && r.b[2 * i + 1] == b.b[i]);
+
+	r = punpckhwd(a, b);
+	for (i = 0; i < 4; i ++) nemu_assert(r.w[2 * i] == a.w[i + 4] && r.w[2 * i + 1] == b.w[i + 4]);
+
+	r = packuswb(a, b);
+	for (i = 0; i < 8; i ++) {
+		short x = a.w[i], y = b.w[i];
+		nemu_assert(r.b[i] == (x < 0 ? 0 : x > 255 ? 255 : x));
+		nemu_assert(r.b[i + 8] == (y < 0 ? 0 : y > 255 ? 255 : y));
+	}
+
+	r = packsswb(a, b);
+	for (i = 0; i < 8; i ++) {
+		short x = a.w[i];
+		nemu_assert((signed char)r.b[i] == (x < -128 ? -128 : x > 127 ? 127 : x));
+	}
+
+	unsigned mask = 0;
+	for (i = 0; i < 16; i ++) mask |= (b.b[i] >> 7) << i;
+	nemu_assert(pmovmskb(b) == mask);
+
+	r = shifts(a);
+	for (i = 0; i < 2; i ++) {
+		xmm_t t = a;
+		int j;
+		for (j = 0; j < 8; j ++) t.w[j] <<= 3;
+		for (j = 0; j < 4; j ++) t.l[j] = (int)t.l[j] >> 1;
+		nemu_assert(r.q[i] == t.q[i] >> 4);
+	}
+
+	r = byte_shifts(a);
+	nemu_assert(r.b[0] == 0);
+	for (i = 1; i < 13; i ++) nemu_assert(r.b[i] == a.b[i + 2]);
+	for (i = 13; i < 16; i ++) nemu_assert(r.b[i] == 0);
+
+	r = pmul(a, b, &hi);
+	for (i = 0; i < 8; i ++) {
+		unsigned p = (unsigned)a.w[i] * b.w[i];
+		nemu_assert(r.w[i] == (p & 0xffff) && hi.w[i] == p >> 16);
+	}
+
+	r = sat(a, b);
+	for (i = 0; i < 16; i ++) {
+		int x = a.b[i] + b.b[i];
+		x = x > 255 ? 255 : x;
+		x = (signed char)x - (signed char)b.b[i];
+		nemu_assert((signed char)r.b[i] == (x < -128 ? -128 : x > 127 ? 127 : x));
+	}
+
+	nemu_assert(movd(0x40000001) == 0x80000002);
+	unsigned long long q = 0x4000000180000003ull;
+	nemu_assert(movq_mem(&q) == 0x8000000300000006ull);
+	nemu_assert(pextr_pinsr(a, 0x12345678) == 0x5678);
+
+	r = movlhps(a, b);
+	nemu_assert(r.q[0] == a.q[0] && r.q[1] == b.q[0]);
+	r = movhps_load(a, &q);
+	nemu_assert(r.q[0] == a.q[0] && r.q[1] == q);
+
+	copy_unaligned(dst + 1, src1 + 3);
+	for (i = 0; i < 16; i ++) nemu_assert(dst[i + 1] == src1[i + 3]);
+}
+
+int main() {
+	unsigned a, b, c, d;
+	cpuid(1, &a, &b, &c, &d);
+	nemu_assert(d & (1 << 26));
+
+	test_loops();
+	test_instrs();
+
+	return 0;
+}
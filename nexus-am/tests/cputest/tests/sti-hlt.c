@@ -0,0 +1,46 @@
+#include "trap.h"
+
+/* An interrupt pending before "sti; hlt" is taken after the hlt, not
+ * before it, so that the hlt does not wait for another one.
+ */
+
+#define RTC_PORT 0x48
+
+volatile int ticks = 0;
+
+void timer_entry();
+asm (".globl timer_entry; timer_entry: incl ticks; iretl");
+
+unsigned long long idt[256];
+
+struct {
+	unsigned short limit;
+	unsigned int base;
+} __attribute__((packed)) idt_desc = { sizeof(idt) - 1, (unsigned int)idt };
+
+void set_gate(int n, void (*entry)()) {
+	unsigned int off = (unsigned int)entry;
+	idt[n] = (off & 0xffff) | (0x8ull << 16) | (0x8eull << 40) | ((unsigned long long)(off >> 16) << 48);
+}
+
+static inline unsigned inl(int port) {
+	unsigned data;
+	asm volatile ("inl %1, %0" : "=a"(data) : "d"((unsigned short)port));
+	return data;
+}
+
+int main() {
+	set_gate(32, timer_entry);
+	asm volatile ("lidt %0" : : "m"(idt_desc));
+
+	int i;
+	for (i = 1; i <= 3; i ++) {
+		// wait with IF clear for longer than a tick, so that IRQ 0 is pending
+		unsigned start = inl(RTC_PORT);
+		while (inl(RTC_PORT) - start < 30) ;
+		asm volatile ("sti; hlt; cli");
+		nemu_assert(ticks == i);
+	}
+
+	return 0;
+}
@@ -0,0 +1,62 @@
+#include "trap.h"
+
+int lock = 0;
+unsigned counter = 10;
+
+static unsigned cmpxchg(int *p, int old, int new, unsigned *zf) {
+	unsigned char z;
+	asm volatile ("cmpxchgl %3, %1; setz %2" : "+a"(old), "+m"(*p), "=q"(z) : "r"(new) : "cc", "memory");
+	*zf = z;
+	return old;
+}
+
+static unsigned xadd(unsigned *p, unsigned v) {
+	asm volatile ("xaddl %0, %1" : "+r"(v), "+m"(*p) : : "cc", "memory");
+	return v;
+}
+
+static int loop_count(int n) {
+	int k = 0;
+	asm ("1: incl %0; loop 1b" : "+r"(k), "+c"(n) : : "cc");
+	return k;
+}
+
+static int jecxz_taken(int n) {
+	int r = 1;
+	asm ("jecxz 1f; movl $0, %0; 1:" : "+r"(r) : "c"(n));
+	return r;
+}
+
+/* count the leading equal bytes with loope */
+static int loope_count(const char *s, const char *t, int n) {
+	int i = 0;
+	asm ("1: movb (%2,%0), %%al; incl %0; cmpb -1(%3,%0), %%al; loope 1b"
+			: "+r"(i), "+c"(n) : "r"(s), "r"(t) : "eax", "cc", "memory");
+	return i;
+}
+
+int main() {
+	unsigned a = 1, b = 2, zf;
+	unsigned char c = 3, d = 4;
+
+	asm ("xchgl %0, %1" : "+r"(a), "+r"(b));
+	nemu_assert(a == 2 && b == 1);
+	asm ("xchgb %0, %1" : "+q"(c), "+m"(d));
+	nemu_assert(c == 4 && d == 3);
+	asm ("xchgl %%eax, %%edx" : "+a"(a), "+d"(b));
+	nemu_assert(a == 1 && b == 2);
+
+	nemu_assert(cmpxchg(&lock, 0, 5, &zf) == 0 && zf == 1 && lock == 5);
+	nemu_assert(cmpxchg(&lock, 0, 7, &zf) == 5 && zf == 0 && lock == 5);
+
+	nemu_assert(xadd(&counter, 3) == 10 && counter == 13);
+	nemu_assert(xadd(&counter, -13) == 13 && counter == 0);
+
+	nemu_assert(loop_count(5) == 5);
+	nemu_assert(jecxz_taken(0) == 1);
+	nemu_assert(jecxz_taken(3) == 0);
+	nemu_assert(loope_count("abcdef", "abcxef", 6) == 4);
+	nemu_assert(loope_count("abc", "abc", 3) == 3);
+
+	return 0;
+}
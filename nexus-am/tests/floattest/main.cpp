@@ -2,6 +2,8 @@
 #include <klib.h>
 #include <fix16.h>
 
+extern "C" void test_x87(void);
+
 uint32_t colors[] = {
   0xff0000,
   0xeeb422,
@@ -41,6 +43,8 @@ void plot(Float(*f)(Float)) {
 
 int main() {
   _ioe_init();
+  test_x87();
+
   // plot functions: x in [0, 1], y in [-1, 1]
 
   // y = 2(x-1/2)
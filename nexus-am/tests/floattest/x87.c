@@ -0,0 +1,235 @@
+#include <am.h>
+#include <klib.h>
+
+/* Check the x87 instructions emitted by the compiler for float, double
+ * and long double, and the control and status words.
+ */
+
+#define check(cond) \
+  do { \
+    if (!(cond)) { \
+      printf("x87: check failed at line %d\n", __LINE__); \
+      _halt(1); \
+    } \
+  } while (0)
+
+#define SW_IE 0x0001
+#define SW_ZE 0x0004
+#define SW_C0 0x0100
+#define SW_C2 0x0400
+#define SW_C3 0x4000
+
+/* volatile, so that the compiler can not fold the computations */
+static volatile double d_one = 1.0, d_two = 2.0, d_three = 3.0, d_zero = 0.0;
+static volatile float f_third = 1.0f / 3.0f;
+static volatile int i_vals[] = { 0, 1, -1, 7, -7, 2147483647, -2147483647 - 1 };
+
+static uint16_t fnstsw(void) {
+  uint16_t sw;
+  asm volatile ("fnstsw %0" : "=a"(sw));
+  return sw;
+}
+
+static uint16_t fnstcw(void) {
+  uint16_t cw;
+  asm volatile ("fnstcw %0" : "=m"(cw));
+  return cw;
+}
+
+static void fldcw(uint16_t cw) {
+  asm volatile ("fldcw %0" : : "m"(cw));
+}
+
+static void fnclex(void) {
+  asm volatile ("fnclex");
+}
+
+/* fistp with the current rounding control */
+static int fistp(double x) {
+  int i;
+  asm volatile ("fistpl %0" : "=m"(i) : "t"(x) : "st");
+  return i;
+}
+
+static long double fsqrt(long double x) {
+  asm ("fsqrt" : "+t"(x));
+  return x;
+}
+
+static long double fsin(long double x) {
+  asm ("fsin" : "+t"(x));
+  return x;
+}
+
+static long double fprem(long double x, long double y) {
+  asm ("1: fprem; fnstsw %%ax; sahf; jp 1b" : "+t"(x) : "u"(y) : "eax", "cc");
+  return x;
+}
+
+static long double fabsl_(long double x) {
+  return x < 0 ? -x : x;
+}
+
+static void test_arith(void) {
+  double a = d_one, b = d_two, c = d_three;
+
+  check(a + b == 3.0);
+  check(c - b - a == 0.0);
+  check(b - c == -1.0);
+  check(b * c == 6.0);
+  check(c / b == 1.5);
+  check(a / c * c == 1.0);
+  check(-c == -3.0);
+  check((a - c) * (b - c) == 2.0);
+
+  float f = f_third;
+  volatile float g = f * 3.0f;
+  check(g == 1.0f);
+  check((double)f != 1.0 / 3.0);
+
+  /* extended precision is kept in long double */
+  long double e = (long double)a + 0x1p-60L;
+  check(e != 1.0L);
+  check((double)e == 1.0);
+  check(e - 1.0L == 0x1p-60L);
+}
+
+static void test_convert(void) {
+  int i;
+  for (i = 0; i < sizeof(i_vals) / sizeof(i_vals[0]); i ++) {
+    double x = i_vals[i];
+    check((int)x == i_vals[i]);
+    check((long long)(x * 4.0) == (long long)i_vals[i] * 4);
+  }
+
+  double x = d_two + 0.7;
+  check((int)x == 2);
+  check((int)-x == -2);
+  double y = d_two + 0.5;
+  check((long long)(y * 1e15) == 2500000000000000LL);
+  check((unsigned)(y * 1e9) == 2500000000u);
+
+  long long ll = 1LL << 53;
+  check((double)(ll + 1) == (double)ll);
+  check((long double)(ll + 1) != (long double)ll);
+
+  short s = -12345;
+  check((double)s * d_two == -24690.0);
+}
+
+static void test_compare(void) {
+  double a = d_one, b = d_two, nan = d_zero / d_zero;
+
+  check(a < b);
+  check(!(b < a));
+  check(a <= a);
+  check(b > a);
+  check(a != b);
+  check(!(a == b));
+
+  /* every ordered comparison with NaN is false */
+  check(nan != nan);
+  check(!(nan == nan));
+  check(!(nan < a) && !(nan > a) && !(nan <= a) && !(nan >= a));
+
+  float fa = (float)a, fb = (float)b;
+  check(fa < fb && fb > fa);
+
+  double m = a < b ? a : b;
+  check(m == 1.0);
+}
+
+static void test_status(void) {
+  fnclex();
+
+  /* fcom sets C3, C2 and C0 */
+  asm volatile ("fld1; fldz; fcompp" ::: "st", "st(1)");
+  check((fnstsw() & (SW_C3 | SW_C2 | SW_C0)) == SW_C0);
+  asm volatile ("fld1; fld1; fcompp" ::: "st", "st(1)");
+  check((fnstsw() & (SW_C3 | SW_C2 | SW_C0)) == SW_C3);
+
+  /* TOP is in bits 11-13 */
+  uint16_t sw;
+  check((fnstsw() & 0x3800) == 0);
+  asm volatile ("fld1; fnstsw %0; fstp %%st(0)" : "=a"(sw));
+  check((sw & 0x3800) == (7 << 11));
+
+  /* division by zero */
+  volatile double inf = d_one / d_zero;
+  check(inf > 1e308);
+  check(fnstsw() & SW_ZE);
+  fnclex();
+  check((fnstsw() & (SW_ZE | SW_IE)) == 0);
+
+  /* 0 / 0 is an invalid operation */
+  volatile double nan = d_zero / d_zero;
+  check(nan != nan);
+  check(fnstsw() & SW_IE);
+  fnclex();
+
+  /* fxam: +inf has class 011 */
+  asm volatile ("fxam; fnstsw %0; fstp %%st(0)" : "=a"(sw) : "t"((double)inf) : "st");
+  check((sw & (SW_C3 | SW_C2 | SW_C0)) == (SW_C2 | SW_C0));
+}
+
+static void test_rounding(void) {
+  uint16_t cw = fnstcw();
+  check(cw == 0x37f);
+
+  double x = d_two + 0.5, y = -x;
+  volatile long double down, up;
+
+  check(fistp(x) == 2);
+  check(fistp(y) == -2);
+  check(fistp(x + d_one) == 4);
+
+  fldcw((cw & ~0xc00) | 0x400);  // down
+  check(fistp(x) == 2);
+  check(fistp(y) == -3);
+  down = (long double)d_one / d_three;
+
+  fldcw((cw & ~0xc00) | 0x800);  // up
+  check(fistp(x) == 3);
+  check(fistp(y) == -2);
+  up = (long double)d_one / d_three;
+
+  fldcw(cw | 0xc00);  // chop
+  check(fistp(x) == 2);
+  check(fistp(y) == -2);
+  check(down < up);
+  check((long double)d_one / d_three == down);
+
+  /* double precision control */
+  fldcw((cw & ~0x300) | 0x200);
+  long double e = (long double)d_one + 0x1p-60L;
+  check(e == 1.0L);
+
+  fldcw(cw);
+  e = (long double)d_one + 0x1p-60L;
+  check(e != 1.0L);
+}
+
+static void test_special(void) {
+  check(fsqrt(16.0L * d_one) == 4.0L);
+  long double r = fsqrt(2.0L * d_one);
+  check(fabsl_(r * r - 2) < 1e-18L);
+
+  long double pi;
+  asm ("fldpi" : "=t"(pi));
+  check(fabsl_(fsin(pi / 6) - 0.5L) < 1e-18L);
+  check(fabsl_(fsin(pi)) < 1e-18L);
+
+  check(fprem(7.5L * d_one, 2.0L) == 1.5L);
+  check(fprem(-7.5L * d_one, 2.0L) == -1.5L);
+  check(fprem(0x1p70L * d_one, 3.0L) == 1.0L);
+}
+
+void test_x87(void) {
+  test_arith();
+  test_convert();
+  test_compare();
+  test_status();
+  test_rounding();
+  test_special();
+  printf("x87: all checks passed\n");
+}
@@ -0,0 +1,91 @@
+#include <am.h>
+#include <klib.h>
+
+/* A 4MB page mapped with _map_large must translate every address in it
+ * to the same offset of the physical page, and nothing past its end.
+ *
+ * With `make run MAP_GUARD=1', the test ends with a _map on a page
+ * inside the 4MB page, which _map must refuse with _halt(1), so that
+ * run is expected to stop at a BAD TRAP.
+ */
+
+#define VA 0x10000000
+
+// the same word through the 4MB page and through the kernel mapping
+#define VIRT(off) (*(volatile uint32_t *)(VA + (off)))
+#define PHYS(off) (*(volatile uint32_t *)(large + (off)))
+
+static _Protect as;
+static uint8_t pool[4][PGSIZE] __attribute__((aligned(PGSIZE)));
+static int nr_page = 0;
+static uint8_t *large;
+
+static volatile uintptr_t fault_cr2 = 0;
+
+static void *palloc() {
+  assert(nr_page < 4);
+  return pool[nr_page ++];
+}
+
+static void pfree(void *p) {
+}
+
+_RegSet* handler(_Event ev, _RegSet *regs) {
+  switch (ev.event) {
+    case _EVENT_PAGE_FAULT:
+      assert(fault_cr2 == 0);
+      fault_cr2 = ev.cause;
+      _map(&as, (void *)(ev.cause & ~(PGSIZE - 1)), palloc());
+      break;
+    default:
+      assert(0);
+  }
+  return regs;
+}
+
+int main() {
+  _asye_init(handler);
+  _pte_init(palloc, pfree);
+  _protect(&as);
+
+  // the physical page comes from the heap
+  large = (void *)(((uintptr_t)_heap.start + PGSIZE_LARGE - 1) & ~(PGSIZE_LARGE - 1));
+  assert(large + PGSIZE_LARGE <= (uint8_t *)_heap.end);
+
+  assert(_map_large(&as, (void *)VA, large) == 1);
+  // the directory entry is taken now
+  assert(_map_large(&as, (void *)VA, large) == 0);
+  assert(_map_large(&as, (void *)(VA + PGSIZE_LARGE - PGSIZE), large) == 0);
+  _switch(&as);
+
+  // writes at both ends land in the physical page
+  VIRT(0) = 0x12345678;
+  VIRT(PGSIZE_LARGE - 4) = 0x9abcdef0;
+  assert(PHYS(0) == 0x12345678);
+  assert(PHYS(PGSIZE_LARGE - 4) == 0x9abcdef0);
+
+  // and reads at both ends see what the kernel wrote there
+  PHYS(0) = 0xcafe0001;
+  PHYS(PGSIZE_LARGE - 4) = 0xcafe0002;
+  assert(VIRT(0) == 0xcafe0001);
+  assert(VIRT(PGSIZE_LARGE - 4) == 0xcafe0002);
+
+  // an access across a 4KB boundary inside the page needs no other mapping
+  PHYS(3 * PGSIZE - 2) = 0x11223344;
+  assert(VIRT(3 * PGSIZE - 2) == 0x11223344);
+  assert(fault_cr2 == 0);
+
+  // the next byte is not mapped
+  assert(*(volatile uint8_t *)(VA + PGSIZE_LARGE) == 0);
+  assert(fault_cr2 == VA + PGSIZE_LARGE);
+
+#ifdef MAP_GUARD
+  printf("_map inside the 4MB page, expecting _halt(1)\n");
+  _map(&as, (void *)(VA + PGSIZE), palloc());
+  printf("_map returned\n");
+  return 0;
+#endif
+
+  printf("4MB page mapped at 0x%x\n", VA);
+  return 0;
+}
@@ -0,0 +1,48 @@
+#include <am.h>
+#include <klib.h>
+
+#define N 100000
+
+static volatile intptr_t lk = 0;
+static volatile int nr_done = 0;
+static int sum = 0;
+static int atomic_sum = 0;
+static int count[MAX_CPU];
+
+static void spin_lock() {
+  while (_atomic_xchg(&lk, 1));
+}
+
+static void spin_unlock() {
+  _barrier();
+  _atomic_xchg(&lk, 0);
+}
+
+static void entry() {
+  int me = _cpu();
+  for (int i = 0; i < N; i ++) {
+    spin_lock();
+    sum ++;
+    count[me] ++;
+    spin_unlock();
+
+    asm volatile ("lock incl %0" : "+m"(atomic_sum) : : "cc");
+  }
+
+  // the last CPU to finish checks the sums, which may be another one
+  // than CPU 0: _mpe_init() waits for it
+  spin_lock();
+  printf("CPU #%d done\n", me);
+  if (++ nr_done == _NR_CPU) {
+    for (int i = 0; i < _NR_CPU; i ++) assert(count[i] == N);
+    assert(sum == N * _NR_CPU);
+    assert(atomic_sum == N * _NR_CPU);
+    printf("%d CPUs, sum = %d\n", _NR_CPU, sum);
+  }
+  spin_unlock();
+}
+
+int main() {
+  _mpe_init(entry);
+  return 1;
+}
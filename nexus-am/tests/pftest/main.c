@@ -0,0 +1,113 @@
+#include <am.h>
+#include <klib.h>
+
+/* Pages of a user area are mapped lazily by the page fault handler, as
+ * a kernel would do on demand. Each fault must report the address in
+ * CR2 and the kind of access in the error code, and the instruction
+ * must be restarted, also in the middle of a REP string instruction.
+ */
+
+#define VA 0x10000000
+#define PF_ERR_WRITE 0x2
+#define MAX_FAULT 8
+
+static _Protect as;
+static uint8_t pool[16][PGSIZE] __attribute__((aligned(PGSIZE)));
+static int nr_page = 0;
+
+// written by the handler behind the back of the compiler
+static volatile struct {
+  uintptr_t cr2, error_code, eip;
+} fault[MAX_FAULT];
+static volatile int nr_fault = 0;
+
+static void *palloc() {
+  assert(nr_page < 16);
+  return pool[nr_page ++];
+}
+
+static void pfree(void *p) {
+}
+
+_RegSet* handler(_Event ev, _RegSet *regs) {
+  switch (ev.event) {
+    case _EVENT_PAGE_FAULT:
+      assert(nr_fault < MAX_FAULT);
+      fault[nr_fault].cr2 = ev.cause;
+      fault[nr_fault].error_code = regs->error_code;
+      fault[nr_fault].eip = regs->eip;
+      nr_fault ++;
+      _map(&as, (void *)(ev.cause & ~(PGSIZE - 1)), palloc());
+      break;
+    default:
+      assert(0);
+  }
+  return regs;
+}
+
+static uint32_t src[2 * PGSIZE / 4];
+
+int main() {
+  _asye_init(handler);
+  _pte_init(palloc, pfree);
+  _protect(&as);
+  _switch(&as);
+
+  // a read, which sees the zeroed page
+  uint32_t val;
+  uintptr_t eip;
+  asm volatile ("movl $1f, %1; 1: movl (%2), %0" : "=r"(val), "=&r"(eip) : "r"(VA + 0x124) : "memory");
+  assert(val == 0);
+  assert(nr_fault == 1);
+  assert(fault[0].cr2 == VA + 0x124);
+  assert((fault[0].error_code & PF_ERR_WRITE) == 0);
+  assert(fault[0].eip == eip);
+
+  // a write
+  volatile uint32_t *p = (void *)(VA + PGSIZE + 0x458);
+  asm volatile ("movl $1f, %0; 1: movl $3, (%1)" : "=&r"(eip) : "r"(p) : "memory");
+  assert(*p == 3);
+  assert(nr_fault == 2);
+  assert(fault[1].cr2 == (uintptr_t)p);
+  assert(fault[1].error_code & PF_ERR_WRITE);
+  assert(fault[1].eip == eip);
+
+  // a read-modify-write is done once, after the restart
+  p = (void *)(VA + 2 * PGSIZE + 0x9c0);
+  asm volatile ("movl $1f, %0; 1: addl $5, (%1)" : "=&r"(eip) : "r"(p) : "memory", "cc");
+  assert(*p == 5);
+  assert(nr_fault == 3);
+  assert(fault[2].cr2 == (uintptr_t)p);
+  assert(fault[2].eip == eip);
+
+  // the pages mapped stay mapped
+  assert(*(volatile uint32_t *)(VA + 0x124) == 0);
+  assert(nr_fault == 3);
+
+  // rep movsl over three pages not present: each fault comes at the first
+  // element on a new page, and the elements done before are kept
+  int i;
+  for (i = 0; i < 2 * PGSIZE / 4; i ++) {
+    src[i] = i * 7 + 1;
+  }
+  uintptr_t dst = VA + 4 * PGSIZE + 0x800;
+  uintptr_t esi, edi, ecx;
+  asm volatile ("movl $1f, %3; 1: rep movsl"
+      : "=S"(esi), "=D"(edi), "=c"(ecx), "=&r"(eip)
+      : "0"(src), "1"(dst), "2"(2 * PGSIZE / 4) : "memory");
+  assert(ecx == 0);
+  assert(esi == (uintptr_t)src + 2 * PGSIZE);
+  assert(edi == dst + 2 * PGSIZE);
+  assert(nr_fault == 6);
+  for (i = 0; i < 3; i ++) {
+    assert(fault[3 + i].cr2 == (i == 0 ? dst : VA + (4 + i) * PGSIZE));
+    assert(fault[3 + i].error_code & PF_ERR_WRITE);
+    assert(fault[3 + i].eip == eip);
+  }
+  for (i = 0; i < 2 * PGSIZE / 4; i ++) {
+    assert(((uint32_t *)dst)[i] == i * 7 + 1);
+  }
+
+  printf("%d page faults handled\n", nr_fault);
+  return 0;
+}
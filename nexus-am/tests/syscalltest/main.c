@@ -0,0 +1,59 @@
+#include <am.h>
+#include <klib.h>
+
+#define N 1000
+
+/* A system call through `int $0x80' and one through SYSENTER, with the
+ * arguments passed as libos passes them, must reach the handler alike,
+ * and return to ring 0.
+ */
+
+static int nr_syscall = 0;
+
+_RegSet* handler(_Event ev, _RegSet *regs) {
+  switch (ev.event) {
+    case _EVENT_SYSCALL:
+      assert((regs->cs & 0x3) == 0);
+      nr_syscall ++;
+      regs->eax = regs->eax * 1000 + regs->ebx * 100 + regs->ecx * 10 + regs->edx;
+      break;
+    case _EVENT_IRQ_TIME:
+      break;
+    default:
+      assert(0);
+  }
+  return regs;
+}
+
+static int sys_int(int type, int a0, int a1, int a2) {
+  int ret;
+  asm volatile("int $0x80": "=a"(ret): "a"(type), "b"(a0), "c"(a1), "d"(a2));
+  return ret;
+}
+
+static int sys_sysenter(int type, int a0, int a1, int a2) {
+  int ret;
+  asm volatile("movl %%esp, %%ecx; movl $1f, %%edx; sysenter; 1:"
+      : "=a"(ret): "a"(type), "b"(a0), "S"(a1), "D"(a2): "ecx", "edx", "cc");
+  return ret;
+}
+
+int main(){
+  _asye_init(handler);
+
+  uint32_t eax, ebx, ecx, edx;
+  asm volatile("cpuid": "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx): "a"(1));
+  if (!(edx & (1 << 11))) {
+    printf("SYSENTER is not supported\n");
+    return 0;
+  }
+
+  for (int i = 0; i < N; i ++) {
+    int a0 = i % 10, a1 = i / 10 % 10, a2 = i / 100;
+    assert(sys_sysenter(1, a0, a1, a2) == sys_int(1, a0, a1, a2));
+  }
+  assert(nr_syscall == 2 * N);
+
+  printf("%d system calls done\n", nr_syscall);
+  return 0;
+}